@@ -445,7 +445,7 @@ do_ls_R (const char *dir)
   return 0;
 }
 
-static int show_file (const char *dir, const char *name, const struct guestfs_statns *stat, const struct guestfs_xattr_list *xattrs, void *unused);
+static int show_file (const char *dir, const char *name, const struct guestfs_statns *stat, const struct guestfs_xattr_list *xattrs, const char *link, void *unused);
 
 static int
 do_ls_lR (const char *dir)
@@ -455,19 +455,20 @@ do_ls_lR (const char *dir)
 
 /* This is the function which is called to display all files and
  * directories, and it's where the magic happens.  We are called with
- * full stat and extended attributes for each file, so there is no
- * penalty for displaying anything in those structures.  However if we
- * need other things (eg. checksum) we may have to go back to the
- * appliance and then there can be a very large penalty.
+ * full stat, extended attributes and symlink target for each file, so
+ * there is no penalty for displaying anything in those structures.
+ * However if we need other things (eg. checksum) we may have to go
+ * back to the appliance and then there can be a very large penalty.
  */
 static int
 show_file (const char *dir, const char *name,
            const struct guestfs_statns *stat,
            const struct guestfs_xattr_list *xattrs,
+           const char *link,
            void *unused)
 {
   const char *filetype;
-  CLEANUP_FREE char *path = NULL, *csum = NULL, *link = NULL;
+  CLEANUP_FREE char *path = NULL, *csum = NULL;
 
   /* Display the basic fields. */
   output_start_line ();
@@ -533,9 +534,6 @@ show_file (const char *dir, const char *name,
 
   output_string (path);
 
-  if (is_lnk (stat->st_mode))
-    /* XXX Fix this for NTFS. */
-    link = guestfs_readlink (g, path);
   if (link)
     output_string_link (link);
 
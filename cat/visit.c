@@ -28,19 +28,195 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
+#include <unistd.h>
 #include <errno.h>
-#include <assert.h>
 #include <libintl.h>
+#include <sys/stat.h>
+#include <rpc/types.h>
+#include <rpc/xdr.h>
 
 #include "getprogname.h"
 
 #include "guestfs.h"
+#include "guestfs_protocol.h"
 #include "guestfs-internal-frontend.h"
 
 #include "visit.h"
 
-static int _visit (guestfs_h *g, int depth, const char *dir, visitor_function f, void *opaque);
+/* An entry which has been read from the stream but not yet visited,
+ * and the extended attribute entries which follow it.
+ */
+struct pending {
+  bool valid;
+  guestfs_int_walk_entry entry;
+  guestfs_int_walk_entry *attrs;
+  size_t nr_attrs, alloc_attrs;
+};
+
+static void
+free_pending (struct pending *p)
+{
+  size_t i;
+
+  if (p->valid)
+    xdr_free ((xdrproc_t) xdr_guestfs_int_walk_entry, (char *) &p->entry);
+  for (i = 0; i < p->nr_attrs; ++i)
+    xdr_free ((xdrproc_t) xdr_guestfs_int_walk_entry, (char *) &p->attrs[i]);
+  p->valid = false;
+  p->nr_attrs = 0;
+}
+
+/* Call the visitor function for the pending entry.  'top' is true
+ * for the first entry, which is the top directory.
+ */
+static int
+visit_pending (const char *dir, bool top, struct pending *p,
+               visitor_function f, void *opaque)
+{
+  const guestfs_int_walk_entry *entry = &p->entry;
+  CLEANUP_FREE struct guestfs_xattr *xattr_val = NULL;
+  CLEANUP_FREE char *parent = NULL;
+  struct guestfs_xattr_list xattrs;
+  struct guestfs_statns stat;
+  const char *link, *name;
+  size_t i;
+
+  xattrs.len = p->nr_attrs;
+  xattrs.val = NULL;
+  if (xattrs.len > 0) {
+    xattr_val = malloc (xattrs.len * sizeof (struct guestfs_xattr));
+    if (xattr_val == NULL) {
+      perror ("malloc");
+      return -1;
+    }
+    for (i = 0; i < xattrs.len; ++i) {
+      xattr_val[i].attrname = p->attrs[i].we_attrname;
+      xattr_val[i].attrval = p->attrs[i].we_attrval.we_attrval_val;
+      xattr_val[i].attrval_len = p->attrs[i].we_attrval.we_attrval_len;
+    }
+    xattrs.val = xattr_val;
+  }
+
+  stat.st_dev = entry->we_st_dev;
+  stat.st_ino = entry->we_st_ino;
+  stat.st_mode = entry->we_st_mode;
+  stat.st_nlink = entry->we_st_nlink;
+  stat.st_uid = entry->we_st_uid;
+  stat.st_gid = entry->we_st_gid;
+  stat.st_rdev = entry->we_st_rdev;
+  stat.st_size = entry->we_st_size;
+  stat.st_blksize = entry->we_st_blksize;
+  stat.st_blocks = entry->we_st_blocks;
+  stat.st_atime_sec = entry->we_st_atime_sec;
+  stat.st_atime_nsec = entry->we_st_atime_nsec;
+  stat.st_mtime_sec = entry->we_st_mtime_sec;
+  stat.st_mtime_nsec = entry->we_st_mtime_nsec;
+  stat.st_ctime_sec = entry->we_st_ctime_sec;
+  stat.st_ctime_nsec = entry->we_st_ctime_nsec;
+  stat.st_spare1 = stat.st_spare2 = stat.st_spare3 =
+    stat.st_spare4 = stat.st_spare5 = stat.st_spare6 = 0;
+
+  link = is_lnk (stat.st_mode) ? entry->we_link : NULL;
+
+  /* The top directory is visited with name == NULL.  Split the other
+   * paths into directory and name.
+   */
+  if (top)
+    return f (dir, NULL, &stat, &xattrs, link, opaque);
+
+  name = strrchr (entry->we_path, '/');
+  if (name == NULL) {
+    fprintf (stderr, _("%s: error: unexpected path %s\n"),
+             getprogname (), entry->we_path);
+    return -1;
+  }
+  if (name == entry->we_path)
+    parent = strdup ("/");
+  else
+    parent = strndup (entry->we_path, name - entry->we_path);
+  if (parent == NULL) {
+    perror ("strdup");
+    return -1;
+  }
+  return f (parent, name+1, &stat, &xattrs, link, opaque);
+}
+
+/* Read the entries written by internal_walk from 'fp', calling the
+ * visitor function for each file once its extended attributes have
+ * been read.  Only one file is held in memory at a time.
+ */
+static int
+visit_stream (const char *dir, FILE *fp, visitor_function f, void *opaque)
+{
+  struct pending p = { .valid = false };
+  guestfs_int_walk_entry entry;
+  struct stat statbuf;
+  bool top = true;
+  XDR xdr;
+  int r = 0;
+
+  if (fstat (fileno (fp), &statbuf) == -1) {
+    perror ("fstat");
+    return -1;
+  }
+
+  xdrstdio_create (&xdr, fp, XDR_DECODE);
+
+  while (r == 0 && xdr_getpos (&xdr) < statbuf.st_size) {
+    memset (&entry, 0, sizeof entry);
+    if (!xdr_guestfs_int_walk_entry (&xdr, &entry)) {
+      fprintf (stderr, _("%s: error: could not decode the list of files\n"),
+               getprogname ());
+      r = -1;
+      break;
+    }
+
+    /* Extended attributes belong to the entry before them. */
+    if (STRNEQ (entry.we_attrname, "")) {
+      if (!p.valid) {
+        fprintf (stderr, _("%s: error: unexpected extended attribute %s\n"),
+                 getprogname (), entry.we_attrname);
+        xdr_free ((xdrproc_t) xdr_guestfs_int_walk_entry, (char *) &entry);
+        r = -1;
+        break;
+      }
+      if (p.nr_attrs == p.alloc_attrs) {
+        const size_t n = p.alloc_attrs ? 2 * p.alloc_attrs : 16;
+        guestfs_int_walk_entry *attrs =
+          realloc (p.attrs, n * sizeof (guestfs_int_walk_entry));
+
+        if (attrs == NULL) {
+          perror ("realloc");
+          xdr_free ((xdrproc_t) xdr_guestfs_int_walk_entry, (char *) &entry);
+          r = -1;
+          break;
+        }
+        p.attrs = attrs;
+        p.alloc_attrs = n;
+      }
+      p.attrs[p.nr_attrs++] = entry;
+      continue;
+    }
+
+    if (p.valid) {
+      r = visit_pending (dir, top, &p, f, opaque);
+      top = false;
+      free_pending (&p);
+    }
+    p.entry = entry;
+    p.valid = true;
+  }
+
+  if (r == 0 && p.valid)
+    r = visit_pending (dir, top, &p, f, opaque);
+
+  xdr_destroy (&xdr);
+  free_pending (&p);
+  free (p.attrs);
+  return r;
+}
 
 /**
  * Visit every file and directory in a guestfs filesystem, starting
@@ -53,13 +229,20 @@ static int _visit (guestfs_h *g, int depth, const char *dir, visitor_function f,
  * every file.  The parameters passed to C<f> include the current
  * directory name, the current file name (or C<NULL> when we're
  * visiting a directory), the C<guestfs_statns> (file permissions
- * etc), and the list of extended attributes of the file.  The visitor
- * function may return C<-1> which causes the whole recursion to stop
- * with an error.
+ * etc), the list of extended attributes of the file, and the target
+ * of the symbolic link (or C<NULL> if the file is not a symbolic
+ * link).  The visitor function may return C<-1> which causes the
+ * whole recursion to stop with an error.
  *
  * Also passed to this function is an C<opaque> pointer which is
  * passed through to the visitor function.
  *
+ * The whole tree is fetched from the appliance in a single call (the
+ * call which implements L<guestfs(3)/guestfs_walk>) into a local
+ * temporary file, and the visitor function is then called for each
+ * entry as it is read back, parents before children.  So unlike
+ * C<guestfs_walk>, the tree is never held in memory.
+ *
  * Returns C<0> if everything went OK, or C<-1> if there was an error.
  * Error handling is not particularly well defined.  It will either
  * set an error in the libguestfs handle or print an error on stderr,
@@ -68,103 +251,41 @@ static int _visit (guestfs_h *g, int depth, const char *dir, visitor_function f,
 int
 visit (guestfs_h *g, const char *dir, visitor_function f, void *opaque)
 {
-  return _visit (g, 0, dir, f, opaque);
-}
-
-static int
-_visit (guestfs_h *g, int depth, const char *dir,
-        visitor_function f, void *opaque)
-{
-  /* Call 'f' with the top directory.  Note that ordinary recursive
-   * visits will not otherwise do this, so we have to have a special
-   * case.
-   */
-  if (depth == 0) {
-    CLEANUP_FREE_STATNS struct guestfs_statns *stat = NULL;
-    CLEANUP_FREE_XATTR_LIST struct guestfs_xattr_list *xattrs = NULL;
-    int r;
-
-    stat = guestfs_lstatns (g, dir);
-    if (stat == NULL)
-      return -1;
+  CLEANUP_FREE char *tmpdir = guestfs_get_tmpdir (g);
+  CLEANUP_UNLINK_FREE char *localfile = NULL;
+  char dev_fd[64];
+  FILE *fp;
+  int fd, r;
 
-    xattrs = guestfs_lgetxattrs (g, dir);
-    if (xattrs == NULL)
-      return -1;
-
-    r = f (dir, NULL, stat, xattrs, opaque);
-
-    if (r == -1)
-      return -1;
-  }
-
-  size_t i, xattrp;
-  CLEANUP_FREE_STRING_LIST char **names = NULL;
-  CLEANUP_FREE_STAT_LIST struct guestfs_statns_list *stats = NULL;
-  CLEANUP_FREE_XATTR_LIST struct guestfs_xattr_list *xattrs = NULL;
-
-  names = guestfs_ls (g, dir);
-  if (names == NULL)
+  if (tmpdir == NULL)
     return -1;
 
-  stats = guestfs_lstatnslist (g, dir, names);
-  if (stats == NULL)
+  if (asprintf (&localfile, "%s/visitXXXXXX", tmpdir) == -1) {
+    perror ("asprintf");
     return -1;
-
-  xattrs = guestfs_lxattrlist (g, dir, names);
-  if (xattrs == NULL)
+  }
+  if ((fd = mkstemp (localfile)) == -1) {
+    perror ("mkstemp");
     return -1;
+  }
 
-  /* Call function on everything in this directory. */
-  for (i = 0, xattrp = 0; names[i] != NULL; ++i, ++xattrp) {
-    CLEANUP_FREE char *path = NULL;
-    CLEANUP_FREE char *attrval = NULL;
-    struct guestfs_xattr_list file_xattrs;
-    size_t nr_xattrs;
-
-    assert (stats->len >= i);
-    assert (xattrs->len >= xattrp);
-
-    /* Find the list of extended attributes for this file. */
-    assert (strlen (xattrs->val[xattrp].attrname) == 0);
-
-    if (xattrs->val[xattrp].attrval_len == 0) {
-      fprintf (stderr, _("%s: error getting extended attrs for %s %s\n"),
-               getprogname (), dir, names[i]);
-      return -1;
-    }
-    /* attrval is not \0-terminated. */
-    attrval = malloc (xattrs->val[xattrp].attrval_len + 1);
-    if (attrval == NULL) {
-      perror ("malloc");
-      return -1;
-    }
-    memcpy (attrval, xattrs->val[xattrp].attrval,
-            xattrs->val[xattrp].attrval_len);
-    attrval[xattrs->val[xattrp].attrval_len] = '\0';
-    if (sscanf (attrval, "%zu", &nr_xattrs) != 1) {
-      fprintf (stderr, _("%s: error: cannot parse xattr count for %s %s\n"),
-               getprogname (), dir, names[i]);
-      return -1;
-    }
-
-    file_xattrs.len = nr_xattrs;
-    file_xattrs.val = &xattrs->val[xattrp+1];
-    xattrp += nr_xattrs;
+  snprintf (dev_fd, sizeof dev_fd, "/dev/fd/%d", fd);
 
-    /* Call the function. */
-    if (f (dir, names[i], &stats->val[i], &file_xattrs, opaque) == -1)
-      return -1;
+  if (guestfs_internal_walk (g, dir, dev_fd) == -1) {
+    close (fd);
+    return -1;
+  }
 
-    /* Recursively call visit, but only on directories. */
-    if (is_dir (stats->val[i].st_mode)) {
-      path = full_path (dir, names[i]);
-      if (_visit (g, depth + 1, path, f, opaque) == -1)
-        return -1;
-    }
+  fp = fdopen (fd, "r");
+  if (fp == NULL) {
+    perror ("fdopen");
+    close (fd);
+    return -1;
   }
 
-  return 0;
+  r = visit_stream (dir, fp, f, opaque);
+  fclose (fp);
+  return r;
 }
 
 char *
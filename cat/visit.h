@@ -19,7 +19,7 @@
 #ifndef VISIT_H
 #define VISIT_H
 
-typedef int (*visitor_function) (const char *dir, const char *name, const struct guestfs_statns *stat, const struct guestfs_xattr_list *xattrs, void *opaque);
+typedef int (*visitor_function) (const char *dir, const char *name, const struct guestfs_statns *stat, const struct guestfs_xattr_list *xattrs, const char *link, void *opaque);
 
 extern int visit (guestfs_h *g, const char *dir, visitor_function f, void *opaque);
 
@@ -24,6 +24,10 @@
 #include <unistd.h>
 #include <limits.h>
 
+#ifdef HAVE_BLKID
+#include <blkid.h>
+#endif
+
 #include "daemon.h"
 #include "actions.h"
 #include "optgroups.h"
@@ -38,11 +42,11 @@ get_blkid_tag (const char *device, const char *tag)
   int r;
   size_t len;
 
-  r = commandr (&out, &err,
-                str_blkid,
-                /* Adding -c option kills all caching, even on RHEL 5. */
-                "-c", "/dev/null",
-                "-o", "value", "-s", tag, device, NULL);
+  r = commandrf (&out, &err, COMMAND_FLAG_CACHE,
+                 str_blkid,
+                 /* Adding -c option kills all caching, even on RHEL 5. */
+                 "-c", "/dev/null",
+                 "-o", "value", "-s", tag, device, NULL);
   if (r != 0 && r != 2) {
     if (r >= 0)
       reply_with_error ("%s: %s (blkid returned %d)", device, err, r);
@@ -140,8 +144,8 @@ blkid_with_p_i_opt (const char *device)
   CLEANUP_FREE_STRING_LIST char **lines = NULL;
   CLEANUP_FREE_STRINGSBUF DECLARE_STRINGSBUF (ret);
 
-  r = command (&out, &err, str_blkid, "-c", "/dev/null",
-               "-p", "-i", "-o", "export", device, NULL);
+  r = commandf (&out, &err, COMMAND_FLAG_CACHE, str_blkid, "-c", "/dev/null",
+                "-p", "-i", "-o", "export", device, NULL);
   if (r == -1) {
     reply_with_error ("%s", err);
     return NULL;
@@ -237,3 +241,239 @@ do_blkid (const char *device)
   else
     return blkid_without_p_i_opt (device);
 }
+
+/* Probe the devices for guestfs_vfs_probe_list.  devices contains
+ * the translated device names, or NULL for devices which do not
+ * exist.
+ */
+struct probe_list {
+  char **devices;
+  guestfs_int_vfs_probe *probes;
+};
+
+/* Replace fields which were not found with empty strings.  Returns
+ * -1 if memory could not be allocated.
+ */
+static int
+fill_empty_fields (guestfs_int_vfs_probe *p)
+{
+  char **fields[] = { &p->vp_type, &p->vp_label, &p->vp_uuid,
+                      &p->vp_partuuid };
+  size_t i;
+
+  for (i = 0; i < sizeof fields / sizeof fields[0]; ++i) {
+    if (*fields[i] == NULL) {
+      *fields[i] = strdup ("");
+      if (*fields[i] == NULL)
+        return -1;
+    }
+  }
+  return 0;
+}
+
+#ifdef HAVE_BLKID
+
+static int
+lookup_probe_value (blkid_probe pr, const char *name, char **ret)
+{
+  const char *value;
+
+  if (blkid_probe_lookup_value (pr, name, &value, NULL) == 0) {
+    *ret = strdup (value);
+    if (*ret == NULL)
+      return -1;
+  }
+  return 0;
+}
+
+/* Called by parallel_run, in a worker thread.  Devices which cannot
+ * be read or probed are not an error: their fields are left empty.
+ */
+static int
+probe_device (size_t i, void *vp)
+{
+  struct probe_list *pl = vp;
+  guestfs_int_vfs_probe *p = &pl->probes[i];
+  blkid_probe pr;
+  int r = 0;
+
+  pr = NULL;
+  if (pl->devices[i] != NULL)
+    pr = blkid_new_probe_from_filename (pl->devices[i]);
+  if (pr != NULL) {
+    blkid_probe_enable_superblocks (pr, 1);
+    blkid_probe_set_superblocks_flags (pr,
+                                       BLKID_SUBLKS_TYPE |
+                                       BLKID_SUBLKS_LABEL |
+                                       BLKID_SUBLKS_UUID);
+    blkid_probe_enable_partitions (pr, 1);
+    blkid_probe_set_partitions_flags (pr, BLKID_PARTS_ENTRY_DETAILS);
+
+    if (blkid_do_safeprobe (pr) == 0) {
+      if (lookup_probe_value (pr, "TYPE", &p->vp_type) == -1 ||
+          lookup_probe_value (pr, "LABEL", &p->vp_label) == -1 ||
+          lookup_probe_value (pr, "UUID", &p->vp_uuid) == -1 ||
+          lookup_probe_value (pr, "PART_ENTRY_UUID", &p->vp_partuuid) == -1)
+        r = -1;
+    }
+    blkid_free_probe (pr);
+  }
+
+  if (r == 0)
+    r = fill_empty_fields (p);
+  return r;
+}
+
+static int
+probe_devices (struct probe_list *pl, size_t n)
+{
+  int r;
+
+  r = parallel_run (n, probe_device, pl);
+  if (r == -2) {
+    reply_with_error ("operation cancelled by user");
+    return -1;
+  }
+  if (r == -1) {
+    reply_with_error ("probe failed: out of memory");
+    return -1;
+  }
+  return 0;
+}
+
+#else /* !HAVE_BLKID */
+
+/* Without libblkid, run the blkid program once for each device and
+ * parse its "export" output, which contains all the tags.
+ */
+static int
+probe_devices (struct probe_list *pl, size_t n)
+{
+  size_t i, j;
+
+  for (i = 0; i < n; ++i) {
+    guestfs_int_vfs_probe *p = &pl->probes[i];
+    CLEANUP_FREE char *out = NULL, *err = NULL;
+    CLEANUP_FREE_STRING_LIST char **lines = NULL;
+    int r = -1;
+
+    if (pl->devices[i] != NULL)
+      r = commandrf (&out, &err, COMMAND_FLAG_CACHE,
+                     str_blkid, "-c", "/dev/null", "-o", "export",
+                     pl->devices[i], NULL);
+    if (r == 0) {
+      lines = split_lines (out);
+      if (lines == NULL)
+        return -1;
+
+      for (j = 0; lines[j] != NULL; ++j) {
+        char **field;
+        char *value, *src, *dst;
+
+        if (STRPREFIX (lines[j], "TYPE="))
+          field = &p->vp_type;
+        else if (STRPREFIX (lines[j], "LABEL="))
+          field = &p->vp_label;
+        else if (STRPREFIX (lines[j], "UUID="))
+          field = &p->vp_uuid;
+        else if (STRPREFIX (lines[j], "PARTUUID="))
+          field = &p->vp_partuuid;
+        else
+          continue;
+
+        /* Remove the backslashes which blkid uses to escape special
+         * characters.
+         */
+        value = strchr (lines[j], '=') + 1;
+        for (src = dst = value; *src; ++src) {
+          if (*src == '\\' && src[1])
+            ++src;
+          *dst++ = *src;
+        }
+        *dst = '\0';
+
+        free (*field);
+        *field = strdup (value);
+        if (*field == NULL) {
+          reply_with_perror ("strdup");
+          return -1;
+        }
+      }
+    }
+
+    if (fill_empty_fields (p) == -1) {
+      reply_with_perror ("strdup");
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+#endif /* !HAVE_BLKID */
+
+guestfs_int_vfs_probe_list *
+do_vfs_probe_list (char *const *devices)
+{
+  guestfs_int_vfs_probe_list *ret;
+  struct probe_list pl = { .devices = NULL };
+  const size_t n = count_strings (devices);
+  size_t i;
+
+  /* Device name translation is done here rather than by the
+   * generated code, so that a device which does not exist does not
+   * fail the whole call, and so that vp_device is the name which the
+   * caller used.
+   */
+  pl.devices = calloc (n + 1, sizeof (char *));
+  if (pl.devices == NULL) {
+    reply_with_perror ("calloc");
+    return NULL;
+  }
+  for (i = 0; i < n; ++i) {
+    if (STRNEQLEN (devices[i], "/dev/", 5)) {
+      reply_with_error ("%s: expecting a device name", devices[i]);
+      free_stringslen (pl.devices, n);
+      return NULL;
+    }
+    if (!is_root_device (devices[i]))
+      pl.devices[i] = device_name_translation (devices[i]);
+  }
+
+  ret = malloc (sizeof *ret);
+  if (ret == NULL) {
+    reply_with_perror ("malloc");
+    free_stringslen (pl.devices, n);
+    return NULL;
+  }
+  ret->guestfs_int_vfs_probe_list_len = n;
+  ret->guestfs_int_vfs_probe_list_val =
+    calloc (n, sizeof (guestfs_int_vfs_probe));
+  if (n > 0 && ret->guestfs_int_vfs_probe_list_val == NULL) {
+    reply_with_perror ("calloc");
+    free (ret);
+    free_stringslen (pl.devices, n);
+    return NULL;
+  }
+
+  for (i = 0; i < n; ++i) {
+    ret->guestfs_int_vfs_probe_list_val[i].vp_device = strdup (devices[i]);
+    if (ret->guestfs_int_vfs_probe_list_val[i].vp_device == NULL) {
+      reply_with_perror ("strdup");
+      goto error;
+    }
+  }
+
+  pl.probes = ret->guestfs_int_vfs_probe_list_val;
+  if (probe_devices (&pl, n) == -1)
+    goto error;
+
+  free_stringslen (pl.devices, n);
+  return ret;
+
+ error:
+  free_stringslen (pl.devices, n);
+  xdr_free ((xdrproc_t) xdr_guestfs_int_vfs_probe_list, (char *) ret);
+  free (ret);
+  return NULL;
+}
@@ -20,79 +20,248 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <pthread.h>
+
+#include "md5.h"
+#include "sha1.h"
+#include "sha256.h"
+#include "sha512.h"
+#include "fts_.h"
 
 #include "guestfs_protocol.h"
 #include "daemon.h"
 #include "actions.h"
 
-GUESTFSD_EXT_CMD(str_find, find);
-GUESTFSD_EXT_CMD(str_xargs, xargs);
-GUESTFSD_EXT_CMD(str_cksum, cksum);
-GUESTFSD_EXT_CMD(str_md5sum, md5sum);
-GUESTFSD_EXT_CMD(str_sha1sum, sha1sum);
-GUESTFSD_EXT_CMD(str_sha224sum, sha224sum);
-GUESTFSD_EXT_CMD(str_sha256sum, sha256sum);
-GUESTFSD_EXT_CMD(str_sha384sum, sha384sum);
-GUESTFSD_EXT_CMD(str_sha512sum, sha512sum);
-
-static const char *
-program_of_csum (const char *csumtype)
+/* The checksums are computed in the daemon, rather than by running
+ * md5sum etc, so that checksumming many small files doesn't cost a
+ * fork and exec each.  The algorithms come from gnulib.
+ */
+enum csum_type {
+  CSUM_CRC,
+  CSUM_MD5,
+  CSUM_SHA1,
+  CSUM_SHA224,
+  CSUM_SHA256,
+  CSUM_SHA384,
+  CSUM_SHA512,
+};
+
+struct csum_ctx {
+  enum csum_type type;
+  uint64_t len;                 /* Number of bytes processed. */
+  union {
+    uint32_t crc;
+    struct md5_ctx md5;
+    struct sha1_ctx sha1;
+    struct sha256_ctx sha256;
+    struct sha512_ctx sha512;
+  } u;
+};
+
+/* Size of the buffer used to read each file. */
+#define CSUM_BUFFER_SIZE (128 * 1024)
+
+static int
+csum_type_of_string (const char *csumtype)
 {
   if (STRCASEEQ (csumtype, "crc"))
-    return str_cksum;
+    return CSUM_CRC;
   else if (STRCASEEQ (csumtype, "md5"))
-    return str_md5sum;
+    return CSUM_MD5;
   else if (STRCASEEQ (csumtype, "sha1"))
-    return str_sha1sum;
+    return CSUM_SHA1;
   else if (STRCASEEQ (csumtype, "sha224"))
-    return str_sha224sum;
+    return CSUM_SHA224;
   else if (STRCASEEQ (csumtype, "sha256"))
-    return str_sha256sum;
+    return CSUM_SHA256;
   else if (STRCASEEQ (csumtype, "sha384"))
-    return str_sha384sum;
+    return CSUM_SHA384;
   else if (STRCASEEQ (csumtype, "sha512"))
-    return str_sha512sum;
+    return CSUM_SHA512;
   else {
     reply_with_error ("unknown checksum type, expecting crc|md5|sha1|sha224|sha256|sha384|sha512");
+    return -1;
+  }
+}
+
+/* The CRC used by POSIX cksum(1). */
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void
+init_crc_table (void)
+{
+  uint32_t i, j, c;
+
+  for (i = 0; i < 256; ++i) {
+    c = i << 24;
+    for (j = 0; j < 8; ++j)
+      c = c & 0x80000000 ? (c << 1) ^ 0x04c11db7 : c << 1;
+    crc_table[i] = c;
+  }
+}
+
+static uint32_t
+crc_update (uint32_t crc, const unsigned char *buf, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len; ++i)
+    crc = (crc << 8) ^ crc_table[(crc >> 24) ^ buf[i]];
+  return crc;
+}
+
+static void
+csum_init (struct csum_ctx *ctx, enum csum_type type)
+{
+  ctx->type = type;
+  ctx->len = 0;
+
+  switch (type) {
+  case CSUM_CRC:
+    pthread_once (&crc_table_once, init_crc_table);
+    ctx->u.crc = 0;
+    break;
+  case CSUM_MD5: md5_init_ctx (&ctx->u.md5); break;
+  case CSUM_SHA1: sha1_init_ctx (&ctx->u.sha1); break;
+  case CSUM_SHA224: sha224_init_ctx (&ctx->u.sha256); break;
+  case CSUM_SHA256: sha256_init_ctx (&ctx->u.sha256); break;
+  case CSUM_SHA384: sha384_init_ctx (&ctx->u.sha512); break;
+  case CSUM_SHA512: sha512_init_ctx (&ctx->u.sha512); break;
+  }
+}
+
+static void
+csum_update (struct csum_ctx *ctx, const void *buf, size_t len)
+{
+  ctx->len += len;
+
+  switch (ctx->type) {
+  case CSUM_CRC: ctx->u.crc = crc_update (ctx->u.crc, buf, len); break;
+  case CSUM_MD5: md5_process_bytes (buf, len, &ctx->u.md5); break;
+  case CSUM_SHA1: sha1_process_bytes (buf, len, &ctx->u.sha1); break;
+  case CSUM_SHA224:
+  case CSUM_SHA256: sha256_process_bytes (buf, len, &ctx->u.sha256); break;
+  case CSUM_SHA384:
+  case CSUM_SHA512: sha512_process_bytes (buf, len, &ctx->u.sha512); break;
+  }
+}
+
+/* Finish the checksum and return it as a string, formatted the same
+ * way as the first field printed by the corresponding program (eg.
+ * md5sum).  Returns NULL with errno set if malloc fails.
+ */
+static char *
+csum_finish (struct csum_ctx *ctx)
+{
+  unsigned char digest[SHA512_DIGEST_SIZE];
+  size_t i, size = 0;
+  uint64_t n;
+  uint32_t crc;
+  char *ret;
+
+  switch (ctx->type) {
+  case CSUM_CRC:
+    crc = ctx->u.crc;
+    for (n = ctx->len; n > 0; n >>= 8) {
+      const unsigned char c = n & 0xff;
+      crc = crc_update (crc, &c, 1);
+    }
+    if (asprintf (&ret, "%" PRIu32, ~crc) == -1)
+      return NULL;
+    return ret;
+  case CSUM_MD5:
+    md5_finish_ctx (&ctx->u.md5, digest); size = MD5_DIGEST_SIZE; break;
+  case CSUM_SHA1:
+    sha1_finish_ctx (&ctx->u.sha1, digest); size = SHA1_DIGEST_SIZE; break;
+  case CSUM_SHA224:
+    sha224_finish_ctx (&ctx->u.sha256, digest); size = SHA224_DIGEST_SIZE; break;
+  case CSUM_SHA256:
+    sha256_finish_ctx (&ctx->u.sha256, digest); size = SHA256_DIGEST_SIZE; break;
+  case CSUM_SHA384:
+    sha384_finish_ctx (&ctx->u.sha512, digest); size = SHA384_DIGEST_SIZE; break;
+  case CSUM_SHA512:
+    sha512_finish_ctx (&ctx->u.sha512, digest); size = SHA512_DIGEST_SIZE; break;
+  }
+
+  ret = malloc (size * 2 + 1);
+  if (ret == NULL)
     return NULL;
+  for (i = 0; i < size; ++i)
+    sprintf (&ret[i * 2], "%02x", digest[i]);
+  return ret;
+}
+
+/* Checksum everything that can be read from fd.  should_stop is
+ * called between reads, and if it returns true the checksum is
+ * abandoned with errno EINTR.  On success returns the checksum (which
+ * the caller must free) and the number of bytes read in *len.  On
+ * error returns NULL with errno set.
+ */
+static char *
+checksum_fd (enum csum_type type, int fd, uint64_t *len,
+             int (*should_stop) (void))
+{
+  CLEANUP_FREE char *buf = NULL;
+  struct csum_ctx ctx;
+  ssize_t r;
+
+  buf = malloc (CSUM_BUFFER_SIZE);
+  if (buf == NULL)
+    return NULL;
+
+  csum_init (&ctx, type);
+
+  for (;;) {
+    if (should_stop ()) {
+      errno = EINTR;
+      return NULL;
+    }
+
+    r = read (fd, buf, CSUM_BUFFER_SIZE);
+    if (r == -1) {
+      if (errno == EINTR)
+        continue;
+      return NULL;
+    }
+    if (r == 0)
+      break;
+    csum_update (&ctx, buf, r);
   }
+
+  if (len)
+    *len = ctx.len;
+  return csum_finish (&ctx);
 }
 
 static char *
-checksum (const char *csumtype, int fd)
+checksum (const char *csumtype, int fd, const char *display)
 {
-  const char *program;
-  char *out;
-  CLEANUP_FREE char *err = NULL;
-  int flags, r;
-  size_t len;
+  int type;
+  char *ret;
 
-  program = program_of_csum (csumtype);
-  if (program == NULL)
+  type = csum_type_of_string (csumtype);
+  if (type == -1)
     return NULL;
 
   pulse_mode_start ();
 
-  flags = COMMAND_FLAG_CHROOT_COPY_FILE_TO_STDIN | fd;
-  r = commandf (&out, &err, flags, program, NULL);
-  if (r == -1) {
+  ret = checksum_fd (type, fd, NULL, cancel_requested);
+  if (ret == NULL) {
     pulse_mode_cancel ();
-    reply_with_error ("%s: %s", program, err);
-    free (out);
+    reply_with_perror ("%s", display);
     return NULL;
   }
 
-  /* Split it at the first whitespace. */
-  len = strcspn (out, " \t\n");
-  out[len] = '\0';
-
   pulse_mode_end ();
 
-  return out;			/* Caller frees. */
+  return ret;			/* Caller frees. */
 }
 
 char *
@@ -109,7 +278,7 @@ do_checksum (const char *csumtype, const char *path)
     return NULL;
   }
 
-  return checksum (csumtype, fd);
+  return checksum (csumtype, fd, path);
 }
 
 char *
@@ -123,30 +292,291 @@ do_checksum_device (const char *csumtype, const char *device)
     return NULL;
   }
 
-  return checksum (csumtype, fd);
+  return checksum (csumtype, fd, device);
 }
 
-/* Has one FileOut parameter. */
-int
-do_checksums_out (const char *csumtype, const char *dir)
+/* Checksumming many files is done in parallel (see parallel.c).  Each
+ * task opens one file relative to dirfd, which must not involve the
+ * chroot since that is shared by all threads.  To stop the file
+ * escaping from the sysroot, the final component of each name must
+ * not be a symlink.  Names relative to a directory (dirfd is not
+ * AT_FDCWD) must be single components, see is_plain_name.  The only
+ * other caller passes absolute paths found by a physical directory
+ * walk of the sysroot.
+ */
+struct checksum_files {
+  enum csum_type type;
+  int dirfd;
+  char *const *names;
+  char **csums;                 /* Results, one per name. */
+  uint64_t *sizes;              /* Size of each file. */
+  int *errnos;                  /* errno if a task failed. */
+};
+
+/* Is name a single path component which is not "." or ".."? */
+static int
+is_plain_name (const char *name)
 {
+  return name[0] != '\0' && strchr (name, '/') == NULL &&
+    STRNEQ (name, ".") && STRNEQ (name, "..");
+}
+
+static int
+checksum_one_file (size_t i, void *cfv)
+{
+  struct checksum_files *cf = cfv;
   struct stat statbuf;
+  int fd, err;
+
+  if (cf->dirfd != AT_FDCWD && !is_plain_name (cf->names[i])) {
+    errno = EINVAL;
+    goto error;
+  }
+
+  fd = openat (cf->dirfd, cf->names[i],
+               O_RDONLY|O_NOFOLLOW|O_NONBLOCK|O_CLOEXEC);
+  if (fd == -1)
+    goto error;
+
+  if (fstat (fd, &statbuf) == -1)
+    goto error_close;
+  if (!S_ISREG (statbuf.st_mode)) {
+    errno = EINVAL;
+    goto error_close;
+  }
+
+  cf->csums[i] = checksum_fd (cf->type, fd, &cf->sizes[i],
+                              parallel_should_stop);
+  if (cf->csums[i] == NULL)
+    goto error_close;
+
+  close (fd);
+  return 0;
+
+ error_close:
+  err = errno;
+  close (fd);
+  errno = err;
+ error:
+  cf->errnos[i] = errno;
+  return -1;
+}
+
+/* Checksum the n files in names in parallel.  On success the
+ * checksums are returned in cf->csums.  On error this sends the
+ * reply.
+ */
+static int
+checksum_files (struct checksum_files *cf, size_t n,
+                const char *dir, const char *display_dir)
+{
+  size_t i;
   int r;
-  const char *program;
-  CLEANUP_FREE char *str = NULL;
-  CLEANUP_FREE char *sysrootdir = NULL;
-  CLEANUP_FREE char *cmd = NULL;
-  FILE *fp;
 
-  str = malloc (GUESTFS_MAX_CHUNK_SIZE);
-  if (str == NULL) {
-    reply_with_perror ("malloc");
+  cf->csums = calloc (n, sizeof (char *));
+  cf->sizes = calloc (n, sizeof (uint64_t));
+  cf->errnos = calloc (n, sizeof (int));
+  if (cf->csums == NULL || cf->sizes == NULL || cf->errnos == NULL) {
+    reply_with_perror ("calloc");
+    return -1;
+  }
+
+  r = parallel_run (n, checksum_one_file, cf);
+  if (r == -2) {
+    reply_with_error_errno (EINTR, "operation cancelled by user");
     return -1;
   }
+  if (r == -1) {
+    /* Report the first failure (cancelled tasks set EINTR). */
+    for (i = 0; i < n; ++i) {
+      if (cf->errnos[i] != 0 && cf->errnos[i] != EINTR)
+        break;
+    }
+    if (i == n)
+      i = 0;
+    if (cf->errnos[i] == EINVAL)
+      reply_with_error ("%s/%s: not a regular file", display_dir, cf->names[i]);
+    else
+      reply_with_perror_errno (cf->errnos[i], "%s/%s",
+                               display_dir, cf->names[i]);
+    return -1;
+  }
+
+  return 0;
+}
+
+static void
+free_checksum_files (struct checksum_files *cf, size_t n)
+{
+  size_t i;
+
+  if (cf->csums) {
+    for (i = 0; i < n; ++i)
+      free (cf->csums[i]);
+    free (cf->csums);
+  }
+  free (cf->sizes);
+  free (cf->errnos);
+}
+
+char **
+do_internal_checksumlist (const char *csumtype, const char *path,
+                          char *const *names)
+{
+  struct checksum_files cf = { .names = names };
+  const size_t n = count_strings (names);
+  CLEANUP_FREE_STRINGSBUF DECLARE_STRINGSBUF (ret);
+  int type;
+  size_t i;
+
+  for (i = 0; i < n; ++i) {
+    if (!is_plain_name (names[i])) {
+      reply_with_error ("%s: invalid file name", names[i]);
+      return NULL;
+    }
+  }
+
+  type = csum_type_of_string (csumtype);
+  if (type == -1)
+    return NULL;
+  cf.type = type;
+
+  CHROOT_IN;
+  cf.dirfd = open (path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+  CHROOT_OUT;
+
+  if (cf.dirfd == -1) {
+    reply_with_perror ("open: %s", path);
+    return NULL;
+  }
+
+  if (checksum_files (&cf, n, path, path) == -1) {
+    close (cf.dirfd);
+    free_checksum_files (&cf, n);
+    return NULL;
+  }
+  close (cf.dirfd);
+
+  for (i = 0; i < n; ++i) {
+    if (add_string_nodup (&ret, cf.csums[i]) == -1) {
+      free_checksum_files (&cf, n);
+      return NULL;
+    }
+    cf.csums[i] = NULL;         /* now owned by ret */
+  }
+  free_checksum_files (&cf, n);
+
+  if (end_stringsbuf (&ret) == -1)
+    return NULL;
+
+  return take_stringsbuf (&ret);
+}
+
+/* The output of checksums_out is sent in chunk-sized buffers as it
+ * is formatted, so that it is never held in memory all at once.
+ */
+struct checksums_output {
+  char *buf;                    /* Output waiting to be sent. */
+  size_t len;
+};
+
+/* Returns 0, or -2 if send_file_write failed or the library
+ * cancelled the transfer.
+ */
+static int
+output_write (struct checksums_output *out, const char *s, size_t n)
+{
+  size_t m;
+
+  while (n > 0) {
+    m = MIN (n, chunk_size - out->len);
+    memcpy (out->buf + out->len, s, m);
+    out->len += m;
+    s += m;
+    n -= m;
+
+    if (out->len == chunk_size) {
+      if (send_file_write (out->buf, out->len) < 0)
+        return -2;
+      out->len = 0;
+    }
+  }
+
+  return 0;
+}
+
+static int
+output_string (struct checksums_output *out, const char *s)
+{
+  return output_write (out, s, strlen (s));
+}
+
+/* Write the output line for one file in the same format as the
+ * program which used to compute the checksum, ie. md5sum (etc) or
+ * cksum.
+ */
+static int
+format_checksum_line (struct checksums_output *out, enum csum_type type,
+                      const char *csum, uint64_t size, const char *path)
+{
+  char sizestr[32];
+  const char *p;
+  int r;
+
+  if (type == CSUM_CRC) {
+    snprintf (sizestr, sizeof sizestr, " %" PRIu64 " ", size);
+    if ((r = output_string (out, csum)) < 0 ||
+        (r = output_string (out, sizestr)) < 0 ||
+        (r = output_string (out, path)) < 0)
+      return r;
+    return output_write (out, "\n", 1);
+  }
 
-  program = program_of_csum (csumtype);
-  if (program == NULL)
+  /* md5sum escapes file names containing backslash or newline. */
+  if (strpbrk (path, "\\\n") == NULL) {
+    if ((r = output_string (out, csum)) < 0 ||
+        (r = output_write (out, "  ", 2)) < 0 ||
+        (r = output_string (out, path)) < 0)
+      return r;
+    return output_write (out, "\n", 1);
+  }
+
+  if ((r = output_write (out, "\\", 1)) < 0 ||
+      (r = output_string (out, csum)) < 0 ||
+      (r = output_write (out, "  ", 2)) < 0)
+    return r;
+  for (p = path; *p; ++p) {
+    if (*p == '\\')
+      r = output_write (out, "\\\\", 2);
+    else if (*p == '\n')
+      r = output_write (out, "\\n", 2);
+    else
+      r = output_write (out, p, 1);
+    if (r < 0)
+      return r;
+  }
+  return output_write (out, "\n", 1);
+}
+
+/* Has one FileOut parameter. */
+int
+do_checksums_out (const char *csumtype, const char *dir)
+{
+  struct stat statbuf;
+  int type, r;
+  CLEANUP_FREE char *sysrootdir = NULL;
+  CLEANUP_FREE_STRINGSBUF DECLARE_STRINGSBUF (names);
+  struct checksum_files cf = { .dirfd = AT_FDCWD };
+  struct checksums_output out = { .len = 0 };
+  char *fts_argv[2];
+  FTS *fts;
+  FTSENT *ent;
+  size_t rootlen, i;
+
+  type = csum_type_of_string (csumtype);
+  if (type == -1)
     return -1;
+  cf.type = type;
 
   sysrootdir = sysroot_path (dir);
   if (!sysrootdir) {
@@ -164,19 +594,47 @@ do_checksums_out (const char *csumtype, const char *dir)
     return -1;
   }
 
-  cmd = NULL;
-  if (asprintf_nowarn (&cmd, "cd %Q && %s -type f -print0 | %s -0 %s",
-                       sysrootdir, str_find, str_xargs, program) == -1) {
-    reply_with_perror ("asprintf");
+  /* List the regular files, like 'find -type f'.  The walk is
+   * physical, so it never follows symlinks out of the sysroot.
+   */
+  fts_argv[0] = sysrootdir;
+  fts_argv[1] = NULL;
+  fts = fts_open (fts_argv, FTS_PHYSICAL|FTS_NOCHDIR, NULL);
+  if (fts == NULL) {
+    reply_with_perror ("fts_open: %s", dir);
     return -1;
   }
 
-  if (verbose)
-    fprintf (stderr, "%s\n", cmd);
+  rootlen = strlen (sysrootdir);
+  while ((ent = fts_read (fts)) != NULL) {
+    if (ent->fts_info == FTS_F) {
+      if (add_string (&names, ent->fts_path) == -1) {
+        fts_close (fts);
+        return -1;
+      }
+    }
+    else if (ent->fts_info == FTS_DNR || ent->fts_info == FTS_ERR) {
+      reply_with_perror_errno (ent->fts_errno, "%s%s",
+                               dir, ent->fts_path + rootlen);
+      fts_close (fts);
+      return -1;
+    }
+  }
+  fts_close (fts);
 
-  fp = popen (cmd, "r");
-  if (fp == NULL) {
-    reply_with_perror ("%s", cmd);
+  if (end_stringsbuf (&names) == -1)
+    return -1;
+  cf.names = names.argv;
+
+  if (checksum_files (&cf, names.size - 1, dir, dir) == -1) {
+    free_checksum_files (&cf, names.size - 1);
+    return -1;
+  }
+
+  out.buf = malloc (chunk_size);
+  if (out.buf == NULL) {
+    reply_with_perror ("malloc");
+    free_checksum_files (&cf, names.size - 1);
     return -1;
   }
 
@@ -186,25 +644,281 @@ do_checksums_out (const char *csumtype, const char *dir)
    */
   reply (NULL, NULL);
 
-  while ((r = fread (str, 1, GUESTFS_MAX_CHUNK_SIZE, fp)) > 0) {
-    if (send_file_write (str, r) < 0) {
-      pclose (fp);
+  /* Format the output, with paths relative to dir like 'cd dir && find'. */
+  r = 0;
+  for (i = 0; r == 0 && i < names.size - 1; ++i) {
+    CLEANUP_FREE char *rel = NULL;
+    const char *p = names.argv[i] + rootlen;
+
+    while (*p == '/')
+      p++;
+    if (asprintf (&rel, "./%s", p) == -1) {
+      perror ("asprintf");
+      r = -1;
+      break;
+    }
+    r = format_checksum_line (&out, type, cf.csums[i], cf.sizes[i], rel);
+  }
+  free_checksum_files (&cf, names.size - 1);
+
+  if (r == 0 && out.len > 0 && send_file_write (out.buf, out.len) < 0)
+    r = -2;
+  free (out.buf);
+
+  if (r == -2)                  /* send_file_write has cancelled. */
+    return -1;
+  if (r == -1) {
+    send_file_end (1);          /* Cancel. */
+    return -1;
+  }
+
+  if (send_file_end (0))        /* Normal end of file. */
+    return -1;
+
+  return 0;
+}
+
+/* Block hash manifests (see guestfs_block_hash_manifest).  The file
+ * or device is read in windows of MANIFEST_WINDOW bytes, and the
+ * blocks in each window are read and hashed in parallel.
+ */
+#define MANIFEST_WINDOW (32 * 1024 * 1024)
+#define MANIFEST_DEFAULT_BLOCKSIZE (64 * 1024)
+#define MANIFEST_MIN_BLOCKSIZE 512
+#define MANIFEST_MAX_BLOCKSIZE (16 * 1024 * 1024)
+
+struct manifest_window {
+  enum csum_type type;
+  int fd;
+  size_t blocksize;
+  uint64_t start;               /* Offset of the first block. */
+  uint64_t end;                 /* End of the window (may be a partial block). */
+  char *buf;
+  char **csums;                 /* Results, NULL for blocks of zeroes. */
+  int *errnos;                  /* errno if a task failed. */
+};
+
+static int
+hash_one_block (size_t i, void *mwv)
+{
+  struct manifest_window *mw = mwv;
+  const uint64_t offset = mw->start + i * mw->blocksize;
+  const size_t len = MIN (mw->blocksize, mw->end - offset);
+  char *buf = mw->buf + i * mw->blocksize;
+  struct csum_ctx ctx;
+  size_t n = 0;
+  ssize_t r;
+
+  while (n < len) {
+    r = pread (mw->fd, buf + n, len - n, offset + n);
+    if (r == -1) {
+      if (errno == EINTR)
+        continue;
+      mw->errnos[i] = errno;
       return -1;
     }
+    if (r == 0)                 /* The file was truncated under us. */
+      break;
+    n += r;
+  }
+
+  if (is_zero (buf, n))
+    return 0;
+
+  csum_init (&ctx, mw->type);
+  csum_update (&ctx, buf, n);
+  mw->csums[i] = csum_finish (&ctx);
+  if (mw->csums[i] == NULL) {
+    mw->errnos[i] = errno;
+    return -1;
+  }
+  return 0;
+}
+
+/* Find the next range of blocks at or after pos which may contain
+ * data, skipping holes.  Files which don't support SEEK_DATA (and
+ * block devices) are treated as a single range of data.  Returns 0
+ * if there is no more data.
+ */
+static int
+next_data_range (int fd, uint64_t pos, uint64_t size, size_t blocksize,
+                 uint64_t *start_r, uint64_t *end_r)
+{
+  off_t data, hole;
+
+  data = lseek (fd, pos, SEEK_DATA);
+  if (data == -1) {
+    if (errno == ENXIO)
+      return 0;
+    data = pos;
+    hole = size;
+  }
+  else {
+    hole = lseek (fd, data, SEEK_HOLE);
+    if (hole == -1 || (uint64_t) hole > size)
+      hole = size;
+  }
+
+  /* Round out to whole blocks. */
+  *start_r = data - data % blocksize;
+  if (*start_r < pos)
+    *start_r = pos;
+  *end_r = hole + (blocksize - hole % blocksize) % blocksize;
+  if (*end_r > size)
+    *end_r = size;
+  return *start_r < *end_r;
+}
+
+/* Send the manifest lines for the blocks in one window.  On error
+ * the transfer has been cancelled.
+ */
+static int
+send_manifest_window (const struct manifest_window *mw, size_t nr_blocks)
+{
+  CLEANUP_FREE char *out = NULL;
+  size_t i, outlen = 0;
+  FILE *fp;
+  int r;
+
+  fp = open_memstream (&out, &outlen);
+  if (fp == NULL) {
+    perror ("open_memstream");
+    send_file_end (1);          /* Cancel. */
+    return -1;
+  }
+  for (i = 0; i < nr_blocks; ++i) {
+    if (mw->csums[i])
+      fprintf (fp, "%" PRIu64 " %s\n",
+               mw->start + i * mw->blocksize, mw->csums[i]);
+  }
+  if (fclose (fp) == EOF) {
+    perror ("fclose");
+    send_file_end (1);          /* Cancel. */
+    return -1;
+  }
+
+  for (i = 0; i < outlen; i += r) {
+    r = MIN (outlen - i, chunk_size);
+    if (send_file_write (out + i, r) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+/* Has one FileOut parameter. */
+int
+do_block_hash_manifest (const char *device, int blocksize,
+                        const char *csumtype)
+{
+  CLEANUP_CLOSE int fd = -1;
+  CLEANUP_FREE char *buf = NULL;
+  CLEANUP_FREE char *header = NULL;
+  CLEANUP_FREE char **csums = NULL;
+  CLEANUP_FREE int *errnos = NULL;
+  struct manifest_window mw = { 0 };
+  size_t window_blocks, nr_blocks, i;
+  uint64_t size, pos, start, end;
+  off_t size_r;
+  int is_dev, type, r;
+
+  if (!(optargs_bitmask & GUESTFS_BLOCK_HASH_MANIFEST_BLOCKSIZE_BITMASK))
+    blocksize = MANIFEST_DEFAULT_BLOCKSIZE;
+  if (blocksize < MANIFEST_MIN_BLOCKSIZE ||
+      blocksize > MANIFEST_MAX_BLOCKSIZE ||
+      (blocksize & (blocksize - 1)) != 0) {
+    reply_with_error ("blocksize must be a power of 2 between %d and %d",
+                      MANIFEST_MIN_BLOCKSIZE, MANIFEST_MAX_BLOCKSIZE);
+    return -1;
   }
+  if (!(optargs_bitmask & GUESTFS_BLOCK_HASH_MANIFEST_CSUMTYPE_BITMASK))
+    csumtype = "sha256";
+  type = csum_type_of_string (csumtype);
+  if (type == -1)
+    return -1;
+
+  is_dev = STRPREFIX (device, "/dev/");
 
-  if (ferror (fp)) {
-    fprintf (stderr, "fread: %s: %m\n", dir);
-    send_file_end (1);                /* Cancel. */
-    pclose (fp);
+  if (!is_dev) CHROOT_IN;
+  fd = open (device, O_RDONLY|O_CLOEXEC);
+  if (!is_dev) CHROOT_OUT;
+  if (fd == -1) {
+    reply_with_perror ("%s", device);
     return -1;
   }
 
-  if (pclose (fp) != 0) {
-    fprintf (stderr, "pclose: %s: %m\n", dir);
-    send_file_end (1);                /* Cancel. */
+  if (check_not_directory (device, fd) == -1)
+    return -1;
+
+  size_r = lseek (fd, 0, SEEK_END);
+  if (size_r == -1) {
+    reply_with_perror ("lseek: %s", device);
+    return -1;
+  }
+  size = size_r;
+
+  window_blocks = MANIFEST_WINDOW / blocksize;
+  buf = malloc (MANIFEST_WINDOW);
+  csums = malloc (window_blocks * sizeof (char *));
+  errnos = malloc (window_blocks * sizeof (int));
+  if (buf == NULL || csums == NULL || errnos == NULL) {
+    reply_with_perror ("malloc");
     return -1;
   }
+  mw.type = type;
+  mw.fd = fd;
+  mw.blocksize = blocksize;
+  mw.buf = buf;
+  mw.csums = csums;
+  mw.errnos = errnos;
+
+  if (asprintf (&header, "# blocksize %d csumtype %s size %" PRIu64 "\n",
+                blocksize, csumtype, size) == -1) {
+    reply_with_perror ("asprintf");
+    return -1;
+  }
+
+  /* Now we must send the reply message, before the file contents.  After
+   * this there is no opportunity in the protocol to send any error
+   * message back.  Instead we can only cancel the transfer.
+   */
+  reply (NULL, NULL);
+
+  if (send_file_write (header, strlen (header)) < 0)
+    return -1;
+
+  pos = 0;
+  while (next_data_range (fd, pos, size, blocksize, &start, &end)) {
+    for (pos = start; pos < end; pos = mw.end) {
+      mw.start = pos;
+      mw.end = MIN (end, pos + (uint64_t) window_blocks * blocksize);
+      nr_blocks = (mw.end - mw.start + blocksize - 1) / blocksize;
+      memset (csums, 0, nr_blocks * sizeof (char *));
+      memset (errnos, 0, nr_blocks * sizeof (int));
+
+      r = parallel_run (nr_blocks, hash_one_block, &mw);
+      if (r == -1) {
+        for (i = 0; i < nr_blocks; ++i) {
+          if (errnos[i] != 0) {
+            fprintf (stderr, "%s: %" PRIu64 ": %s\n", device,
+                     mw.start + i * blocksize, strerror (errnos[i]));
+            break;
+          }
+        }
+      }
+      if (r != 0)
+        send_file_end (1);      /* Cancel. */
+      else
+        r = send_manifest_window (&mw, nr_blocks);
+
+      for (i = 0; i < nr_blocks; ++i)
+        free (csums[i]);
+      if (r != 0)
+        return -1;
+
+      notify_progress (mw.end, size);
+    }
+  }
 
   if (send_file_end (0))        /* Normal end of file. */
     return -1;
@@ -25,14 +25,20 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#ifdef HAVE_POSIX_SPAWNP
+#include <spawn.h>
+#endif
 #include <error.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "ignore-value.h"
 
@@ -41,9 +47,12 @@
 #include "cleanups.h"
 
 extern int verbose;
+extern char **environ;
 
 extern const char *sysroot;
 extern size_t sysroot_len;
+extern int cancel_requested (void);
+extern void udev_changed (void);
 
 /* For improved readability dealing with pipe arrays */
 #define PIPE_READ 0
@@ -170,109 +179,111 @@ commandvf (char **stdoutput, char **stderror, unsigned flags,
     return -1;
 }
 
+/* Output captured from a command.  The buffer grows geometrically,
+ * and each read goes straight into the free space at the end, so
+ * capturing a large output costs linear time.
+ */
+struct output {
+  char *buf;
+  size_t len;
+  size_t alloc;
+};
+
+/* Minimum free space in the buffer before each read. */
+#define OUTPUT_READ_SIZE 4096
+
 /**
- * This is a more sane version of L<system(3)> for running external
- * commands.  It uses fork/execvp, so we don't need to worry about
- * quoting of parameters, and it allows us to capture any error
- * messages in a buffer.
- *
- * If C<stdoutput> is not C<NULL>, then C<*stdoutput> will return the
- * stdout of the command as a string.
- *
- * If C<stderror> is not C<NULL>, then C<*stderror> will return the
- * stderr of the command.  If there is a final \n character, it is
- * removed so you can use the error string directly in a call to
- * C<reply_with_error>.
- *
- * Flags are:
- *
- * =over 4
- *
- * =item C<COMMAND_FLAG_FOLD_STDOUT_ON_STDERR>
- *
- * For broken external commands that send error messages to stdout
- * (hello, parted) but that don't have any useful stdout information,
- * use this flag to capture the error messages in the C<*stderror>
- * buffer.  If using this flag, you should pass C<stdoutput=NULL>
- * because nothing could ever be captured in that buffer.
+ * Read from the pipe C<fd> and append the data to C<out>, or discard
+ * it if C<out> is C<NULL>.  If C<echo> is true, the data is also
+ * copied to the daemon's stderr.
  *
- * =item C<COMMAND_FLAG_CHROOT_COPY_FILE_TO_STDIN>
- *
- * For running external commands on chrooted files correctly (see
- * L<https://bugzilla.redhat.com/579608>) specifying this flag causes
- * another process to be forked which chroots into sysroot and just
- * copies the input file to stdin of the specified command.  The file
- * descriptor is ORed with the flags, and that file descriptor is
- * always closed by this function.  See F<daemon/hexdump.c> for an
- * example of usage.
- *
- * =back
- *
- * There is also a macro C<commandrv(out,err,argv)> which calls
- * C<commandrvf> with C<flags=0>.
+ * Returns the number of bytes read (C<0> means end of file), or
+ * C<-1> on error.
  */
-int
-commandrvf (char **stdoutput, char **stderror, unsigned flags,
-            char const* const *argv)
+static ssize_t
+read_output (int fd, struct output *out, bool echo)
 {
-  size_t so_size = 0, se_size = 0;
-  int so_fd[2], se_fd[2];
-  const unsigned flag_copy_stdin =
-    flags & COMMAND_FLAG_CHROOT_COPY_FILE_TO_STDIN;
-  const int flag_copy_fd = (int) (flags & COMMAND_FLAG_FD_MASK);
-  const unsigned flag_out_on_err = flags & COMMAND_FLAG_FOLD_STDOUT_ON_STDERR;
-  pid_t pid;
-  int r, quit, i;
-  fd_set rset, rset2;
-  char buf[256];
+  char buf[OUTPUT_READ_SIZE];
   char *p;
+  ssize_t r;
+
+  if (out == NULL)
+    p = buf;
+  else {
+    if (out->alloc - out->len < OUTPUT_READ_SIZE) {
+      size_t alloc = out->alloc > 0 ? out->alloc * 2 : OUTPUT_READ_SIZE * 2;
+
+      while (alloc - out->len < OUTPUT_READ_SIZE)
+        alloc *= 2;
+      p = realloc (out->buf, alloc);
+      if (p == NULL) {
+        perror ("realloc");
+        return -1;
+      }
+      out->buf = p;
+      out->alloc = alloc;
+    }
+    p = out->buf + out->len;
+  }
 
-  if (stdoutput) *stdoutput = NULL;
-  if (stderror) *stderror = NULL;
+  r = read (fd, p, OUTPUT_READ_SIZE);
+  if (r == -1) {
+    perror ("read");
+    return -1;
+  }
 
-  if (verbose) {
-    printf ("commandrvf: stdout=%s stderr=%s flags=0x%x\n",
-            stdoutput ? "y" : flag_out_on_err ? "e" : "n",
-            stderror ? "y" : "n", flags);
-    fputs ("commandrvf: ", stdout);
-    fputs (argv[0], stdout);
-    for (i = 1; argv[i] != NULL; ++i) {
-      char quote;
+  if (r > 0) {
+    if (echo)
+      ignore_value (write (STDERR_FILENO, p, r));
+    if (out)
+      out->len += r;
+  }
 
-      /* Do simple (and incorrect) quoting of the debug output.  Real
-       * quoting is not necessary because we use execvp to run the
-       * command below.
-       */
-      if (strchr (argv[i], '\''))
-        quote = '"';
-      else if (strchr (argv[i], '"'))
-        quote = '\'';
-      else if (strchr (argv[i], ' '))
-        quote = '"';
-      else
-        quote = 0;
+  return r;
+}
 
-      putchar (' ');
-      if (quote) putchar (quote);
-      fputs (argv[i], stdout);
-      if (quote) putchar (quote);
+/**
+ * Return the captured output as a \0-terminated string, which the
+ * caller must free.  Returns C<NULL> if memory could not be
+ * allocated.
+ */
+static char *
+finish_output (struct output *out)
+{
+  char *p;
+
+  if (out->alloc == out->len) {
+    p = realloc (out->buf, out->len + 1);
+    if (p == NULL) {
+      perror ("realloc");
+      free (out->buf);
+      return NULL;
     }
-    putchar ('\n');
+    out->buf = p;
+    out->alloc = out->len + 1;
   }
+  out->buf[out->len] = '\0';
+  return out->buf;
+}
 
-  /* Note: abort is used in a few places along the error paths early
-   * in this function.  This is because (a) cleaning up correctly is
-   * very complex at these places and (b) abort is used when a
-   * resource problems is indicated which would be due to much more
-   * serious issues - eg. memory or file descriptor leaks.  We
-   * wouldn't expect fork(2) or pipe(2) to fail in normal
-   * circumstances.
-   */
-
-  if (pipe (so_fd) == -1 || pipe (se_fd) == -1) {
-    error (0, errno, "pipe");
-    abort ();
-  }
+/**
+ * Start the command using L<fork(2)> and L<execvp(3)>.  This is
+ * needed when the command must run chrooted in the sysroot, which
+ * C<posix_spawnp> cannot do.
+ *
+ * Returns C<0>.  C<*pidp> is set to the PID of the child.  If the
+ * command cannot be executed, the child prints an error on its
+ * stderr and exits with C<EXIT_FAILURE>.
+ */
+static int
+fork_command (pid_t *pidp, unsigned flags, int so_fd[2], int se_fd[2],
+              char const* const *argv)
+{
+  const unsigned flag_copy_stdin =
+    flags & COMMAND_FLAG_CHROOT_COPY_FILE_TO_STDIN;
+  const int flag_copy_fd = (int) (flags & COMMAND_FLAG_FD_MASK);
+  const unsigned flag_out_on_err = flags & COMMAND_FLAG_FOLD_STDOUT_ON_STDERR;
+  pid_t pid;
 
   pid = fork ();
   if (pid == -1) {
@@ -333,10 +344,186 @@ commandrvf (char **stdoutput, char **stderror, unsigned flags,
     _exit (EXIT_FAILURE);
   }
 
+  *pidp = pid;
+  return 0;
+}
+
+#ifdef HAVE_POSIX_SPAWNP
+/**
+ * Start the command using L<posix_spawnp(3)>.  This sets up the
+ * child's file descriptors in the same way as C<fork_command>, but
+ * avoids copying the daemon's page tables, which is the main cost of
+ * L<fork(2)> when the daemon has a lot of memory mapped.  The daemon
+ * always runs with C</> as its current directory, so the child does
+ * not need to change directory.
+ *
+ * Returns C<0> and sets C<*pidp> on success, or returns an errno
+ * value if the command could not be executed.
+ */
+static int
+spawn_command (pid_t *pidp, unsigned flags, int so_fd[2], int se_fd[2],
+               char const* const *argv)
+{
+  const unsigned flag_copy_stdin =
+    flags & COMMAND_FLAG_CHROOT_COPY_FILE_TO_STDIN;
+  const int flag_copy_fd = (int) (flags & COMMAND_FLAG_FD_MASK);
+  const unsigned flag_out_on_err = flags & COMMAND_FLAG_FOLD_STDOUT_ON_STDERR;
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t sigdefault;
+  int err;
+
+  if ((err = posix_spawn_file_actions_init (&actions)) != 0 ||
+      (err = posix_spawnattr_init (&attr)) != 0) {
+    error (0, err, "posix_spawn_file_actions_init");
+    abort ();
+  }
+
+  sigemptyset (&sigdefault);
+  sigaddset (&sigdefault, SIGALRM);
+  sigaddset (&sigdefault, SIGPIPE);
+
+  if ((err = posix_spawnattr_setsigdefault (&attr, &sigdefault)) != 0 ||
+      (err = posix_spawnattr_setflags (&attr, POSIX_SPAWN_SETSIGDEF)) != 0 ||
+      (err = flag_copy_stdin ?
+       posix_spawn_file_actions_adddup2 (&actions, flag_copy_fd,
+                                         STDIN_FILENO) :
+       posix_spawn_file_actions_addopen (&actions, STDIN_FILENO,
+                                         "/dev/null", O_RDONLY, 0)) != 0 ||
+      (err = posix_spawn_file_actions_addclose (&actions,
+                                                so_fd[PIPE_READ])) != 0 ||
+      (err = posix_spawn_file_actions_addclose (&actions,
+                                                se_fd[PIPE_READ])) != 0 ||
+      (err = posix_spawn_file_actions_adddup2 (&actions,
+                                               flag_out_on_err ?
+                                               se_fd[PIPE_WRITE] :
+                                               so_fd[PIPE_WRITE],
+                                               STDOUT_FILENO)) != 0 ||
+      (err = posix_spawn_file_actions_adddup2 (&actions, se_fd[PIPE_WRITE],
+                                               STDERR_FILENO)) != 0 ||
+      (err = posix_spawn_file_actions_addclose (&actions,
+                                                so_fd[PIPE_WRITE])) != 0 ||
+      (err = posix_spawn_file_actions_addclose (&actions,
+                                                se_fd[PIPE_WRITE])) != 0) {
+    error (0, err, "posix_spawn_file_actions");
+    abort ();
+  }
+
+  err = posix_spawnp (pidp, argv[0], &actions, &attr,
+                      (void *) argv, environ);
+
+  posix_spawn_file_actions_destroy (&actions);
+  posix_spawnattr_destroy (&attr);
+
+  return err;
+}
+#endif /* HAVE_POSIX_SPAWNP */
+
+/* Run the command.  This is the implementation of C<commandrvf>
+ * without the cache.
+ */
+static int
+run_command (char **stdoutput, char **stderror, unsigned flags,
+             char const* const *argv)
+{
+  struct output so = { .buf = NULL }, se = { .buf = NULL };
+  int so_fd[2], se_fd[2];
+  const unsigned flag_copy_stdin =
+    flags & COMMAND_FLAG_CHROOT_COPY_FILE_TO_STDIN;
+  const int flag_copy_fd = (int) (flags & COMMAND_FLAG_FD_MASK);
+  const unsigned flag_out_on_err = flags & COMMAND_FLAG_FOLD_STDOUT_ON_STDERR;
+  const unsigned flag_cancellable = flags & COMMAND_FLAG_CANCELLABLE;
+  pid_t pid;
+  int r, quit, i, err;
+  bool cancelled = false;
+  fd_set rset, rset2;
+  struct timeval tv;
+
+  if (stdoutput) *stdoutput = NULL;
+  if (stderror) *stderror = NULL;
+
+  if (verbose) {
+    printf ("commandrvf: stdout=%s stderr=%s flags=0x%x\n",
+            stdoutput ? "y" : flag_out_on_err ? "e" : "n",
+            stderror ? "y" : "n", flags);
+    fputs ("commandrvf: ", stdout);
+    fputs (argv[0], stdout);
+    for (i = 1; argv[i] != NULL; ++i) {
+      char quote;
+
+      /* Do simple (and incorrect) quoting of the debug output.  Real
+       * quoting is not necessary because we use execvp to run the
+       * command below.
+       */
+      if (strchr (argv[i], '\''))
+        quote = '"';
+      else if (strchr (argv[i], '"'))
+        quote = '\'';
+      else if (strchr (argv[i], ' '))
+        quote = '"';
+      else
+        quote = 0;
+
+      putchar (' ');
+      if (quote) putchar (quote);
+      fputs (argv[i], stdout);
+      if (quote) putchar (quote);
+    }
+    putchar ('\n');
+  }
+
+  /* Note: abort is used in a few places along the error paths early
+   * in this function.  This is because (a) cleaning up correctly is
+   * very complex at these places and (b) abort is used when a
+   * resource problems is indicated which would be due to much more
+   * serious issues - eg. memory or file descriptor leaks.  We
+   * wouldn't expect fork(2) or pipe(2) to fail in normal
+   * circumstances.
+   *
+   * The pipes are close-on-exec so that commands run at the same time
+   * by concurrent calls don't inherit each other's pipes, which would
+   * stop us seeing end of file until the other command exits.
+   */
+
+  if (pipe2 (so_fd, O_CLOEXEC) == -1 || pipe2 (se_fd, O_CLOEXEC) == -1) {
+    error (0, errno, "pipe2");
+    abort ();
+  }
+
+#ifdef HAVE_POSIX_SPAWNP
+  if (!(flags & COMMAND_FLAG_DO_CHROOT && sysroot_len > 0))
+    err = spawn_command (&pid, flags, so_fd, se_fd, argv);
+  else
+#endif
+    err = fork_command (&pid, flags, so_fd, se_fd, argv);
+
   /* Parent process. */
   close (so_fd[PIPE_WRITE]);
   close (se_fd[PIPE_WRITE]);
 
+  if (err != 0) {
+    /* The command could not be run.  Report this in the same way as
+     * a forked child which failed to exec the command.
+     */
+    close (so_fd[PIPE_READ]);
+    close (se_fd[PIPE_READ]);
+    if (flag_copy_stdin) close (flag_copy_fd);
+    if (verbose)
+      fprintf (stderr, "%s: %s\n", argv[0], strerror (err));
+    if (stdoutput) {
+      *stdoutput = strdup ("");
+      if (*stdoutput == NULL)
+        return -1;
+    }
+    if (stderror) {
+      if (asprintf (stderror, "%s: %s", argv[0], strerror (err)) == -1) {
+        *stderror = NULL;
+        return -1;
+      }
+    }
+    return EXIT_FAILURE;
+  }
+
   FD_ZERO (&rset);
   FD_SET (so_fd[PIPE_READ], &rset);
   FD_SET (se_fd[PIPE_READ], &rset);
@@ -344,28 +531,39 @@ commandrvf (char **stdoutput, char **stderror, unsigned flags,
   quit = 0;
   while (quit < 2) {
   again:
+    if (flag_cancellable && cancel_requested ()) {
+      kill (pid, SIGKILL);
+      cancelled = true;
+      goto quit;
+    }
+
     rset2 = rset;
+    /* If cancellable, wake up periodically to check for cancellation. */
+    tv.tv_sec = 0;
+    tv.tv_usec = 100000;
     r = select (MAX (so_fd[PIPE_READ], se_fd[PIPE_READ]) + 1, &rset2,
-                NULL, NULL, NULL);
+                NULL, NULL, flag_cancellable ? &tv : NULL);
+    if (r == 0)
+      goto again;
     if (r == -1) {
       if (errno == EINTR)
         goto again;
 
       perror ("select");
     quit:
-      if (stdoutput) {
-        free (*stdoutput);
-        *stdoutput = NULL;
-      }
+      free (so.buf);
+      free (se.buf);
       if (stderror) {
-        free (*stderror);
         /* Need to return non-NULL *stderror here since most callers
          * will try to print and then free the err string.
          * Unfortunately recovery from strdup failure here is not
          * possible.
          */
-        *stderror = strdup ("error running external command, "
-                            "see debug output for details");
+        if (cancelled)
+          *stderror = strdup ("operation cancelled by user");
+        else
+          *stderror = strdup ("error running external command, "
+                              "see debug output for details");
       }
       close (so_fd[PIPE_READ]);
       close (se_fd[PIPE_READ]);
@@ -375,48 +573,17 @@ commandrvf (char **stdoutput, char **stderror, unsigned flags,
     }
 
     if (FD_ISSET (so_fd[PIPE_READ], &rset2)) { /* something on stdout */
-      r = read (so_fd[PIPE_READ], buf, sizeof buf);
-      if (r == -1) {
-        perror ("read");
+      r = read_output (so_fd[PIPE_READ], stdoutput ? &so : NULL, false);
+      if (r == -1)
         goto quit;
-      }
       if (r == 0) { FD_CLR (so_fd[PIPE_READ], &rset); quit++; }
-
-      if (r > 0 && stdoutput) {
-        so_size += r;
-        p = realloc (*stdoutput, so_size);
-        if (p == NULL) {
-          perror ("realloc");
-          goto quit;
-        }
-        *stdoutput = p;
-        memcpy (*stdoutput + so_size - r, buf, r);
-      }
     }
 
     if (FD_ISSET (se_fd[PIPE_READ], &rset2)) { /* something on stderr */
-      r = read (se_fd[PIPE_READ], buf, sizeof buf);
-      if (r == -1) {
-        perror ("read");
+      r = read_output (se_fd[PIPE_READ], stderror ? &se : NULL, verbose);
+      if (r == -1)
         goto quit;
-      }
       if (r == 0) { FD_CLR (se_fd[PIPE_READ], &rset); quit++; }
-
-      if (r > 0) {
-        if (verbose)
-          ignore_value (write (STDERR_FILENO, buf, r));
-
-        if (stderror) {
-          se_size += r;
-          p = realloc (*stderror, se_size);
-          if (p == NULL) {
-            perror ("realloc");
-            goto quit;
-          }
-          *stderror = p;
-          memcpy (*stderror + se_size - r, buf, r);
-        }
-      }
     }
   }
 
@@ -426,28 +593,14 @@ commandrvf (char **stdoutput, char **stderror, unsigned flags,
   /* Make sure the output buffers are \0-terminated.  Also remove any
    * trailing \n characters from the error buffer (not from stdout).
    */
-  if (stdoutput) {
-    void *q = realloc (*stdoutput, so_size+1);
-    if (q == NULL) {
-      perror ("realloc");
-      free (*stdoutput);
-    }
-    *stdoutput = q;
-    if (*stdoutput)
-      (*stdoutput)[so_size] = '\0';
-  }
+  if (stdoutput)
+    *stdoutput = finish_output (&so);
   if (stderror) {
-    void *q = realloc (*stderror, se_size+1);
-    if (q == NULL) {
-      perror ("realloc");
-      free (*stderror);
-    }
-    *stderror = q;
+    *stderror = finish_output (&se);
     if (*stderror) {
-      (*stderror)[se_size] = '\0';
-      while (se_size > 0 && (*stderror)[se_size-1] == '\n') {
-        se_size--;
-        (*stderror)[se_size] = '\0';
+      while (se.len > 0 && (*stderror)[se.len-1] == '\n') {
+        se.len--;
+        (*stderror)[se.len] = '\0';
       }
     }
   }
@@ -468,3 +621,271 @@ commandrvf (char **stdoutput, char **stderror, unsigned flags,
   } else
     return -1;
 }
+
+/* Cache of the output of commands run with COMMAND_FLAG_CACHE.
+ *
+ * Inspection and list_filesystems run the same LVM, blkid and parted
+ * queries many times, and each run of lvm has to scan all the
+ * devices.  The main loop enables the cache only while it runs calls
+ * which cannot change the devices (see C<is_read_only_proc>), and any
+ * other call empties it.
+ */
+struct cache_entry {
+  char *key;                    /* Flags and argv, \0-separated. */
+  size_t keylen;
+  char *out;
+  char *err;
+  int status;                   /* Exit status of the command. */
+};
+
+/* Maximum number of entries.  When this is reached the cache is
+ * emptied, which is simpler than LRU and rarely happens in practice.
+ */
+#define CACHE_MAX_ENTRIES 64
+
+static struct cache_entry cache[CACHE_MAX_ENTRIES];
+static size_t cache_len;
+static bool cache_enabled;
+
+/* Concurrent calls (see main_loop in proto.c) share the cache. */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+cache_clear (void)
+{
+  size_t i;
+
+  for (i = 0; i < cache_len; ++i) {
+    free (cache[i].key);
+    free (cache[i].out);
+    free (cache[i].err);
+  }
+  cache_len = 0;
+}
+
+/**
+ * Enable or disable the cache used by C<COMMAND_FLAG_CACHE>.  This is
+ * called by the main loop before each call.  Disabling the cache also
+ * empties it, so that later calls see the effect of any changes.
+ */
+void
+command_cache_enable (int enable)
+{
+  pthread_mutex_lock (&cache_lock);
+  if (!enable)
+    cache_clear ();
+  cache_enabled = enable;
+  pthread_mutex_unlock (&cache_lock);
+}
+
+static bool
+cache_is_enabled (void)
+{
+  bool r;
+
+  pthread_mutex_lock (&cache_lock);
+  r = cache_enabled;
+  pthread_mutex_unlock (&cache_lock);
+  return r;
+}
+
+/* Make the cache key for a command.  Returns NULL if it could not be
+ * allocated.
+ */
+static char *
+make_cache_key (unsigned flags, char const* const *argv, size_t *keylen)
+{
+  char *key, *p;
+  size_t i, len;
+  char flagsstr[16];
+
+  snprintf (flagsstr, sizeof flagsstr, "%x", flags);
+  len = strlen (flagsstr) + 1;
+  for (i = 0; argv[i] != NULL; ++i)
+    len += strlen (argv[i]) + 1;
+
+  key = malloc (len);
+  if (key == NULL) {
+    perror ("malloc");
+    return NULL;
+  }
+  p = stpcpy (key, flagsstr) + 1;
+  for (i = 0; argv[i] != NULL; ++i)
+    p = stpcpy (p, argv[i]) + 1;
+
+  *keylen = len;
+  return key;
+}
+
+/* Copy a saved output to the caller's buffer, if it wants it. */
+static int
+copy_output (char **ret, const char *saved)
+{
+  if (ret == NULL)
+    return 0;
+  *ret = strdup (saved);
+  if (*ret == NULL) {
+    perror ("strdup");
+    return -1;
+  }
+  return 0;
+}
+
+/* Look for 'key' in the cache.  Call this with cache_lock held. */
+static struct cache_entry *
+cache_lookup (const char *key, size_t keylen)
+{
+  size_t i;
+
+  for (i = 0; i < cache_len; ++i) {
+    if (cache[i].keylen == keylen && memcmp (cache[i].key, key, keylen) == 0)
+      return &cache[i];
+  }
+  return NULL;
+}
+
+static int
+cached_command (char **stdoutput, char **stderror, unsigned flags,
+                char const* const *argv)
+{
+  CLEANUP_FREE char *key = NULL;
+  size_t keylen;
+  struct cache_entry *entry;
+  char *out = NULL, *err = NULL;
+  int r;
+
+  if (stdoutput) *stdoutput = NULL;
+  if (stderror) *stderror = NULL;
+
+  key = make_cache_key (flags, argv, &keylen);
+  if (key == NULL)
+    return -1;
+
+  pthread_mutex_lock (&cache_lock);
+  entry = cache_lookup (key, keylen);
+  if (entry) {
+    if (verbose)
+      printf ("commandrvf: %s: using cached output\n", argv[0]);
+    if (copy_output (stdoutput, entry->out) == -1 ||
+        copy_output (stderror, entry->err) == -1) {
+      pthread_mutex_unlock (&cache_lock);
+      if (stdoutput) {
+        free (*stdoutput);
+        *stdoutput = NULL;
+      }
+      return -1;
+    }
+    r = entry->status;
+    pthread_mutex_unlock (&cache_lock);
+    return r;
+  }
+  pthread_mutex_unlock (&cache_lock);
+
+  /* Don't hold the lock while the command runs, so that concurrent
+   * calls can run other commands.
+   */
+  r = run_command (&out, &err, flags, argv);
+
+  /* Save the output if the command ran and exited normally, whatever
+   * its exit status.  Other errors may be transient.
+   */
+  pthread_mutex_lock (&cache_lock);
+  if (r >= 0 && out != NULL && err != NULL && cache_enabled &&
+      cache_lookup (key, keylen) == NULL) {
+    if (cache_len == CACHE_MAX_ENTRIES)
+      cache_clear ();
+    if (copy_output (&cache[cache_len].out, out) == 0 &&
+        copy_output (&cache[cache_len].err, err) == 0) {
+      cache[cache_len].key = key;
+      cache[cache_len].keylen = keylen;
+      cache[cache_len].status = r;
+      key = NULL;
+      cache_len++;
+    }
+    else
+      free (cache[cache_len].out);
+  }
+  pthread_mutex_unlock (&cache_lock);
+
+  if (stdoutput)
+    *stdoutput = out;
+  else
+    free (out);
+  if (stderror)
+    *stderror = err;
+  else
+    free (err);
+  return r;
+}
+
+/**
+ * This is a more sane version of L<system(3)> for running external
+ * commands.  It uses posix_spawnp (or fork/execvp when the command
+ * must run chrooted), so we don't need to worry about quoting of
+ * parameters, and it allows us to capture any error messages in a
+ * buffer.
+ *
+ * If C<stdoutput> is not C<NULL>, then C<*stdoutput> will return the
+ * stdout of the command as a string.
+ *
+ * If C<stderror> is not C<NULL>, then C<*stderror> will return the
+ * stderr of the command.  If there is a final \n character, it is
+ * removed so you can use the error string directly in a call to
+ * C<reply_with_error>.
+ *
+ * Flags are:
+ *
+ * =over 4
+ *
+ * =item C<COMMAND_FLAG_FOLD_STDOUT_ON_STDERR>
+ *
+ * For broken external commands that send error messages to stdout
+ * (hello, parted) but that don't have any useful stdout information,
+ * use this flag to capture the error messages in the C<*stderror>
+ * buffer.  If using this flag, you should pass C<stdoutput=NULL>
+ * because nothing could ever be captured in that buffer.
+ *
+ * =item C<COMMAND_FLAG_CHROOT_COPY_FILE_TO_STDIN>
+ *
+ * For running external commands on chrooted files correctly (see
+ * L<https://bugzilla.redhat.com/579608>) specifying this flag causes
+ * another process to be forked which chroots into sysroot and just
+ * copies the input file to stdin of the specified command.  The file
+ * descriptor is ORed with the flags, and that file descriptor is
+ * always closed by this function.  See F<daemon/hexdump.c> for an
+ * example of usage.
+ *
+ * =item C<COMMAND_FLAG_CANCELLABLE>
+ *
+ * While the command runs, check if the library has cancelled the
+ * current call (see C<cancel_requested>).  If it has, the command is
+ * killed and this function returns C<-1>.  The caller should check
+ * C<cancel_requested> to find out if this is why the command failed.
+ *
+ * =item C<COMMAND_FLAG_CACHE>
+ *
+ * The command only queries the state of the devices (eg. C<lvm lvs>
+ * or C<blkid>).  If the same command has already succeeded and the
+ * daemon has not run any call which could change the devices since
+ * then, the saved output is returned instead of running the command
+ * again.  See C<command_cache_enable>.
+ *
+ * =back
+ *
+ * There is also a macro C<commandrv(out,err,argv)> which calls
+ * C<commandrvf> with C<flags=0>.
+ */
+int
+commandrvf (char **stdoutput, char **stderror, unsigned flags,
+            char const* const *argv)
+{
+  if ((flags & COMMAND_FLAG_CACHE) && cache_is_enabled () &&
+      !(flags & COMMAND_FLAG_CHROOT_COPY_FILE_TO_STDIN))
+    return cached_command (stdoutput, stderror,
+                           flags & ~COMMAND_FLAG_CACHE, argv);
+
+  /* Any command might change the devices (see udev_settle). */
+  udev_changed ();
+
+  return run_command (stdoutput, stderror, flags, argv);
+}
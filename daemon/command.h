@@ -28,6 +28,8 @@
 #define COMMAND_FLAG_FOLD_STDOUT_ON_STDERR     0x00010000
 #define COMMAND_FLAG_CHROOT_COPY_FILE_TO_STDIN 0x00020000
 #define COMMAND_FLAG_DO_CHROOT                 0x00040000
+#define COMMAND_FLAG_CANCELLABLE               0x00080000
+#define COMMAND_FLAG_CACHE                     0x00100000
 
 extern int commandf (char **stdoutput, char **stderror, unsigned flags,
                      const char *name, ...) __attribute__((sentinel));
@@ -37,5 +39,6 @@ extern int commandvf (char **stdoutput, char **stderror, unsigned flags,
                       char const *const *argv);
 extern int commandrvf (char **stdoutput, char **stderror, unsigned flags,
                        char const* const *argv);
+extern void command_cache_enable (int enable);
 
 #endif /* GUESTFSD_COMMAND_H */
@@ -42,7 +42,7 @@ do_compressX_out (const char *file, const char *filter, int is_device)
   CLEANUP_FREE char *cmd = NULL;
   CLEANUP_FREE char *buf = NULL;
 
-  buf = malloc (GUESTFS_MAX_CHUNK_SIZE);
+  buf = malloc (chunk_size);
   if (buf == NULL) {
     reply_with_perror ("malloc");
     return -1;
@@ -86,7 +86,7 @@ do_compressX_out (const char *file, const char *filter, int is_device)
    */
   reply (NULL, NULL);
 
-  while ((r = fread (buf, 1, GUESTFS_MAX_CHUNK_SIZE, fp)) > 0) {
+  while ((r = fread (buf, 1, chunk_size, fp)) > 0) {
     if (send_file_write (buf, r) < 0) {
       pclose (fp);
       return -1;
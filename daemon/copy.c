@@ -22,12 +22,23 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <string.h>
 #include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#endif
 
 #include "guestfs_protocol.h"
 #include "daemon.h"
 #include "actions.h"
+#include "ignore-value.h"
 
 /* wrflags */
 #define DEST_DEVICE_FLAGS O_WRONLY|O_CLOEXEC, 0
@@ -35,6 +46,443 @@
 /* flags */
 #define COPY_UNLINK_DEST_ON_FAILURE 1
 
+/* Return the offset of the end of the file open on fd.  This is only
+ * called when we already know there is no more data after pos, so for
+ * anything that is not a regular file pos is the best answer.
+ */
+static off_t
+end_of_file (int fd, off_t pos)
+{
+  struct stat statbuf;
+
+  if (fstat (fd, &statbuf) == 0 && S_ISREG (statbuf.st_mode) &&
+      statbuf.st_size > pos)
+    return statbuf.st_size;
+  return pos;
+}
+
+/* Find the next allocated extent at or after pos in the file open on
+ * fd, using SEEK_DATA/SEEK_HOLE, or FIEMAP on kernels which don't
+ * support those.  On success, *data_start and *data_end are set to
+ * the bounds of the extent (both are set to the end of the file if
+ * there is no more data) and the file offset is left at pos.
+ *
+ * Returns -1 if no allocation information is available, in which
+ * case the caller has to read everything.  Block devices always
+ * report a single extent covering the whole device.
+ */
+static int
+find_data_extent (int fd, off_t pos, off_t *data_start, off_t *data_end)
+{
+#ifdef SEEK_DATA
+  off_t data, hole;
+
+  data = lseek (fd, pos, SEEK_DATA);
+  if (data == -1 && errno == ENXIO) {   /* hole up to the end of file */
+    *data_start = *data_end = end_of_file (fd, pos);
+    return lseek (fd, pos, SEEK_SET) == -1 ? -1 : 0;
+  }
+  if (data >= 0) {
+    hole = lseek (fd, data, SEEK_HOLE);
+    if (hole == -1 || lseek (fd, pos, SEEK_SET) == -1)
+      return -1;
+    *data_start = data;
+    *data_end = hole;
+    return 0;
+  }
+  /* Otherwise SEEK_DATA is not supported, fall through to FIEMAP. */
+  if (lseek (fd, pos, SEEK_SET) == -1)
+    return -1;
+#endif
+
+#ifdef FS_IOC_FIEMAP
+  /* A fiemap header followed by room for a single extent. */
+  uint64_t buf[(sizeof (struct fiemap) + sizeof (struct fiemap_extent)) /
+               sizeof (uint64_t) + 1];
+  struct fiemap *fm = (struct fiemap *) buf;
+  const struct fiemap_extent *fe = &fm->fm_extents[0];
+
+  memset (buf, 0, sizeof buf);
+  fm->fm_start = pos;
+  fm->fm_length = FIEMAP_MAX_OFFSET - pos;
+  fm->fm_flags = FIEMAP_FLAG_SYNC;
+  fm->fm_extent_count = 1;
+  if (ioctl (fd, FS_IOC_FIEMAP, fm) == -1)
+    return -1;
+
+  if (fm->fm_mapped_extents == 0) {
+    *data_start = *data_end = end_of_file (fd, pos);
+    return 0;
+  }
+  *data_start = fe->fe_logical > (uint64_t) pos ? (off_t) fe->fe_logical : pos;
+  *data_end = fe->fe_logical + fe->fe_length;
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+#if defined(HAVE_COPY_FILE_RANGE) || defined(__NR_copy_file_range)
+#define HAVE_KERNEL_COPY 1
+
+static ssize_t
+kernel_copy (int fd_in, loff_t *off_in, int fd_out, loff_t *off_out,
+             size_t len)
+{
+#ifdef HAVE_COPY_FILE_RANGE
+  return copy_file_range (fd_in, off_in, fd_out, off_out, len, 0);
+#else
+  /* Older glibc doesn't have a wrapper for this system call. */
+  return syscall (__NR_copy_file_range, fd_in, off_in, fd_out, off_out,
+                  len, 0);
+#endif
+}
+#endif
+
+/* Maximum size of a single copy_file_range call, so that we can send
+ * progress messages and notice cancellation.
+ */
+#define COPY_FILE_RANGE_SIZE (64 * 1024 * 1024)
+
+/* Try to copy between two regular files without passing the data
+ * through userspace.  copy_file_range(2) is tried first (on btrfs and
+ * XFS the kernel implements it as a reflink), then cloning the whole
+ * file with the FICLONE ioctl.
+ *
+ * *src_pos, *dest_pos and *size are advanced by the amount copied,
+ * and the source file offset is left at *src_pos.  The caller copies
+ * whatever remains (everything, if neither method is available) with
+ * the ordinary read/write loop, which will also report any error.
+ */
+static void
+fast_copy (int src_fd, int dest_fd, off_t *src_pos, off_t *dest_pos,
+           int64_t *size, int64_t saved_size)
+{
+  int copied = 0;
+#ifdef HAVE_KERNEL_COPY
+  loff_t in = *src_pos, out = *dest_pos;
+  size_t n;
+  ssize_t r;
+
+  while (*size != 0 && !cancel_requested ()) {
+    n = COPY_FILE_RANGE_SIZE;
+    if (*size != -1 && *size < (int64_t) n)
+      n = *size;
+
+    r = kernel_copy (src_fd, &in, dest_fd, &out, n);
+    if (r <= 0)                 /* End of file, or not supported. */
+      break;
+
+    copied = 1;
+    *src_pos += r;
+    *dest_pos += r;
+    if (*size != -1) {
+      *size -= r;
+      notify_progress ((uint64_t) (saved_size - *size), (uint64_t) saved_size);
+    }
+  }
+#endif
+
+#ifdef FICLONE
+  /* FICLONE can only replace the whole of the destination. */
+  if (!copied && *src_pos == 0 && *dest_pos == 0 && *size == -1) {
+    struct stat statbuf;
+
+    if (fstat (src_fd, &statbuf) == 0 &&
+        ioctl (dest_fd, FICLONE, src_fd) == 0) {
+      *src_pos = *dest_pos = statbuf.st_size;
+      copied = 1;
+    }
+  }
+#endif
+
+  if (copied)
+    ignore_value (lseek (src_fd, *src_pos, SEEK_SET));
+}
+
+/* The copy is done by two threads.  The main thread reads the source
+ * into a ring of buffers, and the writer thread writes each buffer to
+ * the destination, so that reading and writing overlap.  The buffers
+ * are aligned so they can also be used with O_DIRECT.
+ */
+#define COPY_BUFFER_SIZE (1024 * 1024)
+#define COPY_NR_BUFFERS 4
+#define COPY_ALIGNMENT 4096
+
+/* In sparse mode, the size of the blocks which are checked for zeroes
+ * and not written to the destination.
+ */
+#define SPARSE_BLOCK_SIZE 4096
+
+struct copy_buffer {
+  char *data;
+  size_t len;                   /* Number of bytes read into data. */
+  off_t dest_pos;               /* Offset in the destination. */
+};
+
+struct copy_ring {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;          /* Signalled whenever head, tail, done or
+                                 * err changes. */
+  struct copy_buffer buffers[COPY_NR_BUFFERS];
+  size_t head;                  /* Buffers submitted by the main thread. */
+  size_t tail;                  /* Buffers written by the writer thread. */
+  int done;                     /* Main thread has no more buffers. */
+  int err;                      /* Writer thread failed with this errno. */
+  pthread_t thread;
+  int dest_fd;
+  int sparse;
+  int direct;                   /* O_DIRECT is still set on dest_fd. */
+  int seekable;                 /* dest_fd can be written with pwrite. */
+};
+
+/* O_DIRECT requires aligned offsets and lengths.  If we meet an
+ * unaligned request (usually the tail of the copy) then we switch the
+ * file descriptor back to ordinary buffered I/O.
+ */
+static int
+is_aligned (const void *data, size_t len, off_t pos)
+{
+  return (uintptr_t) data % COPY_ALIGNMENT == 0 &&
+    len % COPY_ALIGNMENT == 0 && pos % COPY_ALIGNMENT == 0;
+}
+
+static int
+clear_direct (int fd)
+{
+  const int fl = fcntl (fd, F_GETFL);
+
+  if (fl == -1)
+    return -1;
+  return fcntl (fd, F_SETFL, fl & ~O_DIRECT);
+}
+
+/* Open a file, with O_DIRECT if requested and if the filesystem
+ * supports it.  *direct is cleared if O_DIRECT could not be used.
+ */
+static int
+open_maybe_direct (const char *path, int flags, int mode, int *direct)
+{
+  int fd;
+
+  if (*direct) {
+    fd = open (path, flags|O_DIRECT, mode);
+    if (fd >= 0 || errno != EINVAL)
+      return fd;
+    *direct = 0;
+  }
+  return open (path, flags, mode);
+}
+
+/* Return true if the destination can be written at arbitrary
+ * offsets.  Pipes and character devices can only be written
+ * sequentially.
+ */
+static int
+is_seekable (int fd)
+{
+  struct stat statbuf;
+
+  if (fstat (fd, &statbuf) == 0 &&
+      (S_ISREG (statbuf.st_mode) || S_ISBLK (statbuf.st_mode)))
+    return 1;
+  return lseek (fd, 0, SEEK_CUR) != (off_t) -1;
+}
+
+/* Called from the writer thread.  Returns 0 or an errno. */
+static int
+write_range (struct copy_ring *ring, const char *data, size_t len, off_t pos)
+{
+  ssize_t r;
+
+  if (ring->direct && !is_aligned (data, len, pos)) {
+    if (clear_direct (ring->dest_fd) == -1)
+      return errno;
+    ring->direct = 0;
+  }
+
+  while (len > 0) {
+    if (ring->seekable)
+      r = pwrite (ring->dest_fd, data, len, pos);
+    else
+      r = write (ring->dest_fd, data, len);
+    if (r == -1) {
+      if (errno == EINTR)
+        continue;
+      return errno;
+    }
+    data += r;
+    len -= r;
+    pos += r;
+  }
+
+  return 0;
+}
+
+/* Called from the writer thread.  In sparse mode, only the runs of
+ * non-zero blocks are written.  Returns 0 or an errno.
+ */
+static int
+write_buffer (struct copy_ring *ring, const struct copy_buffer *b)
+{
+  size_t i, n, run = 0;
+  int in_run = 0, err;
+
+  if (!ring->sparse)
+    return write_range (ring, b->data, b->len, b->dest_pos);
+
+  for (i = 0; i < b->len; i += n) {
+    n = b->len - i;
+    if (n > SPARSE_BLOCK_SIZE)
+      n = SPARSE_BLOCK_SIZE;
+
+    if (!is_zero (b->data + i, n)) {
+      if (!in_run) {
+        run = i;
+        in_run = 1;
+      }
+    }
+    else if (in_run) {
+      err = write_range (ring, b->data + run, i - run, b->dest_pos + run);
+      if (err)
+        return err;
+      in_run = 0;
+    }
+  }
+
+  if (in_run)
+    return write_range (ring, b->data + run, b->len - run, b->dest_pos + run);
+  return 0;
+}
+
+static void *
+writer_thread (void *ringv)
+{
+  struct copy_ring *ring = ringv;
+  const struct copy_buffer *b;
+  int err;
+
+  for (;;) {
+    pthread_mutex_lock (&ring->lock);
+    while (ring->tail == ring->head && !ring->done)
+      pthread_cond_wait (&ring->cond, &ring->lock);
+    if (ring->tail == ring->head) {
+      /* Finished, and all buffers have been written. */
+      pthread_mutex_unlock (&ring->lock);
+      return NULL;
+    }
+    b = &ring->buffers[ring->tail % COPY_NR_BUFFERS];
+    pthread_mutex_unlock (&ring->lock);
+
+    err = write_buffer (ring, b);
+
+    pthread_mutex_lock (&ring->lock);
+    if (err)
+      ring->err = err;
+    else
+      ring->tail++;
+    pthread_cond_broadcast (&ring->cond);
+    pthread_mutex_unlock (&ring->lock);
+
+    if (err)
+      return NULL;
+  }
+}
+
+static void
+free_ring (struct copy_ring *ring)
+{
+  size_t i;
+
+  for (i = 0; i < COPY_NR_BUFFERS; ++i)
+    free (ring->buffers[i].data);
+  pthread_cond_destroy (&ring->cond);
+  pthread_mutex_destroy (&ring->lock);
+}
+
+/* Allocate the buffers and start the writer thread.  On error this
+ * sends the reply.
+ */
+static int
+start_ring (struct copy_ring *ring, int dest_fd, int seekable, int sparse,
+            int direct)
+{
+  size_t i;
+  int err;
+
+  memset (ring, 0, sizeof *ring);
+  pthread_mutex_init (&ring->lock, NULL);
+  pthread_cond_init (&ring->cond, NULL);
+  ring->dest_fd = dest_fd;
+  ring->seekable = seekable;
+  ring->sparse = sparse;
+  ring->direct = direct;
+
+  for (i = 0; i < COPY_NR_BUFFERS; ++i) {
+    err = posix_memalign ((void **) &ring->buffers[i].data,
+                          COPY_ALIGNMENT, COPY_BUFFER_SIZE);
+    if (err != 0) {
+      ring->buffers[i].data = NULL;
+      free_ring (ring);
+      reply_with_error_errno (err, "posix_memalign");
+      return -1;
+    }
+  }
+
+  err = pthread_create (&ring->thread, NULL, writer_thread, ring);
+  if (err != 0) {
+    free_ring (ring);
+    reply_with_error_errno (err, "pthread_create");
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Wait for a free buffer.  Returns NULL if the writer thread failed. */
+static struct copy_buffer *
+get_free_buffer (struct copy_ring *ring)
+{
+  struct copy_buffer *b = NULL;
+
+  pthread_mutex_lock (&ring->lock);
+  while (ring->head - ring->tail == COPY_NR_BUFFERS && !ring->err)
+    pthread_cond_wait (&ring->cond, &ring->lock);
+  if (!ring->err)
+    b = &ring->buffers[ring->head % COPY_NR_BUFFERS];
+  pthread_mutex_unlock (&ring->lock);
+
+  return b;
+}
+
+static void
+submit_buffer (struct copy_ring *ring)
+{
+  pthread_mutex_lock (&ring->lock);
+  ring->head++;
+  pthread_cond_broadcast (&ring->cond);
+  pthread_mutex_unlock (&ring->lock);
+}
+
+/* Wait for the writer thread to write out the remaining buffers (or
+ * fail), and free the ring.  Returns 0 or the writer thread's errno.
+ */
+static int
+finish_ring (struct copy_ring *ring)
+{
+  int err;
+
+  pthread_mutex_lock (&ring->lock);
+  ring->done = 1;
+  pthread_cond_broadcast (&ring->cond);
+  pthread_mutex_unlock (&ring->lock);
+
+  pthread_join (ring->thread, NULL);
+  err = ring->err;
+  free_ring (ring);
+  return err;
+}
+
 /* NB: We cheat slightly by assuming that optargs_bitmask is
  * compatible for all four of the calls.  This is true provided they
  * all take the same set of optional arguments.
@@ -46,20 +494,19 @@ copy (const char *src, const char *src_display,
       const char *dest, const char *dest_display,
       int wrflags, int wrmode,
       int flags,
-      int64_t srcoffset, int64_t destoffset, int64_t size, int sparse)
+      int64_t srcoffset, int64_t destoffset, int64_t size, int sparse,
+      int direct)
 {
   const int64_t saved_size = size;
   int src_fd, dest_fd;
-  CLEANUP_FREE char *buf = NULL;
+  struct copy_ring ring;
+  struct copy_buffer *b;
   size_t n;
   ssize_t r;
   int err;
-
-  buf = malloc (BUFSIZ);
-  if (buf == NULL) {
-    reply_with_perror ("malloc");
-    return -1;
-  }
+  off_t src_pos, dest_pos, data_start, data_end;
+  int extents, src_direct, dest_direct, dest_seekable;
+  struct stat statbuf;
 
   if ((optargs_bitmask & GUESTFS_COPY_DEVICE_TO_DEVICE_SRCOFFSET_BITMASK)) {
     if (srcoffset < 0) {
@@ -91,8 +538,12 @@ copy (const char *src, const char *src_display,
   if (! (optargs_bitmask & GUESTFS_COPY_DEVICE_TO_DEVICE_SPARSE_BITMASK))
     sparse = 0;
 
+  if (! (optargs_bitmask & GUESTFS_COPY_DEVICE_TO_DEVICE_DIRECT_BITMASK))
+    direct = 0;
+
   /* Open source and destination. */
-  src_fd = open (src, O_RDONLY|O_CLOEXEC);
+  src_direct = direct;
+  src_fd = open_maybe_direct (src, O_RDONLY|O_CLOEXEC, 0, &src_direct);
   if (src_fd == -1) {
     reply_with_perror ("%s", src_display);
     return -1;
@@ -104,15 +555,22 @@ copy (const char *src, const char *src_display,
     return -1;
   }
 
-  dest_fd = open (dest, wrflags, wrmode);
+  dest_direct = direct;
+  dest_fd = open_maybe_direct (dest, wrflags, wrmode, &dest_direct);
   if (dest_fd == -1) {
     reply_with_perror ("%s", dest_display);
     close (src_fd);
     return -1;
   }
 
-  if (destoffset > 0 && lseek (dest_fd, destoffset, SEEK_SET) == (off_t) -1) {
-    reply_with_perror ("lseek: %s", dest_display);
+  /* Holes and destoffset are skipped by writing at an offset, which
+   * is impossible if the destination is a pipe or similar.
+   */
+  dest_seekable = is_seekable (dest_fd);
+  if (!dest_seekable && (sparse || destoffset > 0)) {
+    reply_with_error ("%s: cannot use %s because the destination "
+                      "is not seekable",
+                      dest_display, sparse ? "sparse" : "destoffset");
     close (src_fd);
     close (dest_fd);
     if (flags & COPY_UNLINK_DEST_ON_FAILURE)
@@ -120,70 +578,122 @@ copy (const char *src, const char *src_display,
     return -1;
   }
 
+  src_pos = srcoffset;
+  dest_pos = destoffset;
+
   if (size == -1)
     pulse_mode_start ();
 
-  while (size != 0) {
-    /* Calculate bytes to copy. */
-    if (size == -1 || size > BUFSIZ)
-      n = BUFSIZ;
-    else
-      n = size;
+  /* Copies between regular files can be done in the kernel, but this
+   * does not preserve holes, so don't use it for sparse copies.  It
+   * doesn't work with O_APPEND either.
+   */
+  if (!sparse && !direct && !(wrflags & O_APPEND) &&
+      fstat (src_fd, &statbuf) == 0 && S_ISREG (statbuf.st_mode) &&
+      fstat (dest_fd, &statbuf) == 0 && S_ISREG (statbuf.st_mode))
+    fast_copy (src_fd, dest_fd, &src_pos, &dest_pos, &size, saved_size);
+
+  if (start_ring (&ring, dest_fd, dest_seekable, sparse, dest_direct) == -1) {
+    if (size == -1)
+      pulse_mode_cancel ();
+    close (src_fd);
+    close (dest_fd);
+    if (flags & COPY_UNLINK_DEST_ON_FAILURE)
+      unlink (dest);
+    return -1;
+  }
 
-    r = read (src_fd, buf, n);
-    if (r == -1) {
-      err = errno;
+  /* In sparse mode, ask the source for its allocated extents, and
+   * skip the unallocated ranges without reading them.  data_end is the
+   * end of the currently known data extent.
+   */
+  data_end = src_pos;
+  extents = sparse;
+
+  while (size != 0) {
+    if (cancel_requested ()) {
       if (size == -1)
         pulse_mode_cancel ();
-      errno = err;
-      reply_with_perror ("read: %s", src_display);
-      close (src_fd);
-      close (dest_fd);
-      if (flags & COPY_UNLINK_DEST_ON_FAILURE)
-        unlink (dest);
-      return -1;
+      reply_with_error_errno (EINTR, "operation cancelled by user");
+      goto error;
     }
 
-    if (r == 0) {
-      if (size == -1) /* if size == -1, this is normal end of loop */
-        break;
-      reply_with_error ("%s: input too short", src_display);
-      close (src_fd);
-      close (dest_fd);
-      if (flags & COPY_UNLINK_DEST_ON_FAILURE)
-        unlink (dest);
-      return -1;
+    if (extents && src_pos >= data_end) {
+      if (find_data_extent (src_fd, src_pos, &data_start, &data_end) == -1)
+        extents = 0;
+      else if (data_start > src_pos) {
+        int64_t skip = data_start - src_pos;
+
+        if (size != -1 && skip > size)
+          skip = size;
+
+        if (lseek (src_fd, skip, SEEK_CUR) == -1) {
+          err = errno;
+          if (size == -1)
+            pulse_mode_cancel ();
+          errno = err;
+          reply_with_perror ("%s: seek (because of sparse flag)",
+                             src_display);
+          goto error;
+        }
+        src_pos += skip;
+        dest_pos += skip;
+
+        if (size != -1) {
+          size -= skip;
+          notify_progress ((uint64_t) (saved_size - size),
+                           (uint64_t) saved_size);
+        }
+        continue;
+      }
     }
 
-    if (sparse && is_zero (buf, r)) {
-      if (lseek (dest_fd, r, SEEK_CUR) == -1) {
+    b = get_free_buffer (&ring);
+    if (b == NULL)              /* Writer thread failed. */
+      break;
+
+    /* Calculate bytes to copy. */
+    if (size == -1 || size > COPY_BUFFER_SIZE)
+      n = COPY_BUFFER_SIZE;
+    else
+      n = size;
+    if (extents && (off_t) n > data_end - src_pos)
+      n = data_end - src_pos;
+
+    if (src_direct && !is_aligned (b->data, n, src_pos)) {
+      if (clear_direct (src_fd) == -1) {
         err = errno;
         if (size == -1)
           pulse_mode_cancel ();
         errno = err;
-        reply_with_perror ("%s: seek (because of sparse flag)", dest_display);
-        close (src_fd);
-        close (dest_fd);
-        if (flags & COPY_UNLINK_DEST_ON_FAILURE)
-          unlink (dest);
-        return -1;
+        reply_with_perror ("fcntl: %s", src_display);
+        goto error;
       }
-      goto sparse_skip;
+      src_direct = 0;
     }
 
-    if (xwrite (dest_fd, buf, r) == -1) {
+    r = read (src_fd, b->data, n);
+    if (r == -1) {
       err = errno;
       if (size == -1)
         pulse_mode_cancel ();
       errno = err;
-      reply_with_perror ("%s: write", dest_display);
-      close (src_fd);
-      close (dest_fd);
-      if (flags & COPY_UNLINK_DEST_ON_FAILURE)
-        unlink (dest);
-      return -1;
+      reply_with_perror ("read: %s", src_display);
+      goto error;
     }
-  sparse_skip:
+
+    if (r == 0) {
+      if (size == -1) /* if size == -1, this is normal end of loop */
+        break;
+      reply_with_error ("%s: input too short", src_display);
+      goto error;
+    }
+
+    b->len = r;
+    b->dest_pos = dest_pos;
+    submit_buffer (&ring);
+    src_pos += r;
+    dest_pos += r;
 
     if (size != -1) {
       size -= r;
@@ -191,9 +701,28 @@ copy (const char *src, const char *src_display,
     }
   }
 
+  err = finish_ring (&ring);
+  if (err != 0) {
+    if (size == -1)
+      pulse_mode_cancel ();
+    errno = err;
+    reply_with_perror ("%s: write", dest_display);
+    goto error_ring_finished;
+  }
+
   if (size == -1)
     pulse_mode_end ();
 
+  /* If the copy ended with a hole, the destination file has not been
+   * extended as far as the end of the hole, so extend it now.
+   */
+  if (sparse && !(wrflags & O_APPEND) &&
+      fstat (dest_fd, &statbuf) == 0 && S_ISREG (statbuf.st_mode) &&
+      dest_pos > statbuf.st_size && ftruncate (dest_fd, dest_pos) == -1) {
+    reply_with_perror ("ftruncate: %s", dest_display);
+    goto error_ring_finished;
+  }
+
   if (close (src_fd) == -1) {
     reply_with_perror ("close: %s", src_display);
     close (dest_fd);
@@ -210,12 +739,21 @@ copy (const char *src, const char *src_display,
   }
 
   return 0;
+
+ error:
+  finish_ring (&ring);
+ error_ring_finished:
+  close (src_fd);
+  close (dest_fd);
+  if (flags & COPY_UNLINK_DEST_ON_FAILURE)
+    unlink (dest);
+  return -1;
 }
 
 int
 do_copy_device_to_device (const char *src, const char *dest,
                           int64_t srcoffset, int64_t destoffset, int64_t size,
-                          int sparse, int append)
+                          int sparse, int append, int direct)
 {
   if ((optargs_bitmask & GUESTFS_COPY_DEVICE_TO_DEVICE_APPEND_BITMASK) &&
       append) {
@@ -223,13 +761,13 @@ do_copy_device_to_device (const char *src, const char *dest,
     return -1;
   }
   return copy (src, src, dest, dest, DEST_DEVICE_FLAGS, 0,
-               srcoffset, destoffset, size, sparse);
+               srcoffset, destoffset, size, sparse, direct);
 }
 
 int
 do_copy_device_to_file (const char *src, const char *dest,
                         int64_t srcoffset, int64_t destoffset, int64_t size,
-                        int sparse, int append)
+                        int sparse, int append, int direct)
 {
   CLEANUP_FREE char *dest_buf = sysroot_path (dest);
   int wrflags = O_WRONLY|O_CREAT|O_NOCTTY|O_CLOEXEC;
@@ -246,13 +784,13 @@ do_copy_device_to_file (const char *src, const char *dest,
     wrflags |= O_TRUNC;
 
   return copy (src, src, dest_buf, dest, wrflags, 0666, 0,
-               srcoffset, destoffset, size, sparse);
+               srcoffset, destoffset, size, sparse, direct);
 }
 
 int
 do_copy_file_to_device (const char *src, const char *dest,
                         int64_t srcoffset, int64_t destoffset, int64_t size,
-                        int sparse, int append)
+                        int sparse, int append, int direct)
 {
   CLEANUP_FREE char *src_buf = sysroot_path (src);
 
@@ -268,13 +806,13 @@ do_copy_file_to_device (const char *src, const char *dest,
   }
 
   return copy (src_buf, src, dest, dest, DEST_DEVICE_FLAGS, 0,
-               srcoffset, destoffset, size, sparse);
+               srcoffset, destoffset, size, sparse, direct);
 }
 
 int
 do_copy_file_to_file (const char *src, const char *dest,
                       int64_t srcoffset, int64_t destoffset, int64_t size,
-                      int sparse, int append)
+                      int sparse, int append, int direct)
 {
   CLEANUP_FREE char *src_buf = NULL, *dest_buf = NULL;
   int wrflags = O_WRONLY|O_CREAT|O_NOCTTY|O_CLOEXEC;
@@ -299,5 +837,5 @@ do_copy_file_to_file (const char *src, const char *dest,
 
   return copy (src_buf, src, dest_buf, dest, wrflags, 0666,
                COPY_UNLINK_DEST_ON_FAILURE,
-               srcoffset, destoffset, size, sparse);
+               srcoffset, destoffset, size, sparse, direct);
 }
@@ -47,7 +47,7 @@ do_cpio_out (const char *dir, const char *format)
   CLEANUP_FREE char *cmd = NULL;
   CLEANUP_FREE char *buffer = NULL;
 
-  buffer = malloc (GUESTFS_MAX_CHUNK_SIZE);
+  buffer = malloc (chunk_size);
   if (buffer == NULL) {
     reply_with_perror ("malloc");
     return -1;
@@ -103,7 +103,7 @@ do_cpio_out (const char *dir, const char *format)
    */
   reply (NULL, NULL);
 
-  while ((r = fread (buffer, 1, GUESTFS_MAX_CHUNK_SIZE, fp)) > 0) {
+  while ((r = fread (buffer, 1, chunk_size, fp)) > 0) {
     if (send_file_write (buffer, r) < 0) {
       pclose (fp);
       return -1;
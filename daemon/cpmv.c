@@ -57,6 +57,9 @@ do_mv (const char *src, const char *dest)
 static int
 cpmv_cmd (const char *cmd, const char *flags, const char *src, const char *dest)
 {
+  const size_t MAX_ARGS = 16;
+  const char *argv[MAX_ARGS];
+  size_t i = 0;
   CLEANUP_FREE char *srcbuf = NULL, *destbuf = NULL;
   CLEANUP_FREE char *err = NULL;
   int r;
@@ -73,12 +76,21 @@ cpmv_cmd (const char *cmd, const char *flags, const char *src, const char *dest)
     return -1;
   }
 
+  ADD_ARG (argv, i, cmd);
+  /* Let cp clone the file data on filesystems which support reflinks
+   * (btrfs, XFS), falling back to an ordinary copy elsewhere.
+   */
+  if (STREQ (cmd, str_cp))
+    ADD_ARG (argv, i, "--reflink=auto");
+  if (flags)
+    ADD_ARG (argv, i, flags);
+  ADD_ARG (argv, i, srcbuf);
+  ADD_ARG (argv, i, destbuf);
+  ADD_ARG (argv, i, NULL);
+
   pulse_mode_start ();
 
-  if (flags)
-    r = command (NULL, &err, cmd, flags, srcbuf, destbuf, NULL);
-  else
-    r = command (NULL, &err, cmd, srcbuf, destbuf, NULL);
+  r = commandv (NULL, &err, argv);
 
   if (r == -1) {
     pulse_mode_cancel ();
@@ -75,6 +75,9 @@ extern int xread (int sock, void *buf, size_t len)
 
 extern char *mountable_to_string (const mountable_t *mountable);
 
+/*-- in devsparts.c --*/
+extern void device_inventory_enable (int enable);
+
 /*-- in mount.c --*/
 
 extern int mount_vfs_nochroot (const char *options, const char *vfstype,
@@ -142,6 +145,9 @@ extern int parse_btrfsvol (const char *desc, mountable_t *mountable);
 extern int prog_exists (const char *prog);
 
 extern void udev_settle (void);
+extern void udev_changed (void);
+extern void udev_begin_call (int read_only);
+extern void udev_end_call (void);
 
 extern int random_name (char *template);
 
@@ -153,10 +159,15 @@ extern int asprintf_nowarn (char **strp, const char *fmt, ...);
 extern const char *function_names[];
 
 /*-- in proto.c --*/
-extern int proc_nr;
-extern int serial;
-extern uint64_t progress_hint;
-extern uint64_t optargs_bitmask;
+/* These describe the call being run by the current thread (see
+ * main_loop).
+ */
+extern __thread int proc_nr;
+extern __thread int serial;
+extern __thread uint64_t progress_hint;
+extern __thread uint64_t optargs_bitmask;
+extern size_t chunk_size;
+extern int hole_chunks;
 
 /*-- in mount.c --*/
 extern int is_root_mounted (void);
@@ -164,6 +175,9 @@ extern int is_device_mounted (const char *device);
 
 /*-- in stubs.c (auto-generated) --*/
 extern void dispatch_incoming_message (XDR *);
+extern int is_batchable_proc (int proc);
+extern int is_read_only_proc (int proc);
+extern int is_concurrent_proc (int proc);
 extern guestfs_int_lvm_pv_list *parse_command_line_pvs (void);
 extern guestfs_int_lvm_vg_list *parse_command_line_vgs (void);
 extern guestfs_int_lvm_lv_list *parse_command_line_lvs (void);
@@ -222,7 +236,7 @@ extern void hivex_finalize (void);
 extern void journal_finalize (void);
 
 /*-- in proto.c --*/
-extern void main_loop (int sock) __attribute__((noreturn));
+extern void main_loop (int sock, int bulk_sock) __attribute__((noreturn));
 
 /*-- in xattr.c --*/
 extern int copy_xattrs (const char *src, const char *dest);
@@ -255,6 +269,15 @@ extern int64_t ntfs_minimum_size (const char *device);
 /*-- in swap.c --*/
 extern int swap_set_uuid (const char *device, const char *uuid);
 
+/*-- in parallel.c --*/
+
+/* Run independent tasks on a pool of threads, one per vCPU.  See
+ * parallel.c for the restrictions on what tasks may do.
+ */
+extern int parallel_run (size_t n, int (*task) (size_t i, void *opaque), void *opaque);
+extern int parallel_should_stop (void);
+extern size_t parallel_nr_threads (size_t n);
+
 /* ordinary daemon functions use these to indicate errors
  * NB: you don't need to prefix the string with the current command,
  * it is added automatically by the client-side RPC stubs.
@@ -278,6 +301,12 @@ extern void reply_with_perror_errno (int err, const char *fs, ...)
 typedef int (*receive_cb) (void *opaque, const void *buf, size_t len);
 extern int receive_file (receive_cb cb, void *opaque);
 
+/* Like receive_file, but 'hole_cb' is called for holes (runs of zero
+ * bytes) in the file, eg. so they can be skipped with lseek.
+ */
+typedef int (*receive_hole_cb) (void *opaque, uint64_t len);
+extern int receive_file_sparse (receive_cb cb, receive_hole_cb hole_cb, void *opaque);
+
 /* daemon functions that receive files (FileIn) can call this
  * to cancel incoming transfers (eg. if there is a local error).
  */
@@ -285,14 +314,24 @@ extern int cancel_receive (void);
 
 /* daemon functions that return files (FileOut) should call
  * reply, then send_file_* for each FileOut parameter.
- * Note max write size if GUESTFS_MAX_CHUNK_SIZE.
+ * Note max write size is chunk_size.
  */
 extern int send_file_write (const void *buf, size_t len);
+extern int send_file_hole (uint64_t len);
 extern int send_file_end (int cancel);
 
 /* only call this if there is a FileOut parameter */
 extern void reply (xdrproc_t xdrp, char *ret);
 
+/* Long-running functions which don't have FileIn or FileOut
+ * parameters should call this periodically.  It returns true if the
+ * library has cancelled the call (see guestfs_user_cancel), in which
+ * case the function should clean up and reply with
+ * reply_with_error_errno (EINTR, ...).  This function is
+ * self-rate-limiting so you can call it as often as necessary.
+ */
+extern int cancel_requested (void);
+
 /* Notify progress to caller.  This function is self-rate-limiting so
  * you can call it as often as necessary.  Actions which call this
  * should add 'Progress' note in generator.
@@ -321,24 +360,6 @@ extern void pulse_mode_cancel (void);
  */
 extern void notify_progress_no_ratelimit (uint64_t position, uint64_t total, const struct timeval *now);
 
-/* Return true iff the buffer is all zero bytes.
- *
- * Note that gcc is smart enough to optimize this properly:
- * http://stackoverflow.com/questions/1493936/faster-means-of-checking-for-an-empty-buffer-in-c/1493989#1493989
- */
-static inline int
-is_zero (const char *buffer, size_t size)
-{
-  size_t i;
-
-  for (i = 0; i < size; ++i) {
-    if (buffer[i] != 0)
-      return 0;
-  }
-
-  return 1;
-}
-
 /* Helper for building up short lists of arguments.  Your code has to
  * define MAX_ARGS to a suitable value.
  */
@@ -25,6 +25,8 @@
 #include <fcntl.h>
 #include <dirent.h>
 #include <limits.h>
+#include <stdbool.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 #include "c-ctype.h"
@@ -128,10 +130,97 @@ add_device (const char *device, struct stringsbuf *r)
   return 0;
 }
 
+/* Inventory of the block devices and partitions.
+ *
+ * Scanning /sys/block and opening every device is a noticeable part
+ * of the fixed cost of inspection, which calls list_devices and
+ * list_partitions many times.  The main loop enables the inventory
+ * only while it runs calls which cannot change the devices (see
+ * C<is_read_only_proc>), and any other call (including hotplugging
+ * a drive) empties it.
+ */
+static bool inventory_enabled;
+static char **inventory_devices;
+static char **inventory_partitions;
+static pthread_mutex_t inventory_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Enable or disable the block device inventory.  This is called by
+ * the main loop before each call.  Disabling the inventory also
+ * empties it.
+ */
+void
+device_inventory_enable (int enable)
+{
+  pthread_mutex_lock (&inventory_lock);
+  if (!enable) {
+    if (inventory_devices)
+      free_strings (inventory_devices);
+    if (inventory_partitions)
+      free_strings (inventory_partitions);
+    inventory_devices = inventory_partitions = NULL;
+  }
+  inventory_enabled = enable;
+  pthread_mutex_unlock (&inventory_lock);
+}
+
+/* Copy a string list.  This doesn't send an error reply, it just
+ * returns NULL.
+ */
+static char **
+copy_list (char *const *list)
+{
+  const size_t n = count_strings (list);
+  char **r;
+  size_t i;
+
+  r = malloc ((n+1) * sizeof (char *));
+  if (r == NULL)
+    return NULL;
+  for (i = 0; i < n; ++i) {
+    r[i] = strdup (list[i]);
+    if (r[i] == NULL) {
+      free_stringslen (r, i);
+      return NULL;
+    }
+  }
+  r[n] = NULL;
+
+  return r;
+}
+
+/* Return a copy of the list in '*saved' if there is one, else scan
+ * the devices and (if the inventory is enabled) save the result.
+ */
+static char **
+list_from_inventory (char ***saved, block_dev_func_t func)
+{
+  char **r;
+
+  pthread_mutex_lock (&inventory_lock);
+  if (*saved) {
+    r = copy_list (*saved);
+    pthread_mutex_unlock (&inventory_lock);
+    if (r == NULL)
+      reply_with_perror ("malloc");
+    return r;
+  }
+  pthread_mutex_unlock (&inventory_lock);
+
+  r = foreach_block_device (func);
+
+  pthread_mutex_lock (&inventory_lock);
+  if (r && inventory_enabled && *saved == NULL)
+    *saved = copy_list (r);     /* Doesn't matter if this fails. */
+  pthread_mutex_unlock (&inventory_lock);
+
+  return r;
+}
+
 char **
 do_list_devices (void)
 {
-  return foreach_block_device (add_device);
+  return list_from_inventory (&inventory_devices, add_device);
 }
 
 static int
@@ -184,7 +273,7 @@ add_partitions (const char *device, struct stringsbuf *r)
 char **
 do_list_partitions (void)
 {
-  return foreach_block_device (add_partitions);
+  return list_from_inventory (&inventory_partitions, add_partitions);
 }
 
 char *
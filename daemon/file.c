@@ -403,8 +403,10 @@ pwrite_fd (int fd, const char *content, size_t size, int64_t offset,
    * XXX We should be smarter about when we do this or should get rid
    * of the udev rules since we don't use blkid in cached mode.
    */
-  if (settle)
+  if (settle) {
+    udev_changed ();
     udev_settle ();
+  }
 
   return r;
 }
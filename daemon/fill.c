@@ -65,6 +65,11 @@ do_fill (int c, int len, const char *path)
 
   n = 0;
   while (n < len_sz) {
+    if (cancel_requested ()) {
+      reply_with_error_errno (EINTR, "operation cancelled by user");
+      close (fd);
+      return -1;
+    }
     r = write (fd, buf, len_sz - n < BUFSIZ ? len_sz - n : BUFSIZ);
     if (r == -1) {
       reply_with_perror ("write: %s", path);
@@ -113,6 +118,11 @@ do_fill_pattern (const char *pattern, int len, const char *path)
   size_t n = 0;
   while (n < len_sz) {
     const size_t wrlen = len_sz - n < patlen ? len_sz - n : patlen;
+    if (cancel_requested ()) {
+      reply_with_error_errno (EINTR, "operation cancelled by user");
+      close (fd);
+      return -1;
+    }
     if (xwrite (fd, pattern, wrlen) == -1) {
       reply_with_perror ("write: %s", path);
       close (fd);
@@ -20,54 +20,352 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <limits.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 #include "guestfs_protocol.h"
 #include "daemon.h"
 #include "actions.h"
 
-GUESTFSD_EXT_CMD(str_find, find);
+/* find0 walks the directory tree itself, rather than running
+ * find(1), using a pool of threads (one per vCPU) which take
+ * directories from a shared stack.  Each thread collects paths in a
+ * chunk-sized buffer, and the main thread sends the full buffers to
+ * the library as they become ready, since only the main thread may
+ * write to the socket.  The number of output buffers in existence
+ * (being filled, queued or being sent) is limited so that their
+ * total size stays under MAX_OUTPUT_BYTES, however many vCPUs there
+ * are; there are never more threads than buffers.
+ *
+ * Paths are relative to the sysroot path of the directory, exactly
+ * as they were when they were printed by 'find' and the prefix was
+ * removed.
+ */
+
+/* Maximum total size of the output buffers. */
+#define MAX_OUTPUT_BYTES (4 * 1024 * 1024)
+
+/* How often (in milliseconds) the main thread checks for cancellation
+ * while it is waiting for output.
+ */
+#define CANCEL_CHECK_MS 100
+
+struct output {
+  struct output *next;
+  size_t len;
+  char data[];
+};
+
+struct walk {
+  pthread_mutex_t lock;
+  pthread_cond_t work_cond;     /* A directory was queued, or the walk ended. */
+  pthread_cond_t output_cond;   /* Output was queued or freed, or a thread exited. */
+  int rootfd;                   /* The directory being listed. */
+  bool root_slash;              /* sysroot path of the directory ends in '/' */
+
+  char **dirs;                  /* Stack of directories waiting to be read. */
+  size_t nr_dirs, alloc_dirs;
+  size_t busy;                  /* Number of threads reading a directory. */
+  size_t running;               /* Number of threads which haven't exited. */
+
+  struct output *output_head, *output_tail;
+  size_t nr_buffers, max_buffers; /* Output buffers allocated, and the limit. */
+
+  bool stop;                    /* Stop because of an error or cancellation. */
+  int err;                      /* First error (errno). */
+  char *err_path;
+};
+
+/* Called with the lock held.  Records only the first error. */
+static void
+walk_error (struct walk *w, int err, const char *path)
+{
+  if (!w->stop) {
+    w->err = err;
+    w->err_path = strdup (path);
+  }
+  w->stop = true;
+  pthread_cond_broadcast (&w->work_cond);
+  pthread_cond_broadcast (&w->output_cond);
+}
+
+/* Called with the lock held. */
+static void
+free_output (struct walk *w, struct output *out)
+{
+  free (out);
+  w->nr_buffers--;
+  pthread_cond_broadcast (&w->output_cond);
+}
+
+/* Called with the lock held.  Takes ownership of the output buffer. */
+static void
+queue_output (struct walk *w, struct output *out)
+{
+  if (w->stop) {
+    free_output (w, out);
+    return;
+  }
+
+  out->next = NULL;
+  if (w->output_tail)
+    w->output_tail->next = out;
+  else
+    w->output_head = out;
+  w->output_tail = out;
+  pthread_cond_broadcast (&w->output_cond);
+}
+
+/* Add a path (including the trailing '\0') to the thread's output
+ * buffer, queuing the buffer if it is full.
+ */
+static int
+add_path (struct walk *w, struct output **outp, const char *path)
+{
+  const size_t len = strlen (path) + 1;
+
+  if (len > chunk_size) {
+    pthread_mutex_lock (&w->lock);
+    walk_error (w, ENAMETOOLONG, path);
+    pthread_mutex_unlock (&w->lock);
+    return -1;
+  }
+
+  if (*outp && (*outp)->len + len > chunk_size) {
+    pthread_mutex_lock (&w->lock);
+    queue_output (w, *outp);
+    pthread_mutex_unlock (&w->lock);
+    *outp = NULL;
+  }
+  if (*outp == NULL) {
+    /* Wait until the main thread has sent and freed a buffer. */
+    pthread_mutex_lock (&w->lock);
+    while (w->nr_buffers >= w->max_buffers && !w->stop)
+      pthread_cond_wait (&w->output_cond, &w->lock);
+    if (w->stop) {
+      pthread_mutex_unlock (&w->lock);
+      return -1;
+    }
+    w->nr_buffers++;
+    pthread_mutex_unlock (&w->lock);
+
+    *outp = malloc (sizeof (struct output) + chunk_size);
+    if (*outp == NULL) {
+      const int err = errno;
+
+      pthread_mutex_lock (&w->lock);
+      w->nr_buffers--;
+      walk_error (w, err, path);
+      pthread_mutex_unlock (&w->lock);
+      return -1;
+    }
+    (*outp)->len = 0;
+  }
+
+  memcpy (&(*outp)->data[(*outp)->len], path, len);
+  (*outp)->len += len;
+  return 0;
+}
 
 static int
-input_to_nul (FILE *fp, char *buf, size_t maxlen)
+push_dir (struct walk *w, char *path)
 {
-  size_t i = 0;
-  int c;
+  pthread_mutex_lock (&w->lock);
+  if (w->nr_dirs >= w->alloc_dirs) {
+    const size_t n = w->alloc_dirs ? w->alloc_dirs * 2 : 64;
+    char **dirs = realloc (w->dirs, n * sizeof (char *));
 
-  while (i < maxlen) {
-    c = fgetc (fp);
-    if (c == EOF)
-      return 0;
-    buf[i++] = c;
-    if (c == '\0')
-      return i;
+    if (dirs == NULL) {
+      walk_error (w, errno, path);
+      pthread_mutex_unlock (&w->lock);
+      free (path);
+      return -1;
+    }
+    w->dirs = dirs;
+    w->alloc_dirs = n;
   }
+  w->dirs[w->nr_dirs++] = path;
+  pthread_cond_signal (&w->work_cond);
+  pthread_mutex_unlock (&w->lock);
+  return 0;
+}
+
+/* Read one directory, adding each entry to the output and queuing
+ * any subdirectories.  dir is the path relative to the sysroot path
+ * of the directory being listed ("" for the directory itself).
+ */
+static int
+read_directory (struct walk *w, struct output **outp, const char *dir)
+{
+  const char *name = dir[0] == '/' ? dir+1 : dir[0] ? dir : ".";
+  const bool slash = dir[0] || !w->root_slash;
+  struct dirent *d;
+  DIR *dirp;
+  int fd;
+
+  fd = openat (w->rootfd, name,
+               O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+  if (fd == -1 || (dirp = fdopendir (fd)) == NULL) {
+    pthread_mutex_lock (&w->lock);
+    walk_error (w, errno, dir);
+    pthread_mutex_unlock (&w->lock);
+    if (fd >= 0)
+      close (fd);
+    return -1;
+  }
+
+  for (;;) {
+    CLEANUP_FREE char *path = NULL;
+    bool is_dir;
+
+    errno = 0;
+    d = readdir (dirp);
+    if (d == NULL)
+      break;
 
-  reply_with_error ("input_to_nul: input string too long");
+    if (STREQ (d->d_name, ".") || STREQ (d->d_name, ".."))
+      continue;
+
+    if (asprintf (&path, "%s%s%s", dir, slash ? "/" : "", d->d_name) == -1)
+      goto error;
+
+    if (d->d_type == DT_UNKNOWN) {
+      struct stat statbuf;
+
+      if (fstatat (dirfd (dirp), d->d_name, &statbuf,
+                   AT_SYMLINK_NOFOLLOW) == -1)
+        goto error;
+      is_dir = S_ISDIR (statbuf.st_mode);
+    }
+    else
+      is_dir = d->d_type == DT_DIR;
+
+    if (add_path (w, outp, path) == -1) {
+      closedir (dirp);
+      return -1;
+    }
+    if (is_dir) {
+      if (push_dir (w, path) == -1) {
+        path = NULL;            /* freed by push_dir */
+        closedir (dirp);
+        return -1;
+      }
+      path = NULL;              /* now owned by w->dirs */
+    }
+  }
+  if (errno != 0)
+    goto error;
+
+  closedir (dirp);
+  return 0;
+
+ error:
+  pthread_mutex_lock (&w->lock);
+  walk_error (w, errno, dir);
+  pthread_mutex_unlock (&w->lock);
+  closedir (dirp);
   return -1;
 }
 
+static void *
+walk_thread (void *wv)
+{
+  struct walk *w = wv;
+  struct output *out = NULL;
+  char *dir;
+
+  pthread_mutex_lock (&w->lock);
+  for (;;) {
+    while (w->nr_dirs == 0 && w->busy > 0 && !w->stop)
+      pthread_cond_wait (&w->work_cond, &w->lock);
+    if (w->stop || w->nr_dirs == 0)
+      break;
+
+    dir = w->dirs[--w->nr_dirs];
+    w->busy++;
+    pthread_mutex_unlock (&w->lock);
+
+    read_directory (w, &out, dir);
+    free (dir);
+
+    pthread_mutex_lock (&w->lock);
+    w->busy--;
+    if (w->nr_dirs == 0 && w->busy == 0)
+      /* The walk is finished, wake up the idle threads. */
+      pthread_cond_broadcast (&w->work_cond);
+  }
+
+  if (out && out->len > 0)
+    queue_output (w, out);
+  else if (out)
+    free_output (w, out);
+  w->running--;
+  pthread_cond_broadcast (&w->output_cond);
+  pthread_mutex_unlock (&w->lock);
+  return NULL;
+}
+
+/* Wait for the next output buffer.  Returns NULL if all threads have
+ * exited, or if the walk is stopping.  Called with the lock held.
+ */
+static struct output *
+next_output (struct walk *w)
+{
+  struct output *out;
+  struct timespec ts;
+
+  while (w->output_head == NULL && w->running > 0 && !w->stop) {
+    clock_gettime (CLOCK_REALTIME, &ts);
+    ts.tv_nsec += CANCEL_CHECK_MS * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000L;
+    }
+
+    if (pthread_cond_timedwait (&w->output_cond, &w->lock, &ts) == ETIMEDOUT) {
+      pthread_mutex_unlock (&w->lock);
+      const int cancelled = cancel_requested ();
+      pthread_mutex_lock (&w->lock);
+      if (cancelled)
+        walk_error (w, EINTR, "");
+    }
+  }
+
+  if (w->stop)
+    return NULL;
+
+  out = w->output_head;
+  if (out) {
+    w->output_head = out->next;
+    if (w->output_head == NULL)
+      w->output_tail = NULL;
+  }
+  return out;
+}
+
 /* Has one FileOut parameter. */
 int
 do_find0 (const char *dir)
 {
   struct stat statbuf;
   int r;
-  FILE *fp;
-  CLEANUP_FREE char *cmd = NULL;
   CLEANUP_FREE char *sysrootdir = NULL;
-  size_t sysrootdirlen;
-  CLEANUP_FREE char *str = NULL;
-
-  str = malloc (GUESTFS_MAX_CHUNK_SIZE);
-  if (str == NULL) {
-    reply_with_perror ("malloc");
-    return -1;
-  }
+  CLEANUP_FREE pthread_t *threads = NULL;
+  struct walk w = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work_cond = PTHREAD_COND_INITIALIZER,
+    .output_cond = PTHREAD_COND_INITIALIZER,
+  };
+  struct output *out;
+  size_t nr_threads, i;
+  char *root;
 
   sysrootdir = sysroot_path (dir);
   if (!sysrootdir) {
@@ -85,21 +383,32 @@ do_find0 (const char *dir)
     return -1;
   }
 
-  sysrootdirlen = strlen (sysrootdir);
-
-  if (asprintf_nowarn (&cmd, "%s %Q -print0", str_find, sysrootdir) == -1) {
-    reply_with_perror ("asprintf");
+  w.rootfd = open (sysrootdir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+  if (w.rootfd == -1) {
+    reply_with_perror ("%s", dir);
     return -1;
   }
+  w.root_slash = sysrootdir[strlen (sysrootdir) - 1] == '/';
 
-  if (verbose)
-    fprintf (stderr, "%s\n", cmd);
-
-  fp = popen (cmd, "r");
-  if (fp == NULL) {
-    reply_with_perror ("%s", cmd);
+  w.max_buffers = MAX (1, MAX_OUTPUT_BYTES / chunk_size);
+  nr_threads = parallel_nr_threads (w.max_buffers);
+  threads = malloc (nr_threads * sizeof (pthread_t));
+  root = strdup ("");
+  if (threads == NULL || root == NULL) {
+    reply_with_perror ("malloc");
+    free (root);
+    close (w.rootfd);
     return -1;
   }
+  w.dirs = malloc (sizeof (char *));
+  if (w.dirs == NULL) {
+    reply_with_perror ("malloc");
+    free (root);
+    close (w.rootfd);
+    return -1;
+  }
+  w.dirs[0] = root;
+  w.nr_dirs = w.alloc_dirs = 1;
 
   /* Now we must send the reply message, before the file contents.  After
    * this there is no opportunity in the protocol to send any error
@@ -107,33 +416,66 @@ do_find0 (const char *dir)
    */
   reply (NULL, NULL);
 
-  /* The code below assumes each path returned can fit into a protocol
-   * chunk (if not you'll get a runtime protocol error).  If this
-   * turns out not to be a problem at some point in the future then
-   * we'll need to modify the code to handle it.  XXX
-   */
-  while ((r = input_to_nul (fp, str, GUESTFS_MAX_CHUNK_SIZE)) > 0) {
-    const size_t len = strlen (str);
-    if (len <= sysrootdirlen)
-      continue;
+  for (i = 0; i < nr_threads; ++i) {
+    pthread_mutex_lock (&w.lock);
+    w.running++;
+    pthread_mutex_unlock (&w.lock);
 
-    /* Remove the directory part of the path before sending it. */
-    if (send_file_write (str + sysrootdirlen, r - sysrootdirlen) < 0) {
-      pclose (fp);
-      return -1;
+    r = pthread_create (&threads[i], NULL, walk_thread, &w);
+    if (r != 0) {
+      pthread_mutex_lock (&w.lock);
+      w.running--;
+      pthread_mutex_unlock (&w.lock);
+      if (i == 0) {
+        fprintf (stderr, "pthread_create: %s: %s\n", dir, strerror (r));
+        send_file_end (1);      /* Cancel. */
+        free (w.dirs[0]);
+        free (w.dirs);
+        close (w.rootfd);
+        return -1;
+      }
+      break;
     }
   }
+  nr_threads = i;
 
-  if (ferror (fp)) {
-    fprintf (stderr, "fgetc: %s: %m\n", dir);
-    send_file_end (1);                /* Cancel. */
-    pclose (fp);
-    return -1;
+  pthread_mutex_lock (&w.lock);
+  while ((out = next_output (&w)) != NULL) {
+    pthread_mutex_unlock (&w.lock);
+    r = send_file_write (out->data, out->len);
+    pthread_mutex_lock (&w.lock);
+    free_output (&w, out);
+    if (r < 0) {
+      /* send_file_write has already cancelled the transfer. */
+      walk_error (&w, 0, "");
+      w.err = 0;
+    }
+  }
+  pthread_mutex_unlock (&w.lock);
+
+  for (i = 0; i < nr_threads; ++i)
+    pthread_join (threads[i], NULL);
+
+  /* Free anything left over after an error. */
+  for (i = 0; i < w.nr_dirs; ++i)
+    free (w.dirs[i]);
+  free (w.dirs);
+  while ((out = w.output_head) != NULL) {
+    w.output_head = out->next;
+    free (out);
   }
+  close (w.rootfd);
+  pthread_cond_destroy (&w.output_cond);
+  pthread_cond_destroy (&w.work_cond);
+  pthread_mutex_destroy (&w.lock);
 
-  if (pclose (fp) != 0) {
-    fprintf (stderr, "pclose: %s: %m\n", dir);
-    send_file_end (1);                /* Cancel. */
+  if (w.stop) {
+    if (w.err != 0 && w.err != EINTR)
+      fprintf (stderr, "find0: %s%s: %s\n",
+               dir, w.err_path ? w.err_path : "", strerror (w.err));
+    free (w.err_path);
+    if (w.err != 0)
+      send_file_end (1);        /* Cancel. */
     return -1;
   }
 
@@ -103,8 +103,15 @@ do_fstrim (const char *path,
   ADD_ARG (argv, i, buf);
   ADD_ARG (argv, i, NULL);
 
-  r = commandv (&out, &err, argv);
+  /* FITRIM can take a long time on large filesystems.  Killing
+   * fstrim (with SIGKILL) interrupts it.
+   */
+  r = commandvf (&out, &err, COMMAND_FLAG_CANCELLABLE, argv);
   if (r == -1) {
+    if (cancel_requested ()) {
+      reply_with_error_errno (EINTR, "%s", err);
+      return -1;
+    }
     /* If the error is about the kernel operation not being supported
      * for this filesystem type, then return errno ENOTSUP here.
      */
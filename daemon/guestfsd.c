@@ -31,7 +31,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <rpc/types.h>
 #include <rpc/xdr.h>
 #include <getopt.h>
@@ -128,6 +130,9 @@ int test_mode = 0;
 /* Name of the virtio-serial channel. */
 #define VIRTIO_SERIAL_CHANNEL "/dev/virtio-ports/org.libguestfs.channel.0"
 
+/* Name of the optional virtio-serial channel for bulk file data. */
+#define VIRTIO_SERIAL_BULK_CHANNEL "/dev/virtio-ports/org.libguestfs.channel.1"
+
 static void
 usage (void)
 {
@@ -337,6 +342,17 @@ main (int argc, char *argv[])
   if (STRPREFIX (channel, "/dev/ttyS"))
     makeraw (channel, sock);
 
+  /* Newer libraries add a second virtio-serial port which is used
+   * for FileIn and FileOut data (see do_internal_enable_bulk_channel).
+   * It's fine if it doesn't exist.
+   */
+  int bulk_sock = -1;
+  if (!listen_mode && STREQ (channel, VIRTIO_SERIAL_CHANNEL)) {
+    bulk_sock = open (VIRTIO_SERIAL_BULK_CHANNEL, O_RDWR|O_CLOEXEC);
+    if (bulk_sock == -1 && verbose)
+      printf ("no bulk data channel: %s: %m\n", VIRTIO_SERIAL_BULK_CHANNEL);
+  }
+
   /* Wait for udev devices to be created.  If you start libguestfs,
    * especially with disks that contain complex (eg. mdadm) data
    * already, then it is possible for the 'mdadm' and LVM commands
@@ -363,7 +379,7 @@ main (int argc, char *argv[])
   xdr_destroy (&xdr);
 
   /* Enter the main loop, reading and performing actions. */
-  main_loop (sock);
+  main_loop (sock, bulk_sock);
 
   exit (EXIT_SUCCESS);
 }
@@ -1203,6 +1219,64 @@ random_name (char *template)
   return 0;
 }
 
+/* Only the main loop and the calls it runs may change the devices,
+ * so C<udev_settle> can skip running C<udevadm settle> when nothing
+ * could have changed since the last time it ran.
+ *
+ * C<udev_begin_call> and C<udev_end_call> are only called from the
+ * main thread.  Calls running in worker threads are read-only, and
+ * the main loop doesn't begin a call which isn't read-only until the
+ * workers have finished, so the per-call flags are the same for all
+ * the calls running at any time.  All the flags are protected by
+ * udev_lock, since workers may call C<udev_settle>.
+ */
+static bool udev_pending = true; /* Devices may have changed since settle. */
+static bool udev_call_read_only; /* Current call(s) can't change devices. */
+static bool udev_call_settled;   /* udev_settle was called by current call. */
+static pthread_mutex_t udev_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Called by the main loop before each call.
+ */
+void
+udev_begin_call (int read_only)
+{
+  pthread_mutex_lock (&udev_lock);
+  udev_call_read_only = read_only;
+  udev_call_settled = false;
+  pthread_mutex_unlock (&udev_lock);
+}
+
+/**
+ * Called by the main loop after each call.  Calls which may change
+ * the devices without running a command (eg. by writing to a device)
+ * need to be settled before the next call which settles, unless they
+ * settled themselves.
+ */
+void
+udev_end_call (void)
+{
+  pthread_mutex_lock (&udev_lock);
+  if (!udev_call_read_only && !udev_call_settled)
+    udev_pending = true;
+  pthread_mutex_unlock (&udev_lock);
+}
+
+/**
+ * Record that the devices may have changed, so the next
+ * C<udev_settle> must wait for udev.  This is called for every
+ * command run by a call which is not read-only, and before waiting
+ * for changes made outside the appliance (eg. hotplugging).
+ */
+void
+udev_changed (void)
+{
+  pthread_mutex_lock (&udev_lock);
+  if (!udev_call_read_only)
+    udev_pending = true;
+  pthread_mutex_unlock (&udev_lock);
+}
+
 /**
  * LVM and other commands aren't synchronous, especially when udev is
  * involved.  eg. You can create or remove some device, but the
@@ -1211,6 +1285,9 @@ random_name (char *template)
  *
  * Use C<udevadm settle> after certain commands, but don't be too
  * fussed if it fails.
+ *
+ * This does nothing if the devices cannot have changed since the last
+ * time it ran (see C<udev_changed>).
  */
 void
 udev_settle (void)
@@ -1218,6 +1295,16 @@ udev_settle (void)
   char cmd[80];
   int r;
 
+  /* Concurrent calls (see main_loop in proto.c) wait for the same
+   * settle rather than each running their own.
+   */
+  pthread_mutex_lock (&udev_lock);
+  udev_call_settled = true;
+  if (!udev_pending) {
+    pthread_mutex_unlock (&udev_lock);
+    return;
+  }
+
   snprintf (cmd, sizeof cmd, "%s%s settle",
             str_udevadm, verbose ? " --debug" : "");
   if (verbose)
@@ -1227,6 +1314,9 @@ udev_settle (void)
     perror ("system");
   else if (!WIFEXITED (r) || WEXITSTATUS (r) != 0)
     fprintf (stderr, "warning: udevadm command failed\n");
+
+  udev_pending = false;
+  pthread_mutex_unlock (&udev_lock);
 }
 
 char *
@@ -60,6 +60,7 @@ do_internal_hot_add_drive (const char *label)
   time (&start_t);
 
   while (time (&now_t) - start_t <= HOT_ADD_TIMEOUT) {
+    udev_changed ();            /* The change happens outside the appliance. */
     udev_settle ();
 
     r = access (path, F_OK);
@@ -88,6 +89,7 @@ do_internal_hot_remove_drive_precheck (const char *label)
   CLEANUP_FREE char *out = NULL, *err = NULL;
 
   /* Ensure there are no requests in flight (thanks Paolo Bonzini). */
+  udev_changed ();
   udev_settle ();
   sync_disks ();
 
@@ -140,6 +142,7 @@ do_internal_hot_remove_drive (const char *label)
   time (&start_t);
 
   while (time (&now_t) - start_t <= HOT_REMOVE_TIMEOUT) {
+    udev_changed ();            /* The change happens outside the appliance. */
     udev_settle ();
 
     r = access (path, F_OK);
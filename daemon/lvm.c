@@ -193,8 +193,8 @@ do_pvs (void)
   CLEANUP_FREE char *err = NULL;
   int r;
 
-  r = command (&out, &err,
-               str_lvm, "pvs", "-o", "pv_name", "--noheadings", NULL);
+  r = commandf (&out, &err, COMMAND_FLAG_CACHE,
+                str_lvm, "pvs", "-o", "pv_name", "--noheadings", NULL);
   if (r == -1) {
     reply_with_error ("%s", err);
     free (out);
@@ -211,8 +211,8 @@ do_vgs (void)
   CLEANUP_FREE char *err = NULL;
   int r;
 
-  r = command (&out, &err,
-               str_lvm, "vgs", "-o", "vg_name", "--noheadings", NULL);
+  r = commandf (&out, &err, COMMAND_FLAG_CACHE,
+                str_lvm, "vgs", "-o", "vg_name", "--noheadings", NULL);
   if (r == -1) {
     reply_with_error ("%s", err);
     free (out);
@@ -261,12 +261,12 @@ do_lvs (void)
     return NULL;
 
   if (has_S > 0) {
-    r = command (&out, &err,
-                 str_lvm, "lvs",
-                 "-o", "vg_name,lv_name",
-                 "-S", "lv_role=public && lv_skip_activation!=1",
-                 "--noheadings",
-                 "--separator", "/", NULL);
+    r = commandf (&out, &err, COMMAND_FLAG_CACHE,
+                  str_lvm, "lvs",
+                  "-o", "vg_name,lv_name",
+                  "-S", "lv_role=public && lv_skip_activation!=1",
+                  "--noheadings",
+                  "--separator", "/", NULL);
     if (r == -1) {
       reply_with_error ("%s", err);
       free (out);
@@ -275,11 +275,11 @@ do_lvs (void)
 
     return convert_lvm_output (out, "/dev/");
   } else {
-    r = command (&out, &err,
-                 str_lvm, "lvs",
-                 "-o", "lv_attr,vg_name,lv_name",
-                 "--noheadings",
-                 "--separator", ":", NULL);
+    r = commandf (&out, &err, COMMAND_FLAG_CACHE,
+                  str_lvm, "lvs",
+                  "-o", "lv_attr,vg_name,lv_name",
+                  "--noheadings",
+                  "--separator", ":", NULL);
     if (r == -1) {
       reply_with_error ("%s", err);
       free (out);
@@ -717,10 +717,10 @@ get_lvm_field (const char *cmd, const char *field, const char *device)
 {
   char *out;
   CLEANUP_FREE char *err = NULL;
-  int r = command (&out, &err,
-                   str_lvm, cmd,
-                   "--unbuffered", "--noheadings", "-o", field,
-                   device, NULL);
+  int r = commandf (&out, &err, COMMAND_FLAG_CACHE,
+                    str_lvm, cmd,
+                    "--unbuffered", "--noheadings", "-o", field,
+                    device, NULL);
   if (r == -1) {
     reply_with_error ("%s: %s", device, err);
     free (out);
@@ -754,10 +754,10 @@ get_lvm_fields (const char *cmd, const char *field, const char *device)
 {
   CLEANUP_FREE char *out = NULL, *err = NULL;
 
-  int r = command (&out, &err,
-                   str_lvm, cmd,
-                   "--unbuffered", "--noheadings", "-o", field,
-                   device, NULL);
+  int r = commandf (&out, &err, COMMAND_FLAG_CACHE,
+                    str_lvm, cmd,
+                    "--unbuffered", "--noheadings", "-o", field,
+                    device, NULL);
   if (r == -1) {
     reply_with_error ("%s: %s", device, err);
     return NULL;
@@ -45,7 +45,8 @@ int
 is_root_mounted (void)
 {
   FILE *fp;
-  struct mntent *m;
+  struct mntent *m, mbuf;
+  char buf[4096];
 
   /* NB: Eventually we should aim to parse /proc/self/mountinfo, but
    * that requires custom parsing code.
@@ -54,7 +55,10 @@ is_root_mounted (void)
   if (fp == NULL)
     error (EXIT_FAILURE, errno, "setmntent: %s", "/proc/mounts");
 
-  while ((m = getmntent (fp)) != NULL) {
+  /* Use getmntent_r because concurrent calls (see main_loop in
+   * proto.c) may get here at the same time.
+   */
+  while ((m = getmntent_r (fp, &mbuf, buf, sizeof buf)) != NULL) {
     /* Allow a mount directory like "/sysroot". */
     if (sysroot_len > 0 && STREQ (m->mnt_dir, sysroot)) {
     gotit:
@@ -79,7 +83,8 @@ int
 is_device_mounted (const char *device)
 {
   FILE *fp;
-  struct mntent *m;
+  struct mntent *m, mbuf;
+  char buf[4096];
   struct stat stat1, stat2;
 
   if (stat (device, &stat1) == -1) {
@@ -94,7 +99,7 @@ is_device_mounted (const char *device)
   if (fp == NULL)
     error (EXIT_FAILURE, errno, "setmntent: %s", "/proc/mounts");
 
-  while ((m = getmntent (fp)) != NULL) {
+  while ((m = getmntent_r (fp, &mbuf, buf, sizeof buf)) != NULL) {
     if ((sysroot_len > 0 && STREQ (m->mnt_dir, sysroot)) ||
         (STRPREFIX (m->mnt_dir, sysroot) && m->mnt_dir[sysroot_len] == '/')) {
       if (stat (m->mnt_fsname, &stat2) == 0) {
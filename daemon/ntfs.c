@@ -275,7 +275,7 @@ do_ntfscat_i (const mountable_t *mountable, int64_t inode)
   CLEANUP_FREE char *cmd = NULL;
   CLEANUP_FREE char *buffer = NULL;
 
-  buffer = malloc (GUESTFS_MAX_CHUNK_SIZE);
+  buffer = malloc (chunk_size);
   if (buffer == NULL) {
     reply_with_perror ("malloc");
     return -1;
@@ -309,7 +309,7 @@ do_ntfscat_i (const mountable_t *mountable, int64_t inode)
    */
   reply (NULL, NULL);
 
-  while ((r = fread (buffer, 1, GUESTFS_MAX_CHUNK_SIZE, fp)) > 0) {
+  while ((r = fread (buffer, 1, chunk_size, fp)) > 0) {
     if (send_file_write (buffer, r) < 0) {
       pclose (fp);
       return -1;
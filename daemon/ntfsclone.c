@@ -154,7 +154,7 @@ do_ntfsclone_out (const char *device,
   CLEANUP_FREE char *cmd = NULL;
   CLEANUP_FREE char *buf = NULL;
 
-  buf = malloc (GUESTFS_MAX_CHUNK_SIZE);
+  buf = malloc (chunk_size);
   if (buf == NULL) {
     reply_with_perror ("malloc");
     return -1;
@@ -188,7 +188,7 @@ do_ntfsclone_out (const char *device,
    */
   reply (NULL, NULL);
 
-  while ((r = fread (buf, 1, GUESTFS_MAX_CHUNK_SIZE, fp)) > 0) {
+  while ((r = fread (buf, 1, chunk_size, fp)) > 0) {
     if (send_file_write (buf, r) < 0) {
       pclose (fp);
       return -1;
@@ -0,0 +1,232 @@
+/* libguestfs - the guestfsd daemon
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Run independent tasks in parallel across the appliance vCPUs.
+ *
+ * Only the thread running the call may send replies, read from the
+ * socket (cancel_requested) or enter the chroot.  Tasks run by
+ * parallel_run must therefore only do plain file I/O and computation,
+ * and record any errors for the caller to report after parallel_run
+ * returns.
+ *
+ * Concurrent calls (see main_loop in proto.c) may each be running
+ * parallel_run at the same time.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "daemon.h"
+
+/* Upper limit on the number of threads, whatever the number of CPUs. */
+#define MAX_THREADS 32
+
+/* How often (in milliseconds) the main thread checks for cancellation
+ * while the tasks are running.
+ */
+#define CANCEL_CHECK_MS 100
+
+struct parallel {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;          /* Signalled when a thread exits. */
+  size_t n;                     /* Number of tasks. */
+  size_t next;                  /* Next task to hand out. */
+  size_t running;               /* Number of threads still running. */
+  int stop;                     /* Don't hand out any more tasks. */
+  int failed;                   /* A task returned -1. */
+  int (*task) (size_t i, void *opaque);
+  void *opaque;
+};
+
+/* The current parallel_run, for parallel_should_stop.  This is set
+ * in the thread which called parallel_run and in its task threads.
+ */
+static __thread struct parallel *current;
+
+static void *
+worker_thread (void *pv)
+{
+  struct parallel *p = pv;
+  size_t i;
+
+  current = p;
+
+  for (;;) {
+    pthread_mutex_lock (&p->lock);
+    if (p->stop || p->next >= p->n) {
+      p->running--;
+      pthread_cond_broadcast (&p->cond);
+      pthread_mutex_unlock (&p->lock);
+      return NULL;
+    }
+    i = p->next++;
+    pthread_mutex_unlock (&p->lock);
+
+    if (p->task (i, p->opaque) == -1) {
+      pthread_mutex_lock (&p->lock);
+      p->failed = 1;
+      p->stop = 1;
+      pthread_mutex_unlock (&p->lock);
+    }
+  }
+}
+
+/**
+ * Return the number of threads to use for C<n> independent pieces
+ * of work: one per online CPU, but no more than C<n>.
+ */
+size_t
+parallel_nr_threads (size_t n)
+{
+  const long ncpus = sysconf (_SC_NPROCESSORS_ONLN);
+  size_t r = ncpus > 0 ? (size_t) ncpus : 1;
+
+  if (r > MAX_THREADS)
+    r = MAX_THREADS;
+  if (r > n)
+    r = n;
+  return r;
+}
+
+/**
+ * Run C<task (i, opaque)> for each C<i> in C<[0, n)>, using one
+ * thread per online CPU.  The order in which tasks run is not
+ * defined.
+ *
+ * No more tasks are started after a task fails (returns C<-1>) or
+ * after the library cancels the current call.  Long-running tasks
+ * can call C<parallel_should_stop> to find out if they should give
+ * up early.
+ *
+ * Returns C<0> if every task returned C<0>, C<-1> if a task failed,
+ * or C<-2> if the call was cancelled.  No reply is sent: the caller
+ * must report errors.
+ */
+int
+parallel_run (size_t n, int (*task) (size_t i, void *opaque), void *opaque)
+{
+  struct parallel p = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .n = n,
+    .task = task,
+    .opaque = opaque,
+  };
+  const size_t nr_threads = parallel_nr_threads (n);
+  pthread_t threads[MAX_THREADS];
+  size_t i, started;
+  int cancelled = 0, err;
+
+  current = &p;
+
+  for (started = 0; started < nr_threads; ++started) {
+    pthread_mutex_lock (&p.lock);
+    p.running++;
+    pthread_mutex_unlock (&p.lock);
+
+    err = pthread_create (&threads[started], NULL, worker_thread, &p);
+    if (err != 0) {
+      if (verbose)
+        fprintf (stderr, "parallel_run: pthread_create: %s\n",
+                 strerror (err));
+      pthread_mutex_lock (&p.lock);
+      p.running--;
+      pthread_mutex_unlock (&p.lock);
+      break;
+    }
+  }
+
+  if (started == 0) {
+    /* Couldn't create any threads, so run the tasks here. */
+    current = NULL;
+    for (i = 0; i < n; ++i) {
+      if (cancel_requested ()) {
+        cancelled = 1;
+        break;
+      }
+      if (task (i, opaque) == -1) {
+        p.failed = 1;
+        break;
+      }
+    }
+  }
+  else {
+    pthread_mutex_lock (&p.lock);
+    while (p.running > 0) {
+      struct timespec ts;
+
+      clock_gettime (CLOCK_REALTIME, &ts);
+      ts.tv_nsec += CANCEL_CHECK_MS * 1000000L;
+      if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+      }
+
+      if (pthread_cond_timedwait (&p.cond, &p.lock, &ts) == ETIMEDOUT &&
+          !cancelled) {
+        pthread_mutex_unlock (&p.lock);
+        cancelled = cancel_requested ();
+        pthread_mutex_lock (&p.lock);
+        if (cancelled)
+          p.stop = 1;
+      }
+    }
+    pthread_mutex_unlock (&p.lock);
+
+    for (i = 0; i < started; ++i)
+      pthread_join (threads[i], NULL);
+  }
+
+  current = NULL;
+  pthread_cond_destroy (&p.cond);
+  pthread_mutex_destroy (&p.lock);
+
+  if (cancelled)
+    return -2;
+  if (p.failed)
+    return -1;
+  return 0;
+}
+
+/**
+ * Called from a task to find out if the current C<parallel_run> is
+ * stopping, because another task failed or the call was cancelled.
+ * When called outside C<parallel_run> (ie. from the main thread)
+ * this checks for cancellation by the library instead.
+ */
+int
+parallel_should_stop (void)
+{
+  struct parallel *p = current;
+  int r;
+
+  if (p == NULL)
+    return cancel_requested ();
+
+  pthread_mutex_lock (&p->lock);
+  r = p->stop;
+  pthread_mutex_unlock (&p->lock);
+  return r;
+}
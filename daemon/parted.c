@@ -321,13 +321,15 @@ print_partition_table (const char *device, bool add_m_option)
   int r;
 
   if (add_m_option)
-    r = command (&out, &err, str_parted, "-m", "-s", "--", device,
-                 "unit", "b",
-                 "print", NULL);
+    r = commandf (&out, &err, COMMAND_FLAG_CACHE,
+                  str_parted, "-m", "-s", "--", device,
+                  "unit", "b",
+                  "print", NULL);
   else
-    r = command (&out, &err, str_parted, "-s", "--", device,
-                 "unit", "b",
-                 "print", NULL);
+    r = commandf (&out, &err, COMMAND_FLAG_CACHE,
+                  str_parted, "-s", "--", device,
+                  "unit", "b",
+                  "print", NULL);
   if (r == -1) {
     int errcode = 0;
 
@@ -540,7 +542,8 @@ do_part_get_mbr_id (const char *device, int partnum)
 
   udev_settle ();
 
-  r = command (&out, &err, str_sfdisk, param, device, partnum_str, NULL);
+  r = commandf (&out, &err, COMMAND_FLAG_CACHE,
+                str_sfdisk, param, device, partnum_str, NULL);
   if (r == -1) {
     reply_with_error ("sfdisk %s: %s", param, err);
     return -1;
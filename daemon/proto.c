@@ -21,18 +21,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <string.h>
 #include <signal.h>
 #include <inttypes.h>
 #include <unistd.h>
 #include <errno.h>
 #include <error.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/param.h>		/* defines MIN */
 #include <sys/select.h>
 #include <sys/time.h>
 #include <rpc/types.h>
 #include <rpc/xdr.h>
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #ifdef HAVE_WINDOWS_H
 #include <windows.h>
 #endif
@@ -42,10 +49,13 @@
 #include "daemon.h"
 #include "guestfs_protocol.h"
 #include "errnostring.h"
+#include "actions.h"
 
-/* The message currently being processed. */
-int proc_nr;
-int serial;
+/* The message currently being processed.  Several requests may be
+ * running at once (see main_loop), so these are per-thread.
+ */
+__thread int proc_nr;
+__thread int serial;
 
 /* Hint for implementing progress messages for uploaded/incoming data.
  * The caller sets this to a value > 0 if it knows or can estimate how
@@ -53,7 +63,7 @@ int serial;
  * coming from a pipe).  If this is known then we can emit progress
  * messages as we write the data.
  */
-uint64_t progress_hint;
+__thread uint64_t progress_hint;
 
 /* Optional arguments bitmask.  Caller sets this to indicate which
  * optional arguments in the guestfs_<foo>_args structure are
@@ -62,34 +72,411 @@ uint64_t progress_hint;
  * bitmask has bits set that the daemon doesn't understand, then the
  * whole call is rejected early in processing.
  */
-uint64_t optargs_bitmask;
+__thread uint64_t optargs_bitmask;
+
+/* Size of the chunks used for FileIn and FileOut transfers.  The
+ * library may ask for larger chunks after launch (see
+ * do_internal_set_chunk_size below).  Functions which send files
+ * should read and send up to this many bytes at a time.
+ */
+size_t chunk_size = GUESTFS_MAX_CHUNK_SIZE;
+
+/* Set if the library understands hole chunks (GUESTFS_CHUNK_HOLE),
+ * see do_internal_enable_hole_chunks below.  If not set, runs of
+ * zeroes have to be sent as ordinary data.
+ */
+int hole_chunks = 0;
+
+/* Zeroes used to expand holes for code which can't handle them. */
+static const char zero_buf[64 * 1024];
+
+#ifdef HAVE_ZLIB
+/* Set if the library asked for compressed chunks
+ * (GUESTFS_CHUNK_COMPRESSED), see do_internal_enable_compressed_chunks
+ * below.
+ */
+static int compressed_chunks = 0;
+
+/* Buffer used to compress outgoing chunks and decompress incoming
+ * ones.  It holds up to chunk_size bytes.
+ */
+static char *zbuf;
+static size_t zbuf_size;
+
+static char *
+get_zbuf (void)
+{
+  if (zbuf_size < chunk_size) {
+    char *p = realloc (zbuf, chunk_size);
+
+    if (p == NULL) {
+      perror ("realloc");
+      return NULL;
+    }
+    zbuf = p;
+    zbuf_size = chunk_size;
+  }
+  return zbuf;
+}
+#endif
+
+/* Number of times each procedure has been run, and the total time
+ * spent running them, in microseconds.  Returned to the library by
+ * internal_daemon_call_stats.
+ */
+static uint64_t call_count[GUESTFS_MAX_PROC_NR+1];
+static uint64_t call_usec[GUESTFS_MAX_PROC_NR+1];
+static pthread_mutex_t call_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Record that 'proc_nr' has been run, starting at 'start'.
+ * Returns the time taken in microseconds.  The call which fetches the
+ * counts is not counted, so that fetching them doesn't change them.
+ */
+static int64_t
+record_call_time (int proc_nr, const struct timeval *start)
+{
+  struct timeval end_t;
+  int64_t start_us, end_us, elapsed_us;
+
+  gettimeofday (&end_t, NULL);
+  start_us = (int64_t) start->tv_sec * 1000000 + start->tv_usec;
+  end_us = (int64_t) end_t.tv_sec * 1000000 + end_t.tv_usec;
+  elapsed_us = end_us - start_us;
+  if (elapsed_us < 0)
+    elapsed_us = 0;
+
+  if (proc_nr >= 0 && proc_nr <= GUESTFS_MAX_PROC_NR &&
+      proc_nr != GUESTFS_PROC_INTERNAL_DAEMON_CALL_STATS) {
+    pthread_mutex_lock (&call_stats_lock);
+    call_count[proc_nr]++;
+    call_usec[proc_nr] += elapsed_us;
+    pthread_mutex_unlock (&call_stats_lock);
+  }
+
+  return elapsed_us;
+}
 
 /* Time at which we received the current request. */
-static struct timeval start_t;
+static __thread struct timeval start_t;
 
 /* Time at which the last progress notification was sent. */
-static struct timeval last_progress_t;
+static __thread struct timeval last_progress_t;
 
 /* Counts the number of progress notifications sent during this call. */
-static size_t count_progress;
+static __thread size_t count_progress;
+
+/* Set when the library has cancelled the current call, and the time
+ * at which we last checked (see cancel_requested).
+ */
+static __thread int call_cancelled;
+static __thread struct timeval last_cancel_check_t;
+
+/* Serializes writes to the control channel, and protects out_buf
+ * (see below).
+ */
+static pthread_mutex_t reply_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The library may pipeline requests (see guestfs_int_call_pipelined
+ * in src/proto.c), so several requests can be waiting on the socket.
+ * Reads go through a buffer so that we pick up everything which is
+ * available with a single read(2) call, instead of two reads (length
+ * word and body) for each message.
+ */
+#define READ_AHEAD_SIZE (64 * 1024)
+
+struct channel {
+  int fd;
+  char read_ahead_buf[READ_AHEAD_SIZE];
+  size_t read_ahead_start, read_ahead_end;
+};
+
+/* The daemon communications socket, which carries requests, replies
+ * and progress messages.
+ */
+static struct channel control = { .fd = -1 };
+
+/* The optional bulk data channel (see do_internal_enable_bulk_channel
+ * below).  If the library has enabled it, FileIn and FileOut chunks
+ * are sent over this channel instead of the control channel, so
+ * progress messages are not stuck behind file data.  Cancellation
+ * flags always use the control channel.
+ */
+static struct channel bulk = { .fd = -1 };
+
+/* The channel used for file chunks, either &control or &bulk. */
+static struct channel *file_channel = &control;
 
-/* The daemon communications socket. */
-static int sock;
+/* Read whatever is available on the channel into the read-ahead
+ * buffer, blocking if there is nothing.  Returns -1 on error or EOF.
+ */
+static int
+fill_read_ahead (struct channel *ch)
+{
+  ssize_t r;
+
+  if (ch->read_ahead_start > 0) {
+    memmove (ch->read_ahead_buf, ch->read_ahead_buf + ch->read_ahead_start,
+             ch->read_ahead_end - ch->read_ahead_start);
+    ch->read_ahead_end -= ch->read_ahead_start;
+    ch->read_ahead_start = 0;
+  }
+
+  r = read (ch->fd, ch->read_ahead_buf + ch->read_ahead_end,
+            READ_AHEAD_SIZE - ch->read_ahead_end);
+  if (r == -1) {
+    perror ("read");
+    return -1;
+  }
+  if (r == 0) {
+    fprintf (stderr, "read: unexpected end of file on fd %d\n", ch->fd);
+    return -1;
+  }
+  ch->read_ahead_end += r;
+  return 0;
+}
+
+/* Take up to 'len' bytes from the read-ahead buffer. */
+static size_t
+take_read_ahead (struct channel *ch, char *buf, size_t len)
+{
+  const size_t n = MIN (len, ch->read_ahead_end - ch->read_ahead_start);
+
+  memcpy (buf, ch->read_ahead_buf + ch->read_ahead_start, n);
+  ch->read_ahead_start += n;
+  if (ch->read_ahead_start == ch->read_ahead_end)
+    ch->read_ahead_start = ch->read_ahead_end = 0;
+  return n;
+}
+
+/* Like xread (ch->fd, ...), but using the read-ahead buffer. */
+static int
+channel_read (struct channel *ch, void *v_buf, size_t len)
+{
+  char *buf = v_buf;
+  size_t n;
+
+  n = take_read_ahead (ch, buf, len);
+  buf += n;
+  len -= n;
+
+  /* Read large messages directly into the caller's buffer. */
+  if (len >= READ_AHEAD_SIZE)
+    return xread (ch->fd, buf, len);
+
+  while (len > 0) {
+    if (fill_read_ahead (ch) == -1)
+      return -1;
+    n = take_read_ahead (ch, buf, len);
+    buf += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+/* Concurrent requests.
+ *
+ * Requests for procedures marked concurrent in the generator (see
+ * is_concurrent_proc) are handed to a pool of worker threads, so that
+ * one slow call doesn't hold up other calls which the library has
+ * pipelined behind it.  Their replies may be sent in a different
+ * order from the requests: the library matches them up by serial
+ * number.
+ *
+ * Any other request first waits until all the concurrent requests
+ * have finished, and then runs in the main thread as before.  So the
+ * workers only ever run alongside each other, never alongside a call
+ * which changes the disks or the daemon state, or which uses the
+ * socket for file transfers.  Workers cannot be cancelled: a
+ * cancellation flag sent by the library is read and ignored by the
+ * main loop.
+ *
+ * Each worker has its own root directory and current directory
+ * (unshare (CLONE_FS)), so that CHROOT_IN and CHROOT_OUT in one
+ * thread don't affect the others.
+ */
+#define MAX_WORKERS 8
+
+struct request {
+  struct request *next;
+  char *buf;
+  uint32_t len;
+};
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_idle = PTHREAD_COND_INITIALIZER;
+static struct request *queue_head, *queue_tail;
+static size_t nr_active;        /* Number of requests queued or running. */
+static size_t nr_workers;
+
+/* Set in the worker threads. */
+static __thread bool is_worker;
+
+static void handle_request (char *buf, uint32_t len);
+
+#ifdef HAVE_UNSHARE
+static void *
+worker_thread (void *arg)
+{
+  struct request *req;
+
+  /* Can't fail, since start_workers checked it works. */
+  if (unshare (CLONE_FS) == -1)
+    error (EXIT_FAILURE, errno, "unshare");
+  is_worker = true;
+
+  for (;;) {
+    pthread_mutex_lock (&pool_lock);
+    while (queue_head == NULL)
+      pthread_cond_wait (&pool_work, &pool_lock);
+    req = queue_head;
+    queue_head = req->next;
+    if (queue_head == NULL)
+      queue_tail = NULL;
+    pthread_mutex_unlock (&pool_lock);
+
+    handle_request (req->buf, req->len);
+    free (req->buf);
+    free (req);
+
+    pthread_mutex_lock (&pool_lock);
+    if (--nr_active == 0)
+      pthread_cond_broadcast (&pool_idle);
+    pthread_mutex_unlock (&pool_lock);
+  }
+
+  return NULL;
+}
+#endif /* HAVE_UNSHARE */
+
+/* Start the worker threads.  If the appliance has only one vCPU, or
+ * if anything goes wrong, there are no workers and every request runs
+ * in the main thread.
+ */
+static void
+start_workers (void)
+{
+#ifdef HAVE_UNSHARE
+  const size_t n = parallel_nr_threads (MAX_WORKERS);
+  pthread_t thread;
+  size_t i;
+  int err;
+
+  if (n < 2)
+    return;
+
+  /* Check that unshare works before starting any threads.  It has no
+   * effect here, since the main thread doesn't share anything yet.
+   */
+  if (unshare (CLONE_FS) == -1) {
+    if (verbose)
+      perror ("start_workers: unshare");
+    return;
+  }
+
+  for (i = 0; i < n; ++i) {
+    err = pthread_create (&thread, NULL, worker_thread, NULL);
+    if (err != 0) {
+      if (verbose)
+        fprintf (stderr, "start_workers: pthread_create: %s\n",
+                 strerror (err));
+      break;
+    }
+    pthread_detach (thread);
+    nr_workers++;
+  }
+
+  if (verbose)
+    fprintf (stderr, "guestfsd: %zu worker threads\n", nr_workers);
+#endif
+}
+
+/* Return the procedure number of the request in 'buf', or -1 if the
+ * header is not valid (handle_request will reply with the error).
+ */
+static int
+request_proc (char *buf, uint32_t len)
+{
+  XDR xdr;
+  struct guestfs_message_header hdr;
+  int proc = -1;
+
+  xdrmem_create (&xdr, buf, len, XDR_DECODE);
+  if (xdr_guestfs_message_header (&xdr, &hdr) &&
+      hdr.prog == GUESTFS_PROGRAM &&
+      hdr.vers == GUESTFS_PROTOCOL_VERSION &&
+      hdr.direction == GUESTFS_DIRECTION_CALL &&
+      hdr.status == GUESTFS_STATUS_OK)
+    proc = hdr.proc;
+  xdr_destroy (&xdr);
+  return proc;
+}
+
+/* Cached command output (see COMMAND_FLAG_CACHE), the block device
+ * inventory and the udev state stay valid only across calls which
+ * cannot change the devices.  This is only called from the main
+ * loop, while no worker is running a call which isn't read-only.
+ */
+static void
+begin_call (int read_only)
+{
+  command_cache_enable (read_only);
+  device_inventory_enable (read_only);
+  udev_begin_call (read_only);
+}
+
+/* Queue a request for the workers.  They free 'buf'. */
+static void
+queue_request (char *buf, uint32_t len)
+{
+  struct request *req;
+
+  req = malloc (sizeof *req);
+  if (req == NULL)
+    error (EXIT_FAILURE, errno, "malloc");
+  req->next = NULL;
+  req->buf = buf;
+  req->len = len;
+
+  pthread_mutex_lock (&pool_lock);
+  if (queue_tail)
+    queue_tail->next = req;
+  else
+    queue_head = req;
+  queue_tail = req;
+  nr_active++;
+  pthread_cond_signal (&pool_work);
+  pthread_mutex_unlock (&pool_lock);
+}
+
+/* Wait until the workers have finished all the queued requests. */
+static void
+wait_for_workers (void)
+{
+  pthread_mutex_lock (&pool_lock);
+  while (nr_active > 0)
+    pthread_cond_wait (&pool_idle, &pool_lock);
+  pthread_mutex_unlock (&pool_lock);
+}
 
 void
-main_loop (int _sock)
+main_loop (int _sock, int bulk_sock)
 {
   XDR xdr;
   char *buf;
   char lenbuf[4];
   uint32_t len;
-  struct guestfs_message_header hdr;
+  int proc;
 
-  sock = _sock;
+  control.fd = _sock;
+  bulk.fd = bulk_sock;
+
+  start_workers ();
 
   for (;;) {
     /* Read the length word. */
-    if (xread (sock, lenbuf, 4) == -1)
+    if (channel_read (&control, lenbuf, 4) == -1)
       exit (EXIT_FAILURE);
 
     xdrmem_create (&xdr, lenbuf, 4, XDR_DECODE);
@@ -102,7 +489,8 @@ main_loop (int _sock)
 	       len);
 
     /* Cancellation sent from the library and received after the
-     * previous request has finished processing.  Just ignore it.
+     * previous request has finished processing, or meant for a
+     * request running in a worker.  Just ignore it.
      */
     if (len == GUESTFS_CANCEL_FLAG)
       continue;
@@ -116,7 +504,7 @@ main_loop (int _sock)
       continue;
     }
 
-    if (xread (sock, buf, len) == -1)
+    if (channel_read (&control, buf, len) == -1)
       exit (EXIT_FAILURE);
 
 #ifdef ENABLE_PACKET_DUMP
@@ -142,79 +530,104 @@ main_loop (int _sock)
     }
 #endif
 
-    gettimeofday (&start_t, NULL);
-    last_progress_t = start_t;
-    count_progress = 0;
+    proc = request_proc (buf, len);
 
-    /* Decode the message header. */
-    xdrmem_create (&xdr, buf, len, XDR_DECODE);
-    if (!xdr_guestfs_message_header (&xdr, &hdr))
-      error (EXIT_FAILURE, 0, "could not decode message header");
-
-    /* Check the version etc. */
-    if (hdr.prog != GUESTFS_PROGRAM) {
-      reply_with_error ("wrong program (%u)", hdr.prog);
-      goto cont;
-    }
-    if (hdr.vers != GUESTFS_PROTOCOL_VERSION) {
-      reply_with_error ("wrong protocol version (%u)", hdr.vers);
-      goto cont;
-    }
-    if (hdr.direction != GUESTFS_DIRECTION_CALL) {
-      reply_with_error ("unexpected message direction (%d)",
-                        (int) hdr.direction);
-      goto cont;
-    }
-    if (hdr.status != GUESTFS_STATUS_OK) {
-      reply_with_error ("unexpected message status (%d)", (int) hdr.status);
-      goto cont;
+    /* Concurrent procedures are always read-only, so the workers
+     * can run alongside each other without changing this state.
+     */
+    if (nr_workers > 0 && proc >= 0 && is_concurrent_proc (proc)) {
+      begin_call (1);
+      queue_request (buf, len);
+      continue;
     }
 
-    proc_nr = hdr.proc;
-    serial = hdr.serial;
-    progress_hint = hdr.progress_hint;
-    optargs_bitmask = hdr.optargs_bitmask;
+    wait_for_workers ();
+    begin_call (proc >= 0 && is_read_only_proc (proc));
+    handle_request (buf, len);
+    udev_end_call ();
+    free (buf);
+  }
+}
 
-    /* Clear errors before we call the stub functions.  This is just
-     * to ensure that we can accurately report errors in cases where
-     * error handling paths don't set errno correctly.
-     */
-    errno = 0;
-#ifdef WIN32
-    SetLastError (0);
-    WSASetLastError (0);
-#endif
+/* Decode, run and reply to the request in 'buf'.  This is called in
+ * the main thread, or in a worker thread for concurrent requests.
+ * The main loop has already called begin_call.
+ */
+static void
+handle_request (char *buf, uint32_t len)
+{
+  XDR xdr;
+  struct guestfs_message_header hdr;
+  int64_t elapsed_us;
 
-    /* Now start to process this message. */
-    dispatch_incoming_message (&xdr);
-    /* Note that dispatch_incoming_message will also send a reply. */
+  gettimeofday (&start_t, NULL);
+  last_progress_t = start_t;
+  count_progress = 0;
+  call_cancelled = 0;
+  last_cancel_check_t.tv_sec = last_cancel_check_t.tv_usec = 0;
 
-    /* In verbose mode, display the time taken to run each command. */
-    if (verbose) {
-      struct timeval end_t;
-      gettimeofday (&end_t, NULL);
+  /* Decode the message header. */
+  xdrmem_create (&xdr, buf, len, XDR_DECODE);
+  if (!xdr_guestfs_message_header (&xdr, &hdr))
+    error (EXIT_FAILURE, 0, "could not decode message header");
 
-      int64_t start_us, end_us, elapsed_us;
-      start_us = (int64_t) start_t.tv_sec * 1000000 + start_t.tv_usec;
-      end_us = (int64_t) end_t.tv_sec * 1000000 + end_t.tv_usec;
-      elapsed_us = end_us - start_us;
+  /* Check the version etc. */
+  if (hdr.prog != GUESTFS_PROGRAM) {
+    reply_with_error ("wrong program (%u)", hdr.prog);
+    goto out;
+  }
+  if (hdr.vers != GUESTFS_PROTOCOL_VERSION) {
+    reply_with_error ("wrong protocol version (%u)", hdr.vers);
+    goto out;
+  }
+  if (hdr.direction != GUESTFS_DIRECTION_CALL) {
+    reply_with_error ("unexpected message direction (%d)",
+                      (int) hdr.direction);
+    goto out;
+  }
+  if (hdr.status != GUESTFS_STATUS_OK) {
+    reply_with_error ("unexpected message status (%d)", (int) hdr.status);
+    goto out;
+  }
 
-      fprintf (stderr,
-	       "guestfsd: main_loop: proc %d (%s) took %d.%02d seconds\n",
-               proc_nr,
-               proc_nr >= 0 && proc_nr <= GUESTFS_MAX_PROC_NR
-               ? function_names[proc_nr] : "UNKNOWN PROCEDURE",
-               (int) (elapsed_us / 1000000),
-               (int) ((elapsed_us / 10000) % 100));
-    }
+  proc_nr = hdr.proc;
+  serial = hdr.serial;
+  progress_hint = hdr.progress_hint;
+  optargs_bitmask = hdr.optargs_bitmask;
 
-  cont:
-    xdr_destroy (&xdr);
-    free (buf);
+  /* Clear errors before we call the stub functions.  This is just
+   * to ensure that we can accurately report errors in cases where
+   * error handling paths don't set errno correctly.
+   */
+  errno = 0;
+#ifdef WIN32
+  SetLastError (0);
+  WSASetLastError (0);
+#endif
+
+  /* Now start to process this message. */
+  dispatch_incoming_message (&xdr);
+  /* Note that dispatch_incoming_message will also send a reply. */
+
+  elapsed_us = record_call_time (proc_nr, &start_t);
+
+  /* In verbose mode, display the time taken to run each command. */
+  if (verbose) {
+    fprintf (stderr,
+             "guestfsd: main_loop: proc %d (%s) took %d.%02d seconds\n",
+             proc_nr,
+             proc_nr >= 0 && proc_nr <= GUESTFS_MAX_PROC_NR
+             ? function_names[proc_nr] : "UNKNOWN PROCEDURE",
+             (int) (elapsed_us / 1000000),
+             (int) ((elapsed_us / 10000) % 100));
   }
+
+ out:
+  xdr_destroy (&xdr);
 }
 
 static void send_error (int errnum, char *msg);
+static int write_reply (const void *buf, size_t len);
 
 void
 reply_with_error_errno (int err, const char *fs, ...)
@@ -261,7 +674,6 @@ send_error (int errnum, char *msg)
 {
   XDR xdr;
   CLEANUP_FREE char *buf = NULL;
-  char lenbuf[4];
   struct guestfs_message_header hdr;
   struct guestfs_message_error err;
   unsigned len;
@@ -278,10 +690,11 @@ send_error (int errnum, char *msg)
   if (strlen (msg) > GUESTFS_ERROR_LEN)
     msg[GUESTFS_ERROR_LEN] = '\0';
 
-  buf = malloc (GUESTFS_ERROR_LEN + 200);
+  /* The first 4 bytes of the buffer are reserved for the length word. */
+  buf = malloc (GUESTFS_ERROR_LEN + 200 + 4);
   if (!buf)
     error (EXIT_FAILURE, errno, "malloc");
-  xdrmem_create (&xdr, buf, GUESTFS_ERROR_LEN + 200, XDR_ENCODE);
+  xdrmem_create (&xdr, buf + 4, GUESTFS_ERROR_LEN + 200, XDR_ENCODE);
 
   memset (&hdr, 0, sizeof hdr);
   hdr.prog = GUESTFS_PROGRAM;
@@ -307,29 +720,71 @@ send_error (int errnum, char *msg)
   len = xdr_getpos (&xdr);
   xdr_destroy (&xdr);
 
-  xdrmem_create (&xdr, lenbuf, 4, XDR_ENCODE);
+  xdrmem_create (&xdr, buf, 4, XDR_ENCODE);
   xdr_u_int (&xdr, &len);
   xdr_destroy (&xdr);
 
-  if (xwrite (sock, lenbuf, 4) == -1)
-    error (EXIT_FAILURE, 0, "xwrite failed");
-  if (xwrite (sock, buf, len) == -1)
+  pthread_mutex_lock (&reply_lock);
+  if (write_reply (buf, (size_t) len + 4) == -1)
     error (EXIT_FAILURE, 0, "xwrite failed");
+  pthread_mutex_unlock (&reply_lock);
+}
+
+/* Buffer used to encode replies and file chunks.  It is kept from
+ * one message to the next, and only enlarged to GUESTFS_MESSAGE_MAX
+ * if a reply doesn't fit.  The first 4 bytes are reserved for the
+ * length word, so each message is sent with a single write.
+ */
+#define OUT_BUF_INITIAL_SIZE (64 * 1024)
+static char *out_buf;
+static size_t out_buf_size;
+
+static void
+alloc_out_buf (size_t size)
+{
+  if (out_buf_size >= size)
+    return;
+
+  free (out_buf);
+  out_buf = malloc (size);
+  if (out_buf == NULL)
+    error (EXIT_FAILURE, errno, "malloc");
+  out_buf_size = size;
+}
+
+/* Write the length word at the start of out_buf ('len' is the
+ * length of the message following the length word).
+ */
+static void
+set_out_buf_len (uint32_t len)
+{
+  XDR xdr;
+
+  xdrmem_create (&xdr, out_buf, 4, XDR_ENCODE);
+  xdr_u_int (&xdr, &len);
+  xdr_destroy (&xdr);
+}
+
+/* Send the file chunk in out_buf. */
+static int
+send_out_buf (uint32_t len)
+{
+  set_out_buf_len (len);
+  return xwrite (file_channel->fd, out_buf, (size_t) len + 4);
 }
 
 void
 reply (xdrproc_t xdrp, char *ret)
 {
   XDR xdr;
-  CLEANUP_FREE char *buf = NULL;
-  char lenbuf[4];
   struct guestfs_message_header hdr;
   uint32_t len;
 
-  buf = malloc (GUESTFS_MESSAGE_MAX);
-  if (!buf)
-    error (EXIT_FAILURE, errno, "malloc");
-  xdrmem_create (&xdr, buf, GUESTFS_MESSAGE_MAX, XDR_ENCODE);
+  pthread_mutex_lock (&reply_lock);
+  alloc_out_buf (OUT_BUF_INITIAL_SIZE);
+
+ again:
+  xdrmem_create (&xdr, out_buf + 4, out_buf_size - 4, XDR_ENCODE);
 
   memset (&hdr, 0, sizeof hdr);
   hdr.prog = GUESTFS_PROGRAM;
@@ -348,8 +803,13 @@ reply (xdrproc_t xdrp, char *ret)
      * we want to return an error message instead. (RHBZ#509597).
      */
     if (!(*xdrp) (&xdr, ret)) {
-      reply_with_error ("guestfsd: failed to encode reply body\n(maybe the reply exceeds the maximum message size in the protocol?)");
       xdr_destroy (&xdr);
+      if (out_buf_size < GUESTFS_MESSAGE_MAX + 4) {
+        alloc_out_buf (GUESTFS_MESSAGE_MAX + 4);
+        goto again;
+      }
+      pthread_mutex_unlock (&reply_lock);
+      reply_with_error ("guestfsd: failed to encode reply body\n(maybe the reply exceeds the maximum message size in the protocol?)");
       return;
     }
   }
@@ -357,19 +817,40 @@ reply (xdrproc_t xdrp, char *ret)
   len = xdr_getpos (&xdr);
   xdr_destroy (&xdr);
 
-  xdrmem_create (&xdr, lenbuf, 4, XDR_ENCODE);
-  xdr_u_int (&xdr, &len);
-  xdr_destroy (&xdr);
-
-  if (xwrite (sock, lenbuf, 4) == -1)
-    error (EXIT_FAILURE, 0, "xwrite failed");
-  if (xwrite (sock, buf, (size_t) len) == -1)
+  set_out_buf_len (len);
+  if (write_reply (out_buf, (size_t) len + 4) == -1)
     error (EXIT_FAILURE, 0, "xwrite failed");
+  pthread_mutex_unlock (&reply_lock);
+}
+
+/* Pass a hole of 'len' bytes to 'cb' as ordinary zero data. */
+static int
+expand_hole (receive_cb cb, void *opaque, uint64_t len)
+{
+  while (len > 0) {
+    const size_t n = MIN (len, sizeof zero_buf);
+
+    if (cb (opaque, zero_buf, n) == -1)
+      return -1;
+    len -= n;
+  }
+
+  return 0;
 }
 
 /* Receive file chunks, repeatedly calling 'cb'. */
 int
 receive_file (receive_cb cb, void *opaque)
+{
+  return receive_file_sparse (cb, NULL, opaque);
+}
+
+/* Receive file chunks, repeatedly calling 'cb' for data and
+ * 'hole_cb' for holes (runs of zero bytes).  If 'hole_cb' is NULL,
+ * holes are passed to 'cb' as zeroes.
+ */
+int
+receive_file_sparse (receive_cb cb, receive_hole_cb hole_cb, void *opaque)
 {
   guestfs_chunk chunk;
   char lenbuf[4];
@@ -384,7 +865,7 @@ receive_file (receive_cb cb, void *opaque)
       fprintf (stderr, "guestfsd: receive_file: reading length word\n");
 
     /* Read the length word. */
-    if (xread (sock, lenbuf, 4) == -1)
+    if (channel_read (file_channel, lenbuf, 4) == -1)
       exit (EXIT_FAILURE);
 
     xdrmem_create (&xdr, lenbuf, 4, XDR_DECODE);
@@ -403,7 +884,7 @@ receive_file (receive_cb cb, void *opaque)
       return -1;
     }
 
-    if (xread (sock, buf, len) == -1)
+    if (channel_read (file_channel, buf, len) == -1)
       exit (EXIT_FAILURE);
 
     xdrmem_create (&xdr, buf, len, XDR_DECODE);
@@ -420,6 +901,65 @@ receive_file (receive_cb cb, void *opaque)
                (unsigned) chunk.cancel,
                chunk.data.data_len, chunk.data.data_val);
 
+    if (chunk.cancel == GUESTFS_CHUNK_HOLE && hole_chunks) {
+      uint64_t hole_len;
+
+      xdrmem_create (&xdr, chunk.data.data_val, chunk.data.data_len,
+                     XDR_DECODE);
+      r = xdr_uint64_t (&xdr, &hole_len);
+      xdr_destroy (&xdr);
+      xdr_free ((xdrproc_t) xdr_guestfs_chunk, (char *) &chunk);
+      if (!r) {
+        fprintf (stderr, "guestfsd: receive_file: invalid hole chunk\n");
+        return -1;
+      }
+
+      if (verbose)
+        fprintf (stderr,
+                 "guestfsd: receive_file: got hole: len = %" PRIu64 "\n",
+                 hole_len);
+
+      if (hole_cb)
+        r = hole_cb (opaque, hole_len);
+      else if (cb)
+        r = expand_hole (cb, opaque, hole_len);
+      else
+        r = 0;
+      if (r == -1) {
+        if (verbose)
+          fprintf (stderr, "guestfsd: receive_file: write error\n");
+        return -1;
+      }
+      continue;
+    }
+
+#ifdef HAVE_ZLIB
+    if (chunk.cancel == GUESTFS_CHUNK_COMPRESSED && compressed_chunks) {
+      char *data = get_zbuf ();
+      uLongf data_len = chunk_size;
+
+      if (data == NULL ||
+          chunk.data.data_len == 0 ||
+          uncompress ((Bytef *) data, &data_len,
+                      (const Bytef *) chunk.data.data_val,
+                      chunk.data.data_len) != Z_OK ||
+          data_len == 0) {
+        fprintf (stderr, "guestfsd: receive_file: invalid compressed chunk\n");
+        xdr_free ((xdrproc_t) xdr_guestfs_chunk, (char *) &chunk);
+        return -1;
+      }
+      xdr_free ((xdrproc_t) xdr_guestfs_chunk, (char *) &chunk);
+
+      r = cb ? cb (opaque, data, data_len) : 0;
+      if (r == -1) {
+        if (verbose)
+          fprintf (stderr, "guestfsd: receive_file: write error\n");
+        return -1;
+      }
+      continue;
+    }
+#endif
+
     if (chunk.cancel != 0 && chunk.cancel != 1) {
       fprintf (stderr,
                "guestfsd: receive_file: chunk.cancel != [0|1] ... "
@@ -469,7 +1009,7 @@ cancel_receive (void)
   xdr_u_int (&xdr, &flag);
   xdr_destroy (&xdr);
 
-  if (xwrite (sock, fbuf, sizeof fbuf) == -1) {
+  if (xwrite (control.fd, fbuf, sizeof fbuf) == -1) {
     perror ("write to socket");
     return -1;
   }
@@ -481,6 +1021,33 @@ cancel_receive (void)
 static int check_for_library_cancellation (void);
 static int send_chunk (const guestfs_chunk *);
 
+/* Length of the hole which has not been sent yet.  Consecutive holes
+ * are merged, and the hole chunk is sent before the next data chunk
+ * or the end of the file.
+ */
+static uint64_t pending_hole;
+
+static int
+flush_pending_hole (void)
+{
+  guestfs_chunk chunk;
+  char buf[8];
+  XDR xdr;
+
+  if (pending_hole == 0)
+    return 0;
+
+  xdrmem_create (&xdr, buf, sizeof buf, XDR_ENCODE);
+  xdr_uint64_t (&xdr, &pending_hole);
+  xdr_destroy (&xdr);
+  pending_hole = 0;
+
+  chunk.cancel = GUESTFS_CHUNK_HOLE;
+  chunk.data.data_len = sizeof buf;
+  chunk.data.data_val = buf;
+  return send_chunk (&chunk);
+}
+
 /* Also check if the library sends us a cancellation message. */
 int
 send_file_write (const void *buf, size_t len)
@@ -488,22 +1055,46 @@ send_file_write (const void *buf, size_t len)
   guestfs_chunk chunk;
   int cancel;
 
-  if (len > GUESTFS_MAX_CHUNK_SIZE) {
-    fprintf (stderr, "guestfsd: send_file_write: len (%zu) > GUESTFS_MAX_CHUNK_SIZE (%d)\n",
-             len, GUESTFS_MAX_CHUNK_SIZE);
+  if (len > chunk_size) {
+    fprintf (stderr, "guestfsd: send_file_write: len (%zu) > chunk_size (%zu)\n",
+             len, chunk_size);
     return -1;
   }
 
   cancel = check_for_library_cancellation ();
 
   if (cancel) {
+    pending_hole = 0;
     chunk.cancel = 1;
     chunk.data.data_len = 0;
     chunk.data.data_val = NULL;
+  } else if (hole_chunks && is_zero (buf, len)) {
+    /* Don't send zeroes over the socket. */
+    pending_hole += len;
+    return 0;
   } else {
+    if (flush_pending_hole () == -1)
+      return -1;
     chunk.cancel = 0;
     chunk.data.data_len = len;
     chunk.data.data_val = (char *) buf;
+#ifdef HAVE_ZLIB
+    /* Send a compressed chunk if the data gets smaller.  If it
+     * doesn't fit in len-1 bytes, compress2 returns Z_BUF_ERROR.
+     */
+    if (compressed_chunks && len > 0) {
+      char *data = get_zbuf ();
+      uLongf data_len = len - 1;
+
+      if (data &&
+          compress2 ((Bytef *) data, &data_len,
+                     (const Bytef *) buf, len, Z_BEST_SPEED) == Z_OK) {
+        chunk.cancel = GUESTFS_CHUNK_COMPRESSED;
+        chunk.data.data_len = data_len;
+        chunk.data.data_val = data;
+      }
+    }
+#endif
   }
 
   if (send_chunk (&chunk) == -1)
@@ -513,51 +1104,134 @@ send_file_write (const void *buf, size_t len)
   return 0;
 }
 
+/* Send 'len' zero bytes, eg. for a hole in a sparse file.  If the
+ * library doesn't understand hole chunks, the zeroes are sent as
+ * ordinary data.  Returns the same as send_file_write.
+ */
+int
+send_file_hole (uint64_t len)
+{
+  if (!hole_chunks) {
+    while (len > 0) {
+      const size_t n = MIN (len, MIN (chunk_size, sizeof zero_buf));
+      const int r = send_file_write (zero_buf, n);
+
+      if (r < 0)
+        return r;
+      len -= n;
+    }
+    return 0;
+  }
+
+  if (check_for_library_cancellation ()) {
+    if (send_file_end (1) == -1)
+      return -1;
+    return -2;
+  }
+
+  pending_hole += len;
+  return 0;
+}
+
 static int
 check_for_library_cancellation (void)
 {
+  struct channel *ch = &control;
   fd_set rset;
   struct timeval tv;
   int r;
-  char buf[4];
   uint32_t flag;
   XDR xdr;
 
-  FD_ZERO (&rset);
-  FD_SET (sock, &rset);
-  tv.tv_sec = 0;
-  tv.tv_usec = 0;
-  r = select (sock+1, &rset, NULL, NULL, &tv);
-  if (r == -1) {
-    perror ("select");
-    return 0;
+  /* Nothing buffered, so check if anything is waiting on the socket. */
+  if (ch->read_ahead_start == ch->read_ahead_end) {
+    FD_ZERO (&rset);
+    FD_SET (ch->fd, &rset);
+    tv.tv_sec = 0;
+    tv.tv_usec = 0;
+    r = select (ch->fd+1, &rset, NULL, NULL, &tv);
+    if (r == -1) {
+      perror ("select");
+      return 0;
+    }
+    if (r == 0)
+      return 0;
   }
-  if (r == 0)
-    return 0;
 
-  /* Read the message from the daemon. */
-  r = xread (sock, buf, sizeof buf);
-  if (r == -1)
-    return 0;
+  /* Make sure we have the whole length word / flag. */
+  while (ch->read_ahead_end - ch->read_ahead_start < 4) {
+    if (fill_read_ahead (ch) == -1)
+      return 0;
+  }
 
-  xdrmem_create (&xdr, buf, sizeof buf, XDR_DECODE);
+  xdrmem_create (&xdr, ch->read_ahead_buf + ch->read_ahead_start, 4,
+                 XDR_DECODE);
   xdr_u_int (&xdr, &flag);
   xdr_destroy (&xdr);
 
+  /* Anything else is left in the buffer for main_loop to read.  This
+   * is normal when the library has pipelined the next request.
+   */
   if (flag != GUESTFS_CANCEL_FLAG) {
-    fprintf (stderr, "guestfsd: check_for_library_cancellation: read 0x%x from library, expected 0x%x\n",
-             flag, GUESTFS_CANCEL_FLAG);
+    if (verbose)
+      fprintf (stderr, "guestfsd: check_for_library_cancellation: read 0x%x from library, expected 0x%x\n",
+               flag, GUESTFS_CANCEL_FLAG);
     return 0;
   }
 
+  ch->read_ahead_start += 4;
+  if (ch->read_ahead_start == ch->read_ahead_end)
+    ch->read_ahead_start = ch->read_ahead_end = 0;
   return 1;
 }
 
+/* Minimum time between checks of the socket in cancel_requested,
+ * in microseconds.
+ */
+#define CANCEL_CHECK_PERIOD 100000
+
+int
+cancel_requested (void)
+{
+  struct timeval now_t;
+  int64_t last_us, now_us;
+
+  if (call_cancelled)
+    return 1;
+
+  /* Only the main thread reads from the socket. */
+  if (is_worker)
+    return 0;
+
+  /* Rate limit, so callers don't have to. */
+  gettimeofday (&now_t, NULL);
+  last_us =
+    (int64_t) last_cancel_check_t.tv_sec * 1000000 +
+    last_cancel_check_t.tv_usec;
+  now_us = (int64_t) now_t.tv_sec * 1000000 + now_t.tv_usec;
+  if (now_us >= last_us && now_us - last_us < CANCEL_CHECK_PERIOD)
+    return 0;
+  last_cancel_check_t = now_t;
+
+  if (check_for_library_cancellation ()) {
+    if (verbose)
+      fprintf (stderr, "guestfsd: cancel_requested: call cancelled by library\n");
+    call_cancelled = 1;
+  }
+
+  return call_cancelled;
+}
+
 int
 send_file_end (int cancel)
 {
   guestfs_chunk chunk;
 
+  if (cancel)
+    pending_hole = 0;
+  else if (flush_pending_hole () == -1)
+    return -1;
+
   chunk.cancel = cancel;
   chunk.data.data_len = 0;
   chunk.data.data_val = NULL;
@@ -567,38 +1241,298 @@ send_file_end (int cancel)
 static int
 send_chunk (const guestfs_chunk *chunk)
 {
-  const size_t buf_len = GUESTFS_MAX_CHUNK_SIZE + 48;
-  CLEANUP_FREE char *buf = NULL;
-  char lenbuf[4];
   XDR xdr;
   uint32_t len;
 
-  buf = malloc (buf_len);
-  if (buf == NULL) {
-    perror ("malloc");
-    return -1;
-  }
+  pthread_mutex_lock (&reply_lock);
+  alloc_out_buf (chunk_size + 4 + 48);
 
-  xdrmem_create (&xdr, buf, buf_len, XDR_ENCODE);
+  xdrmem_create (&xdr, out_buf + 4, out_buf_size - 4, XDR_ENCODE);
   if (!xdr_guestfs_chunk (&xdr, (guestfs_chunk *) chunk)) {
     fprintf (stderr, "guestfsd: send_chunk: failed to encode chunk\n");
     xdr_destroy (&xdr);
+    pthread_mutex_unlock (&reply_lock);
     return -1;
   }
 
   len = xdr_getpos (&xdr);
   xdr_destroy (&xdr);
 
-  xdrmem_create (&xdr, lenbuf, 4, XDR_ENCODE);
-  xdr_u_int (&xdr, &len);
-  xdr_destroy (&xdr);
-
-  const int err = (xwrite (sock, lenbuf, 4) == 0
-                   && xwrite (sock, buf, len) == 0 ? 0 : -1);
-  if (err)
+  if (send_out_buf (len) == -1)
     error (EXIT_FAILURE, 0, "send_chunk: write failed");
+  pthread_mutex_unlock (&reply_lock);
+
+  return 0;
+}
+
+/* Called by the library after launch to negotiate the chunk size.
+ * Older daemons don't have this call, and the library then carries
+ * on using GUESTFS_MAX_CHUNK_SIZE.
+ */
+int
+do_internal_set_chunk_size (int size)
+{
+  if (size < GUESTFS_MAX_CHUNK_SIZE)
+    size = GUESTFS_MAX_CHUNK_SIZE;
+  if (size > GUESTFS_MAX_NEGOTIATED_CHUNK_SIZE)
+    size = GUESTFS_MAX_NEGOTIATED_CHUNK_SIZE;
+
+  chunk_size = size;
+  return size;
+}
+
+/* While internal_batch is running, the replies to the individual
+ * requests are collected in this buffer instead of being written to
+ * the socket.  The collected replies are returned together as the
+ * reply to internal_batch, so they must fit in a single message.
+ */
+#define BATCH_REPLIES_MAX (GUESTFS_MESSAGE_MAX - 1024)
+static bool in_batch;
+static char *batch_replies;
+static size_t batch_replies_len, batch_replies_size;
+static bool batch_overflow;
+
+/* Send a complete reply message (including the length word). */
+static int
+write_reply (const void *buf, size_t len)
+{
+  if (!in_batch)
+    return xwrite (control.fd, buf, len);
+
+  if (batch_replies_len + len > BATCH_REPLIES_MAX) {
+    batch_overflow = true;
+    return 0;
+  }
+
+  if (batch_replies_len + len > batch_replies_size) {
+    size_t size = MAX (batch_replies_size * 2, batch_replies_len + len);
+    char *p;
+
+    size = MIN (size, BATCH_REPLIES_MAX);
+    p = realloc (batch_replies, size);
+    if (p == NULL)
+      error (EXIT_FAILURE, errno, "realloc");
+    batch_replies = p;
+    batch_replies_size = size;
+  }
+
+  memcpy (batch_replies + batch_replies_len, buf, len);
+  batch_replies_len += len;
+  return 0;
+}
+
+/* Run the request messages in 'requests' (see guestfs_int_batch_run
+ * in src/batch.c), and return their replies concatenated.
+ *
+ * Only procedures marked batchable in the generator may be called
+ * this way.  They never send or receive file chunks, and they have
+ * no side effects, so if the replies don't all fit we simply stop
+ * and the library sends the remaining requests again.
+ */
+char *
+do_internal_batch (const char *requests, size_t requests_size, size_t *size_r)
+{
+  const int saved_proc_nr = proc_nr;
+  const int saved_serial = serial;
+  const uint64_t saved_progress_hint = progress_hint;
+  const uint64_t saved_optargs_bitmask = optargs_bitmask;
+  size_t pos = 0, nr_replies = 0;
+  const char *errmsg = NULL;
+  char *ret;
+
+  if (requests_size == 0) {
+    reply_with_error ("no requests");
+    return NULL;
+  }
+
+  in_batch = true;
+  batch_replies_len = 0;
+  batch_overflow = false;
+
+  while (pos < requests_size) {
+    XDR xdr;
+    uint32_t len;
+    struct guestfs_message_header hdr;
+
+    if (requests_size - pos < 4) {
+      errmsg = "truncated length word";
+      break;
+    }
+    xdrmem_create (&xdr, (char *) requests + pos, 4, XDR_DECODE);
+    xdr_u_int (&xdr, &len);
+    xdr_destroy (&xdr);
+    pos += 4;
+
+    if (len > requests_size - pos) {
+      errmsg = "truncated request";
+      break;
+    }
+
+    xdrmem_create (&xdr, (char *) requests + pos, len, XDR_DECODE);
+    pos += len;
+    if (!xdr_guestfs_message_header (&xdr, &hdr)) {
+      xdr_destroy (&xdr);
+      errmsg = "could not decode message header";
+      break;
+    }
+
+    proc_nr = hdr.proc;
+    serial = hdr.serial;
+    progress_hint = hdr.progress_hint;
+    optargs_bitmask = hdr.optargs_bitmask;
+
+    if (hdr.prog != GUESTFS_PROGRAM ||
+        hdr.vers != GUESTFS_PROTOCOL_VERSION ||
+        hdr.direction != GUESTFS_DIRECTION_CALL ||
+        hdr.status != GUESTFS_STATUS_OK)
+      reply_with_error ("invalid message header in batch");
+    else if (!is_batchable_proc (proc_nr))
+      reply_with_error ("procedure %d cannot be called in a batch", proc_nr);
+    else {
+      struct timeval call_start_t;
+
+      gettimeofday (&call_start_t, NULL);
+      errno = 0;
+      dispatch_incoming_message (&xdr);
+      record_call_time (proc_nr, &call_start_t);
+    }
+    xdr_destroy (&xdr);
+
+    if (batch_overflow) {
+      /* If even the first reply is too large, return an error for
+       * it so that the library doesn't keep resending the request.
+       */
+      if (nr_replies == 0) {
+        batch_overflow = false;
+        reply_with_error ("reply is too large to be returned in a batch");
+      }
+      break;
+    }
+    nr_replies++;
+  }
+
+  in_batch = false;
+  proc_nr = saved_proc_nr;
+  serial = saved_serial;
+  progress_hint = saved_progress_hint;
+  optargs_bitmask = saved_optargs_bitmask;
+
+  if (errmsg) {
+    reply_with_error ("%s", errmsg);
+    return NULL;
+  }
+
+  /* Hand the buffer over to the caller. */
+  ret = batch_replies;
+  *size_r = batch_replies_len;
+  batch_replies = NULL;
+  batch_replies_len = batch_replies_size = 0;
+  return ret;
+}
+
+/* Called by the library after launch if it understands hole chunks.
+ * Older daemons don't have this call, and then neither side sends
+ * hole chunks.
+ */
+int
+do_internal_enable_hole_chunks (void)
+{
+  hole_chunks = 1;
+  return 0;
+}
+
+/* Called by the library after launch if it has a bulk data channel
+ * (see struct channel above).  Older daemons don't have this call,
+ * and if the appliance doesn't have the second virtio-serial port
+ * this fails.  In both cases file chunks stay on the control channel.
+ */
+int
+do_internal_enable_bulk_channel (void)
+{
+  if (bulk.fd == -1) {
+    reply_with_error_errno (ENOTSUP, "the appliance has no bulk data channel");
+    return -1;
+  }
+
+  file_channel = &bulk;
+  return 0;
+}
+
+/* Called by the library after launch if the user asked for
+ * compressed transfers.  If the daemon was built without zlib this
+ * fails, and the library carries on sending uncompressed chunks.
+ */
+int
+do_internal_enable_compressed_chunks (void)
+{
+#ifdef HAVE_ZLIB
+  compressed_chunks = 1;
+  return 0;
+#else
+  reply_with_error_errno (ENOTSUP, "guestfsd was built without zlib");
+  return -1;
+#endif
+}
+
+/* Called by the library to fetch the counts kept by
+ * record_call_time.  Only the cs_daemon_* fields are filled in.
+ */
+guestfs_int_call_stat_list *
+do_internal_daemon_call_stats (int reset)
+{
+  guestfs_int_call_stat_list *ret;
+  size_t i, n = 0;
+
+  ret = malloc (sizeof *ret);
+  if (ret == NULL) {
+    reply_with_perror ("malloc");
+    return NULL;
+  }
+  ret->guestfs_int_call_stat_list_len = 0;
+  ret->guestfs_int_call_stat_list_val = NULL;
+
+  for (i = 0; i <= GUESTFS_MAX_PROC_NR; ++i)
+    if (call_count[i] > 0)
+      n++;
+
+  if (n > 0) {
+    ret->guestfs_int_call_stat_list_val =
+      calloc (n, sizeof (guestfs_int_call_stat));
+    if (ret->guestfs_int_call_stat_list_val == NULL) {
+      reply_with_perror ("calloc");
+      free (ret);
+      return NULL;
+    }
+  }
+
+  for (i = 0, n = 0; i <= GUESTFS_MAX_PROC_NR; ++i) {
+    guestfs_int_call_stat *cs;
+
+    if (call_count[i] == 0)
+      continue;
+
+    cs = &ret->guestfs_int_call_stat_list_val[n];
+    cs->cs_proc_nr = i;
+    cs->cs_name = strdup (function_names[i] ? function_names[i] : "");
+    if (cs->cs_name == NULL) {
+      reply_with_perror ("strdup");
+      ret->guestfs_int_call_stat_list_len = n;
+      xdr_free ((xdrproc_t) xdr_guestfs_int_call_stat_list, (char *) ret);
+      free (ret);
+      return NULL;
+    }
+    cs->cs_daemon_calls = call_count[i];
+    cs->cs_daemon_usec = call_usec[i];
+    n++;
+  }
+  ret->guestfs_int_call_stat_list_len = n;
+
+  if (reset) {
+    memset (call_count, 0, sizeof call_count);
+    memset (call_usec, 0, sizeof call_usec);
+  }
 
-  return err;
+  return ret;
 }
 
 /* Initial delay before sending notification messages, and
@@ -660,7 +1594,8 @@ notify_progress_no_ratelimit (uint64_t position, uint64_t total,
   xdr_u_int (&xdr, &i);
   xdr_destroy (&xdr);
 
-  if (xwrite (sock, buf, 4) == -1)
+  pthread_mutex_lock (&reply_lock);
+  if (xwrite (control.fd, buf, 4) == -1)
     error (EXIT_FAILURE, 0, "xwrite failed");
 
   message.proc = proc_nr;
@@ -672,13 +1607,15 @@ notify_progress_no_ratelimit (uint64_t position, uint64_t total,
   if (!xdr_guestfs_progress (&xdr, &message)) {
     fprintf (stderr, "guestfsd: xdr_guestfs_progress: failed to encode message\n");
     xdr_destroy (&xdr);
+    pthread_mutex_unlock (&reply_lock);
     return;
   }
   len = xdr_getpos (&xdr);
   xdr_destroy (&xdr);
 
-  if (xwrite (sock, buf, len) == -1)
+  if (xwrite (control.fd, buf, len) == -1)
     error (EXIT_FAILURE, 0, "xwrite failed");
+  pthread_mutex_unlock (&reply_lock);
 }
 
 /* "Pulse mode" progress messages. */
@@ -769,7 +1706,7 @@ async_safe_send_pulse (int sig)
     /* 64 bit total = 1 */    0, 0, 0, 0, 0, 0, 0, 1
   };
 
-  if (xwrite (sock, msg, sizeof msg) == -1)
+  if (xwrite (control.fd, msg, sizeof msg) == -1)
     exit (EXIT_FAILURE);
 }
 
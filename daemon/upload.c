@@ -34,6 +34,7 @@
 struct write_cb_data {
   int fd;                       /* file descriptor */
   uint64_t written;             /* bytes written so far */
+  int ends_with_hole;           /* last thing received was a hole */
 };
 
 static int
@@ -47,6 +48,27 @@ write_cb (void *data_vp, const void *buf, size_t len)
     return -1;
 
   data->written += len;
+  data->ends_with_hole = 0;
+
+  if (progress_hint > 0)
+    notify_progress (data->written, progress_hint);
+
+  return 0;
+}
+
+/* Used when uploading to a new regular file: skip over holes, so
+ * that the file is created sparse.
+ */
+static int
+hole_cb (void *data_vp, uint64_t len)
+{
+  struct write_cb_data *data = data_vp;
+
+  if (lseek (data->fd, len, SEEK_CUR) == -1)
+    return -1;
+
+  data->written += len;
+  data->ends_with_hole = 1;
 
   if (progress_hint > 0)
     notify_progress (data->written, progress_hint);
@@ -58,8 +80,9 @@ write_cb (void *data_vp, const void *buf, size_t len)
 static int
 upload (const char *filename, int flags, int64_t offset)
 {
-  struct write_cb_data data = { .written = 0 };
-  int err, r, is_dev;
+  struct write_cb_data data = { .written = 0, .ends_with_hole = 0 };
+  struct stat statbuf;
+  int err, r, is_dev, sparse;
 
   is_dev = STRPREFIX (filename, "/dev/");
 
@@ -84,7 +107,13 @@ upload (const char *filename, int flags, int64_t offset)
     }
   }
 
-  r = receive_file (write_cb, &data.fd);
+  /* Holes can only be skipped if the file has just been truncated.
+   * Otherwise (eg. devices) they must be written as zeroes.
+   */
+  sparse = (flags & O_TRUNC) != 0 &&
+    fstat (data.fd, &statbuf) == 0 && S_ISREG (statbuf.st_mode);
+
+  r = receive_file_sparse (write_cb, sparse ? hole_cb : NULL, &data);
   if (r == -1) {		/* write error */
     err = errno;
     r = cancel_receive ();
@@ -102,6 +131,17 @@ upload (const char *filename, int flags, int64_t offset)
     return -1;
   }
 
+  /* If the file ends with a hole, set the file size. */
+  if (data.ends_with_hole) {
+    const off_t pos = lseek (data.fd, 0, SEEK_CUR);
+
+    if (pos == -1 || ftruncate (data.fd, pos) == -1) {
+      reply_with_perror ("ftruncate: %s", filename);
+      close (data.fd);
+      return -1;
+    }
+  }
+
   if (close (data.fd) == -1) {
     reply_with_perror ("close: %s", filename);
     return -1;
@@ -154,7 +194,7 @@ do_download (const char *filename)
   int fd, r, is_dev;
   CLEANUP_FREE char *buf = NULL;
 
-  buf = malloc (GUESTFS_MAX_CHUNK_SIZE);
+  buf = malloc (chunk_size);
   if (buf == NULL) {
     reply_with_perror ("malloc");
     return -1;
@@ -201,7 +241,32 @@ do_download (const char *filename)
    */
   reply (NULL, NULL);
 
-  while ((r = read (fd, buf, GUESTFS_MAX_CHUNK_SIZE)) > 0) {
+  r = 0;
+  for (;;) {
+#ifdef SEEK_DATA
+    /* Skip over holes in sparse files without reading them. */
+    if (!is_dev && hole_chunks) {
+      off_t data = lseek (fd, sent, SEEK_DATA);
+
+      if (data == -1 && errno == ENXIO) /* hole up to the end of file */
+        data = total;
+      if (data > (off_t) sent) {
+        if (send_file_hole (data - sent) < 0) {
+          close (fd);
+          return -1;
+        }
+        sent = data;
+        notify_progress (sent, total);
+        if (sent >= total)
+          break;
+      }
+    }
+#endif
+
+    r = read (fd, buf, chunk_size);
+    if (r <= 0)
+      break;
+
     if (send_file_write (buf, r) < 0) {
       close (fd);
       return -1;
@@ -237,7 +302,7 @@ do_download_offset (const char *filename, int64_t offset, int64_t size)
   int fd, r, is_dev;
   CLEANUP_FREE char *buf = NULL;
 
-  buf = malloc (GUESTFS_MAX_CHUNK_SIZE);
+  buf = malloc (chunk_size);
   if (buf == NULL) {
     reply_with_perror ("malloc");
     return -1;
@@ -287,7 +352,7 @@ do_download_offset (const char *filename, int64_t offset, int64_t size)
 
   while (usize > 0) {
     r = read (fd, buf,
-              usize > GUESTFS_MAX_CHUNK_SIZE ? GUESTFS_MAX_CHUNK_SIZE : usize);
+              usize > chunk_size ? chunk_size : usize);
     if (r == -1) {
       fprintf (stderr, "read: %s: %m\n", filename);
       send_file_end (1);        /* Cancel. */
@@ -0,0 +1,355 @@
+/* libguestfs - the guestfsd daemon
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <rpc/types.h>
+#include <rpc/xdr.h>
+
+#include "fts_.h"
+#include "areadlink.h"
+
+#include "guestfs_protocol.h"
+#include "daemon.h"
+#include "actions.h"
+
+/* The same test as in xattr.c. */
+#if (defined(HAVE_ATTR_XATTR_H) || defined(HAVE_SYS_XATTR_H)) &&	\
+  defined(HAVE_LLISTXATTR) && defined(HAVE_LGETXATTR)
+# define HAVE_WALK_XATTRS
+# ifdef HAVE_ATTR_XATTR_H
+#  include <attr/xattr.h>
+# else
+#  include <sys/xattr.h>
+# endif
+#endif
+
+/* The walk sends one guestfs_int_walk_entry for each file, followed
+ * by one for each of its extended attributes.  The entries are
+ * XDR-encoded and packed into chunk-sized buffers.
+ */
+struct walk_output {
+  char *buf;                    /* Output waiting to be sent. */
+  size_t len;
+  char *xdrbuf;                 /* Used to encode each entry. */
+};
+
+static int
+send_entry (struct walk_output *out, guestfs_int_walk_entry *entry)
+{
+  XDR xdr;
+  size_t len;
+
+  xdrmem_create (&xdr, out->xdrbuf, chunk_size, XDR_ENCODE);
+  if (!xdr_guestfs_int_walk_entry (&xdr, entry)) {
+    fprintf (stderr, "xdr_guestfs_int_walk_entry: %s: entry too large\n",
+             entry->we_path);
+    xdr_destroy (&xdr);
+    return -1;
+  }
+  len = xdr_getpos (&xdr);
+  xdr_destroy (&xdr);
+
+  if (out->len + len > chunk_size) {
+    if (send_file_write (out->buf, out->len) < 0)
+      return -2;
+    out->len = 0;
+  }
+  memcpy (out->buf + out->len, out->xdrbuf, len);
+  out->len += len;
+  return 0;
+}
+
+static void
+stat_to_walk_entry (guestfs_int_walk_entry *entry, const struct stat *statbuf)
+{
+  entry->we_st_dev = statbuf->st_dev;
+  entry->we_st_ino = statbuf->st_ino;
+  entry->we_st_mode = statbuf->st_mode;
+  entry->we_st_nlink = statbuf->st_nlink;
+  entry->we_st_uid = statbuf->st_uid;
+  entry->we_st_gid = statbuf->st_gid;
+  entry->we_st_rdev = statbuf->st_rdev;
+  entry->we_st_size = statbuf->st_size;
+#ifdef HAVE_STRUCT_STAT_ST_BLKSIZE
+  entry->we_st_blksize = statbuf->st_blksize;
+#else
+  entry->we_st_blksize = -1;
+#endif
+#ifdef HAVE_STRUCT_STAT_ST_BLOCKS
+  entry->we_st_blocks = statbuf->st_blocks;
+#else
+  entry->we_st_blocks = -1;
+#endif
+  entry->we_st_atime_sec = statbuf->st_atime;
+#ifdef HAVE_STRUCT_STAT_ST_ATIM_TV_NSEC
+  entry->we_st_atime_nsec = statbuf->st_atim.tv_nsec;
+#endif
+  entry->we_st_mtime_sec = statbuf->st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+  entry->we_st_mtime_nsec = statbuf->st_mtim.tv_nsec;
+#endif
+  entry->we_st_ctime_sec = statbuf->st_ctime;
+#ifdef HAVE_STRUCT_STAT_ST_CTIM_TV_NSEC
+  entry->we_st_ctime_nsec = statbuf->st_ctim.tv_nsec;
+#endif
+}
+
+/* Send the extended attributes of a file, sorted by name (like
+ * guestfs_lgetxattrs).
+ */
+#ifdef HAVE_WALK_XATTRS
+static int
+compare_names (const void *p1, const void *p2)
+{
+  return strcmp (* (char * const *) p1, * (char * const *) p2);
+}
+
+static int
+send_xattrs (struct walk_output *out, const char *path)
+{
+  CLEANUP_FREE char *list = NULL;
+  CLEANUP_FREE char **names = NULL;
+  ssize_t len, vlen;
+  size_t i, n;
+  int r;
+
+  len = llistxattr (path, NULL, 0);
+  if (len == -1) {
+    if (errno == ENOTSUP)
+      return 0;
+    perror (path);
+    return -1;
+  }
+  if (len == 0)
+    return 0;
+
+  list = malloc (len);
+  if (list == NULL) {
+    perror ("malloc");
+    return -1;
+  }
+  len = llistxattr (path, list, len);
+  if (len == -1) {
+    perror (path);
+    return -1;
+  }
+
+  for (i = 0, n = 0; i < (size_t) len; i += strlen (&list[i]) + 1)
+    n++;
+  names = malloc (n * sizeof (char *));
+  if (names == NULL) {
+    perror ("malloc");
+    return -1;
+  }
+  for (i = 0, n = 0; i < (size_t) len; i += strlen (&list[i]) + 1)
+    names[n++] = &list[i];
+  qsort (names, n, sizeof (char *), compare_names);
+
+  for (i = 0; i < n; ++i) {
+    guestfs_int_walk_entry entry = { .we_path = (char *) "",
+                                     .we_link = (char *) "" };
+    CLEANUP_FREE char *val = NULL;
+
+    vlen = lgetxattr (path, names[i], NULL, 0);
+    if (vlen == -1) {
+      perror (path);
+      return -1;
+    }
+    if (vlen > XATTR_SIZE_MAX) {
+      fprintf (stderr, "%s: extended attribute is too large\n", path);
+      return -1;
+    }
+    val = malloc (vlen > 0 ? vlen : 1);
+    if (val == NULL) {
+      perror ("malloc");
+      return -1;
+    }
+    vlen = lgetxattr (path, names[i], val, vlen);
+    if (vlen == -1) {
+      perror (path);
+      return -1;
+    }
+
+    entry.we_attrname = names[i];
+    entry.we_attrval.we_attrval_val = val;
+    entry.we_attrval.we_attrval_len = vlen;
+    r = send_entry (out, &entry);
+    if (r < 0)
+      return r;
+  }
+
+  return 0;
+}
+#endif /* HAVE_WALK_XATTRS */
+
+/* List siblings in the same order as guestfs_ls. */
+static int
+compare_ents (const FTSENT **e1, const FTSENT **e2)
+{
+  return strcmp ((*e1)->fts_name, (*e2)->fts_name);
+}
+
+/* Has one FileOut parameter. */
+int
+do_internal_walk (const char *dir)
+{
+  struct stat statbuf;
+  CLEANUP_FREE char *sysrootdir = NULL;
+  CLEANUP_FREE char *buf = NULL, *xdrbuf = NULL;
+  struct walk_output out;
+  char *fts_argv[2];
+  FTS *fts;
+  FTSENT *ent;
+  size_t rootlen, dirlen;
+  int r = 0;
+
+  /* The top directory may be a symlink (eg. /lib -> usr/lib), so it
+   * is resolved in the chroot.  Only the entries below it are
+   * listed without following symlinks.
+   */
+  sysrootdir = sysroot_realpath (dir);
+  if (!sysrootdir) {
+    reply_with_perror ("%s", dir);
+    return -1;
+  }
+  rootlen = strlen (sysrootdir);
+  while (rootlen > sysroot_len && sysrootdir[rootlen-1] == '/')
+    sysrootdir[--rootlen] = '\0';
+
+  if (stat (sysrootdir, &statbuf) == -1) {
+    reply_with_perror ("%s", dir);
+    return -1;
+  }
+  if (!S_ISDIR (statbuf.st_mode)) {
+    reply_with_error ("%s: not a directory", dir);
+    return -1;
+  }
+
+  buf = malloc (chunk_size);
+  xdrbuf = malloc (chunk_size);
+  if (buf == NULL || xdrbuf == NULL) {
+    reply_with_perror ("malloc");
+    return -1;
+  }
+  out.buf = buf;
+  out.len = 0;
+  out.xdrbuf = xdrbuf;
+
+  /* Paths below the top directory are sent with the name the caller
+   * used as a prefix, so "/" becomes "" and trailing slashes are
+   * dropped.
+   */
+  dirlen = strlen (dir);
+  while (dirlen > 0 && dir[dirlen-1] == '/')
+    dirlen--;
+
+  /* The walk is physical (symlinks are not followed), and visits
+   * each directory before its contents, like guestfs_find.
+   */
+  fts_argv[0] = sysrootdir;
+  fts_argv[1] = NULL;
+  fts = fts_open (fts_argv, FTS_PHYSICAL|FTS_NOCHDIR, compare_ents);
+  if (fts == NULL) {
+    reply_with_perror ("fts_open: %s", dir);
+    return -1;
+  }
+
+  /* Now we must send the reply message, before the file contents.  After
+   * this there is no opportunity in the protocol to send any error
+   * message back.  Instead we can only cancel the transfer.
+   */
+  reply (NULL, NULL);
+
+  while (r == 0 && (ent = fts_read (fts)) != NULL) {
+    guestfs_int_walk_entry entry = { .we_attrname = (char *) "" };
+    CLEANUP_FREE char *link = NULL, *path = NULL;
+
+    switch (ent->fts_info) {
+    case FTS_DP:                /* Directory, in postorder. */
+      continue;
+    case FTS_DNR:
+    case FTS_ERR:
+    case FTS_NS:
+      fprintf (stderr, "%s: %s\n", ent->fts_path, strerror (ent->fts_errno));
+      r = -1;
+      continue;
+    }
+
+    /* Paths are sent as the library sees them, under the top
+     * directory as the caller named it.
+     */
+    if (ent->fts_level == FTS_ROOTLEVEL)
+      entry.we_path = (char *) dir;
+    else {
+      if (asprintf (&path, "%.*s%s",
+                    (int) dirlen, dir, ent->fts_path + rootlen) == -1) {
+        perror ("asprintf");
+        r = -1;
+        continue;
+      }
+      entry.we_path = path;
+    }
+    stat_to_walk_entry (&entry, ent->fts_statp);
+
+    if (S_ISLNK (ent->fts_statp->st_mode)) {
+      link = areadlink (ent->fts_accpath);
+      if (link == NULL) {
+        perror (ent->fts_path);
+        r = -1;
+        continue;
+      }
+      entry.we_link = link;
+    }
+    else
+      entry.we_link = (char *) "";
+
+    r = send_entry (&out, &entry);
+#ifdef HAVE_WALK_XATTRS
+    if (r == 0)
+      r = send_xattrs (&out, ent->fts_accpath);
+#endif
+  }
+
+  if (r == 0 && errno != 0 && ent == NULL) {
+    perror ("fts_read");
+    r = -1;
+  }
+  fts_close (fts);
+
+  if (r == -2)                  /* send_file_write has cancelled. */
+    return -1;
+  if (r == 0 && out.len > 0 && send_file_write (out.buf, out.len) < 0)
+    return -1;
+  if (r == -1) {
+    send_file_end (1);          /* Cancel. */
+    return -1;
+  }
+
+  if (send_file_end (0))        /* Normal end of file. */
+    return -1;
+
+  return 0;
+}
@@ -21,10 +21,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <stdbool.h>
+#include <limits.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/statvfs.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
 
 #include "ignore-value.h"
 
@@ -134,6 +144,142 @@ do_wipefs (const char *device)
   return 0;
 }
 
+/* Read an integer attribute from the request queue of the block
+ * device dev in sysfs.  Partitions don't have a queue directory, so
+ * try the parent device as well.  Returns -1 if the attribute can't
+ * be read.
+ */
+static int64_t
+read_queue_attr (dev_t dev, const char *attr)
+{
+  static const char *const fmts[] = {
+    "/sys/dev/block/%u:%u/queue/%s",
+    "/sys/dev/block/%u:%u/../queue/%s",
+  };
+  char path[PATH_MAX];
+  FILE *fp;
+  int64_t r;
+  size_t i;
+
+  for (i = 0; i < sizeof fmts / sizeof fmts[0]; ++i) {
+    snprintf (path, sizeof path, fmts[i], major (dev), minor (dev), attr);
+    fp = fopen (path, "re");
+    if (fp == NULL)
+      continue;
+    if (fscanf (fp, "%" SCNi64, &r) != 1)
+      r = -1;
+    fclose (fp);
+    return r;
+  }
+
+  return -1;
+}
+
+/* Ways of zeroing a range of a block device in the kernel. */
+enum zero_method {
+  ZERO_PUNCH_HOLE,              /* fallocate (FALLOC_FL_PUNCH_HOLE) */
+  ZERO_ZEROOUT,                 /* ioctl (BLKZEROOUT) */
+};
+
+static int
+zero_range (int fd, enum zero_method method, uint64_t offset, uint64_t len)
+{
+  switch (method) {
+  case ZERO_PUNCH_HOLE:
+#ifdef FALLOC_FL_PUNCH_HOLE
+    return fallocate (fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+                      offset, len);
+#else
+    break;
+#endif
+  case ZERO_ZEROOUT:
+#ifdef BLKZEROOUT
+    {
+      uint64_t range[2] = { offset, len };
+      return ioctl (fd, BLKZEROOUT, range);
+    }
+#else
+    break;
+#endif
+  }
+
+  errno = EOPNOTSUPP;
+  return -1;
+}
+
+/* Size of each request, so that we can send progress messages and
+ * notice cancellation.
+ */
+#define ZERO_RANGE_SIZE (UINT64_C(1024) * 1024 * 1024)
+
+/* Zero the whole device using zero_range.  Returns 0 on success, 1
+ * if the method isn't supported so the caller has to write zeroes
+ * instead, or -1 on error (the reply has been sent).
+ */
+static int
+zero_device_range (int fd, const char *device,
+                   enum zero_method method, const char *method_name,
+                   uint64_t size)
+{
+  uint64_t len, pos = 0;
+
+  while (pos < size) {
+    if (cancel_requested ()) {
+      reply_with_error_errno (EINTR, "operation cancelled by user");
+      return -1;
+    }
+
+    len = MIN (size - pos, ZERO_RANGE_SIZE);
+    if (zero_range (fd, method, pos, len) == -1) {
+      if (pos == 0 &&
+          (errno == EOPNOTSUPP || errno == ENOTTY || errno == EINVAL))
+        return 1;
+      reply_with_perror ("%s: %s", method_name, device);
+      return -1;
+    }
+    pos += len;
+
+    notify_progress (pos, size);
+  }
+
+  return 0;
+}
+
+/* Try to zero the device without writing zeroes to it.  Punching a
+ * hole in a block device deallocates the blocks if the device can
+ * guarantee that they then read back as zeroes, which keeps it
+ * sparse, and otherwise fails without writing anything.  If that
+ * fails but the device can zero blocks itself (WRITE ZEROES) we let
+ * the kernel offload it with BLKZEROOUT.  Without hardware support
+ * BLKZEROOUT just writes zeroes, which would make the device
+ * non-sparse, so it isn't used in that case.
+ *
+ * Returns 0 on success, 1 if the caller has to write zeroes, or -1
+ * on error (the reply has been sent).
+ */
+static int
+zero_device_offload (int fd, const char *device, uint64_t size)
+{
+  struct stat statbuf;
+  int r;
+
+  if (fstat (fd, &statbuf) == -1 || !S_ISBLK (statbuf.st_mode))
+    return 1;
+
+  r = zero_device_range (fd, device, ZERO_PUNCH_HOLE, "fallocate", size);
+  if (r <= 0)
+    return r;
+
+  if (read_queue_attr (statbuf.st_rdev, "write_zeroes_max_bytes") > 0) {
+    r = zero_device_range (fd, device, ZERO_ZEROOUT, "ioctl: BLKZEROOUT",
+                           size);
+    if (r <= 0)
+      return r;
+  }
+
+  return 1;
+}
+
 int
 do_zero_device (const char *device)
 {
@@ -148,6 +294,18 @@ do_zero_device (const char *device)
     return -1;
   }
 
+  switch (zero_device_offload (fd, device, size)) {
+  case 0:
+    if (close (fd) == -1) {
+      reply_with_perror ("close: %s", device);
+      return -1;
+    }
+    return 0;
+  case -1:
+    close (fd);
+    return -1;
+  }
+
   char buf[sizeof zero_buf];
 
   uint64_t pos = 0;
@@ -155,6 +313,13 @@ do_zero_device (const char *device)
   while (pos < size) {
     uint64_t n64 = size - pos;
     size_t n;
+
+    if (cancel_requested ()) {
+      reply_with_error_errno (EINTR, "operation cancelled by user");
+      close (fd);
+      return -1;
+    }
+
     if (n64 > sizeof buf)
       n = sizeof buf;
     else
@@ -169,7 +334,7 @@ do_zero_device (const char *device)
       return -1;
     }
 
-    if (!is_zero (buf, sizeof buf)) {
+    if (!is_zero (buf, n)) {
       r = pwrite (fd, zero_buf, n, pos);
       if (r == -1) {
         reply_with_perror ("pwrite: %s (with %" PRIu64 " bytes left to write)",
@@ -193,19 +358,82 @@ do_zero_device (const char *device)
   return 0;
 }
 
-int
-do_is_zero (const char *path)
+/* Size of the buffer used to scan for non-zero data. */
+#define IS_ZERO_BUFFER_SIZE (1024 * 1024)
+
+/* Return 1 if everything that can be read from fd is zero, 0 if not,
+ * or -1 on error (the reply has been sent).
+ *
+ * Holes can only contain zeroes, so where the kernel can tell us
+ * about them (SEEK_DATA/SEEK_HOLE) only the allocated ranges are
+ * read.  For block devices the kernel reports a single data range
+ * covering the whole device.  If fd can't be seeked at all (eg. a
+ * pipe or character device) it is simply read to the end.
+ */
+static int
+is_zero_fd (int fd, const char *name)
 {
-  int fd;
   CLEANUP_FREE char *buf = NULL;
+  off_t pos = 0, data_end = 0;
+  size_t n;
   ssize_t r;
+  const bool seekable = lseek (fd, 0, SEEK_CUR) != -1;
 
-  buf = malloc (BUFSIZ);
+  if (!seekable)
+    data_end = -1;
+
+  buf = malloc (IS_ZERO_BUFFER_SIZE);
   if (buf == NULL) {
     reply_with_perror ("malloc");
     return -1;
   }
 
+  for (;;) {
+    if (cancel_requested ()) {
+      reply_with_error_errno (EINTR, "operation cancelled by user");
+      return -1;
+    }
+
+    n = IS_ZERO_BUFFER_SIZE;
+
+#ifdef SEEK_DATA
+    if (data_end != -1 && pos >= data_end) {
+      const off_t data = lseek (fd, pos, SEEK_DATA);
+
+      if (data == -1 && errno == ENXIO) /* only holes after pos */
+        return 1;
+      if (data >= 0) {
+        pos = data;
+        data_end = lseek (fd, data, SEEK_HOLE);
+      }
+      else
+        data_end = -1;          /* not supported, read everything */
+    }
+    if (data_end != -1 && (off_t) n > data_end - pos)
+      n = data_end - pos;
+#endif
+
+    if (seekable)
+      r = pread (fd, buf, n, pos);
+    else
+      r = read (fd, buf, n);
+    if (r == -1) {
+      reply_with_perror ("read: %s", name);
+      return -1;
+    }
+    if (r == 0)
+      return 1;
+    if (!is_zero (buf, r))
+      return 0;
+    pos += r;
+  }
+}
+
+int
+do_is_zero (const char *path)
+{
+  int fd, r;
+
   CHROOT_IN;
   fd = open (path, O_RDONLY|O_CLOEXEC);
   CHROOT_OUT;
@@ -215,15 +443,8 @@ do_is_zero (const char *path)
     return -1;
   }
 
-  while ((r = read (fd, buf, BUFSIZ)) > 0) {
-    if (!is_zero (buf, r)) {
-      close (fd);
-      return 0;
-    }
-  }
-
+  r = is_zero_fd (fd, path);
   if (r == -1) {
-    reply_with_perror ("read: %s", path);
     close (fd);
     return -1;
   }
@@ -233,21 +454,13 @@ do_is_zero (const char *path)
     return -1;
   }
 
-  return 1;
+  return r;
 }
 
 int
 do_is_zero_device (const char *device)
 {
-  int fd;
-  CLEANUP_FREE char *buf = NULL;
-  ssize_t r;
-
-  buf = malloc (BUFSIZ);
-  if (buf == NULL) {
-    reply_with_perror ("malloc");
-    return -1;
-  }
+  int fd, r;
 
   fd = open (device, O_RDONLY|O_CLOEXEC);
   if (fd == -1) {
@@ -255,15 +468,8 @@ do_is_zero_device (const char *device)
     return -1;
   }
 
-  while ((r = read (fd, buf, BUFSIZ)) > 0) {
-    if (!is_zero (buf, r)) {
-      close (fd);
-      return 0;
-    }
-  }
-
+  r = is_zero_fd (fd, device);
   if (r == -1) {
-    reply_with_perror ("read: %s", device);
     close (fd);
     return -1;
   }
@@ -273,17 +479,19 @@ do_is_zero_device (const char *device)
     return -1;
   }
 
-  return 1;
+  return r;
 }
 
 /* Current implementation is to create a file of all zeroes, then
- * delete it.  The description of this function is left open in order
- * to allow better implementations in future, including
+ * delete it.  The description of this function is left
+ * open in order to allow better implementations in future, including
  * sparsification.
- */
-/* XXX This function really should be cancellable (for the benefit of
- * virt-sparsify).  However currently the library can only handle
- * cancellation for FileIn/FileOut operations.
+ *
+ * Unlike zero_device, the zeroes really have to be written here.
+ * fallocate (FALLOC_FL_ZERO_RANGE) on a file only allocates unwritten
+ * extents, leaving the old data on the device, and since Linux 4.12
+ * nothing tells us whether free space trimmed with FITRIM reads back
+ * as zeroes.
  */
 int
 do_zero_free_space (const char *dir)
@@ -328,6 +536,13 @@ do_zero_free_space (const char *dir)
   bfree_initial = statbuf.f_bfree;
 
   for (;;) {
+    if (cancel_requested ()) {
+      reply_with_error_errno (EINTR, "operation cancelled by user");
+      close (fd);
+      unlink (filename);
+      return -1;
+    }
+
     if (write (fd, zero_buf, sizeof zero_buf) == -1) {
       if (errno == ENOSPC)      /* expected error */
         break;
@@ -406,6 +406,7 @@ struct file {
   char *path;
   struct guestfs_statns *stat;
   struct guestfs_xattr_list *xattrs;
+  char *link;                  /* Symlink target, or NULL. */
   char *csum;                  /* Checksum. If NULL, use file times and size. */
 };
 
@@ -418,6 +419,7 @@ free_tree (struct tree *t)
     free (t->files[i].path);
     guestfs_free_statns (t->files[i].stat);
     guestfs_free_xattr_list (t->files[i].xattrs);
+    free (t->files[i].link);
     free (t->files[i].csum);
   }
 
@@ -426,7 +428,8 @@ free_tree (struct tree *t)
   free (t);
 }
 
-static int visit_entry (const char *dir, const char *name, const struct guestfs_statns *stat, const struct guestfs_xattr_list *xattrs, void *vt);
+static int visit_entry (const char *dir, const char *name, const struct guestfs_statns *stat, const struct guestfs_xattr_list *xattrs, const char *link, void *vt);
+static int checksum_tree (struct tree *t);
 
 static struct tree *
 visit_guest (guestfs_h *g)
@@ -447,6 +450,11 @@ visit_guest (guestfs_h *g)
     return NULL;
   }
 
+  if (checksum && checksum_tree (t) == -1) {
+    free_tree (t);
+    return NULL;
+  }
+
   if (verbose)
     fprintf (stderr, "read %zu entries from guest\n", t->nr_files);
 
@@ -462,12 +470,14 @@ static int
 visit_entry (const char *dir, const char *name,
              const struct guestfs_statns *stat_orig,
              const struct guestfs_xattr_list *xattrs_orig,
+             const char *link_orig,
              void *vt)
 {
   struct tree *t = vt;
-  char *path = NULL, *csum = NULL;
+  char *path = NULL;
   struct guestfs_statns *stat = NULL;
   struct guestfs_xattr_list *xattrs = NULL;
+  char *link = NULL;
   size_t i;
 
   path = full_path (dir, name);
@@ -485,11 +495,12 @@ visit_entry (const char *dir, const char *name,
     perror ("guestfs_copy_xattr_list");
     goto error;
   }
-
-  if (checksum && is_reg (stat->st_mode)) {
-    csum = guestfs_checksum (t->g, checksum, path);
-    if (!csum)
+  if (link_orig) {
+    link = strdup (link_orig);
+    if (link == NULL) {
+      perror ("strdup");
       goto error;
+    }
   }
 
   /* If --atime option was NOT passed, flatten the atime field. */
@@ -535,18 +546,80 @@ visit_entry (const char *dir, const char *name,
   t->files[i].path = path;
   t->files[i].stat = stat;
   t->files[i].xattrs = xattrs;
-  t->files[i].csum = csum;
+  t->files[i].link = link;
+  t->files[i].csum = NULL;
 
   return 0;
 
  error:
   free (path);
-  free (csum);
   guestfs_free_statns (stat);
   guestfs_free_xattr_list (xattrs);
+  free (link);
   return -1;
 }
 
+/* Compute the checksums of the regular files in the tree.  Rather
+ * than making one call per file, the files in each directory are
+ * checksummed by a single call to guestfs_checksumlist, which the
+ * daemon processes in parallel.
+ */
+static int
+checksum_tree (struct tree *t)
+{
+  size_t i, j, k, dirlen;
+  const char *path;
+  char *dir;
+  char **names, **csums;
+
+  i = 0;
+  while (i < t->nr_files) {
+    if (!is_reg (t->files[i].stat->st_mode)) {
+      i++;
+      continue;
+    }
+
+    /* Find the run of regular files in the same directory. */
+    path = t->files[i].path;
+    dirlen = strrchr (path, '/') - path;
+    for (j = i+1; j < t->nr_files; ++j) {
+      const char *p = t->files[j].path;
+
+      if (!is_reg (t->files[j].stat->st_mode) ||
+          (size_t) (strrchr (p, '/') - p) != dirlen ||
+          STRNEQLEN (p, path, dirlen))
+        break;
+    }
+
+    dir = dirlen == 0 ? strdup ("/") : strndup (path, dirlen);
+    names = malloc ((j-i+1) * sizeof (char *));
+    if (dir == NULL || names == NULL) {
+      perror ("malloc");
+      free (dir);
+      free (names);
+      return -1;
+    }
+    for (k = i; k < j; ++k)
+      names[k-i] = t->files[k].path + dirlen + 1;
+    names[j-i] = NULL;
+
+    csums = guestfs_checksumlist (t->g, checksum, dir, names);
+    free (dir);
+    free (names);
+    if (csums == NULL)
+      return -1;
+
+    /* The tree takes ownership of the strings. */
+    for (k = i; k < j; ++k)
+      t->files[k].csum = csums[k-i];
+    free (csums);
+
+    i = j;
+  }
+
+  return 0;
+}
+
 static void deleted (guestfs_h *, struct file *);
 static void added (guestfs_h *, struct file *);
 static int compare_stats (struct file *, struct file *);
@@ -752,7 +825,6 @@ output_file (guestfs_h *g, struct file *file)
 {
   const char *filetype;
   size_t i;
-  CLEANUP_FREE char *link = NULL;
 
   if (is_reg (file->stat->st_mode))
     filetype = "-";
@@ -802,12 +874,8 @@ output_file (guestfs_h *g, struct file *file)
 
   output_string (file->path);
 
-  if (is_lnk (file->stat->st_mode)) {
-    /* XXX Fix this for NTFS. */
-    link = guestfs_readlink (g, file->path);
-    if (link)
-      output_string_link (link);
-  }
+  if (file->link)
+    output_string_link (file->link);
 
   if (enable_xattrs) {
     for (i = 0; i < file->xattrs->len; ++i) {
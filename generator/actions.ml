@@ -35,6 +35,7 @@ let defaults = { name = "";
                  progress = false; camel_name = "";
                  cancellable = false; config_only = false;
                  once_had_no_optargs = false; blocking = true; wrapper = true;
+                 batchable = false; read_only = false; concurrent = false;
                  c_name = ""; c_function = ""; c_optarg_prefix = "";
                  non_c_aliases = [] }
 
@@ -1364,6 +1365,12 @@ This returns the enable network flag." };
   { defaults with
     name = "list_filesystems"; added = (1, 5, 15);
     style = RHashtable "fses", [], [];
+    tests = [
+      InitBasicFSonLVM, Always, TestResult (
+        [["list_filesystems"]],
+        "check_hash (ret, \"/dev/VG/LV\", \"ext2\") == 0 && "^
+        "get_key (ret, \"/dev/sda1\") == NULL"), []
+    ];
     shortdesc = "list filesystems";
     longdesc = "\
 This inspection command looks for filesystems on partitions,
@@ -2560,7 +2567,28 @@ or C<guestfs_download> functions." };
         [["mkdir_p"; "/find/b/c"];
          ["touch"; "/find/b/c/d"];
          ["find"; "/find/b/"]],
-        "is_string_list (ret, 2, \"c\", \"c/d\")"), []
+        "is_string_list (ret, 2, \"c\", \"c/d\")"), [];
+      InitScratchFS, Always, TestResult (
+        [["mkdir_p"; "/find2/a"];
+         ["mkdir_p"; "/find2/b"];
+         ["mkdir_p"; "/find2/c"];
+         ["fill_dir"; "/find2/a"; "1000"];
+         ["fill_dir"; "/find2/b"; "1000"];
+         ["fill_dir"; "/find2/c"; "1000"];
+         ["find"; "/find2"]],
+        "STREQ (ret[0], \"a\") && "^
+        "STREQ (ret[1], \"a/00000000\") && "^
+        "STREQ (ret[1000], \"a/00000999\") && "^
+        "STREQ (ret[1001], \"b\") && "^
+        "STREQ (ret[2002], \"c\") && "^
+        "STREQ (ret[3002], \"c/00000999\") && "^
+        "ret[3003] == NULL"), [];
+      InitScratchFS, Always, TestResult (
+        [["mkdir_p"; "/find3/d/e"];
+         ["touch"; "/find3/d/e/f"];
+         ["ln_s"; "d"; "/find3/l"];
+         ["find"; "/find3"]],
+        "is_string_list (ret, 4, \"d\", \"d/e\", \"d/e/f\", \"l\")"), []
     ];
     shortdesc = "find all files and directories";
     longdesc = "\
@@ -2795,6 +2823,195 @@ symbolic links already (albeit slightly less efficient).
 This call is intended for programs that want to efficiently
 list a directory contents without making many round-trips." };
 
+  { defaults with
+    name = "checksumlist"; added = (1, 35, 15);
+    style = RStringList "checksums", [String "csumtype"; Pathname "path"; FilenameList "names"], [];
+    tests = [
+      InitScratchFS, Always, TestResult (
+        [["mkdir"; "/checksumlist"];
+         ["write"; "/checksumlist/a"; "hello"];
+         ["touch"; "/checksumlist/b"];
+         ["checksumlist"; "md5"; "/checksumlist"; "a b"]],
+        "is_string_list (ret, 2, \"5d41402abc4b2a76b9719d911017c592\", \"d41d8cd98f00b204e9800998ecf8427e\")"), [];
+      InitScratchFS, Always, TestLastFail (
+        [["mkdir"; "/checksumlist2"];
+         ["mkdir"; "/checksumlist2/dir"];
+         ["checksumlist"; "md5"; "/checksumlist2"; "dir"]]), [];
+      InitScratchFS, Always, TestResult (
+        [["mkdir"; "/checksumlist3"];
+         ["write"; "/checksumlist3/a"; "hello"];
+         ["touch"; "/checksumlist3/b"];
+         ["checksumlist"; "md5"; "/checksumlist3"; "b a b"]],
+        "is_string_list (ret, 3, \"d41d8cd98f00b204e9800998ecf8427e\", \"5d41402abc4b2a76b9719d911017c592\", \"d41d8cd98f00b204e9800998ecf8427e\")"), [];
+      InitScratchFS, Always, TestLastFail (
+        [["mkdir"; "/checksumlist4"];
+         ["mkdir"; "/checksumlist4/dir"];
+         ["touch"; "/checksumlist4/dir/a"];
+         ["checksumlist"; "md5"; "/checksumlist4"; "dir/a"]]), [];
+      InitScratchFS, Always, TestLastFail (
+        [["mkdir"; "/checksumlist5"];
+         ["write"; "/checksumlist5/a"; "hello"];
+         ["ln_s"; "a"; "/checksumlist5/b"];
+         ["checksumlist"; "md5"; "/checksumlist5"; "b"]]), []
+    ];
+    shortdesc = "compute checksums of multiple files";
+    longdesc = "\
+This call computes the checksums of multiple files, where
+all files are in the directory C<path>.  C<names> is the
+list of files from this directory.  C<csumtype> is the type
+of checksum, see C<guestfs_checksum>.
+
+On return you get a list of strings, with a one-to-one
+correspondence to the C<names> list.  Each string is the
+checksum of the corresponding file.
+
+Every name must be a regular file: symbolic links are not
+followed.  If any file cannot be checksummed then the whole
+call fails.
+
+The files are checksummed in parallel, using all of the
+appliance vCPUs (see C<guestfs_set_smp>).  This call is intended
+for programs that want to checksum many files without making
+many round-trips." };
+
+  { defaults with
+    name = "download_changed_blocks"; added = (1, 35, 15);
+    style = RErr, [Dev_or_Path "device"; String "manifest"; String "filename"], [OString "newmanifest"];
+    progress = true; cancellable = true;
+    tests = [
+      InitScratchFS, Always, TestResultTrue (
+        [["fill"; "0"; "200000"; "/download_changed_blocks_zero"];
+         ["block_hash_manifest"; "/download_changed_blocks_zero"; "testmanifest0.tmp"; ""; "NOARG"];
+         ["fill"; "65"; "200000"; "/download_changed_blocks"];
+         ["download_changed_blocks"; "/download_changed_blocks"; "testmanifest0.tmp"; "testblocks.tmp"; "testmanifest1.tmp"];
+         ["pwrite"; "/download_changed_blocks"; "BBBB"; "70000"];
+         ["download_changed_blocks"; "/download_changed_blocks"; "testmanifest1.tmp"; "testblocks.tmp"; "NOARG"];
+         ["upload"; "testblocks.tmp"; "/download_changed_blocks_copy"];
+         ["equal"; "/download_changed_blocks"; "/download_changed_blocks_copy"]]), [];
+      (* Blocks which have become zero. *)
+      InitScratchFS, Always, TestResultTrue (
+        [["fill"; "0"; "200000"; "/download_changed_blocks_zeroed"];
+         ["block_hash_manifest"; "/download_changed_blocks_zeroed"; "testmanifest4.tmp"; ""; "NOARG"];
+         ["fill"; "65"; "200000"; "/download_changed_blocks_zeroed"];
+         ["download_changed_blocks"; "/download_changed_blocks_zeroed"; "testmanifest4.tmp"; "testblocks2.tmp"; "testmanifest5.tmp"];
+         ["truncate_size"; "/download_changed_blocks_zeroed"; "70000"];
+         ["truncate_size"; "/download_changed_blocks_zeroed"; "200000"];
+         ["download_changed_blocks"; "/download_changed_blocks_zeroed"; "testmanifest5.tmp"; "testblocks2.tmp"; "NOARG"];
+         ["upload"; "testblocks2.tmp"; "/download_changed_blocks_zeroed_copy"];
+         ["equal"; "/download_changed_blocks_zeroed"; "/download_changed_blocks_zeroed_copy"]]), [];
+      (* The device has shrunk.  The new manifest replaces the old one
+       * each time, and the last call has nothing to download.
+       *)
+      InitScratchFS, Always, TestResultTrue (
+        [["fill"; "0"; "200000"; "/download_changed_blocks_shrunk"];
+         ["block_hash_manifest"; "/download_changed_blocks_shrunk"; "testmanifest6.tmp"; ""; "NOARG"];
+         ["fill"; "65"; "200000"; "/download_changed_blocks_shrunk"];
+         ["download_changed_blocks"; "/download_changed_blocks_shrunk"; "testmanifest6.tmp"; "testblocks3.tmp"; "testmanifest6.tmp"];
+         ["truncate_size"; "/download_changed_blocks_shrunk"; "100000"];
+         ["download_changed_blocks"; "/download_changed_blocks_shrunk"; "testmanifest6.tmp"; "testblocks3.tmp"; "testmanifest6.tmp"];
+         ["download_changed_blocks"; "/download_changed_blocks_shrunk"; "testmanifest6.tmp"; "testblocks3.tmp"; "testmanifest6.tmp"];
+         ["upload"; "testblocks3.tmp"; "/download_changed_blocks_shrunk_copy"];
+         ["equal"; "/download_changed_blocks_shrunk"; "/download_changed_blocks_shrunk_copy"]]), []
+    ];
+    shortdesc = "download only the blocks which have changed";
+    longdesc = "\
+Update the local file C<filename> so that it is a copy of the
+file or device C<device>, downloading only the blocks which have
+changed.
+
+C<manifest> is a local file containing a manifest created by
+C<guestfs_block_hash_manifest>, which must describe the current
+contents of C<filename>.  (If C<filename> does not exist, it is
+created, and then C<manifest> should describe a device containing
+only zeroes.)  A new manifest is computed for C<device> using the
+same block size and checksum type, and only the blocks whose
+checksums are different are downloaded and written to C<filename>.
+Blocks which have become zero are zeroed (if possible, by punching
+holes) in C<filename>, and C<filename> is truncated or extended to
+the size of C<device>.
+
+If the optional C<newmanifest> parameter is given, then the new
+manifest is saved to this local file, ready for the next call.
+
+This can be used to make incremental backups of guest disks.
+Note that C<device> must not be modified during the call." };
+
+  { defaults with
+    name = "walk"; added = (1, 35, 15);
+    style = RStructList ("entries", "walk_entry"), [Pathname "directory"], [];
+    cancellable = true;
+    tests = [
+      InitScratchFS, Always, TestResult (
+        [["mkdir"; "/walk"];
+         ["touch"; "/walk/b"];
+         ["ln_s"; "b"; "/walk/a"];
+         ["mkdir"; "/walk/c"];
+         ["touch"; "/walk/c/d"];
+         ["walk"; "/walk"]],
+        "ret->len == 5 && "^
+        "STREQ (ret->val[0].we_path, \"/walk\") && "^
+        "STREQ (ret->val[1].we_path, \"/walk/a\") && "^
+        "STREQ (ret->val[1].we_link, \"b\") && "^
+        "STREQ (ret->val[2].we_path, \"/walk/b\") && "^
+        "STREQ (ret->val[3].we_path, \"/walk/c\") && "^
+        "STREQ (ret->val[4].we_path, \"/walk/c/d\")"), [];
+      InitScratchFS, Always, TestResult (
+        [["mkdir"; "/walk2"];
+         ["touch"; "/walk2/c"];
+         ["mkdir"; "/walk2/a"];
+         ["touch"; "/walk2/a/z"];
+         ["touch"; "/walk2/b"];
+         ["walk"; "/walk2"]],
+        "ret->len == 5 && "^
+        "STREQ (ret->val[1].we_path, \"/walk2/a\") && "^
+        "S_ISDIR (ret->val[1].we_st_mode) && "^
+        "STREQ (ret->val[2].we_path, \"/walk2/a/z\") && "^
+        "S_ISREG (ret->val[2].we_st_mode) && "^
+        "STREQ (ret->val[3].we_path, \"/walk2/b\") && "^
+        "STREQ (ret->val[4].we_path, \"/walk2/c\")"), [];
+      InitScratchFS, Always, TestResult (
+        [["mkdir_p"; "/walk3/real"];
+         ["touch"; "/walk3/real/x"];
+         ["ln_s"; "real"; "/walk3/link"];
+         ["walk"; "/walk3/link"]],
+        "ret->len == 2 && "^
+        "STREQ (ret->val[0].we_path, \"/walk3/link\") && "^
+        "STREQ (ret->val[1].we_path, \"/walk3/link/x\")"), [];
+      InitScratchFS, Always, TestResult (
+        [["mkdir"; "/walk4"];
+         ["fill_dir"; "/walk4"; "3000"];
+         ["walk"; "/walk4"]],
+        "ret->len == 3001 && "^
+        "STREQ (ret->val[1].we_path, \"/walk4/00000000\") && "^
+        "STREQ (ret->val[3000].we_path, \"/walk4/00002999\")"), []
+    ];
+    shortdesc = "list a directory tree with stats and extended attributes";
+    longdesc = "\
+This walks the directory tree starting at C<directory>, and returns
+one entry for C<directory> itself and for every file and directory
+under it.  Symbolic links below C<directory> are not followed, but
+if C<directory> itself is a symbolic link to a directory then the
+directory it points to is walked.  Entries are returned in the same
+order as a recursive C<guestfs_ls>: each directory comes before its
+contents, and entries in the same directory are sorted by name.
+
+For each file, C<we_path> is the full path, the C<we_st_*> fields
+are the same as the fields returned by C<guestfs_lstatns>, and
+C<we_link> is the target of the symbolic link (or an empty string
+if the file is not a symbolic link).  C<we_attrname> is an empty
+string.
+
+Each file entry is followed by one entry for each of its extended
+attributes (see C<guestfs_lgetxattrs>).  These entries have
+C<we_attrname> and C<we_attrval> set to the name and value of the
+attribute, and the other fields are empty or zero.
+
+The whole tree is listed by the appliance and returned in a single
+call.  This is intended for programs such as L<virt-ls(1)> and
+L<virt-diff(1)> which would otherwise make several calls for each
+directory (C<guestfs_ls>, C<guestfs_lstatnslist>,
+C<guestfs_lxattrlist>, C<guestfs_readlink>)." };
+
   { defaults with
     name = "ls"; added = (0, 0, 4);
     style = RStringList "listing", [Pathname "directory"], [];
@@ -3131,6 +3348,14 @@ L</guestfs_last_errno>) is set to C<EINTR>, so you can test for this
 to find out if the operation was cancelled or failed because of
 another error.
 
+Some other long-running calls can also be cancelled this way, in
+which case they return an error with errno set to C<EINTR> too.
+These include C<guestfs_copy_device_to_device> (and the other copy
+calls), C<guestfs_zero_device>, C<guestfs_zero_free_space>,
+C<guestfs_fill>, C<guestfs_fill_pattern>, C<guestfs_checksum>,
+C<guestfs_checksum_device> and C<guestfs_fstrim>.  Calls which don't
+support cancellation run to completion as before.
+
 No cleanup is performed: for example, if a file was being uploaded
 then after cancellation there may be a partially uploaded file.  It is
 the caller's responsibility to clean up if necessary.
@@ -3729,6 +3954,151 @@ Searches all the entries associated with the given inode.
 For each entry, a C<tsk_dirent> structure is returned.
 See C<filesystem_walk> for more information about C<tsk_dirent> structures." };
 
+  { defaults with
+    name = "set_pipeline_depth"; added = (1, 35, 15);
+    style = RErr, [Int "depth"], [];
+    fish_alias = ["pipeline-depth"];
+    blocking = false;
+    shortdesc = "set the maximum number of requests in flight";
+    longdesc = "\
+Set the maximum number of requests that the library may send to
+the appliance before it starts reading the replies.
+
+Some calls (for example C<guestfs_lstatnslist>,
+C<guestfs_lxattrlist> and C<guestfs_readlinklist>) are split
+by the library into many smaller requests.  With the default
+C<depth> of C<1> each request waits for the previous reply, so
+every request pays a full round trip to the appliance.  Setting
+C<depth> greater than C<1> allows those requests to be pipelined,
+which can significantly reduce the time taken to scan large
+directories.
+
+C<depth> must be between C<1> and C<64>." };
+
+  { defaults with
+    name = "get_pipeline_depth"; added = (1, 35, 15);
+    style = RInt "depth", [], [];
+    blocking = false;
+    tests = [
+      InitNone, Always, TestResult (
+        [["get_pipeline_depth"]], "ret >= 1"), []
+    ];
+    shortdesc = "get the maximum number of requests in flight";
+    longdesc = "\
+This returns the maximum number of requests that the library may
+send to the appliance before reading the replies.  See
+C<guestfs_set_pipeline_depth>." };
+
+  { defaults with
+    name = "set_transfer_compression"; added = (1, 35, 15);
+    style = RErr, [Bool "compression"], [];
+    fish_alias = ["transfer-compression"]; config_only = true;
+    blocking = false;
+    shortdesc = "compress file transfers to and from the appliance";
+    longdesc = "\
+If C<compression> is true, then the data sent in C<FileIn> and
+C<FileOut> transfers (for example by C<guestfs_upload>,
+C<guestfs_download>, C<guestfs_tar_in> and C<guestfs_tar_out>)
+is compressed with zlib, if both the library and the appliance
+were built with zlib support.  Each chunk of data is compressed
+separately, and chunks which do not compress are sent as they are.
+
+This trades CPU time in the library and the appliance for fewer
+bytes crossing the transport, so it is most useful when the data
+is easily compressible and the transport is slow (for example
+a remote libvirt connection).  The default is false.
+
+If the appliance does not support compression, transfers are
+silently done without it.  This must be called before
+C<guestfs_launch>." };
+
+  { defaults with
+    name = "get_transfer_compression"; added = (1, 35, 15);
+    style = RBool "compression", [], [];
+    blocking = false;
+    tests = [
+      InitNone, Always, TestResultFalse (
+        [["get_transfer_compression"]]), []
+    ];
+    shortdesc = "get the transfer compression flag";
+    longdesc = "\
+This returns the transfer compression flag.  See
+C<guestfs_set_transfer_compression>." };
+
+  { defaults with
+    name = "get_call_stats"; added = (1, 35, 15);
+    style = RStructList ("stats", "call_stat"), [], [];
+    blocking = false;
+    shortdesc = "get per-procedure call statistics";
+    longdesc = "\
+This returns statistics about the calls made from this handle to
+the appliance since the handle was created, or since the last
+call to C<guestfs_reset_call_stats>.  One C<call_stat> structure
+is returned for each procedure which has been called at least once.
+
+The fields are:
+
+=over 4
+
+=item C<cs_proc_nr>
+
+=item C<cs_name>
+
+The procedure number and the name of the call.
+
+=item C<cs_calls>
+
+=item C<cs_errors>
+
+The number of replies received, and how many of those were errors.
+
+=item C<cs_total_usec>
+
+=item C<cs_p50_usec>
+
+=item C<cs_p99_usec>
+
+The total, median and 99th percentile round trip time (from sending
+the request to receiving the reply) in microseconds, as measured
+by the library.  The percentiles are approximate: they are rounded
+up to the next step of a logarithmic histogram.
+
+=item C<cs_bytes_sent>
+
+=item C<cs_bytes_received>
+
+The number of bytes of requests and replies, including the chunks
+of C<FileIn> and C<FileOut> transfers.
+
+=item C<cs_daemon_calls>
+
+=item C<cs_daemon_usec>
+
+The number of times the daemon ran the procedure and the total time
+it spent doing so, in microseconds.  The difference between
+C<cs_total_usec> and C<cs_daemon_usec> is the time spent in the
+transport.  These are zero if the appliance has not been launched.
+
+=back
+
+Some library functions send several calls to the daemon in a single
+C<internal_batch> call.  The library counts these only under
+C<internal_batch>, while the daemon counts each call under its own
+procedure as well as under C<internal_batch>." };
+
+  { defaults with
+    name = "reset_call_stats"; added = (1, 35, 15);
+    style = RErr, [], [];
+    blocking = false;
+    tests = [
+      InitNone, Always, TestRun (
+        [["reset_call_stats"]]), []
+    ];
+    shortdesc = "reset per-procedure call statistics";
+    longdesc = "\
+This clears the statistics returned by C<guestfs_get_call_stats>,
+both in the library and in the appliance." };
+
 ]
 
 (* daemon_functions are any functions which cause some action
@@ -3822,6 +4192,8 @@ is I<not> intended that you try to parse the output string." };
     name = "list_devices"; added = (0, 0, 4);
     style = RStringList "devices", [], [];
     proc_nr = Some 7;
+    read_only = true;
+    concurrent = true;
     tests = [
       InitEmpty, Always, TestResult (
         [["list_devices"]],
@@ -3839,6 +4211,8 @@ See also C<guestfs_list_filesystems>." };
     name = "list_partitions"; added = (0, 0, 4);
     style = RStringList "partitions", [], [];
     proc_nr = Some 8;
+    read_only = true;
+    concurrent = true;
     tests = [
       InitBasicFS, Always, TestResult (
         [["list_partitions"]],
@@ -3849,7 +4223,16 @@ See also C<guestfs_list_filesystems>." };
          ["part_add"; "/dev/sda"; "p"; "204800"; "409599"];
          ["part_add"; "/dev/sda"; "p"; "409600"; "-64"];
          ["list_partitions"]],
-        "is_device_list (ret, 4, \"/dev/sda1\", \"/dev/sda2\", \"/dev/sda3\", \"/dev/sdb1\")"), []
+        "is_device_list (ret, 4, \"/dev/sda1\", \"/dev/sda2\", \"/dev/sda3\", \"/dev/sdb1\")"), [];
+      InitEmpty, Always, TestResult (
+        [["part_init"; "/dev/sda"; "mbr"];
+         ["part_add"; "/dev/sda"; "p"; "64"; "204799"];
+         ["list_partitions"];
+         ["part_add"; "/dev/sda"; "p"; "204800"; "409599"];
+         ["list_partitions"];
+         ["part_del"; "/dev/sda"; "1"];
+         ["list_partitions"]],
+        "is_device_list (ret, 2, \"/dev/sda2\", \"/dev/sdb1\")"), []
     ];
     shortdesc = "list the partitions";
     longdesc = "\
@@ -3866,6 +4249,8 @@ See also C<guestfs_list_filesystems>." };
     name = "pvs"; added = (0, 0, 4);
     style = RStringList "physvols", [], [];
     proc_nr = Some 9;
+    read_only = true;
+    concurrent = true;
     optional = Some "lvm2";
     tests = [
       InitBasicFSonLVM, Always, TestResult (
@@ -3895,6 +4280,8 @@ See also C<guestfs_pvs_full>." };
     name = "vgs"; added = (0, 0, 4);
     style = RStringList "volgroups", [], [];
     proc_nr = Some 10;
+    read_only = true;
+    concurrent = true;
     optional = Some "lvm2";
     tests = [
       InitBasicFSonLVM, Always, TestResult (
@@ -3926,6 +4313,8 @@ See also C<guestfs_vgs_full>." };
     name = "lvs"; added = (0, 0, 4);
     style = RStringList "logvols", [], [];
     proc_nr = Some 11;
+    read_only = true;
+    concurrent = true;
     optional = Some "lvm2";
     tests = [
       InitBasicFSonLVM, Always, TestResult (
@@ -3945,7 +4334,18 @@ See also C<guestfs_vgs_full>." };
          ["lvcreate"; "LV2"; "VG1"; "50"];
          ["lvcreate"; "LV3"; "VG2"; "50"];
          ["lvs"]],
-        "is_string_list (ret, 3, \"/dev/VG1/LV1\", \"/dev/VG1/LV2\", \"/dev/VG2/LV3\")"), []
+        "is_string_list (ret, 3, \"/dev/VG1/LV1\", \"/dev/VG1/LV2\", \"/dev/VG2/LV3\")"), [];
+      InitEmpty, Always, TestResult (
+        [["part_disk"; "/dev/sda"; "mbr"];
+         ["pvcreate"; "/dev/sda1"];
+         ["vgcreate"; "VG"; "/dev/sda1"];
+         ["lvcreate"; "LV1"; "VG"; "50"];
+         ["lvs"];
+         ["lvcreate"; "LV2"; "VG"; "50"];
+         ["lvs"];
+         ["lvremove"; "/dev/VG/LV1"];
+         ["lvs"]],
+        "is_string_list (ret, 1, \"/dev/VG/LV2\")"), []
     ];
     shortdesc = "list the LVM logical volumes (LVs)";
     longdesc = "\
@@ -3961,6 +4361,8 @@ See also C<guestfs_lvs_full>, C<guestfs_list_filesystems>." };
     name = "pvs_full"; added = (0, 0, 4);
     style = RStructList ("physvols", "lvm_pv"), [], [];
     proc_nr = Some 12;
+    read_only = true;
+    concurrent = true;
     optional = Some "lvm2";
     shortdesc = "list the LVM physical volumes (PVs)";
     longdesc = "\
@@ -3971,6 +4373,8 @@ of the L<pvs(8)> command.  The \"full\" version includes all fields." };
     name = "vgs_full"; added = (0, 0, 4);
     style = RStructList ("volgroups", "lvm_vg"), [], [];
     proc_nr = Some 13;
+    read_only = true;
+    concurrent = true;
     optional = Some "lvm2";
     shortdesc = "list the LVM volume groups (VGs)";
     longdesc = "\
@@ -3981,6 +4385,8 @@ of the L<vgs(8)> command.  The \"full\" version includes all fields." };
     name = "lvs_full"; added = (0, 0, 4);
     style = RStructList ("logvols", "lvm_lv"), [], [];
     proc_nr = Some 14;
+    read_only = true;
+    concurrent = true;
     optional = Some "lvm2";
     shortdesc = "list the LVM logical volumes (LVs)";
     longdesc = "\
@@ -4347,6 +4753,9 @@ yourself (Augeas support makes this relatively easy)." };
     name = "exists"; added = (0, 0, 8);
     style = RBool "existsflag", [Pathname "path"], [];
     proc_nr = Some 36;
+    batchable = true;
+    read_only = true;
+    concurrent = true;
     tests = [
       InitISOFS, Always, TestResultTrue (
         [["exists"; "/empty"]]), [];
@@ -4364,6 +4773,9 @@ See also C<guestfs_is_file>, C<guestfs_is_dir>, C<guestfs_stat>." };
     name = "is_file"; added = (0, 0, 8);
     style = RBool "fileflag", [Pathname "path"], [OBool "followsymlinks"];
     proc_nr = Some 37;
+    batchable = true;
+    read_only = true;
+    concurrent = true;
     once_had_no_optargs = true;
     tests = [
       InitISOFS, Always, TestResultTrue (
@@ -4389,6 +4801,9 @@ See also C<guestfs_stat>." };
     name = "is_dir"; added = (0, 0, 8);
     style = RBool "dirflag", [Pathname "path"], [OBool "followsymlinks"];
     proc_nr = Some 38;
+    batchable = true;
+    read_only = true;
+    concurrent = true;
     once_had_no_optargs = true;
     tests = [
       InitISOFS, Always, TestResultFalse (
@@ -4577,6 +4992,7 @@ contains the filesystem." };
     name = "mounts"; added = (0, 0, 8);
     style = RStringList "devices", [], [];
     proc_nr = Some 46;
+    read_only = true;
     tests = [
       InitScratchFS, Always, TestResult (
         [["mounts"]], "is_device_list (ret, 1, \"/dev/sdb1\")"), []
@@ -4637,6 +5053,8 @@ and physical volumes." };
     name = "file"; added = (1, 9, 1);
     style = RString "description", [Dev_or_Path "path"], [];
     proc_nr = Some 49;
+    read_only = true;
+    concurrent = true;
     tests = [
       InitISOFS, Always, TestResultString (
         [["file"; "/empty"]], "empty"), [];
@@ -4739,6 +5157,11 @@ C<guestfs_is_file>, C<guestfs_is_blockdev> (etc), C<guestfs_is_zero>." };
          ["upload"; "test-pwd"; "/pwd/test-pwd"];
          ["chmod"; "0o755"; "/pwd/test-pwd"];
          ["command"; "/pwd/test-pwd"]], "/"), [];
+      InitScratchFS, IfNotCrossAppliance, TestResultString (
+        [["mkdir"; "/command13"];
+         ["upload"; "test-command"; "/command13/test-command"];
+         ["chmod"; "0o755"; "/command13/test-command"];
+         ["command"; "/command13/test-command 13"]], "Result13"), [];
     ];
     shortdesc = "run a command from the guest filesystem";
     longdesc = "\
@@ -4843,7 +5266,15 @@ locations." };
          ["upload"; "test-command"; "/command_lines11/test-command"];
          ["chmod"; "0o755"; "/command_lines11/test-command"];
          ["command_lines"; "/command_lines11/test-command 11"]],
-        "is_string_list (ret, 2, \"Result11-1\", \"Result11-2\")"), []
+        "is_string_list (ret, 2, \"Result11-1\", \"Result11-2\")"), [];
+      InitScratchFS, IfNotCrossAppliance, TestResult (
+        [["mkdir"; "/command_lines12"];
+         ["upload"; "test-command"; "/command_lines12/test-command"];
+         ["chmod"; "0o755"; "/command_lines12/test-command"];
+         ["command_lines"; "/command_lines12/test-command 12"]],
+        "STREQ (ret[0], \"Result12-0\") && "^
+        "STREQ (ret[99999], \"Result12-99999\") && "^
+        "ret[100000] == NULL"), []
     ];
     shortdesc = "run a command, returning lines";
     longdesc = "\
@@ -4856,6 +5287,8 @@ See also: C<guestfs_sh_lines>" };
     name = "statvfs"; added = (1, 9, 2);
     style = RStruct ("statbuf", "statvfs"), [Pathname "path"], [];
     proc_nr = Some 54;
+    read_only = true;
+    concurrent = true;
     tests = [
       InitISOFS, Always, TestResult (
         [["statvfs"; "/"]], "ret->namemax == 255"), []
@@ -4922,6 +5355,8 @@ This uses the L<blockdev(8)> command." };
     name = "blockdev_getro"; added = (1, 9, 3);
     style = RBool "ro", [Device "device"], [];
     proc_nr = Some 58;
+    read_only = true;
+    concurrent = true;
     tests = [
       InitEmpty, Always, TestResultTrue (
         [["blockdev_setro"; "/dev/sda"];
@@ -4938,6 +5373,8 @@ This uses the L<blockdev(8)> command." };
     name = "blockdev_getss"; added = (1, 9, 3);
     style = RInt "sectorsize", [Device "device"], [];
     proc_nr = Some 59;
+    read_only = true;
+    concurrent = true;
     tests = [
       InitEmpty, Always, TestResult (
         [["blockdev_getss"; "/dev/sda"]], "ret == 512"), []
@@ -4956,6 +5393,8 @@ This uses the L<blockdev(8)> command." };
     name = "blockdev_getbsz"; added = (1, 9, 3);
     style = RInt "blocksize", [Device "device"], [];
     proc_nr = Some 60;
+    read_only = true;
+    concurrent = true;
     test_excuse = "cannot be tested because output differs depending on page size";
     shortdesc = "get blocksize of block device";
     longdesc = "\
@@ -4986,6 +5425,8 @@ C<blocksize> option of C<guestfs_mkfs>." };
     name = "blockdev_getsz"; added = (1, 9, 3);
     style = RInt64 "sizeinsectors", [Device "device"], [];
     proc_nr = Some 62;
+    read_only = true;
+    concurrent = true;
     tests = [
       InitEmpty, Always, TestResult (
         [["blockdev_getsz"; "/dev/sda"]],
@@ -5006,10 +5447,21 @@ This uses the L<blockdev(8)> command." };
     name = "blockdev_getsize64"; added = (1, 9, 3);
     style = RInt64 "sizeinbytes", [Device "device"], [];
     proc_nr = Some 63;
+    read_only = true;
+    concurrent = true;
     tests = [
       InitEmpty, Always, TestResult (
         [["blockdev_getsize64"; "/dev/sda"]],
-          "ret == INT64_C(2)*1024*1024*1024"), []
+          "ret == INT64_C(2)*1024*1024*1024"), [];
+      InitEmpty, Always, TestResult (
+        [["part_disk"; "/dev/sda"; "mbr"];
+         ["pvcreate"; "/dev/sda1"];
+         ["vgcreate"; "VG"; "/dev/sda1"];
+         ["lvcreate"; "LV"; "VG"; "52"];
+         ["blockdev_getsize64"; "/dev/VG/LV"];
+         ["lvresize"; "/dev/VG/LV"; "100"];
+         ["blockdev_getsize64"; "/dev/VG/LV"]],
+        "ret == 100 * 1024 * 1024"), []
     ];
     shortdesc = "get total size of device in bytes";
     longdesc = "\
@@ -5098,6 +5550,8 @@ See also C<guestfs_upload>, C<guestfs_cat>." };
     name = "checksum"; added = (1, 0, 2);
     style = RString "checksum", [String "csumtype"; Pathname "path"], [];
     proc_nr = Some 68;
+    read_only = true;
+    progress = true;
     tests = [
       InitISOFS, Always, TestResultString (
         [["checksum"; "crc"; "/known-3"]], "2891671662"), [];
@@ -5136,27 +5590,27 @@ for the C<cksum> command.
 
 =item C<md5>
 
-Compute the MD5 hash (using the C<md5sum> program).
+Compute the MD5 hash (the same as the C<md5sum> program).
 
 =item C<sha1>
 
-Compute the SHA1 hash (using the C<sha1sum> program).
+Compute the SHA1 hash (the same as the C<sha1sum> program).
 
 =item C<sha224>
 
-Compute the SHA224 hash (using the C<sha224sum> program).
+Compute the SHA224 hash (the same as the C<sha224sum> program).
 
 =item C<sha256>
 
-Compute the SHA256 hash (using the C<sha256sum> program).
+Compute the SHA256 hash (the same as the C<sha256sum> program).
 
 =item C<sha384>
 
-Compute the SHA384 hash (using the C<sha384sum> program).
+Compute the SHA384 hash (the same as the C<sha384sum> program).
 
 =item C<sha512>
 
-Compute the SHA512 hash (using the C<sha512sum> program).
+Compute the SHA512 hash (the same as the C<sha512sum> program).
 
 =back
 
@@ -5164,7 +5618,8 @@ The checksum is returned as a printable string.
 
 To get the checksum for a device, use C<guestfs_checksum_device>.
 
-To get the checksums for many files, use C<guestfs_checksums_out>." };
+To get the checksums for many files, use C<guestfs_checksumlist>
+or C<guestfs_checksums_out>." };
 
   { defaults with
     name = "tar_in"; added = (1, 0, 3);
@@ -6731,6 +7186,8 @@ This call returns the previous umask." };
     name = "readdir"; added = (1, 0, 55);
     style = RStructList ("entries", "dirent"), [Pathname "dir"], [];
     proc_nr = Some 138;
+    read_only = true;
+    concurrent = true;
     protocol_limit_warning = true;
     shortdesc = "read directories entries";
     longdesc = "\
@@ -6823,6 +7280,8 @@ process compressed files." };
     name = "getxattrs"; added = (1, 0, 59);
     style = RStructList ("xattrs", "xattr"), [Pathname "path"], [];
     proc_nr = Some 141;
+    read_only = true;
+    concurrent = true;
     optional = Some "linuxxattrs";
     shortdesc = "list extended attributes of a file or directory";
     longdesc = "\
@@ -6838,6 +7297,8 @@ See also: C<guestfs_lgetxattrs>, L<attr(5)>." };
     name = "lgetxattrs"; added = (1, 0, 59);
     style = RStructList ("xattrs", "xattr"), [Pathname "path"], [];
     proc_nr = Some 142;
+    read_only = true;
+    concurrent = true;
     optional = Some "linuxxattrs";
     shortdesc = "list extended attributes of a file or directory";
     longdesc = "\
@@ -6900,6 +7361,7 @@ of the link itself." };
     name = "mountpoints"; added = (1, 0, 62);
     style = RHashtable "mps", [], [];
     proc_nr = Some 147;
+    read_only = true;
     shortdesc = "show mountpoints";
     longdesc = "\
 This call is similar to C<guestfs_mounts>.  That call returns
@@ -7303,6 +7765,9 @@ The I<-f> option removes the link (C<linkname>) if it exists already." };
     name = "readlink"; added = (1, 0, 66);
     style = RString "link", [Pathname "path"], [];
     proc_nr = Some 168;
+    batchable = true;
+    read_only = true;
+    concurrent = true;
     shortdesc = "read the target of a symbolic link";
     longdesc = "\
 This command reads the target of a symbolic link." };
@@ -7783,6 +8248,7 @@ See also C<guestfs_ping_daemon>." };
     name = "find0"; added = (1, 0, 74);
     style = RErr, [Pathname "directory"; FileOut "files"], [];
     proc_nr = Some 196;
+    read_only = true;
     cancellable = true;
     test_excuse = "there is a regression test for this";
     shortdesc = "find all files and directories, returning NUL-separated list";
@@ -7900,9 +8366,16 @@ See also C<guestfs_realpath>." };
     name = "vfs_type"; added = (1, 0, 75);
     style = RString "fstype", [Mountable "mountable"], [];
     proc_nr = Some 198;
+    read_only = true;
+    concurrent = true;
     tests = [
       InitScratchFS, Always, TestResultString (
-        [["vfs_type"; "/dev/sdb1"]], "ext2"), []
+        [["vfs_type"; "/dev/sdb1"]], "ext2"), [];
+      InitPartition, Always, TestResultString (
+        [["mkfs"; "ext2"; "/dev/sda1"; ""; "NOARG"; ""; ""; "NOARG"];
+         ["vfs_type"; "/dev/sda1"];
+         ["mkfs"; "ext4"; "/dev/sda1"; ""; "NOARG"; ""; ""; "NOARG"];
+         ["vfs_type"; "/dev/sda1"]], "ext4"), []
     ];
     shortdesc = "get the Linux VFS type corresponding to a mounted device";
     longdesc = "\
@@ -8039,6 +8512,8 @@ yourself (Augeas support makes this relatively easy)." };
     name = "internal_lxattrlist"; added = (1, 19, 32);
     style = RStructList ("xattrs", "xattr"), [Pathname "path"; FilenameList "names"], [];
     proc_nr = Some 205;
+    read_only = true;
+    concurrent = true;
     visibility = VInternal;
     optional = Some "linuxxattrs";
     shortdesc = "lgetxattr on multiple files";
@@ -8069,6 +8544,8 @@ into smaller groups of names." };
     name = "internal_readlinklist"; added = (1, 19, 32);
     style = RStringList "links", [Pathname "path"; FilenameList "names"], [];
     proc_nr = Some 206;
+    read_only = true;
+    concurrent = true;
     visibility = VInternal;
     shortdesc = "readlink on multiple files";
     longdesc = "\
@@ -8098,6 +8575,8 @@ into smaller groups of names." };
     name = "pread"; added = (1, 0, 77);
     style = RBufferOut "content", [Pathname "path"; Int "count"; Int64 "offset"], [];
     proc_nr = Some 207;
+    read_only = true;
+    concurrent = true;
     protocol_limit_warning = true;
     tests = [
       InitISOFS, Always, TestResult (
@@ -8294,7 +8773,16 @@ table.  This works on C<gpt> but not on C<mbr> partitions." };
     name = "part_list"; added = (1, 0, 78);
     style = RStructList ("partitions", "partition"), [Device "device"], [];
     proc_nr = Some 213;
-    tests = [] (* XXX Add a regression test for this. *);
+    read_only = true;
+    concurrent = true;
+    tests = [
+      InitEmpty, Always, TestResult (
+        [["part_init"; "/dev/sda"; "mbr"];
+         ["part_list"; "/dev/sda"];
+         ["part_add"; "/dev/sda"; "p"; "64"; "204799"];
+         ["part_list"; "/dev/sda"]],
+        "ret->len == 1 && ret->val[0].part_start == 64 * 512"), []
+    ];
     shortdesc = "list partitions on a device";
     longdesc = "\
 This command parses the partition table on C<device> and
@@ -8327,6 +8815,8 @@ Size of the partition in bytes.
     name = "part_get_parttype"; added = (1, 0, 78);
     style = RString "parttype", [Device "device"], [];
     proc_nr = Some 214;
+    read_only = true;
+    concurrent = true;
     tests = [
       InitEmpty, Always, TestResultString (
         [["part_disk"; "/dev/sda"; "gpt"];
@@ -8466,6 +8956,8 @@ See also C<guestfs_initrd_list>." };
     name = "pvuuid"; added = (1, 0, 87);
     style = RString "uuid", [Device "device"], [];
     proc_nr = Some 222;
+    read_only = true;
+    concurrent = true;
     shortdesc = "get the UUID of a physical volume";
     longdesc = "\
 This command returns the UUID of the LVM PV C<device>." };
@@ -8474,6 +8966,8 @@ This command returns the UUID of the LVM PV C<device>." };
     name = "vguuid"; added = (1, 0, 87);
     style = RString "uuid", [String "vgname"], [];
     proc_nr = Some 223;
+    read_only = true;
+    concurrent = true;
     shortdesc = "get the UUID of a volume group";
     longdesc = "\
 This command returns the UUID of the LVM VG named C<vgname>." };
@@ -8482,6 +8976,8 @@ This command returns the UUID of the LVM VG named C<vgname>." };
     name = "lvuuid"; added = (1, 0, 87);
     style = RString "uuid", [Device "device"], [];
     proc_nr = Some 224;
+    read_only = true;
+    concurrent = true;
     shortdesc = "get the UUID of a logical volume";
     longdesc = "\
 This command returns the UUID of the LVM LV C<device>." };
@@ -8490,6 +8986,8 @@ This command returns the UUID of the LVM LV C<device>." };
     name = "vgpvuuids"; added = (1, 0, 87);
     style = RStringList "uuids", [String "vgname"], [];
     proc_nr = Some 225;
+    read_only = true;
+    concurrent = true;
     shortdesc = "get the PV UUIDs containing the volume group";
     longdesc = "\
 Given a VG called C<vgname>, this returns the UUIDs of all
@@ -8504,6 +9002,8 @@ See also C<guestfs_vglvuuids>." };
     name = "vglvuuids"; added = (1, 0, 87);
     style = RStringList "uuids", [String "vgname"], [];
     proc_nr = Some 226;
+    read_only = true;
+    concurrent = true;
     shortdesc = "get the LV UUIDs of all LVs in the volume group";
     longdesc = "\
 Given a VG called C<vgname>, this returns the UUIDs of all
@@ -8542,7 +9042,20 @@ is not large enough." };
     progress = true;
     tests = [
       InitBasicFSonLVM, Always, TestRun (
-        [["zero_device"; "/dev/VG/LV"]]), []
+        [["zero_device"; "/dev/VG/LV"]]), [];
+      InitBasicFSonLVM, Always, TestResultTrue (
+        [["umount"; "/"; "false"; "false"];
+         ["zero_device"; "/dev/VG/LV"];
+         ["is_zero_device"; "/dev/VG/LV"]]), [];
+      InitEmpty, Always, TestResultTrue (
+        [["pwrite_device"; "/dev/sdc"; "hello"; "0"];
+         ["pwrite_device"; "/dev/sdc"; "hello"; "5242877"];
+         ["zero_device"; "/dev/sdc"];
+         ["is_zero_device"; "/dev/sdc"]]), [];
+      InitEmpty, Always, TestResultTrue (
+        [["zero_device"; "/dev/sdc"];
+         ["zero_device"; "/dev/sdc"];
+         ["is_zero_device"; "/dev/sdc"]]), []
     ];
     shortdesc = "write zeroes to an entire device";
     longdesc = "\
@@ -8552,7 +9065,13 @@ a device.
 
 If blocks are already zero, then this command avoids writing
 zeroes.  This prevents the underlying device from becoming non-sparse
-or growing unnecessarily." };
+or growing unnecessarily.
+
+If the device can deallocate blocks and guarantee that they read
+back as zeroes, then the blocks are deallocated instead.  Otherwise
+if the device can zero blocks itself without transferring data
+(eg. using SCSI C<WRITE SAME> or NVMe C<WRITE ZEROES>), then that is
+used." };
 
   { defaults with
     name = "txz_in"; added = (1, 3, 2);
@@ -8617,6 +9136,8 @@ it contains." };
     name = "part_get_bootable"; added = (1, 3, 2);
     style = RBool "bootable", [Device "device"; Int "partnum"], [];
     proc_nr = Some 234;
+    read_only = true;
+    concurrent = true;
     tests = [
       InitEmpty, Always, TestResultTrue (
         [["part_init"; "/dev/sda"; "mbr"];
@@ -8635,6 +9156,8 @@ See also C<guestfs_part_set_bootable>." };
     name = "part_get_mbr_id"; added = (1, 3, 2);
     style = RInt "idbyte", [Device "device"; Int "partnum"], [];
     proc_nr = Some 235;
+    read_only = true;
+    concurrent = true;
     fish_output = Some FishOutputHexadecimal;
     tests = [
       InitEmpty, Always, TestResult (
@@ -8772,16 +9295,43 @@ it out to local file C<base64file> encoded as base64." };
     style = RErr, [String "csumtype"; Pathname "directory"; FileOut "sumsfile"], [];
     proc_nr = Some 244;
     cancellable = true;
+    tests = [
+      InitScratchFS, Always, TestResult (
+        [["mkdir"; "/checksums_out"];
+         ["write"; "/checksums_out/a"; "hello"];
+         ["checksums_out"; "md5"; "/checksums_out"; "testchecksums.tmp"];
+         ["upload"; "testchecksums.tmp"; "/checksums_out.out"];
+         ["read_lines"; "/checksums_out.out"]],
+        "is_string_list (ret, 1, \"5d41402abc4b2a76b9719d911017c592  ./a\")"), [];
+      InitScratchFS, Always, TestResult (
+        [["mkdir"; "/checksums_out2"];
+         ["mkdir"; "/checksums_out2/dir"];
+         ["write"; "/checksums_out2/dir/a"; "hello"];
+         ["checksums_out"; "crc"; "/checksums_out2"; "testchecksums.tmp"];
+         ["upload"; "testchecksums.tmp"; "/checksums_out2.out"];
+         ["read_lines"; "/checksums_out2.out"]],
+        "is_string_list (ret, 1, \"3287646509 5 ./dir/a\")"), [];
+      InitScratchFS, Always, TestResult (
+        [["mkdir"; "/checksums_out3"];
+         ["fill_dir"; "/checksums_out3"; "3000"];
+         ["checksums_out"; "sha256"; "/checksums_out3"; "testchecksums.tmp"];
+         ["upload"; "testchecksums.tmp"; "/checksums_out3.out"];
+         ["wc_l"; "/checksums_out3.out"]],
+        "ret == 3000"), []
+    ];
     shortdesc = "compute MD5, SHAx or CRC checksum of files in a directory";
     longdesc = "\
 This command computes the checksums of all regular files in
 F<directory> and then emits a list of those checksums to
 the local output file C<sumsfile>.
 
+The files are checksummed in parallel, using all of the
+appliance vCPUs (see C<guestfs_set_smp>).
+
 This can be used for verifying the integrity of a virtual
 machine.  However to be properly secure you should pay
-attention to the output of the checksum command (it uses
-the ones from GNU coreutils).  In particular when the
+attention to the output format, which is the same as the
+GNU coreutils checksum commands.  In particular when the
 filename is not printable, coreutils uses a special
 backslash syntax.  For more information, see the GNU
 coreutils info file." };
@@ -8949,6 +9499,8 @@ a file in the host and attach it as a device." };
     name = "vfs_label"; added = (1, 3, 18);
     style = RString "label", [Mountable "mountable"], [];
     proc_nr = Some 253;
+    read_only = true;
+    concurrent = true;
     tests = [
       InitBasicFS, Always, TestResultString (
         [["set_label"; "/dev/sda1"; "LTEST"];
@@ -8962,6 +9514,11 @@ a file in the host and attach it as a device." };
          ["mkfs"; "btrfs"; "/dev/sda1"; ""; "NOARG"; ""; ""; ""];
          ["set_label"; "/dev/sda1"; "test-label-btrfs"];
          ["vfs_label"; "/dev/sda1"]], "test-label-btrfs"), [];
+      InitBasicFS, Always, TestResultString (
+        [["set_label"; "/dev/sda1"; "LTEST1"];
+         ["vfs_label"; "/dev/sda1"];
+         ["set_label"; "/dev/sda1"; "LTEST2"];
+         ["vfs_label"; "/dev/sda1"]], "LTEST2"), []
     ];
     shortdesc = "get the filesystem label";
     longdesc = "\
@@ -8976,6 +9533,8 @@ To find a filesystem from the label, use C<guestfs_findfs_label>." };
     style = RString "uuid", [Mountable "mountable"], [];
     fish_alias = ["get-uuid"];
     proc_nr = Some 254;
+    read_only = true;
+    concurrent = true;
     tests =
       (let uuid = uuidgen () in [
         InitBasicFS, Always, TestResultString (
@@ -9136,6 +9695,8 @@ I<other> keys." };
     name = "is_lv"; added = (1, 5, 3);
     style = RBool "lvflag", [Mountable "mountable"], [];
     proc_nr = Some 264;
+    read_only = true;
+    concurrent = true;
     tests = [
       InitBasicFSonLVM, Always, TestResultTrue (
         [["is_lv"; "/dev/VG/LV"]]), [];
@@ -9175,6 +9736,8 @@ To find the label of a filesystem, use C<guestfs_vfs_label>." };
     name = "is_chardev"; added = (1, 5, 10);
     style = RBool "flag", [Pathname "path"], [OBool "followsymlinks"];
     proc_nr = Some 267;
+    read_only = true;
+    concurrent = true;
     once_had_no_optargs = true;
     tests = [
       InitISOFS, Always, TestResultFalse (
@@ -9198,6 +9761,8 @@ See also C<guestfs_stat>." };
     name = "is_blockdev"; added = (1, 5, 10);
     style = RBool "flag", [Pathname "path"], [OBool "followsymlinks"];
     proc_nr = Some 268;
+    read_only = true;
+    concurrent = true;
     once_had_no_optargs = true;
     tests = [
       InitISOFS, Always, TestResultFalse (
@@ -9225,6 +9790,8 @@ See also C<guestfs_stat>." };
     name = "is_fifo"; added = (1, 5, 10);
     style = RBool "flag", [Pathname "path"], [OBool "followsymlinks"];
     proc_nr = Some 269;
+    read_only = true;
+    concurrent = true;
     once_had_no_optargs = true;
     tests = [
       InitISOFS, Always, TestResultFalse (
@@ -9248,6 +9815,9 @@ See also C<guestfs_stat>." };
     name = "is_symlink"; added = (1, 5, 10);
     style = RBool "flag", [Pathname "path"], [];
     proc_nr = Some 270;
+    batchable = true;
+    read_only = true;
+    concurrent = true;
     tests = [
       InitISOFS, Always, TestResultFalse (
         [["is_symlink"; "/directory"]]), [];
@@ -9265,6 +9835,8 @@ See also C<guestfs_stat>." };
     name = "is_socket"; added = (1, 5, 10);
     style = RBool "flag", [Pathname "path"], [OBool "followsymlinks"];
     proc_nr = Some 271;
+    read_only = true;
+    concurrent = true;
     once_had_no_optargs = true;
     (* XXX Need a positive test for sockets. *)
     tests = [
@@ -9286,6 +9858,8 @@ See also C<guestfs_stat>." };
     name = "part_to_dev"; added = (1, 5, 15);
     style = RString "device", [Device "partition"], [];
     proc_nr = Some 272;
+    read_only = true;
+    concurrent = true;
     tests = [
       InitPartition, Always, TestResultDevice (
         [["part_to_dev"; "/dev/sda1"]], "/dev/sda"), [];
@@ -9394,6 +9968,8 @@ See also C<guestfs_pwrite>." };
     name = "pread_device"; added = (1, 5, 21);
     style = RBufferOut "content", [Device "device"; Int "count"; Int64 "offset"], [];
     proc_nr = Some 276;
+    read_only = true;
+    concurrent = true;
     protocol_limit_warning = true;
     tests = [
       InitEmpty, Always, TestResult (
@@ -9414,6 +9990,8 @@ See also C<guestfs_pread>." };
     name = "lvm_canonical_lv_name"; added = (1, 5, 24);
     style = RString "lv", [Device "lvname"], [];
     proc_nr = Some 277;
+    read_only = true;
+    concurrent = true;
     tests = [
       InitBasicFSonLVM, IfAvailable "lvm2", TestResultString (
         [["lvm_canonical_lv_name"; "/dev/mapper/VG-LV"]], "/dev/VG/LV"), [];
@@ -9567,11 +10145,34 @@ handle is closed." };
     name = "is_zero"; added = (1, 11, 8);
     style = RBool "zeroflag", [Pathname "path"], [];
     proc_nr = Some 283;
+    read_only = true;
     tests = [
       InitISOFS, Always, TestResultTrue (
         [["is_zero"; "/100kallzeroes"]]), [];
       InitISOFS, Always, TestResultFalse (
-        [["is_zero"; "/100kallspaces"]]), []
+        [["is_zero"; "/100kallspaces"]]), [];
+      InitScratchFS, Always, TestResultTrue (
+        [["mkdir"; "/is_zero"];
+         ["touch"; "/is_zero/holes"];
+         ["truncate_size"; "/is_zero/holes"; "104857600"];
+         ["is_zero"; "/is_zero/holes"]]), [];
+      InitScratchFS, Always, TestResultFalse (
+        [["mkdir"; "/is_zero2"];
+         ["touch"; "/is_zero2/last"];
+         ["truncate_size"; "/is_zero2/last"; "104857600"];
+         ["pwrite"; "/is_zero2/last"; "x"; "104857599"];
+         ["is_zero"; "/is_zero2/last"]]), [];
+      InitScratchFS, Always, TestResultTrue (
+        [["mkdir"; "/is_zero3"];
+         ["fill"; "0"; "3000000"; "/is_zero3/mixed"];
+         ["truncate_size"; "/is_zero3/mixed"; "10000000"];
+         ["is_zero"; "/is_zero3/mixed"]]), [];
+      InitScratchFS, Always, TestResultFalse (
+        [["mkdir"; "/is_zero4"];
+         ["fill"; "0"; "3000000"; "/is_zero4/mixed"];
+         ["truncate_size"; "/is_zero4/mixed"; "10000000"];
+         ["pwrite"; "/is_zero4/mixed"; "x"; "2999999"];
+         ["is_zero"; "/is_zero4/mixed"]]), []
     ];
     shortdesc = "test if a file contains all zero bytes";
     longdesc = "\
@@ -9582,13 +10183,18 @@ it contains all zero bytes." };
     name = "is_zero_device"; added = (1, 11, 8);
     style = RBool "zeroflag", [Device "device"], [];
     proc_nr = Some 284;
+    read_only = true;
     tests = [
       InitBasicFS, Always, TestResultTrue (
         [["umount"; "/dev/sda1"; "false"; "false"];
          ["zero_device"; "/dev/sda1"];
          ["is_zero_device"; "/dev/sda1"]]), [];
       InitBasicFS, Always, TestResultFalse (
-        [["is_zero_device"; "/dev/sda1"]]), []
+        [["is_zero_device"; "/dev/sda1"]]), [];
+      InitEmpty, Always, TestResultFalse (
+        [["zero_device"; "/dev/sdc"];
+         ["pwrite_device"; "/dev/sdc"; "x"; "10485759"];
+         ["is_zero_device"; "/dev/sdc"]]), []
     ];
     shortdesc = "test if a device contains all zero bytes";
     longdesc = "\
@@ -9623,6 +10229,8 @@ parameter." };
     name = "list_dm_devices"; added = (1, 11, 15);
     style = RStringList "devices", [], [];
     proc_nr = Some 287;
+    read_only = true;
+    concurrent = true;
     shortdesc = "list device mapper devices";
     longdesc = "\
 List all device mapper devices.
@@ -9754,6 +10362,8 @@ as in C<guestfs_compress_out>." };
     name = "part_to_partnum"; added = (1, 13, 25);
     style = RInt "partnum", [Device "partition"], [];
     proc_nr = Some 293;
+    read_only = true;
+    concurrent = true;
     tests = [
       InitPartition, Always, TestResult (
         [["part_to_partnum"; "/dev/sda1"]], "ret == 1"), [];
@@ -9772,9 +10382,21 @@ See also C<guestfs_part_to_dev>." };
 
   { defaults with
     name = "copy_device_to_device"; added = (1, 13, 25);
-    style = RErr, [Device "src"; Device "dest"], [OInt64 "srcoffset"; OInt64 "destoffset"; OInt64 "size"; OBool "sparse"; OBool "append"];
+    style = RErr, [Device "src"; Device "dest"], [OInt64 "srcoffset"; OInt64 "destoffset"; OInt64 "size"; OBool "sparse"; OBool "append"; OBool "direct"];
     proc_nr = Some 294;
     progress = true;
+    tests = [
+      InitEmpty, Always, TestResult (
+        [["pwrite_device"; "/dev/sda"; "hello"; "5242880"];
+         ["copy_device_to_device"; "/dev/sda"; "/dev/sdb"; ""; ""; "8388608"; ""; ""; "true"];
+         ["pread_device"; "/dev/sdb"; "5"; "5242880"]],
+        "compare_buffers (ret, size, \"hello\", 5) == 0"), [];
+      InitEmpty, Always, TestResult (
+        [["pwrite_device"; "/dev/sda"; "[hello]"; "1048575"];
+         ["copy_device_to_device"; "/dev/sda"; "/dev/sdb"; "1048575"; "4095"; "7"; ""; ""; "true"];
+         ["pread_device"; "/dev/sdb"; "7"; "4095"]],
+        "compare_buffers (ret, size, \"[hello]\", 7) == 0"), []
+    ];
     shortdesc = "copy from source device to destination device";
     longdesc = "\
 The four calls C<guestfs_copy_device_to_device>,
@@ -9803,13 +10425,23 @@ flag currently cannot be set for devices.
 
 If the C<sparse> flag is true then the call avoids writing
 blocks that contain only zeroes, which can help in some situations
-where the backing disk is thin-provisioned.  Note that unless
-the target is already zeroed, using this option will result
-in incorrect copying." };
+where the backing disk is thin-provisioned.  Unallocated ranges
+(holes) in the source are skipped without being read.  Note that
+unless the target is already zeroed, using this option will result
+in incorrect copying.
+
+If the C<direct> flag is true then the source and destination are
+opened with C<O_DIRECT>, bypassing the appliance page cache, where
+the underlying filesystem or device supports it.  Unaligned parts of
+the copy fall back to ordinary buffered I/O.
+
+If the destination is not seekable (for example a pipe or a
+character device) it is written sequentially, and the C<sparse>
+flag and a non-zero C<destoffset> cannot be used." };
 
   { defaults with
     name = "copy_device_to_file"; added = (1, 13, 25);
-    style = RErr, [Device "src"; Pathname "dest"], [OInt64 "srcoffset"; OInt64 "destoffset"; OInt64 "size"; OBool "sparse"; OBool "append"];
+    style = RErr, [Device "src"; Pathname "dest"], [OInt64 "srcoffset"; OInt64 "destoffset"; OInt64 "size"; OBool "sparse"; OBool "append"; OBool "direct"];
     proc_nr = Some 295;
     progress = true;
     shortdesc = "copy from source device to destination file";
@@ -9819,7 +10451,7 @@ of this call." };
 
   { defaults with
     name = "copy_file_to_device"; added = (1, 13, 25);
-    style = RErr, [Pathname "src"; Device "dest"], [OInt64 "srcoffset"; OInt64 "destoffset"; OInt64 "size"; OBool "sparse"; OBool "append"];
+    style = RErr, [Pathname "src"; Device "dest"], [OInt64 "srcoffset"; OInt64 "destoffset"; OInt64 "size"; OBool "sparse"; OBool "append"; OBool "direct"];
     proc_nr = Some 296;
     progress = true;
     shortdesc = "copy from source file to destination device";
@@ -9829,14 +10461,14 @@ of this call." };
 
   { defaults with
     name = "copy_file_to_file"; added = (1, 13, 25);
-    style = RErr, [Pathname "src"; Pathname "dest"], [OInt64 "srcoffset"; OInt64 "destoffset"; OInt64 "size"; OBool "sparse"; OBool "append"];
+    style = RErr, [Pathname "src"; Pathname "dest"], [OInt64 "srcoffset"; OInt64 "destoffset"; OInt64 "size"; OBool "sparse"; OBool "append"; OBool "direct"];
     proc_nr = Some 297;
     progress = true;
     tests = [
       InitScratchFS, Always, TestResult (
         [["mkdir"; "/copyff"];
          ["write"; "/copyff/src"; "hello, world"];
-         ["copy_file_to_file"; "/copyff/src"; "/copyff/dest"; ""; ""; ""; ""; "false"];
+         ["copy_file_to_file"; "/copyff/src"; "/copyff/dest"; ""; ""; ""; ""; "false"; ""];
          ["read_file"; "/copyff/dest"]],
         "compare_buffers (ret, size, \"hello, world\", 12) == 0"), [];
       InitScratchFS, Always, TestResultTrue (
@@ -9845,16 +10477,78 @@ of this call." };
          ["fill"; "0"; string_of_int size; "/copyff2/src"];
          ["touch"; "/copyff2/dest"];
          ["truncate_size"; "/copyff2/dest"; string_of_int size];
-         ["copy_file_to_file"; "/copyff2/src"; "/copyff2/dest"; ""; ""; ""; "true"; "false"];
+         ["copy_file_to_file"; "/copyff2/src"; "/copyff2/dest"; ""; ""; ""; "true"; "false"; ""];
          ["is_zero"; "/copyff2/dest"]]), [];
       InitScratchFS, Always, TestResult (
         [["mkdir"; "/copyff3"];
          ["write"; "/copyff3/src"; "hello, world"];
-         ["copy_file_to_file"; "/copyff3/src"; "/copyff3/dest"; ""; ""; ""; ""; "true"];
-         ["copy_file_to_file"; "/copyff3/src"; "/copyff3/dest"; ""; ""; ""; ""; "true"];
-         ["copy_file_to_file"; "/copyff3/src"; "/copyff3/dest"; ""; ""; ""; ""; "true"];
+         ["copy_file_to_file"; "/copyff3/src"; "/copyff3/dest"; ""; ""; ""; ""; "true"; ""];
+         ["copy_file_to_file"; "/copyff3/src"; "/copyff3/dest"; ""; ""; ""; ""; "true"; ""];
+         ["copy_file_to_file"; "/copyff3/src"; "/copyff3/dest"; ""; ""; ""; ""; "true"; ""];
          ["read_file"; "/copyff3/dest"]],
         "compare_buffers (ret, size, \"hello, worldhello, worldhello, world\", 12*3) == 0"), [];
+      InitScratchFS, Always, TestResultTrue (
+        [["mkdir"; "/copyff4"];
+         ["fill"; "65"; "1052673"; "/copyff4/src"];
+         ["copy_file_to_file"; "/copyff4/src"; "/copyff4/dest"; ""; ""; ""; ""; ""; "true"];
+         ["equal"; "/copyff4/src"; "/copyff4/dest"]]), [];
+      InitScratchFS, Always, TestResultTrue (
+        [["mkdir"; "/copyff5"];
+         ["touch"; "/copyff5/src"];
+         ["truncate_size"; "/copyff5/src"; "20971520"];
+         ["pwrite"; "/copyff5/src"; "hello"; "10485760"];
+         ["copy_file_to_file"; "/copyff5/src"; "/copyff5/dest"; ""; ""; ""; "true"; ""; ""];
+         ["equal"; "/copyff5/src"; "/copyff5/dest"]]), [];
+      InitScratchFS, Always, TestResult (
+        [["mkdir"; "/copyff6"];
+         ["touch"; "/copyff6/src"];
+         ["truncate_size"; "/copyff6/src"; "20971520"];
+         ["pwrite"; "/copyff6/src"; "hello"; "10485760"];
+         ["copy_file_to_file"; "/copyff6/src"; "/copyff6/dest"; ""; ""; ""; "true"; ""; ""];
+         ["du"; "/copyff6/dest"]],
+        "ret < 1024"), [];
+      InitScratchFS, Always, TestResult (
+        [["mkdir"; "/copyff7"];
+         ["touch"; "/copyff7/src"];
+         ["truncate_size"; "/copyff7/src"; "20971520"];
+         ["copy_file_to_file"; "/copyff7/src"; "/copyff7/dest"; ""; ""; ""; "true"; ""; ""];
+         ["filesize"; "/copyff7/dest"]],
+        "ret == 20971520"), [];
+      InitScratchFS, Always, TestResultTrue (
+        [["mkdir"; "/copyff8"];
+         ["fill_pattern"; "abcdefg"; "9437187"; "/copyff8/src"];
+         ["copy_file_to_file"; "/copyff8/src"; "/copyff8/dest"; ""; ""; ""; ""; ""; "true"];
+         ["equal"; "/copyff8/src"; "/copyff8/dest"]]), [];
+      InitScratchFS, Always, TestResult (
+        [["mkdir"; "/copyff9"];
+         ["fill_pattern"; "abcdefg"; "9437187"; "/copyff9/src"];
+         ["copy_file_to_file"; "/copyff9/src"; "/copyff9/dest"; "4194307"; "513"; "5000000"; ""; ""; "true"];
+         ["pread"; "/copyff9/dest"; "7"; "513"]],
+        "compare_buffers (ret, size, \"fgabcde\", 7) == 0"), [];
+      InitScratchFS, Always, TestResult (
+        [["mkdir"; "/copyff10"];
+         ["fill_pattern"; "abcdefg"; "9437187"; "/copyff10/src"];
+         ["copy_file_to_file"; "/copyff10/src"; "/copyff10/dest"; "4194307"; "513"; "5000000"; ""; ""; ""];
+         ["pread"; "/copyff10/dest"; "7"; "5000506"]],
+        "compare_buffers (ret, size, \"defgabc\", 7) == 0"), [];
+      InitScratchFS, Always, TestResult (
+        [["mkdir"; "/copyff11"];
+         ["fill_pattern"; "abcdefg"; "9437187"; "/copyff11/src"];
+         ["copy_file_to_file"; "/copyff11/src"; "/copyff11/dest"; "4194307"; "513"; "5000000"; ""; ""; ""];
+         ["filesize"; "/copyff11/dest"]],
+        "ret == 5000513"), [];
+      InitScratchFS, Always, TestResult (
+        [["mkdir"; "/copyff12"];
+         ["write"; "/copyff12/src"; "hello"];
+         ["fill"; "65"; "100000"; "/copyff12/dest"];
+         ["copy_file_to_file"; "/copyff12/src"; "/copyff12/dest"; ""; ""; ""; ""; ""; ""];
+         ["read_file"; "/copyff12/dest"]],
+        "compare_buffers (ret, size, \"hello\", 5) == 0"), [];
+      InitScratchFS, Always, TestResultTrue (
+        [["mkdir"; "/copyff13"];
+         ["fill_pattern"; "abcdefg"; "70000001"; "/copyff13/src"];
+         ["copy_file_to_file"; "/copyff13/src"; "/copyff13/dest"; ""; ""; ""; ""; ""; ""];
+         ["equal"; "/copyff13/src"; "/copyff13/dest"]]), [];
     ];
     shortdesc = "copy from source file to destination file";
     longdesc = "\
@@ -10033,6 +10727,8 @@ If not set, this defaults to C<raid1>.
     name = "list_md_devices"; added = (1, 15, 4);
     style = RStringList "devices", [], [];
     proc_nr = Some 300;
+    read_only = true;
+    concurrent = true;
     shortdesc = "list Linux md (RAID) devices";
     longdesc = "\
 List all Linux md devices." };
@@ -10041,6 +10737,8 @@ List all Linux md devices." };
     name = "md_detail"; added = (1, 15, 6);
     style = RHashtable "info", [Device "md"], [];
     proc_nr = Some 301;
+    read_only = true;
+    concurrent = true;
     optional = Some "mdadm";
     shortdesc = "obtain metadata for an MD device";
     longdesc = "\
@@ -10086,6 +10784,8 @@ device is stopped, but it is not destroyed or zeroed." };
     name = "blkid"; added = (1, 15, 9);
     style = RHashtable "info", [Device "device"], [];
     proc_nr = Some 303;
+    read_only = true;
+    concurrent = true;
     tests = [
       InitScratchFS, Always, TestResult (
         [["blkid"; "/dev/sdb1"]],
@@ -10307,7 +11007,15 @@ To read the label on a filesystem, call C<guestfs_vfs_label>." };
     progress = true;
     tests = [
       InitScratchFS, Always, TestRun (
-        [["zero_free_space"; "/"]]), []
+        [["zero_free_space"; "/"]]), [];
+      InitScratchFS, Always, TestResult (
+        [["mkdir"; "/zero_free_space"];
+         ["write"; "/zero_free_space/a"; "hello"];
+         ["fill"; "65"; "1048576"; "/zero_free_space/b"];
+         ["rm"; "/zero_free_space/b"];
+         ["zero_free_space"; "/zero_free_space"];
+         ["read_file"; "/zero_free_space/a"]],
+        "compare_buffers (ret, size, \"hello\", 5) == 0"), []
     ];
     shortdesc = "zero free space in a filesystem";
     longdesc = "\
@@ -11971,6 +12679,8 @@ for a useful list of type GUIDs." };
     name = "part_get_gpt_type"; added = (1, 21, 1);
     style = RString "guid", [Device "device"; Int "partnum"], [];
     proc_nr = Some 393;
+    read_only = true;
+    concurrent = true;
     optional = Some "gdisk";
     tests = [
       InitGPT, Always, TestResultString (
@@ -12373,6 +13083,8 @@ enables all the other flags, if they are not specified already.
     name = "part_get_name"; added = (1, 25, 33);
     style = RString "name", [Device "device"; Int "partnum"], [];
     proc_nr = Some 416;
+    read_only = true;
+    concurrent = true;
     shortdesc = "get partition name";
     longdesc = "\
 This gets the partition name on partition numbered C<partnum> on
@@ -12453,6 +13165,9 @@ Get the realtime (wallclock) timestamp of the current journal entry." };
     name = "statns"; added = (1, 27, 53);
     style = RStruct ("statbuf", "statns"), [Pathname "path"], [];
     proc_nr = Some 421;
+    batchable = true;
+    read_only = true;
+    concurrent = true;
     tests = [
       InitISOFS, Always, TestResult (
         [["statns"; "/empty"]], "ret->st_size == 0"), []
@@ -12467,6 +13182,9 @@ This is the same as the L<stat(2)> system call." };
     name = "lstatns"; added = (1, 27, 53);
     style = RStruct ("statbuf", "statns"), [Pathname "path"], [];
     proc_nr = Some 422;
+    batchable = true;
+    read_only = true;
+    concurrent = true;
     tests = [
       InitISOFS, Always, TestResult (
         [["lstatns"; "/empty"]], "ret->st_size == 0"), []
@@ -12485,6 +13203,8 @@ This is the same as the L<lstat(2)> system call." };
     name = "internal_lstatnslist"; added = (1, 27, 53);
     style = RStructList ("statbufs", "statns"), [Pathname "path"; FilenameList "names"], [];
     proc_nr = Some 423;
+    read_only = true;
+    concurrent = true;
     visibility = VInternal;
     shortdesc = "lstat on multiple files";
     longdesc = "\
@@ -12846,6 +13566,8 @@ valid GUID." };
     name = "part_get_gpt_guid"; added = (1, 29, 25);
     style = RString "guid", [Device "device"; Int "partnum"], [];
     proc_nr = Some 447;
+    read_only = true;
+    concurrent = true;
     optional = Some "gdisk";
     tests = [
       InitGPT, Always, TestResultString (
@@ -12957,6 +13679,8 @@ All data will be zeroed, but metadata and the like is preserved." };
     name = "part_get_mbr_part_type"; added = (1, 29, 32);
     style = RString "partitiontype", [Device "device"; Int "partnum"], [];
     proc_nr = Some 454;
+    read_only = true;
+    concurrent = true;
     tests = [
       InitEmpty, Always, TestResultString (
         [["part_init"; "/dev/sda"; "mbr"];
@@ -13076,6 +13800,8 @@ or if C<guid> is not a valid GUID." };
     name = "part_get_disk_guid"; added = (1, 33, 2);
     style = RString "guid", [Device "device"], [];
     proc_nr = Some 460;
+    read_only = true;
+    concurrent = true;
     optional = Some "gdisk";
     tests = [
       InitGPT, Always, TestResultString (
@@ -13253,6 +13979,225 @@ is removed." };
     shortdesc = "search the entries associated to the given inode";
     longdesc = "Internal function for find_inode." };
 
+  { defaults with
+    name = "internal_set_chunk_size"; added = (1, 35, 15);
+    style = RInt "size", [Int "size"], [];
+    proc_nr = Some 471;
+    visibility = VInternal;
+    shortdesc = "set the chunk size used for file transfers";
+    longdesc = "\
+This is called by the library after launch to request the chunk
+size used for C<FileIn> and C<FileOut> transfers.  The daemon
+clamps the requested size to the range it supports and returns
+the size it will use." };
+
+  { defaults with
+    name = "internal_batch"; added = (1, 35, 15);
+    style = RBufferOut "replies", [BufferIn "requests"], [];
+    proc_nr = Some 472;
+    read_only = true;
+    visibility = VInternal;
+    shortdesc = "run several daemon calls in one round trip";
+    longdesc = "\
+C<requests> is a sequence of complete, length-prefixed request
+messages, each encoded exactly as it would be sent on the socket.
+The daemon runs them in order and returns the corresponding
+length-prefixed reply messages concatenated in C<replies>.
+
+Requests which transfer files, and nested batches, are answered
+with an error.  If the replies would not fit in a single message,
+the daemon stops early and returns the replies so far; the caller
+must resend the remaining requests.
+
+This is used by the library, see F<src/batch.c>." };
+
+  { defaults with
+    name = "internal_enable_hole_chunks"; added = (1, 35, 15);
+    style = RErr, [], [];
+    proc_nr = Some 473;
+    visibility = VInternal;
+    shortdesc = "enable hole chunks in file transfers";
+    longdesc = "\
+This is called by the library after launch to tell the daemon
+that it understands hole chunks (chunks which stand for a run of
+zero bytes) in C<FileIn> and C<FileOut> transfers.  After this
+the daemon may send hole chunks, and the library may send them
+to the daemon." };
+
+  { defaults with
+    name = "internal_enable_compressed_chunks"; added = (1, 35, 15);
+    style = RErr, [], [];
+    proc_nr = Some 474;
+    visibility = VInternal;
+    shortdesc = "enable compressed chunks in file transfers";
+    longdesc = "\
+This is called by the library after launch when
+C<guestfs_set_transfer_compression> is set.  After this the
+daemon may send zlib-compressed chunks in C<FileIn> and C<FileOut>
+transfers, and the library may send them to the daemon.  If the
+daemon was built without zlib, this returns an error with
+C<errno> set to C<ENOTSUP>." };
+
+  { defaults with
+    name = "internal_enable_bulk_channel"; added = (1, 35, 15);
+    style = RErr, [], [];
+    proc_nr = Some 475;
+    visibility = VInternal;
+    shortdesc = "send file data over the bulk data channel";
+    longdesc = "\
+This is called by the library after launch if the appliance was
+started with a second virtio-serial port for bulk data.  After this,
+the chunks of C<FileIn> and C<FileOut> transfers are sent over that
+port, while requests, replies and progress messages stay on the
+first port.  If the daemon could not open the second port, this
+returns an error with C<errno> set to C<ENOTSUP>." };
+
+  { defaults with
+    name = "internal_daemon_call_stats"; added = (1, 35, 15);
+    style = RStructList ("stats", "call_stat"), [Bool "reset"], [];
+    proc_nr = Some 476;
+    read_only = true;
+    visibility = VInternal;
+    shortdesc = "get the daemon side call statistics";
+    longdesc = "\
+This returns the number of times the daemon has run each procedure
+and the time it spent doing so, in the C<cs_daemon_calls> and
+C<cs_daemon_usec> fields.  The other numeric fields are zero.
+If C<reset> is true, the counters are cleared after being read.
+
+This is used by C<guestfs_get_call_stats>." };
+
+  { defaults with
+    name = "internal_checksumlist"; added = (1, 35, 15);
+    style = RStringList "checksums", [String "csumtype"; Pathname "path"; FilenameList "names"], [];
+    proc_nr = Some 477;
+    visibility = VInternal;
+    shortdesc = "compute checksums of multiple files";
+    longdesc = "\
+This is the internal call which implements C<guestfs_checksumlist>." };
+
+  { defaults with
+    name = "block_hash_manifest"; added = (1, 35, 15);
+    style = RErr, [Dev_or_Path "device"; FileOut "manifest"], [OInt "blocksize"; OString "csumtype"];
+    proc_nr = Some 478;
+    progress = true; cancellable = true;
+    tests = [
+      InitScratchFS, Always, TestResult (
+        [["fill"; "65"; "200000"; "/block_hash_manifest"];
+         ["block_hash_manifest"; "/block_hash_manifest"; "testmanifest2.tmp"; "65536"; "md5"];
+         ["upload"; "testmanifest2.tmp"; "/block_hash_manifest.txt"];
+         ["head_n"; "1"; "/block_hash_manifest.txt"]],
+        "ret[0] && ret[1] == NULL && "^
+        "STREQ (ret[0], \"# blocksize 65536 csumtype md5 size 200000\")"), [];
+      InitScratchFS, Always, TestResult (
+        [["fill"; "65"; "200000"; "/block_hash_manifest"];
+         ["block_hash_manifest"; "/block_hash_manifest"; "testmanifest2.tmp"; "65536"; "md5"];
+         ["upload"; "testmanifest2.tmp"; "/block_hash_manifest.txt"];
+         ["wc_l"; "/block_hash_manifest.txt"]], "ret == 5"), [];
+      (* Zero blocks, including holes, are left out. *)
+      InitScratchFS, Always, TestResult (
+        [["fill"; "65"; "200000"; "/block_hash_manifest_zero"];
+         ["truncate_size"; "/block_hash_manifest_zero"; "65536"];
+         ["truncate_size"; "/block_hash_manifest_zero"; "200000"];
+         ["block_hash_manifest"; "/block_hash_manifest_zero"; "testmanifest3.tmp"; "65536"; "md5"];
+         ["upload"; "testmanifest3.tmp"; "/block_hash_manifest_zero.txt"];
+         ["wc_l"; "/block_hash_manifest_zero.txt"]], "ret == 2"), [];
+      InitScratchFS, Always, TestLastFail (
+        [["touch"; "/block_hash_manifest_bad"];
+         ["block_hash_manifest"; "/block_hash_manifest_bad"; "testmanifest3.tmp"; "1000"; "NOARG"]]), []
+    ];
+    shortdesc = "compute a manifest of block checksums";
+    longdesc = "\
+This computes a checksum of each block of the file or device
+C<device>, and writes the list of checksums (the \"manifest\")
+to the local file C<manifest>.
+
+C<blocksize> is the size of each block in bytes.  It must be a
+power of 2 between 512 and 16777216.  The default is 65536.
+C<csumtype> is the type of checksum, see C<guestfs_checksum>.
+The default is C<sha256>.
+
+The first line of the manifest is:
+
+ # blocksize BLOCKSIZE csumtype CSUMTYPE size SIZE
+
+where C<SIZE> is the size of C<device> in bytes.  This is followed
+by one line for each block which contains data, in order:
+
+ OFFSET CHECKSUM
+
+Blocks which contain only zeroes, including unallocated
+(sparse) parts of files, are left out of the manifest, so the
+manifest of a mostly empty disk is small.  The final block may be
+shorter than C<blocksize>.
+
+The blocks are read and checksummed in parallel, using all of the
+appliance vCPUs (see C<guestfs_set_smp>).
+
+Manifests can be used to find out which blocks of a disk have
+changed, and to copy only the changed blocks, see
+C<guestfs_download_changed_blocks>." };
+
+  { defaults with
+    name = "internal_walk"; added = (1, 35, 15);
+    style = RErr, [Pathname "directory"; FileOut "filename"], [];
+    proc_nr = Some 479;
+    read_only = true;
+    visibility = VInternal;
+    cancellable = true;
+    shortdesc = "walk a directory tree";
+    longdesc = "\
+This is the internal call which implements C<guestfs_walk>." };
+
+  { defaults with
+    name = "vfs_probe_list"; added = (1, 35, 15);
+    style = RStructList ("probes", "vfs_probe"), [StringList "devices"], [];
+    proc_nr = Some 480;
+    read_only = true;
+    concurrent = true;
+    tests = [
+      InitScratchFS, Always, TestResult (
+        [["vfs_probe_list"; "/dev/sdb1"]],
+        "ret->len == 1 && "^
+        "STREQ (ret->val[0].vp_device, \"/dev/sdb1\") && "^
+        "STREQ (ret->val[0].vp_type, \"ext2\")"), [];
+      InitBasicFS, Always, TestResult (
+        [["set_label"; "/dev/sda1"; "probelabel"];
+         ["vfs_probe_list"; "/dev/sda /dev/sda1"]],
+        "ret->len == 2 && "^
+        "STREQ (ret->val[0].vp_type, \"\") && "^
+        "STREQ (ret->val[1].vp_label, \"probelabel\")"), [];
+      InitEmpty, Always, TestResult (
+        [["vfs_probe_list"; "/dev/sdz9 /dev/sda"]],
+        "ret->len == 2 && "^
+        "STREQ (ret->val[0].vp_device, \"/dev/sdz9\") && "^
+        "STREQ (ret->val[0].vp_type, \"\")"), [];
+      InitBasicFSonLVM, Always, TestResult (
+        [["set_label"; "/dev/VG/LV"; "lvlabel"];
+         ["vfs_probe_list"; "/dev/VG/LV /dev/sda1"]],
+        "ret->len == 2 && "^
+        "STREQ (ret->val[0].vp_device, \"/dev/VG/LV\") && "^
+        "STREQ (ret->val[0].vp_type, \"ext2\") && "^
+        "STREQ (ret->val[0].vp_label, \"lvlabel\") && "^
+        "STREQ (ret->val[1].vp_type, \"LVM2_member\")"), []
+    ];
+    shortdesc = "probe the filesystems on a list of devices";
+    longdesc = "\
+This probes each device in C<devices> and returns one entry for
+each, in the same order.  C<vp_type>, C<vp_label> and C<vp_uuid>
+are the filesystem type, label and UUID found by libblkid, which
+are normally the same as the results of C<guestfs_vfs_type>,
+C<guestfs_vfs_label> and C<guestfs_vfs_uuid>.  C<vp_partuuid> is
+the unique ID of the partition in the partition table (the same as
+C<PARTUUID=> in F</etc/fstab>).  Fields which are not known are
+returned as empty strings.  C<vp_device> is the device name as it
+was passed in C<devices>.  A device which does not exist or cannot
+be read does not cause an error: all of its fields except
+C<vp_device> are empty.
+
+The devices are probed in parallel, in a single call.  This is
+faster than calling C<guestfs_vfs_type>, C<guestfs_vfs_label> and
+C<guestfs_vfs_uuid> for each device." };
 ]
 
 (* Non-API meta-commands available only in guestfish.
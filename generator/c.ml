@@ -787,6 +787,17 @@ and generate_internal_actions_h () =
         c_name style
   ) (actions |> non_daemon_functions);
 
+  pr "\n";
+  pr "/* Batch helpers, see src/batch.c. */\n";
+  pr "struct batch;\n";
+  List.iter (
+    fun f ->
+      generate_batch_add_prototype ~single_line:true f;
+      pr ";\n";
+      generate_batch_get_prototype ~single_line:true f;
+      pr ";\n"
+  ) (actions |> daemon_functions |> List.filter (fun { batchable = b } -> b));
+
   pr "\n";
   pr "#endif /* GUESTFS_INTERNAL_ACTIONS_H_ */\n"
 
@@ -1840,6 +1851,13 @@ and generate_client_actions actions () =
 
     let has_filein =
       List.exists (function FileIn _ -> true | _ -> false) args in
+    (* Calls without FileIn or FileOut parameters can be cancelled
+     * by sending a cancel flag to the daemon (see
+     * guestfs_int_cancellable_call_sent in src/proto.c).
+     *)
+    let cancel_by_flag =
+      not (List.exists (function FileIn _ | FileOut _ -> true | _ -> false)
+             args) in
     if has_filein then (
       pr "  uint64_t progress_hint = 0;\n";
       pr "  struct stat progress_stat;\n";
@@ -1873,6 +1891,11 @@ and generate_client_actions actions () =
     pr "  }\n";
     pr "\n";
 
+    if cancel_by_flag then (
+      pr "  guestfs_int_cancellable_call_begin (g);\n";
+      pr "\n"
+    );
+
     (* Send the main header and arguments. *)
     if args_passed_to_daemon = [] && optargs = [] then (
       pr "  serial = guestfs_int_send (g, GUESTFS_PROC_%s, progress_hint, 0,\n"
@@ -1948,6 +1971,8 @@ and generate_client_actions actions () =
     trace_return_error ~indent:4 name style errcode;
     pr "    return %s;\n" (string_of_errcode errcode);
     pr "  }\n";
+    if cancel_by_flag then
+      pr "  guestfs_int_cancellable_call_sent (g);\n";
     pr "\n";
 
     (* Send any additional files (FileIn) requested. *)
@@ -1981,6 +2006,8 @@ and generate_client_actions actions () =
     else
       pr "(xdrproc_t) xdr_guestfs_%s_ret, (char *) &ret" name;
     pr ");\n";
+    if cancel_by_flag then
+      pr "  guestfs_int_cancellable_call_end (g);\n";
 
     pr "  if (r == -1) {\n";
     trace_return_error ~indent:4 name style errcode;
@@ -2223,6 +2250,254 @@ and generate_client_actions_variants () =
       generate_back_compat_wrapper f
   ) (actions |> sort)
 
+(* Prototypes of the batch helpers generated for batchable daemon
+ * functions (see generate_client_actions_batch).  These are
+ * similar to the public prototypes, but with the batch parameter
+ * added, and the call is split into an "add" and a "get" half.
+ *)
+and generate_batch_add_prototype ?(single_line = false)
+    { name = name; c_name = c_name; style = _, args, optargs } =
+  pr "int";
+  if single_line then pr " " else pr "\n";
+  pr "guestfs_int_batch_add_%s (guestfs_h *g, struct batch *b" name;
+  List.iter (
+    function
+    | Pathname n | Device n | Dev_or_Path n | String n | OptString n
+    | Key n | GUID n | Mountable n | Mountable_or_Path n ->
+      pr ", const char *%s" n
+    | StringList n | DeviceList n | FilenameList n ->
+      pr ", char *const *%s" n
+    | Bool n | Int n -> pr ", int %s" n
+    | Int64 n -> pr ", int64_t %s" n
+    | BufferIn n -> pr ", const char *%s, size_t %s_size" n n
+    | FileIn _ | FileOut _ | Pointer _ -> assert false
+  ) args;
+  if optargs <> [] then
+    pr ", const struct guestfs_%s_argv *optargs" c_name;
+  pr ")"
+
+and generate_batch_get_prototype ?(single_line = false)
+    { name = name; style = ret, _, _ } =
+  (match ret with
+   | RErr | RInt _ | RBool _ -> pr "int"
+   | RInt64 _ -> pr "int64_t"
+   | RString _ | RBufferOut _ -> pr "char *"
+   | RStringList _ | RHashtable _ -> pr "char **"
+   | RStruct (_, typ) -> pr "struct guestfs_%s *" typ
+   | RStructList (_, typ) -> pr "struct guestfs_%s_list *" typ
+   | RConstString _ | RConstOptString _ -> assert false
+  );
+  (match ret, single_line with
+   | (RErr | RInt _ | RBool _ | RInt64 _), true -> pr " "
+   | _, true -> ()
+   | _, false -> pr "\n"
+  );
+  pr "guestfs_int_batch_get_%s (guestfs_h *g, struct batch *b, size_t i" name;
+  (match ret with
+   | RBufferOut _ -> pr ", size_t *size_r"
+   | _ -> ()
+  );
+  pr ")"
+
+(* Generate the batch helpers for batchable daemon functions.  The
+ * "add" function marshals the arguments and queues the call in the
+ * batch, returning its index.  After guestfs_int_batch_run, the
+ * "get" function returns the result of the call in the same form as
+ * the public API.  See src/batch.c.
+ *)
+and generate_client_actions_batch () =
+  generate_header CStyle LGPLv2plus;
+
+  pr "\
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <rpc/types.h>
+#include <rpc/xdr.h>
+
+#include \"guestfs.h\"
+#include \"guestfs-internal.h\"
+#include \"guestfs-internal-actions.h\"
+#include \"guestfs_protocol.h\"
+
+";
+
+  let generate_batch_add ({ name = name; c_name = c_name;
+                            style = ret, args, optargs } as f) =
+    generate_batch_add_prototype f;
+    pr "\n";
+    pr "{\n";
+    if optargs <> [] then (
+      pr "  struct guestfs_%s_argv optargs_null;\n" c_name;
+      pr "  if (!optargs) {\n";
+      pr "    optargs_null.bitmask = 0;\n";
+      pr "    optargs = &optargs_null;\n";
+      pr "  }\n";
+      pr "\n"
+    );
+    let has_args = args <> [] || optargs <> [] in
+    if has_args then (
+      pr "  struct guestfs_%s_args args;\n" name;
+      pr "\n"
+    );
+
+    List.iter (
+      function
+      | Pathname n | Device n | Mountable n | Dev_or_Path n
+      | Mountable_or_Path n | String n
+      | Key n | GUID n ->
+        pr "  args.%s = (char *) %s;\n" n n
+      | OptString n ->
+        pr "  args.%s = %s ? (char **) &%s : NULL;\n" n n n
+      | StringList n | DeviceList n | FilenameList n ->
+        pr "  args.%s.%s_val = (char **) %s;\n" n n n;
+        pr "  for (args.%s.%s_len = 0; %s[args.%s.%s_len]; args.%s.%s_len++) ;\n" n n n n n n n;
+      | Bool n | Int n | Int64 n ->
+        pr "  args.%s = %s;\n" n n
+      | BufferIn n ->
+        pr "  args.%s.%s_val = (char *) %s;\n" n n n;
+        pr "  args.%s.%s_len = %s_size;\n" n n n
+      | FileIn _ | FileOut _ | Pointer _ -> assert false
+    ) args;
+
+    List.iter (
+      fun argt ->
+        let n = name_of_optargt argt in
+        pr "  if (optargs->bitmask & GUESTFS_%s_%s_BITMASK) {\n"
+          (String.uppercase c_name) (String.uppercase n);
+        (match argt with
+        | OBool n
+        | OInt n
+        | OInt64 n ->
+          pr "    args.%s = optargs->%s;\n" n n;
+          pr "  } else {\n";
+          pr "    args.%s = 0;\n" n;
+          pr "  }\n";
+        | OString n ->
+          pr "    args.%s = (char *) optargs->%s;\n" n n;
+          pr "  } else {\n";
+          pr "    args.%s = (char *) \"\";\n" n;
+          pr "  }\n";
+        | OStringList n ->
+          pr "    args.%s.%s_val = (char **) optargs->%s;\n" n n n;
+          pr "    for (args.%s.%s_len = 0; optargs->%s[args.%s.%s_len]; args.%s.%s_len++) ;\n" n n n n n n n;
+          pr "  } else {\n";
+          pr "    args.%s.%s_len = 0;\n" n n;
+          pr "    args.%s.%s_val = NULL;\n" n n;
+          pr "  }\n";
+        )
+    ) optargs;
+    if has_args then pr "\n";
+
+    pr "  return guestfs_int_batch_add (g, b, GUESTFS_PROC_%s, %s,\n"
+      (String.uppercase name)
+      (if optargs <> [] then "optargs->bitmask" else "0");
+    if has_args then
+      pr "                                (xdrproc_t) xdr_guestfs_%s_args, (char *) &args,\n" name
+    else
+      pr "                                NULL, NULL,\n";
+    (match ret with
+     | RErr ->
+       pr "                                NULL, 0);\n"
+     | _ ->
+       pr "                                (xdrproc_t) xdr_guestfs_%s_ret,\n" name;
+       pr "                                sizeof (struct guestfs_%s_ret));\n" name
+    );
+    pr "}\n";
+    pr "\n"
+
+  and generate_batch_get ({ name = name; style = ret, _, _ } as f) =
+    let errcode =
+      match errcode_of_ret ret with
+      | `CannotReturnError -> assert false
+      | (`ErrorIsMinusOne | `ErrorIsNULL) as e -> e in
+
+    generate_batch_get_prototype f;
+    pr "\n";
+    pr "{\n";
+    (match ret with
+     | RErr ->
+       pr "  if (guestfs_int_batch_get (g, b, i, GUESTFS_PROC_%s, \"%s\",\n"
+         (String.uppercase name) name;
+       pr "                             NULL) == -1)\n";
+       pr "    return %s;\n" (string_of_errcode errcode);
+       pr "\n";
+       pr "  return 0;\n"
+     | _ ->
+       pr "  struct guestfs_%s_ret ret;\n" name;
+       pr "\n";
+       pr "  if (guestfs_int_batch_get (g, b, i, GUESTFS_PROC_%s, \"%s\",\n"
+         (String.uppercase name) name;
+       pr "                             (char *) &ret) == -1)\n";
+       pr "    return %s;\n" (string_of_errcode errcode);
+       pr "\n";
+       (match ret with
+        | RErr -> assert false
+        | RInt n | RInt64 n | RBool n ->
+          pr "  return ret.%s;\n" n
+        | RConstString _ | RConstOptString _ -> assert false
+        | RString n ->
+          pr "  return ret.%s; /* caller will free */\n" n
+        | RStringList n | RHashtable n ->
+          pr "  /* caller will free this, but we need to add a NULL entry */\n";
+          pr "  ret.%s.%s_val =\n" n n;
+          pr "    safe_realloc (g, ret.%s.%s_val,\n" n n;
+          pr "                  sizeof (char *) * (ret.%s.%s_len + 1));\n"
+            n n;
+          pr "  ret.%s.%s_val[ret.%s.%s_len] = NULL;\n" n n n n;
+          pr "  return ret.%s.%s_val;\n" n n
+        | RStruct (n, _) | RStructList (n, _) ->
+          pr "  /* caller will free this */\n";
+          pr "  return safe_memdup (g, &ret.%s, sizeof (ret.%s));\n" n n
+        | RBufferOut n ->
+          pr "  /* See the comment about RBufferOut in the daemon stubs. */\n";
+          pr "  *size_r = ret.%s.%s_len;\n" n n;
+          pr "  if (ret.%s.%s_len > 0)\n" n n;
+          pr "    return ret.%s.%s_val; /* caller will free */\n" n n;
+          pr "  free (ret.%s.%s_val);\n" n n;
+          pr "  return safe_malloc (g, 1);\n"
+       )
+    );
+    pr "}\n";
+    pr "\n"
+  in
+
+  List.iter (
+    fun f ->
+      generate_batch_add f;
+      generate_batch_get f
+  ) (actions |> daemon_functions |> List.filter (fun { batchable = b } -> b))
+
+(* Names of daemon procedures, used by the call statistics
+ * (src/call-stats.c).
+ *)
+and generate_client_proc_names () =
+  generate_header CStyle LGPLv2plus;
+
+  pr "\
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include \"guestfs.h\"
+#include \"guestfs-internal.h\"
+#include \"guestfs_protocol.h\"
+
+/* This array is indexed by proc_nr.  See guestfs_protocol.x. */
+const char *const guestfs_int_proc_names[GUESTFS_MAX_PROC_NR+1] = {
+";
+  List.iter (
+    function
+    | { name = name; proc_nr = Some proc_nr } ->
+      pr "  [%d] = \"%s\",\n" proc_nr name
+    | { proc_nr = None } -> assert false
+  ) (actions |> daemon_functions);
+  pr "};\n"
+
 (* Code for turning events and event bitmasks into printable strings. *)
 and generate_event_string_c () =
   generate_header CStyle LGPLv2plus;
@@ -25,7 +25,9 @@ val generate_c_call_args : ?handle:string -> ?implicit_size_ptr:string -> ?in_da
 val generate_actions_pod : unit -> unit
 val generate_availability_pod : unit -> unit
 val generate_client_actions : Types.action list -> unit -> unit
+val generate_client_actions_batch : unit -> unit
 val generate_client_actions_variants : unit -> unit
+val generate_client_proc_names : unit -> unit
 val generate_client_structs_cleanup : unit -> unit
 val generate_client_structs_compare : unit -> unit
 val generate_client_structs_copy : unit -> unit
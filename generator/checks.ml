@@ -247,6 +247,61 @@ let () =
     | { wrapper = true } -> ()
   ) (actions |> daemon_functions);
 
+  (* Batchable functions must be daemon functions which don't
+   * transfer files, since the whole batch is sent in one message.
+   *)
+  List.iter (
+    function
+    | { name = name; batchable = true; proc_nr = None } ->
+      failwithf "%s: batchable flag can only be used on daemon functions"
+        name
+    | { name = name; batchable = true; style = _, args, _ } ->
+      if List.exists (function FileIn _ | FileOut _ -> true | _ -> false) args
+      then
+        failwithf "%s: batchable function cannot have FileIn or FileOut parameters"
+          name
+    | { batchable = false } -> ()
+  ) actions;
+
+  (* Read-only functions must be daemon functions.  Batchable
+   * functions must be read-only, since the daemon may run them more
+   * than once.
+   *)
+  List.iter (
+    function
+    | { name = name; read_only = true; proc_nr = None } ->
+      failwithf "%s: read_only flag can only be used on daemon functions"
+        name
+    | { name = name; batchable = true; read_only = false } ->
+      failwithf "%s: batchable function must also be read_only" name
+    | _ -> ()
+  ) actions;
+
+  (* Concurrent functions run in worker threads alongside each other
+   * (see daemon/proto.c), so they must be read-only and they must not
+   * use the socket except to send their reply.  That rules out
+   * progress messages (including pulse mode, which relies on a
+   * process-wide timer) and cancellation, since workers never read
+   * from the socket.  Long-running functions which call
+   * pulse_mode_start, notify_progress or cancel_requested in the
+   * daemon must be marked progress and must not be concurrent.
+   *)
+  List.iter (
+    function
+    | { name = name; concurrent = true; read_only = false } ->
+      failwithf "%s: concurrent function must also be read_only" name
+    | { name = name; concurrent = true; progress = true } ->
+      failwithf "%s: concurrent function cannot send progress messages" name
+    | { name = name; concurrent = true; cancellable = true } ->
+      failwithf "%s: concurrent function cannot be cancellable" name
+    | { name = name; concurrent = true; style = _, args, _ } ->
+      if List.exists (function FileIn _ | FileOut _ -> true | _ -> false) args
+      then
+        failwithf "%s: concurrent function cannot have FileIn or FileOut parameters"
+          name
+    | { concurrent = false } -> ()
+  ) actions;
+
   (* Non-fish functions must have correct camel_name. *)
   List.iter (
     fun { name = name; camel_name = camel_name } ->
@@ -550,7 +550,66 @@ let generate_daemon_dispatch () =
   pr "      reply_with_error (\"dispatch_incoming_message: unknown procedure number %%d, set LIBGUESTFS_PATH to point to the matching libguestfs appliance directory\", proc_nr);\n";
   pr "  }\n";
   pr "}\n";
-  pr "\n"
+  pr "\n";
+
+  (* Procedures which may be called from internal_batch. *)
+  pr "int\n";
+  pr "is_batchable_proc (int proc)\n";
+  pr "{\n";
+  pr "  switch (proc) {\n";
+
+  List.iter (
+    function
+    | { name = name; batchable = true } ->
+      pr "    case GUESTFS_PROC_%s:\n" (String.uppercase name)
+    | { batchable = false } -> ()
+  ) (actions |> daemon_functions);
+
+  pr "      return 1;\n";
+  pr "    default:\n";
+  pr "      return 0;\n";
+  pr "  }\n";
+  pr "}\n";
+  pr "\n";
+
+  (* Procedures which don't change the disks or the daemon state. *)
+  pr "int\n";
+  pr "is_read_only_proc (int proc)\n";
+  pr "{\n";
+  pr "  switch (proc) {\n";
+
+  List.iter (
+    function
+    | { name = name; read_only = true } ->
+      pr "    case GUESTFS_PROC_%s:\n" (String.uppercase name)
+    | { read_only = false } -> ()
+  ) (actions |> daemon_functions);
+
+  pr "      return 1;\n";
+  pr "    default:\n";
+  pr "      return 0;\n";
+  pr "  }\n";
+  pr "}\n";
+  pr "\n";
+
+  (* Procedures which may run in the worker threads. *)
+  pr "int\n";
+  pr "is_concurrent_proc (int proc)\n";
+  pr "{\n";
+  pr "  switch (proc) {\n";
+
+  List.iter (
+    function
+    | { name = name; concurrent = true } ->
+      pr "    case GUESTFS_PROC_%s:\n" (String.uppercase name)
+    | { concurrent = false } -> ()
+  ) (actions |> daemon_functions);
+
+  pr "      return 1;\n";
+  pr "    default:\n";
+  pr "      return 0;\n";
+  pr "  }\n";
+  pr "}\n"
 
 let generate_daemon_lvm_tokenization () =
   generate_header CStyle GPLv2plus;
@@ -676,10 +735,10 @@ let generate_daemon_lvm_tokenization () =
         pr "  ret->guestfs_int_lvm_%s_list_len = 0;\n" typ;
         pr "  ret->guestfs_int_lvm_%s_list_val = NULL;\n" typ;
         pr "\n";
-        pr "  r = command (&out, &err,\n";
-        pr "	       \"lvm\", \"%ss\",\n" typ;
-        pr "	       \"-o\", lvm_%s_cols, \"--unbuffered\", \"--noheadings\",\n" typ;
-        pr "	       \"--nosuffix\", \"--separator\", \"\\r\", \"--units\", \"b\", NULL);\n";
+        pr "  r = commandf (&out, &err, COMMAND_FLAG_CACHE,\n";
+        pr "		\"lvm\", \"%ss\",\n" typ;
+        pr "		\"-o\", lvm_%s_cols, \"--unbuffered\", \"--noheadings\",\n" typ;
+        pr "		\"--nosuffix\", \"--separator\", \"\\r\", \"--units\", \"b\", NULL);\n";
         pr "  if (r == -1) {\n";
         pr "    reply_with_error (\"%%s\", err);\n";
         pr "    free (out);\n";
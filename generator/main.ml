@@ -116,7 +116,9 @@ Run it from the top source directory using the command
   output_to "src/structs-cleanup.c" generate_client_structs_cleanup;
   output_to "src/structs-print.c" generate_client_structs_print_c;
   output_to "src/structs-print.h" generate_client_structs_print_h;
+  output_to "src/actions-batch.c" generate_client_actions_batch;
   output_to "src/actions-variants.c" generate_client_actions_variants;
+  output_to "src/proc-names.c" generate_client_proc_names;
   output_to_subset "src/actions-%d.c" generate_client_actions;
   output_to "daemon/actions.h" generate_daemon_actions_h;
   output_to "daemon/stubs.h" generate_daemon_stubs_h;
@@ -468,6 +468,66 @@ let structs = [
     ];
     s_camel_name = "TSKDirent" };
 
+  (* Per-procedure call statistics. *)
+  { defaults with
+    s_name = "call_stat";
+    s_cols = [
+    "cs_proc_nr", FInt32;
+    "cs_name", FString;
+    "cs_calls", FUInt64;
+    "cs_errors", FUInt64;
+    "cs_total_usec", FUInt64;
+    "cs_p50_usec", FUInt64;
+    "cs_p99_usec", FUInt64;
+    "cs_bytes_sent", FUInt64;
+    "cs_bytes_received", FUInt64;
+    "cs_daemon_calls", FUInt64;
+    "cs_daemon_usec", FUInt64;
+    ];
+    s_camel_name = "CallStat" };
+
+  (* Entry returned by guestfs_walk.  Extended attributes follow the
+   * entry they belong to, with we_attrname set.
+   *)
+  { defaults with
+    s_name = "walk_entry";
+    s_cols = [
+    "we_path", FString;
+    "we_st_dev", FInt64;
+    "we_st_ino", FInt64;
+    "we_st_mode", FInt64;
+    "we_st_nlink", FInt64;
+    "we_st_uid", FInt64;
+    "we_st_gid", FInt64;
+    "we_st_rdev", FInt64;
+    "we_st_size", FInt64;
+    "we_st_blksize", FInt64;
+    "we_st_blocks", FInt64;
+    "we_st_atime_sec", FInt64;
+    "we_st_atime_nsec", FInt64;
+    "we_st_mtime_sec", FInt64;
+    "we_st_mtime_nsec", FInt64;
+    "we_st_ctime_sec", FInt64;
+    "we_st_ctime_nsec", FInt64;
+    "we_link", FString;
+    "we_attrname", FString;
+    "we_attrval", FBuffer;
+    "we_spare1", FInt64;
+    ];
+    s_camel_name = "WalkEntry" };
+
+  (* Result of guestfs_vfs_probe_list. *)
+  { defaults with
+    s_name = "vfs_probe";
+    s_cols = [
+    "vp_device", FString;
+    "vp_type", FString;
+    "vp_label", FString;
+    "vp_uuid", FString;
+    "vp_partuuid", FString;
+    ];
+    s_camel_name = "VFSProbe" };
+
 ] (* end of structs *)
 
 let lookup_struct name =
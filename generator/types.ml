@@ -385,6 +385,31 @@ type action = {
                                      checks arguments and deals with trace
                                      messages.  Set this to false for functions
                                      that have to be thread-safe. *)
+  batchable : bool;               (* For daemon functions, generate
+                                     guestfs_int_batch_add_<name> and
+                                     guestfs_int_batch_get_<name> so that
+                                     library code can queue many calls
+                                     and send them in one round trip
+                                     (see src/batch.c).  Only set this
+                                     on functions without side effects,
+                                     since the daemon may have to run
+                                     them more than once. *)
+  read_only : bool;               (* For daemon functions, the function
+                                     doesn't change the disks, the
+                                     mounted filesystems or any other
+                                     daemon state.  The daemon uses this
+                                     to decide when cached information
+                                     about devices (see
+                                     daemon/command.c) is still valid. *)
+  concurrent : bool;              (* For daemon functions, the daemon may
+                                     run the function in a worker thread
+                                     at the same time as other concurrent
+                                     functions (see daemon/proto.c).  It
+                                     must be read_only, and must not
+                                     transfer files, send progress
+                                     messages or use global daemon state
+                                     such as the Augeas, hivex or journal
+                                     handles. *)
 
   (* "Internal" data attached by the generator at various stages.  This
    * doesn't need to (and shouldn't) be set when defining actions.
@@ -243,14 +243,33 @@ struct guestfs_message_header {
   guestfs_message_status status;
 };
 
+/* Size of file transfer chunks, unless the library and daemon have
+ * agreed on a larger size (see internal_set_chunk_size).  A chunk
+ * and its header must fit in GUESTFS_MESSAGE_MAX.
+ */
 const GUESTFS_MAX_CHUNK_SIZE = 8192;
+const GUESTFS_MAX_NEGOTIATED_CHUNK_SIZE = 2097152;
 
 struct guestfs_chunk {
   int cancel;			     /* if non-zero, transfer is cancelled */
   /* data size is 0 bytes if the transfer has finished successfully */
-  opaque data<GUESTFS_MAX_CHUNK_SIZE>;
+  opaque data<GUESTFS_MAX_NEGOTIATED_CHUNK_SIZE>;
 };
 
+/* A chunk with 'cancel' set to this value is a hole: it stands for
+ * a run of zero bytes, and 'data' is the length of the run encoded
+ * as an XDR unsigned hyper.  Hole chunks are only sent after the
+ * library has called internal_enable_hole_chunks.
+ */
+const GUESTFS_CHUNK_HOLE = 2;
+
+/* A chunk with 'cancel' set to this value carries data compressed
+ * with zlib.  The uncompressed data is never larger than the
+ * negotiated chunk size.  Compressed chunks are only sent after the
+ * library has called internal_enable_compressed_chunks.
+ */
+const GUESTFS_CHUNK_COMPRESSED = 3;
+
 /* Progress notifications.  Daemon self-limits these messages to
  * at most one per second.  The daemon can send these messages
  * at any time, and the caller should discard unexpected messages.
@@ -126,3 +126,12 @@ AC_CHECK_LIB([tsk],[tsk_version_print],[
         AC_DEFINE([HAVE_LIBTSK], [1], [Define to 1 if The Sleuth Kit library (libtsk) is available.])
     ], [])
 ],[AC_MSG_WARN([The Sleuth Kit library (libtsk) not found])])
+
+dnl libblkid library (optional)
+dnl If not available the daemon runs the blkid program instead.
+PKG_CHECK_MODULES([BLKID], [blkid],[
+    AC_SUBST([BLKID_CFLAGS])
+    AC_SUBST([BLKID_LIBS])
+    AC_DEFINE([HAVE_BLKID],[1],[libblkid found at compile time.])
+],
+    [AC_MSG_WARN([libblkid not found, the daemon will run the blkid program instead])])
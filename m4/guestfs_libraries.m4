@@ -58,6 +58,7 @@ AC_CHECK_HEADERS([\
 dnl Functions.
 AC_CHECK_FUNCS([\
     be32toh \
+    copy_file_range \
     fsync \
     futimens \
     getxattr \
@@ -74,13 +75,15 @@ AC_CHECK_FUNCS([\
     ntohs \
     posix_fallocate \
     posix_fadvise \
+    posix_spawnp \
     removexattr \
     setitimer \
     setrlimit \
     setxattr \
     sigaction \
     statvfs \
-    sync])
+    sync \
+    unshare])
 
 dnl Check for UNIX_PATH_MAX, creating a custom one if not available.
 AC_MSG_CHECKING([for UNIX_PATH_MAX])
@@ -267,6 +270,14 @@ LIBS="$old_LIBS"
 dnl Check for yajl JSON library (required).
 PKG_CHECK_MODULES([YAJL], [yajl >= 2.0.4])
 
+dnl Check for zlib (optional, used to compress file transfers).
+PKG_CHECK_MODULES([ZLIB], [zlib],[
+    AC_SUBST([ZLIB_CFLAGS])
+    AC_SUBST([ZLIB_LIBS])
+    AC_DEFINE([HAVE_ZLIB],[1],[zlib found at compile time.])
+],
+    [AC_MSG_WARN([zlib not found, file transfers will not be compressed])])
+
 dnl Check for C++ (optional, we just use this to test the header works).
 AC_PROG_CXX
 
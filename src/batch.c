@@ -0,0 +1,419 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * Batches of daemon calls which are sent in a single round trip.
+ *
+ * Library code which has to make many small, independent daemon calls
+ * (eg. the inspection code testing for the existence of dozens of
+ * files) can queue them in a batch:
+ *
+ *  struct batch *b = guestfs_int_new_batch (g);
+ *  i = guestfs_int_batch_add_is_file (g, b, "/etc/fstab", NULL);
+ *  j = guestfs_int_batch_add_is_dir (g, b, "/etc", NULL);
+ *  ...
+ *  guestfs_int_batch_run (g, b);
+ *  r = guestfs_int_batch_get_is_file (g, b, i);
+ *  ...
+ *  guestfs_int_free_batch (b);
+ *
+ * The C<guestfs_int_batch_add_*> and C<guestfs_int_batch_get_*>
+ * functions are generated for each daemon function which is marked
+ * C<batchable> in F<generator/actions.ml>.
+ *
+ * Each call is encoded when it is added, exactly as it would be sent
+ * on the socket.  C<guestfs_int_batch_run> sends all the requests to
+ * the daemon using C<internal_batch>, and the daemon returns all the
+ * replies together.  If the replies don't fit in one message the
+ * daemon stops early and the remaining requests are sent again.
+ *
+ * Appliances older than the C<internal_batch> call are handled by
+ * sending the requests one at a time.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <rpc/types.h>
+#include <rpc/xdr.h>
+
+#include "guestfs.h"
+#include "guestfs-internal.h"
+#include "guestfs_protocol.h"
+#include "errnostring.h"
+
+/* Leave some space for the header of the internal_batch request. */
+#define BATCH_REQUESTS_MAX (GUESTFS_MESSAGE_MAX - 1024)
+
+struct batch_entry {
+  int proc_nr;
+  int serial;
+  xdrproc_t xdr_ret;
+  size_t ret_size;
+  size_t offset;                /* Encoded request in b->requests. */
+  size_t len;
+
+  bool done;                    /* Reply has been received. */
+  char *ret;                    /* Reply struct, if the call succeeded. */
+  char *error;                  /* Error message, if the call failed. */
+  int errnum;
+};
+
+struct batch {
+  struct batch_entry *entries;
+  size_t nr_entries;
+  size_t alloc;
+
+  char *requests;               /* Concatenated encoded requests. */
+  size_t requests_len;
+  size_t requests_size;
+};
+
+/**
+ * Create a new, empty batch.
+ */
+struct batch *
+guestfs_int_new_batch (guestfs_h *g)
+{
+  return safe_calloc (g, 1, sizeof (struct batch));
+}
+
+/**
+ * Free a batch, including any results which have not been fetched.
+ */
+void
+guestfs_int_free_batch (struct batch *b)
+{
+  size_t i;
+
+  if (b == NULL)
+    return;
+
+  for (i = 0; i < b->nr_entries; ++i) {
+    struct batch_entry *e = &b->entries[i];
+
+    if (e->ret) {
+      xdr_free (e->xdr_ret, e->ret);
+      free (e->ret);
+    }
+    free (e->error);
+  }
+  free (b->entries);
+  free (b->requests);
+  free (b);
+}
+
+/**
+ * Encode a call and add it to the batch.  This is called by the
+ * generated C<guestfs_int_batch_add_*> functions.
+ *
+ * Returns the index of the call in the batch, or C<-1> on error.
+ */
+int
+guestfs_int_batch_add (guestfs_h *g, struct batch *b,
+                       int proc_nr, uint64_t optargs_bitmask,
+                       xdrproc_t xdr_args, char *args,
+                       xdrproc_t xdr_ret, size_t ret_size)
+{
+  struct batch_entry *e;
+  const int serial = g->msg_next_serial++;
+  size_t len;
+
+  if (guestfs_int_encode_message (g, proc_nr, serial, 0, optargs_bitmask,
+                                  xdr_args, args, &len) == -1)
+    return -1;
+
+  if (len > BATCH_REQUESTS_MAX) {
+    error (g, _("request is too large to be added to a batch"));
+    return -1;
+  }
+
+  if (b->requests_len + len > b->requests_size) {
+    b->requests_size = MAX (b->requests_size * 2, b->requests_len + len);
+    b->requests = safe_realloc (g, b->requests, b->requests_size);
+  }
+  memcpy (b->requests + b->requests_len, g->msg_out, len);
+
+  if (b->nr_entries >= b->alloc) {
+    b->alloc += 64;
+    b->entries = safe_realloc (g, b->entries,
+                               b->alloc * sizeof (struct batch_entry));
+  }
+  e = &b->entries[b->nr_entries];
+  memset (e, 0, sizeof *e);
+  e->proc_nr = proc_nr;
+  e->serial = serial;
+  e->xdr_ret = xdr_ret;
+  e->ret_size = ret_size;
+  e->offset = b->requests_len;
+  e->len = len;
+
+  b->requests_len += len;
+  return b->nr_entries++;
+}
+
+/* Decode one reply and store it in the matching entry. */
+static int
+store_reply (guestfs_h *g, struct batch *b, size_t first,
+             const char *buf, size_t size)
+{
+  XDR xdr;
+  guestfs_message_header hdr;
+  guestfs_message_error err;
+  struct batch_entry *e = NULL;
+  size_t i;
+
+  xdrmem_create (&xdr, (char *) buf, size, XDR_DECODE);
+
+  memset (&hdr, 0, sizeof hdr);
+  if (!xdr_guestfs_message_header (&xdr, &hdr)) {
+    error (g, "%s: failed to parse reply header", "internal_batch");
+    xdr_destroy (&xdr);
+    return -1;
+  }
+
+  for (i = first; i < b->nr_entries; ++i) {
+    if (!b->entries[i].done && (unsigned) b->entries[i].serial == hdr.serial) {
+      e = &b->entries[i];
+      break;
+    }
+  }
+  if (e == NULL) {
+    error (g, "%s: reply with unexpected serial (%u)",
+           "internal_batch", hdr.serial);
+    xdr_destroy (&xdr);
+    return -1;
+  }
+  if (guestfs_int_check_reply_header (g, &hdr, e->proc_nr, e->serial) == -1) {
+    xdr_destroy (&xdr);
+    return -1;
+  }
+  /* Only counts replies to requests sent by run_sequentially. */
+  guestfs_int_stats_reply_received (g, &hdr, size);
+
+  if (hdr.status == GUESTFS_STATUS_ERROR) {
+    memset (&err, 0, sizeof err);
+    if (!xdr_guestfs_message_error (&xdr, &err)) {
+      error (g, "%s: failed to parse reply error", "internal_batch");
+      xdr_destroy (&xdr);
+      return -1;
+    }
+    if (err.errno_string[0] != '\0')
+      e->errnum = guestfs_int_string_to_errno (err.errno_string);
+    e->error = err.error_message; /* steal the string */
+    free (err.errno_string);
+  } else if (e->xdr_ret) {
+    e->ret = safe_calloc (g, 1, e->ret_size);
+    if (!e->xdr_ret (&xdr, e->ret, 0)) {
+      error (g, "%s: failed to parse reply", "internal_batch");
+      xdr_free (e->xdr_ret, e->ret);
+      free (e->ret);
+      e->ret = NULL;
+      xdr_destroy (&xdr);
+      return -1;
+    }
+  }
+  xdr_destroy (&xdr);
+
+  e->done = true;
+  return 0;
+}
+
+/* Send the requests from entry 'first' onwards in one internal_batch
+ * call, as many as will fit.  Returns 0 if at least one reply was
+ * stored, or -1 if internal_batch failed.
+ */
+static int
+run_batch (guestfs_h *g, struct batch *b, size_t first)
+{
+  const size_t offset = b->entries[first].offset;
+  size_t i, len = 0, pos = 0, nr_replies = 0;
+  CLEANUP_FREE char *replies = NULL;
+  size_t replies_size;
+
+  for (i = first; i < b->nr_entries; ++i) {
+    if (len + b->entries[i].len > BATCH_REQUESTS_MAX)
+      break;
+    len += b->entries[i].len;
+  }
+
+  /* Old daemons don't have this call, so don't print the error. */
+  guestfs_push_error_handler (g, NULL, NULL);
+  replies = guestfs_internal_batch (g, b->requests + offset, len,
+                                    &replies_size);
+  guestfs_pop_error_handler (g);
+  if (replies == NULL)
+    return -1;
+
+  while (pos < replies_size) {
+    XDR xdr;
+    uint32_t size;
+
+    if (replies_size - pos < 4) {
+      error (g, "%s: truncated reply", "internal_batch");
+      return -1;
+    }
+    xdrmem_create (&xdr, replies + pos, 4, XDR_DECODE);
+    xdr_uint32_t (&xdr, &size);
+    xdr_destroy (&xdr);
+    pos += 4;
+
+    if (size > replies_size - pos) {
+      error (g, "%s: truncated reply", "internal_batch");
+      return -1;
+    }
+    if (store_reply (g, b, first, replies + pos, size) == -1)
+      return -1;
+    pos += size;
+    nr_replies++;
+  }
+
+  if (nr_replies == 0) {
+    error (g, "%s: no replies", "internal_batch");
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Fall back to sending the requests one at a time. */
+static int
+run_sequentially (guestfs_h *g, struct batch *b, size_t first)
+{
+  size_t i;
+
+  for (i = first; i < b->nr_entries; ++i) {
+    struct batch_entry *e = &b->entries[i];
+    uint32_t size;
+    void *buf;
+    int r;
+
+    if (e->done)
+      continue;
+
+    if (guestfs_int_send_encoded (g, b->requests + e->offset, e->len) == -1)
+      return -1;
+    guestfs_int_stats_request_sent (g, e->proc_nr, e->serial, e->len);
+
+  again:
+    if (guestfs_int_recv_from_daemon (g, &size, &buf) == -1)
+      return -1;
+
+    /* See comment in guestfs_int_recv. */
+    if (size == GUESTFS_CANCEL_FLAG)
+      goto again;
+
+    if (size == GUESTFS_LAUNCH_FLAG) {
+      error (g, "%s: received unexpected launch flag from daemon when expecting reply", "internal_batch");
+      return -1;
+    }
+
+    r = store_reply (g, b, i, buf, size);
+    free (buf);
+    if (r == -1)
+      return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Send all the calls in the batch to the daemon, and collect the
+ * replies.  The results are fetched afterwards using the generated
+ * C<guestfs_int_batch_get_*> functions.
+ *
+ * Returns C<0> on success.  Note that this succeeds even if some of
+ * the individual calls failed.  On protocol or connection errors,
+ * this returns C<-1>.
+ */
+int
+guestfs_int_batch_run (guestfs_h *g, struct batch *b)
+{
+  size_t first = 0;
+
+  if (guestfs_int_check_appliance_up (g, "internal_batch") == -1)
+    return -1;
+
+  for (;;) {
+    /* The daemon runs the requests in order, stopping if the replies
+     * won't fit in one message.  Send the rest again.
+     */
+    while (first < b->nr_entries && b->entries[first].done)
+      first++;
+    if (first == b->nr_entries)
+      return 0;
+
+    if (g->no_internal_batch)
+      return run_sequentially (g, b, first);
+
+    if (run_batch (g, b, first) == -1) {
+      /* If the connection was lost, the error has been set. */
+      if (g->state != READY)
+        return -1;
+
+      debug (g, "internal_batch failed, sending requests one at a time");
+      g->no_internal_batch = true;
+    }
+  }
+}
+
+/**
+ * Fetch the reply to call C<i> in the batch.  This is called by the
+ * generated C<guestfs_int_batch_get_*> functions.
+ *
+ * On success the reply struct is copied to C<ret> (if not C<NULL>),
+ * and the caller becomes responsible for freeing it, exactly as if
+ * the struct had been filled in by C<guestfs_int_recv>.  If the call
+ * failed, the error is set on the handle and this returns C<-1>.
+ */
+int
+guestfs_int_batch_get (guestfs_h *g, struct batch *b, size_t i,
+                       int proc_nr, const char *fn, char *ret)
+{
+  struct batch_entry *e;
+
+  if (i >= b->nr_entries || b->entries[i].proc_nr != proc_nr) {
+    error (g, "%s: invalid batch index %zu", fn, i);
+    return -1;
+  }
+  e = &b->entries[i];
+
+  if (!e->done) {
+    error (g, "%s: call in batch was not run", fn);
+    return -1;
+  }
+
+  if (e->error) {
+    if (e->errnum <= 0)
+      error (g, "%s: %s", fn, e->error);
+    else
+      guestfs_int_error_errno (g, e->errnum, "%s: %s", fn, e->error);
+    return -1;
+  }
+
+  if (ret && e->ret) {
+    memcpy (ret, e->ret, e->ret_size);
+    free (e->ret);
+    e->ret = NULL;
+  }
+
+  return 0;
+}
@@ -0,0 +1,393 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * Implementation of L<guestfs(3)/guestfs_download_changed_blocks>, which
+ * compares two block hash manifests (see
+ * L<guestfs(3)/guestfs_block_hash_manifest>) and downloads only the
+ * blocks which differ.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "guestfs.h"
+#include "guestfs-internal.h"
+#include "guestfs-internal-actions.h"
+#include "guestfs_protocol.h"
+
+/* Maximum size of each pread request, well within the protocol limit. */
+#define FETCH_MAX (2 * 1024 * 1024)
+
+/* Number of pread requests which are pipelined together. */
+#define FETCH_BATCH 32
+
+/* An open manifest file, and the current entry in it. */
+struct manifest {
+  const char *filename;
+  FILE *fp;
+  char *line;
+  size_t allocated;
+
+  /* From the header line. */
+  int blocksize;
+  char csumtype[32];
+  uint64_t size;
+
+  /* Current entry. */
+  bool eof;
+  bool have_entry;              /* False until the first entry is read. */
+  uint64_t offset;
+  char csum[129];
+};
+
+/* Read the next entry.  The entries must be in increasing order of
+ * offset, since the two manifests are merged as they are read.
+ */
+static int
+next_entry (guestfs_h *g, struct manifest *m)
+{
+  const uint64_t prev_offset = m->offset;
+
+  if (getline (&m->line, &m->allocated, m->fp) == -1) {
+    if (ferror (m->fp)) {
+      perrorf (g, "read: %s", m->filename);
+      return -1;
+    }
+    m->eof = true;
+    return 0;
+  }
+
+  if (sscanf (m->line, "%" SCNu64 " %128s", &m->offset, m->csum) != 2 ||
+      m->offset % m->blocksize != 0) {
+    error (g, _("%s: invalid line in manifest: %s"), m->filename, m->line);
+    return -1;
+  }
+  if (m->have_entry && m->offset <= prev_offset) {
+    error (g, _("%s: manifest entries are not in order: %s"),
+           m->filename, m->line);
+    return -1;
+  }
+  m->have_entry = true;
+  return 0;
+}
+
+static int
+open_manifest (guestfs_h *g, struct manifest *m, const char *filename)
+{
+  m->filename = filename;
+  m->fp = fopen (filename, "r");
+  if (m->fp == NULL) {
+    perrorf (g, "open: %s", filename);
+    return -1;
+  }
+
+  if (getline (&m->line, &m->allocated, m->fp) == -1 ||
+      sscanf (m->line, "# blocksize %d csumtype %31s size %" SCNu64,
+              &m->blocksize, m->csumtype, &m->size) != 3 ||
+      m->blocksize <= 0) {
+    error (g, _("%s: not a block hash manifest"), filename);
+    return -1;
+  }
+
+  return next_entry (g, m);
+}
+
+static void
+close_manifest (struct manifest *m)
+{
+  if (m->fp)
+    fclose (m->fp);
+  free (m->line);
+}
+
+/* Ranges of the device waiting to be downloaded to the local file. */
+struct fetch {
+  const char *device;
+  bool is_dev;
+  const char *filename;
+  int fd;
+  size_t nr;
+  uint64_t offsets[FETCH_BATCH];
+  size_t counts[FETCH_BATCH];
+};
+
+static int
+pwrite_all (guestfs_h *g, int fd, const char *filename,
+            const char *buf, size_t count, uint64_t offset)
+{
+  ssize_t r;
+
+  while (count > 0) {
+    r = pwrite (fd, buf, count, offset);
+    if (r == -1) {
+      perrorf (g, "write: %s", filename);
+      return -1;
+    }
+    buf += r;
+    count -= r;
+    offset += r;
+  }
+  return 0;
+}
+
+/* Download the pending ranges, pipelining the pread calls, and write
+ * them to the local file.
+ */
+static int
+fetch_flush (guestfs_h *g, struct fetch *f)
+{
+  struct pipelined_call calls[FETCH_BATCH];
+  struct guestfs_pread_args args[FETCH_BATCH];
+  struct guestfs_pread_device_args dev_args[FETCH_BATCH];
+  struct guestfs_pread_ret rets[FETCH_BATCH];
+  struct guestfs_pread_device_ret dev_rets[FETCH_BATCH];
+  size_t i;
+  int r;
+
+  if (f->nr == 0)
+    return 0;
+
+  memset (calls, 0, sizeof calls);
+  memset (rets, 0, sizeof rets);
+  memset (dev_rets, 0, sizeof dev_rets);
+
+  for (i = 0; i < f->nr; ++i) {
+    if (f->is_dev) {
+      dev_args[i].device = (char *) f->device;
+      dev_args[i].count = f->counts[i];
+      dev_args[i].offset = f->offsets[i];
+      calls[i].proc_nr = GUESTFS_PROC_PREAD_DEVICE;
+      calls[i].xdr_args = (xdrproc_t) xdr_guestfs_pread_device_args;
+      calls[i].args = (char *) &dev_args[i];
+      calls[i].xdr_ret = (xdrproc_t) xdr_guestfs_pread_device_ret;
+      calls[i].ret = (char *) &dev_rets[i];
+    }
+    else {
+      args[i].path = (char *) f->device;
+      args[i].count = f->counts[i];
+      args[i].offset = f->offsets[i];
+      calls[i].proc_nr = GUESTFS_PROC_PREAD;
+      calls[i].xdr_args = (xdrproc_t) xdr_guestfs_pread_args;
+      calls[i].args = (char *) &args[i];
+      calls[i].xdr_ret = (xdrproc_t) xdr_guestfs_pread_ret;
+      calls[i].ret = (char *) &rets[i];
+    }
+  }
+
+  r = guestfs_int_call_pipelined (g, f->is_dev ? "pread_device" : "pread",
+                                  calls, f->nr);
+
+  for (i = 0; i < f->nr; ++i) {
+    const char *content;
+    size_t content_len;
+
+    if (f->is_dev) {
+      content = dev_rets[i].content.content_val;
+      content_len = dev_rets[i].content.content_len;
+    }
+    else {
+      content = rets[i].content.content_val;
+      content_len = rets[i].content.content_len;
+    }
+
+    /* pread returns less than was asked for at the end of the
+     * device, which means the device is smaller than the manifest
+     * says.
+     */
+    if (r == 0 && content_len != f->counts[i]) {
+      error (g, _("%s: short read at offset %" PRIu64 ": "
+                  "expected %zu bytes, got %zu"),
+             f->device, f->offsets[i], f->counts[i], content_len);
+      r = -1;
+    }
+    if (r == 0)
+      r = pwrite_all (g, f->fd, f->filename, content, content_len,
+                      f->offsets[i]);
+
+    if (f->is_dev)
+      xdr_free ((xdrproc_t) xdr_guestfs_pread_device_ret,
+                (char *) &dev_rets[i]);
+    else
+      xdr_free ((xdrproc_t) xdr_guestfs_pread_ret, (char *) &rets[i]);
+  }
+
+  f->nr = 0;
+  return r;
+}
+
+/* Queue a range for downloading, merging it with the previous range
+ * if they are contiguous.
+ */
+static int
+fetch_range (guestfs_h *g, struct fetch *f, uint64_t offset, uint64_t len)
+{
+  size_t n;
+
+  while (len > 0) {
+    if (f->nr > 0 &&
+        f->offsets[f->nr-1] + f->counts[f->nr-1] == offset &&
+        f->counts[f->nr-1] < FETCH_MAX) {
+      n = MIN (len, FETCH_MAX - f->counts[f->nr-1]);
+      f->counts[f->nr-1] += n;
+    }
+    else {
+      if (f->nr == FETCH_BATCH && fetch_flush (g, f) == -1)
+        return -1;
+      n = MIN (len, FETCH_MAX);
+      f->offsets[f->nr] = offset;
+      f->counts[f->nr] = n;
+      f->nr++;
+    }
+    offset += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+/* Zero a block of the local file which is now zero on the device. */
+static int
+zero_range (guestfs_h *g, struct fetch *f, uint64_t offset, uint64_t len)
+{
+  CLEANUP_FREE char *zeroes = NULL;
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+  if (fallocate (f->fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+                 offset, len) == 0)
+    return 0;
+#endif
+
+  zeroes = safe_calloc (g, 1, len);
+  return pwrite_all (g, f->fd, f->filename, zeroes, len, offset);
+}
+
+int
+guestfs_impl_download_changed_blocks (guestfs_h *g, const char *device,
+                                      const char *manifest,
+                                      const char *filename,
+                                      const struct guestfs_download_changed_blocks_argv *optargs)
+{
+  CLEANUP_UNLINK_FREE char *tmpfile = NULL;
+  const char *newmanifest = NULL;
+  struct manifest old = { .fp = NULL }, new = { .fp = NULL };
+  struct fetch f = { .device = device, .filename = filename, .fd = -1 };
+  uint64_t blocksize;
+  int ret = -1;
+
+  if (open_manifest (g, &old, manifest) == -1)
+    goto out;
+
+  /* Compute the new manifest.  If the caller wants to keep it then
+   * it is written next to the final file and renamed at the end, so
+   * that newmanifest can be the same file as manifest.
+   */
+  if (optargs->bitmask & GUESTFS_DOWNLOAD_CHANGED_BLOCKS_NEWMANIFEST_BITMASK) {
+    newmanifest = optargs->newmanifest;
+    tmpfile = safe_asprintf (g, "%s.tmp", newmanifest);
+  }
+  else {
+    if (guestfs_int_lazy_make_tmpdir (g) == -1)
+      goto out;
+    tmpfile = safe_asprintf (g, "%s/manifest%d", g->tmpdir, ++g->unique);
+  }
+
+  if (guestfs_block_hash_manifest (g, device, tmpfile,
+                                   GUESTFS_BLOCK_HASH_MANIFEST_BLOCKSIZE,
+                                   old.blocksize,
+                                   GUESTFS_BLOCK_HASH_MANIFEST_CSUMTYPE,
+                                   old.csumtype,
+                                   -1) == -1)
+    goto out;
+
+  if (open_manifest (g, &new, tmpfile) == -1)
+    goto out;
+  blocksize = new.blocksize;
+
+  f.is_dev = STRPREFIX (device, "/dev/");
+  f.fd = open (filename, O_WRONLY|O_CREAT|O_CLOEXEC, 0666);
+  if (f.fd == -1) {
+    perrorf (g, "open: %s", filename);
+    goto out;
+  }
+  if (ftruncate (f.fd, new.size) == -1) {
+    perrorf (g, "truncate: %s", filename);
+    goto out;
+  }
+
+  /* Both manifests are sorted by offset, so merge them. */
+  while (!old.eof || !new.eof) {
+    if (!new.eof && (old.eof || new.offset < old.offset)) {
+      /* The block used to be zero. */
+      if (fetch_range (g, &f, new.offset,
+                       MIN (blocksize, new.size - new.offset)) == -1 ||
+          next_entry (g, &new) == -1)
+        goto out;
+    }
+    else if (!old.eof && (new.eof || old.offset < new.offset)) {
+      /* The block is now zero, or beyond the end of the device. */
+      if (old.offset < new.size &&
+          zero_range (g, &f, old.offset,
+                      MIN (blocksize, new.size - old.offset)) == -1)
+        goto out;
+      if (next_entry (g, &old) == -1)
+        goto out;
+    }
+    else {
+      if (STRNEQ (old.csum, new.csum) &&
+          fetch_range (g, &f, new.offset,
+                       MIN (blocksize, new.size - new.offset)) == -1)
+        goto out;
+      if (next_entry (g, &old) == -1 || next_entry (g, &new) == -1)
+        goto out;
+    }
+  }
+
+  if (fetch_flush (g, &f) == -1)
+    goto out;
+
+  if (close (f.fd) == -1) {
+    f.fd = -1;
+    perrorf (g, "close: %s", filename);
+    goto out;
+  }
+  f.fd = -1;
+
+  if (newmanifest && rename (tmpfile, newmanifest) == -1) {
+    perrorf (g, "rename: %s", newmanifest);
+    goto out;
+  }
+
+  ret = 0;
+
+ out:
+  close_manifest (&old);
+  close_manifest (&new);
+  if (f.fd >= 0)
+    close (f.fd);
+  return ret;
+}
@@ -0,0 +1,381 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * Per-procedure statistics about the calls made to the daemon.
+ *
+ * The protocol code in F<src/proto.c> (and F<src/batch.c>) calls
+ * C<guestfs_int_stats_request_sent> after writing each request and
+ * C<guestfs_int_stats_reply_received> after decoding each reply
+ * header.  Requests are matched to replies by serial number, so this
+ * works for pipelined calls too.
+ *
+ * Latencies are kept in a small logarithmic histogram for each
+ * procedure, which is enough to report approximate percentiles
+ * without storing every sample.
+ *
+ * The daemon keeps its own counts of how long it spent running each
+ * procedure, which are fetched using C<internal_daemon_call_stats>
+ * and merged in by C<guestfs_get_call_stats>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+#include <rpc/types.h>
+#include <rpc/xdr.h>
+
+#include "guestfs.h"
+#include "guestfs-internal.h"
+#include "guestfs-internal-actions.h"
+#include "guestfs_protocol.h"
+
+/* Latencies 0-3 usecs have their own buckets.  Above that, each power
+ * of two is split into 4 buckets, so a bucket's upper bound is at
+ * most 25% above any sample in it.  160 buckets cover up to 2^41
+ * usecs (about 25 days), and anything longer goes in the last bucket.
+ */
+#define NR_LATENCY_BUCKETS 160
+
+struct proc_stats {
+  uint64_t calls;
+  uint64_t errors;
+  uint64_t total_usec;
+  uint64_t bytes_sent;
+  uint64_t bytes_received;
+  uint32_t latency[NR_LATENCY_BUCKETS];
+};
+
+struct in_flight {
+  int serial;
+  int proc_nr;
+  struct timeval start;
+};
+
+struct call_stats {
+  struct proc_stats *procs[GUESTFS_MAX_PROC_NR+1];
+
+  /* Requests which have been sent, but not answered yet. */
+  struct in_flight in_flight[MAX_PIPELINE_DEPTH];
+  size_t nr_in_flight;
+
+  /* Procedure which file transfer chunks are counted against.  This
+   * is the last request sent, since the chunks of a FileIn call
+   * follow the request and the chunks of a FileOut call follow the
+   * reply.
+   */
+  int transfer_proc;
+};
+
+static struct call_stats *
+get_call_stats (guestfs_h *g)
+{
+  if (g->call_stats == NULL) {
+    g->call_stats = safe_calloc (g, 1, sizeof (struct call_stats));
+    g->call_stats->transfer_proc = -1;
+  }
+  return g->call_stats;
+}
+
+static struct proc_stats *
+get_proc_stats (guestfs_h *g, int proc_nr)
+{
+  struct call_stats *stats = get_call_stats (g);
+
+  if (proc_nr < 0 || proc_nr > GUESTFS_MAX_PROC_NR)
+    return NULL;
+
+  if (stats->procs[proc_nr] == NULL)
+    stats->procs[proc_nr] = safe_calloc (g, 1, sizeof (struct proc_stats));
+  return stats->procs[proc_nr];
+}
+
+static size_t
+latency_bucket (uint64_t usec)
+{
+  size_t h, i;
+
+  if (usec < 4)
+    return usec;
+
+  /* h is the position of the highest bit set, counting from 1. */
+  for (h = 0; (usec >> h) > 1; ++h)
+    ;
+  h++;
+
+  i = (h - 2) * 4 + ((usec >> (h - 3)) & 3);
+  return i < NR_LATENCY_BUCKETS ? i : NR_LATENCY_BUCKETS - 1;
+}
+
+/* The largest latency which falls in bucket 'i'. */
+static uint64_t
+latency_bucket_max (size_t i)
+{
+  size_t h;
+
+  if (i < 4)
+    return i;
+
+  h = i / 4 + 2;
+  return (UINT64_C (1) << (h - 1)) + ((uint64_t) (i % 4 + 1) << (h - 3)) - 1;
+}
+
+static uint64_t
+latency_percentile (const struct proc_stats *ps, unsigned percent)
+{
+  uint64_t n = 0, target;
+  size_t i;
+
+  if (ps->calls == 0)
+    return 0;
+
+  /* The smallest n such that n >= calls * percent / 100. */
+  target = (ps->calls * percent + 99) / 100;
+  if (target == 0)
+    target = 1;
+
+  for (i = 0; i < NR_LATENCY_BUCKETS; ++i) {
+    n += ps->latency[i];
+    if (n >= target)
+      return latency_bucket_max (i);
+  }
+  return latency_bucket_max (NR_LATENCY_BUCKETS - 1);
+}
+
+/**
+ * Record that a request has been written to the daemon.  C<size> is
+ * the size of the encoded request.
+ */
+void
+guestfs_int_stats_request_sent (guestfs_h *g, int proc_nr, int serial,
+                                size_t size)
+{
+  struct call_stats *stats = get_call_stats (g);
+  struct proc_stats *ps = get_proc_stats (g, proc_nr);
+  struct in_flight *f;
+
+  if (ps == NULL)
+    return;
+  ps->bytes_sent += size;
+  stats->transfer_proc = proc_nr;
+
+  /* If a reply was lost (because the connection was closed), its
+   * entry may still be here.  Drop the oldest entry to make room.
+   */
+  if (stats->nr_in_flight == MAX_PIPELINE_DEPTH) {
+    memmove (&stats->in_flight[0], &stats->in_flight[1],
+             (MAX_PIPELINE_DEPTH - 1) * sizeof (struct in_flight));
+    stats->nr_in_flight--;
+  }
+
+  f = &stats->in_flight[stats->nr_in_flight++];
+  f->serial = serial;
+  f->proc_nr = proc_nr;
+  gettimeofday (&f->start, NULL);
+}
+
+/**
+ * Record that a reply has been received from the daemon.  C<hdr> is
+ * the decoded reply header and C<size> is the size of the reply.
+ * Replies which don't match a request sent through
+ * C<guestfs_int_stats_request_sent> (such as the replies inside a
+ * batch) are ignored.
+ */
+void
+guestfs_int_stats_reply_received (guestfs_h *g,
+                                  const guestfs_message_header *hdr,
+                                  size_t size)
+{
+  struct call_stats *stats = g->call_stats;
+  struct proc_stats *ps;
+  struct timeval now;
+  int64_t usec;
+  size_t i;
+
+  if (stats == NULL)
+    return;
+
+  for (i = 0; i < stats->nr_in_flight; ++i) {
+    if ((unsigned) stats->in_flight[i].serial == hdr->serial)
+      break;
+  }
+  if (i == stats->nr_in_flight)
+    return;
+
+  gettimeofday (&now, NULL);
+  usec = (now.tv_sec - stats->in_flight[i].start.tv_sec) * INT64_C (1000000);
+  usec += now.tv_usec - stats->in_flight[i].start.tv_usec;
+  if (usec < 0)                 /* The clock went backwards. */
+    usec = 0;
+
+  ps = get_proc_stats (g, stats->in_flight[i].proc_nr);
+  ps->calls++;
+  if (hdr->status == GUESTFS_STATUS_ERROR)
+    ps->errors++;
+  ps->total_usec += usec;
+  ps->bytes_received += size;
+  ps->latency[latency_bucket (usec)]++;
+
+  memmove (&stats->in_flight[i], &stats->in_flight[i+1],
+           (stats->nr_in_flight - i - 1) * sizeof (struct in_flight));
+  stats->nr_in_flight--;
+}
+
+/**
+ * Record bytes of C<FileIn> or C<FileOut> chunks sent or received.
+ */
+void
+guestfs_int_stats_transfer (guestfs_h *g, uint64_t sent, uint64_t received)
+{
+  struct call_stats *stats = g->call_stats;
+  struct proc_stats *ps;
+
+  if (stats == NULL)
+    return;
+
+  ps = get_proc_stats (g, stats->transfer_proc);
+  if (ps == NULL)
+    return;
+  ps->bytes_sent += sent;
+  ps->bytes_received += received;
+}
+
+/**
+ * Forget about requests in flight.  This is called when the
+ * appliance is launched, since replies to requests sent to an
+ * earlier appliance will never arrive.
+ */
+void
+guestfs_int_stats_clear_in_flight (guestfs_h *g)
+{
+  if (g->call_stats) {
+    g->call_stats->nr_in_flight = 0;
+    g->call_stats->transfer_proc = -1;
+  }
+}
+
+void
+guestfs_int_free_call_stats (guestfs_h *g)
+{
+  size_t i;
+
+  if (g->call_stats == NULL)
+    return;
+
+  for (i = 0; i <= GUESTFS_MAX_PROC_NR; ++i)
+    free (g->call_stats->procs[i]);
+  free (g->call_stats);
+  g->call_stats = NULL;
+}
+
+struct guestfs_call_stat_list *
+guestfs_impl_get_call_stats (guestfs_h *g)
+{
+  struct guestfs_call_stat_list *ret;
+  struct guestfs_call_stat_list *daemon_stats = NULL;
+  struct guestfs_call_stat *cs;
+  uint64_t daemon_calls[GUESTFS_MAX_PROC_NR+1];
+  uint64_t daemon_usec[GUESTFS_MAX_PROC_NR+1];
+  size_t i, n = 0;
+
+  memset (daemon_calls, 0, sizeof daemon_calls);
+  memset (daemon_usec, 0, sizeof daemon_usec);
+
+  if (g->state == READY) {
+    /* Old daemons don't have this call, so don't print the error. */
+    guestfs_push_error_handler (g, NULL, NULL);
+    daemon_stats = guestfs_internal_daemon_call_stats (g, 0);
+    guestfs_pop_error_handler (g);
+  }
+  if (daemon_stats) {
+    for (i = 0; i < daemon_stats->len; ++i) {
+      cs = &daemon_stats->val[i];
+      if (cs->cs_proc_nr >= 0 && cs->cs_proc_nr <= GUESTFS_MAX_PROC_NR) {
+        daemon_calls[cs->cs_proc_nr] = cs->cs_daemon_calls;
+        daemon_usec[cs->cs_proc_nr] = cs->cs_daemon_usec;
+      }
+    }
+    guestfs_free_call_stat_list (daemon_stats);
+  }
+
+  ret = safe_malloc (g, sizeof *ret);
+  ret->len = 0;
+  ret->val = NULL;
+
+  for (i = 0; i <= GUESTFS_MAX_PROC_NR; ++i) {
+    const struct proc_stats *ps =
+      g->call_stats ? g->call_stats->procs[i] : NULL;
+
+    if ((ps == NULL || ps->calls == 0) && daemon_calls[i] == 0)
+      continue;
+
+    if (n >= ret->len) {
+      ret->len = ret->len == 0 ? 16 : ret->len * 2;
+      ret->val = safe_realloc (g, ret->val,
+                               ret->len * sizeof (struct guestfs_call_stat));
+    }
+    cs = &ret->val[n++];
+    memset (cs, 0, sizeof *cs);
+    cs->cs_proc_nr = i;
+    cs->cs_name = safe_strdup (g, guestfs_int_proc_names[i] ?
+                               guestfs_int_proc_names[i] : "");
+    if (ps) {
+      cs->cs_calls = ps->calls;
+      cs->cs_errors = ps->errors;
+      cs->cs_total_usec = ps->total_usec;
+      cs->cs_p50_usec = latency_percentile (ps, 50);
+      cs->cs_p99_usec = latency_percentile (ps, 99);
+      cs->cs_bytes_sent = ps->bytes_sent;
+      cs->cs_bytes_received = ps->bytes_received;
+    }
+    cs->cs_daemon_calls = daemon_calls[i];
+    cs->cs_daemon_usec = daemon_usec[i];
+  }
+  ret->len = n;
+
+  return ret;
+}
+
+int
+guestfs_impl_reset_call_stats (guestfs_h *g)
+{
+  struct guestfs_call_stat_list *daemon_stats;
+  size_t i;
+
+  if (g->state == READY) {
+    guestfs_push_error_handler (g, NULL, NULL);
+    daemon_stats = guestfs_internal_daemon_call_stats (g, 1);
+    guestfs_pop_error_handler (g);
+    if (daemon_stats)
+      guestfs_free_call_stat_list (daemon_stats);
+  }
+
+  /* This also forgets the call we just made to reset the daemon. */
+  if (g->call_stats) {
+    for (i = 0; i <= GUESTFS_MAX_PROC_NR; ++i) {
+      free (g->call_stats->procs[i]);
+      g->call_stats->procs[i] = NULL;
+    }
+  }
+
+  return 0;
+}
@@ -46,36 +46,39 @@ struct connection_socket {
 
   int console_sock;          /* Appliance console (for debug info). */
   int daemon_sock;           /* Daemon communications socket. */
+  int bulk_sock;             /* Bulk data channel, or -1 if none. */
 
-  /* Socket for accepting a connection from the daemon.  Only used
+  /* Sockets for accepting connections from the daemon.  Only used
    * before and during accept_connection.
    */
   int daemon_accept_sock;
+  int bulk_accept_sock;
 };
 
 static int handle_log_message (guestfs_h *g, struct connection_socket *conn);
 
+/**
+ * Wait for a connection on C<accept_sock> and accept it, handling
+ * log messages while waiting.  C<start_t> is the time at which we
+ * started waiting for the appliance.
+ *
+ * Returns: 1 = accepted (the new socket is returned in C<*sock_r>),
+ * 0 = appliance closed connection, -1 = error
+ */
 static int
-accept_connection (guestfs_h *g, struct connection *connv)
+accept_one (guestfs_h *g, struct connection_socket *conn,
+            int accept_sock, time_t start_t, int *sock_r)
 {
-  struct connection_socket *conn = (struct connection_socket *) connv;
   int sock = -1;
-  time_t start_t, now_t;
+  time_t now_t;
   int timeout_ms;
 
-  time (&start_t);
-
-  if (conn->daemon_accept_sock == -1) {
-    error (g, _("accept_connection called twice"));
-    return -1;
-  }
-
   while (sock == -1) {
     struct pollfd fds[2];
     nfds_t nfds = 1;
     int r;
 
-    fds[0].fd = conn->daemon_accept_sock;
+    fds[0].fd = accept_sock;
     fds[0].events = POLLIN;
     fds[0].revents = 0;
 
@@ -111,7 +114,7 @@ accept_connection (guestfs_h *g, struct connection *connv)
 
     /* Accept on socket? */
     if ((fds[0].revents & POLLIN) != 0) {
-      sock = accept4 (conn->daemon_accept_sock, NULL, NULL, SOCK_CLOEXEC);
+      sock = accept4 (accept_sock, NULL, NULL, SOCK_CLOEXEC);
       if (sock == -1) {
         if (errno == EINTR || errno == EAGAIN)
           continue;
@@ -121,30 +124,67 @@ accept_connection (guestfs_h *g, struct connection *connv)
     }
   }
 
+  /* Make sure the new socket is non-blocking. */
+  if (fcntl (sock, F_SETFL, O_NONBLOCK) == -1) {
+    perrorf (g, "accept_connection: fcntl");
+    close (sock);
+    return -1;
+  }
+
+  *sock_r = sock;
+  return 1;
+}
+
+static int
+accept_connection (guestfs_h *g, struct connection *connv)
+{
+  struct connection_socket *conn = (struct connection_socket *) connv;
+  time_t start_t;
+  int r;
+
+  time (&start_t);
+
+  if (conn->daemon_accept_sock == -1) {
+    error (g, _("accept_connection called twice"));
+    return -1;
+  }
+
+  r = accept_one (g, conn, conn->daemon_accept_sock, start_t,
+                  &conn->daemon_sock);
+  if (r <= 0)
+    return r;
+
   /* Got a connection and accepted it, so update the connection's
    * internal status.
    */
   close (conn->daemon_accept_sock);
   conn->daemon_accept_sock = -1;
-  conn->daemon_sock = sock;
 
-  /* Make sure the new socket is non-blocking. */
-  if (fcntl (conn->daemon_sock, F_SETFL, O_NONBLOCK) == -1) {
-    perrorf (g, "accept_connection: fcntl");
-    return -1;
+  /* The hypervisor connects all the virtio-serial chardevs when it
+   * starts up, so if there is a bulk data channel the connection for
+   * it is waiting (or will be very soon).
+   */
+  if (conn->bulk_accept_sock >= 0) {
+    r = accept_one (g, conn, conn->bulk_accept_sock, start_t,
+                    &conn->bulk_sock);
+    if (r <= 0)
+      return r;
+
+    close (conn->bulk_accept_sock);
+    conn->bulk_accept_sock = -1;
   }
 
   return 1;
 }
 
 static ssize_t
-read_data (guestfs_h *g, struct connection *connv, void *bufv, size_t len)
+read_sock (guestfs_h *g, struct connection_socket *conn, int sock,
+           void *bufv, size_t len)
 {
   char *buf = bufv;
-  struct connection_socket *conn = (struct connection_socket *) connv;
   const size_t original_len = len;
 
-  if (conn->daemon_sock == -1) {
+  if (sock == -1) {
     error (g, _("read_data: socket not connected"));
     return -1;
   }
@@ -154,7 +194,7 @@ read_data (guestfs_h *g, struct connection *connv, void *bufv, size_t len)
     nfds_t nfds = 1;
     int r;
 
-    fds[0].fd = conn->daemon_sock;
+    fds[0].fd = sock;
     fds[0].events = POLLIN;
     fds[0].revents = 0;
 
@@ -182,7 +222,7 @@ read_data (guestfs_h *g, struct connection *connv, void *bufv, size_t len)
 
     /* Read data on daemon socket? */
     if ((fds[0].revents & POLLIN) != 0) {
-      ssize_t n = read (conn->daemon_sock, buf, len);
+      ssize_t n = read (sock, buf, len);
       if (n == -1) {
         if (errno == EINTR || errno == EAGAIN)
           continue;
@@ -212,19 +252,34 @@ read_data (guestfs_h *g, struct connection *connv, void *bufv, size_t len)
   return original_len;
 }
 
-static int
-can_read_data (guestfs_h *g, struct connection *connv)
+static ssize_t
+read_data (guestfs_h *g, struct connection *connv, void *buf, size_t len)
+{
+  struct connection_socket *conn = (struct connection_socket *) connv;
+
+  return read_sock (g, conn, conn->daemon_sock, buf, len);
+}
+
+static ssize_t
+read_bulk (guestfs_h *g, struct connection *connv, void *buf, size_t len)
 {
   struct connection_socket *conn = (struct connection_socket *) connv;
+
+  return read_sock (g, conn, conn->bulk_sock, buf, len);
+}
+
+static int
+can_read_sock (guestfs_h *g, int sock)
+{
   struct pollfd fd;
   int r;
 
-  if (conn->daemon_sock == -1) {
+  if (sock == -1) {
     error (g, _("can_read_data: socket not connected"));
     return -1;
   }
 
-  fd.fd = conn->daemon_sock;
+  fd.fd = sock;
   fd.events = POLLIN;
   fd.revents = 0;
 
@@ -240,15 +295,22 @@ can_read_data (guestfs_h *g, struct connection *connv)
   return (fd.revents & POLLIN) != 0 ? 1 : 0;
 }
 
+static int
+can_read_data (guestfs_h *g, struct connection *connv)
+{
+  struct connection_socket *conn = (struct connection_socket *) connv;
+
+  return can_read_sock (g, conn->daemon_sock);
+}
+
 static ssize_t
-write_data (guestfs_h *g, struct connection *connv,
+write_sock (guestfs_h *g, struct connection_socket *conn, int sock,
             const void *bufv, size_t len)
 {
   const char *buf = bufv;
-  struct connection_socket *conn = (struct connection_socket *) connv;
   const size_t original_len = len;
 
-  if (conn->daemon_sock == -1) {
+  if (sock == -1) {
     error (g, _("write_data: socket not connected"));
     return -1;
   }
@@ -258,7 +320,7 @@ write_data (guestfs_h *g, struct connection *connv,
     nfds_t nfds = 1;
     int r;
 
-    fds[0].fd = conn->daemon_sock;
+    fds[0].fd = sock;
     fds[0].events = POLLOUT;
     fds[0].revents = 0;
 
@@ -286,7 +348,7 @@ write_data (guestfs_h *g, struct connection *connv,
 
     /* Can write data on daemon socket? */
     if ((fds[0].revents & POLLOUT) != 0) {
-      ssize_t n = write (conn->daemon_sock, buf, len);
+      ssize_t n = write (sock, buf, len);
       if (n == -1) {
         if (errno == EINTR || errno == EAGAIN)
           continue;
@@ -304,6 +366,50 @@ write_data (guestfs_h *g, struct connection *connv,
   return original_len;
 }
 
+static ssize_t
+write_data (guestfs_h *g, struct connection *connv,
+            const void *buf, size_t len)
+{
+  struct connection_socket *conn = (struct connection_socket *) connv;
+
+  return write_sock (g, conn, conn->daemon_sock, buf, len);
+}
+
+static void
+send_cancel_flag (struct connection *connv)
+{
+  struct connection_socket *conn = (struct connection_socket *) connv;
+  /* GUESTFS_CANCEL_FLAG, XDR encoded. */
+  static const unsigned char flag[4] = { 0xff, 0xff, 0xee, 0xee };
+
+  if (conn->daemon_sock == -1)
+    return;
+
+  /* The socket is non-blocking, and nothing else is being written
+   * while the library waits for a reply, so the write will not block
+   * and (being so small) will not be partial.  Errors are ignored:
+   * they will be noticed when the reply is read.
+   */
+  ignore_value (write (conn->daemon_sock, flag, sizeof flag));
+}
+
+static ssize_t
+write_bulk (guestfs_h *g, struct connection *connv,
+            const void *buf, size_t len)
+{
+  struct connection_socket *conn = (struct connection_socket *) connv;
+
+  return write_sock (g, conn, conn->bulk_sock, buf, len);
+}
+
+static int
+has_bulk_channel (guestfs_h *g, struct connection *connv)
+{
+  struct connection_socket *conn = (struct connection_socket *) connv;
+
+  return conn->bulk_sock >= 0;
+}
+
 /**
  * This is called if C<conn-E<gt>console_sock> becomes ready to read
  * while we are doing one of the connection operations above.  It
@@ -405,8 +511,12 @@ free_conn_socket (guestfs_h *g, struct connection *connv)
     close (conn->console_sock);
   if (conn->daemon_sock >= 0)
     close (conn->daemon_sock);
+  if (conn->bulk_sock >= 0)
+    close (conn->bulk_sock);
   if (conn->daemon_accept_sock >= 0)
     close (conn->daemon_accept_sock);
+  if (conn->bulk_accept_sock >= 0)
+    close (conn->bulk_accept_sock);
 
   free (conn);
 }
@@ -417,6 +527,10 @@ static struct connection_ops ops = {
   .read_data = read_data,
   .write_data = write_data,
   .can_read_data = can_read_data,
+  .has_bulk_channel = has_bulk_channel,
+  .read_bulk = read_bulk,
+  .write_bulk = write_bulk,
+  .send_cancel_flag = send_cancel_flag,
 };
 
 /**
@@ -425,13 +539,17 @@ static struct connection_ops ops = {
  * Note that it's OK for C<console_sock> to be passed as C<-1>,
  * meaning there's no console available for this appliance.
  *
- * After calling this, C<daemon_accept_sock> is owned by the
- * connection, and will be closed properly either in
+ * C<bulk_accept_sock> may also be C<-1>, meaning the appliance has
+ * no separate channel for bulk data.
+ *
+ * After calling this, C<daemon_accept_sock> and C<bulk_accept_sock>
+ * are owned by the connection, and will be closed properly either in
  * C<accept_connection> or C<free_connection>.
  */
 struct connection *
 guestfs_int_new_conn_socket_listening (guestfs_h *g,
 				       int daemon_accept_sock,
+				       int bulk_accept_sock,
 				       int console_sock)
 {
   struct connection_socket *conn;
@@ -443,6 +561,13 @@ guestfs_int_new_conn_socket_listening (guestfs_h *g,
     return NULL;
   }
 
+  if (bulk_accept_sock >= 0) {
+    if (fcntl (bulk_accept_sock, F_SETFL, O_NONBLOCK) == -1) {
+      perrorf (g, "new_conn_socket_listening: fcntl");
+      return NULL;
+    }
+  }
+
   if (console_sock >= 0) {
     if (fcntl (console_sock, F_SETFL, O_NONBLOCK) == -1) {
       perrorf (g, "new_conn_socket_listening: fcntl");
@@ -458,7 +583,9 @@ guestfs_int_new_conn_socket_listening (guestfs_h *g,
   /* Set the internal state. */
   conn->console_sock = console_sock;
   conn->daemon_sock = -1;
+  conn->bulk_sock = -1;
   conn->daemon_accept_sock = daemon_accept_sock;
+  conn->bulk_accept_sock = bulk_accept_sock;
 
   return (struct connection *) conn;
 }
@@ -498,7 +625,9 @@ guestfs_int_new_conn_socket_connected (guestfs_h *g,
   /* Set the internal state. */
   conn->console_sock = console_sock;
   conn->daemon_sock = daemon_sock;
+  conn->bulk_sock = -1;
   conn->daemon_accept_sock = -1;
+  conn->bulk_accept_sock = -1;
 
   return (struct connection *) conn;
 }
@@ -32,6 +32,7 @@
 #include "guestfs.h"
 #include "guestfs-internal.h"
 #include "guestfs-internal-actions.h"
+#include "guestfs_protocol.h"
 
 static int
 compare (const void *vp1, const void *vp2)
@@ -47,28 +48,6 @@ sort_strings (char **argv, size_t len)
   qsort (argv, len, sizeof (char *), compare);
 }
 
-/* Take the first 'n' names, returning a newly allocated list.  The
- * strings themselves are not duplicated.  If 'lastp' is not NULL,
- * then it is updated with the pointer to the list of remaining names.
- */
-static char **
-take_strings (guestfs_h *g, char *const *names, size_t n, char *const **lastp)
-{
-  size_t i;
-
-  char **ret = safe_malloc (g, (n+1) * sizeof (char *));
-
-  for (i = 0; names[i] != NULL && i < n; ++i)
-    ret[i] = names[i];
-
-  ret[i] = NULL;
-
-  if (lastp)
-    *lastp = &names[i];
-
-  return ret;
-}
-
 char *
 guestfs_impl_cat (guestfs_h *g, const char *path)
 {
@@ -375,43 +354,95 @@ guestfs_impl_write_append (guestfs_h *g, const char *path,
   return write_or_append (g, path, content, size, 1);
 }
 
+/* The daemon functions internal_lstatnslist, internal_lxattrlist and
+ * internal_readlinklist are called with at most this many names at a
+ * time, so that the reply does not exceed the maximum message size.
+ * The calls are pipelined (see guestfs_int_call_pipelined).
+ */
 #define LSTATNSLIST_MAX 1000
 
+static void
+copy_statns (struct guestfs_statns *dest, const guestfs_int_statns *src)
+{
+  dest->st_dev = src->st_dev;
+  dest->st_ino = src->st_ino;
+  dest->st_mode = src->st_mode;
+  dest->st_nlink = src->st_nlink;
+  dest->st_uid = src->st_uid;
+  dest->st_gid = src->st_gid;
+  dest->st_rdev = src->st_rdev;
+  dest->st_size = src->st_size;
+  dest->st_blksize = src->st_blksize;
+  dest->st_blocks = src->st_blocks;
+  dest->st_atime_sec = src->st_atime_sec;
+  dest->st_atime_nsec = src->st_atime_nsec;
+  dest->st_mtime_sec = src->st_mtime_sec;
+  dest->st_mtime_nsec = src->st_mtime_nsec;
+  dest->st_ctime_sec = src->st_ctime_sec;
+  dest->st_ctime_nsec = src->st_ctime_nsec;
+  dest->st_spare1 = src->st_spare1;
+  dest->st_spare2 = src->st_spare2;
+  dest->st_spare3 = src->st_spare3;
+  dest->st_spare4 = src->st_spare4;
+  dest->st_spare5 = src->st_spare5;
+  dest->st_spare6 = src->st_spare6;
+}
+
 struct guestfs_statns_list *
 guestfs_impl_lstatnslist (guestfs_h *g, const char *dir, char * const*names)
 {
-  size_t len = guestfs_int_count_strings (names);
-  size_t old_len;
+  const size_t len = guestfs_int_count_strings (names);
+  const size_t nr_calls = (len + LSTATNSLIST_MAX - 1) / LSTATNSLIST_MAX;
+  CLEANUP_FREE struct pipelined_call *calls = NULL;
+  CLEANUP_FREE struct guestfs_internal_lstatnslist_args *args = NULL;
+  CLEANUP_FREE struct guestfs_internal_lstatnslist_ret *rets = NULL;
   struct guestfs_statns_list *ret;
+  size_t i, j;
+  int r;
 
   ret = safe_malloc (g, sizeof *ret);
   ret->len = 0;
   ret->val = NULL;
 
-  while (len > 0) {
-    CLEANUP_FREE_STATNS_LIST struct guestfs_statns_list *stats = NULL;
+  if (nr_calls == 0)
+    return ret;
 
-    /* Note we don't need to free up the strings because take_strings
-     * does not do a deep copy.
-     */
-    CLEANUP_FREE char **first = take_strings (g, names, LSTATNSLIST_MAX, &names);
+  calls = safe_calloc (g, nr_calls, sizeof *calls);
+  args = safe_calloc (g, nr_calls, sizeof *args);
+  rets = safe_calloc (g, nr_calls, sizeof *rets);
 
-    len = len <= LSTATNSLIST_MAX ? 0 : len - LSTATNSLIST_MAX;
+  for (i = 0; i < nr_calls; ++i) {
+    args[i].path = (char *) dir;
+    args[i].names.names_val = (char **) &names[i * LSTATNSLIST_MAX];
+    args[i].names.names_len = MIN (LSTATNSLIST_MAX, len - i * LSTATNSLIST_MAX);
+    calls[i].proc_nr = GUESTFS_PROC_INTERNAL_LSTATNSLIST;
+    calls[i].xdr_args = (xdrproc_t) xdr_guestfs_internal_lstatnslist_args;
+    calls[i].args = (char *) &args[i];
+    calls[i].xdr_ret = (xdrproc_t) xdr_guestfs_internal_lstatnslist_ret;
+    calls[i].ret = (char *) &rets[i];
+  }
 
-    stats = guestfs_internal_lstatnslist (g, dir, first);
+  r = guestfs_int_call_pipelined (g, "internal_lstatnslist", calls, nr_calls);
 
-    if (stats == NULL) {
-      guestfs_free_statns_list (ret);
-      return NULL;
-    }
+  for (i = 0; i < nr_calls; ++i) {
+    guestfs_int_statns_list *stats = &rets[i].statbufs;
 
     /* Append stats to ret. */
-    old_len = ret->len;
-    ret->len += stats->len;
-    ret->val = safe_realloc (g, ret->val,
-                             ret->len * sizeof (struct guestfs_statns));
-    memcpy (&ret->val[old_len], stats->val,
-            stats->len * sizeof (struct guestfs_statns));
+    if (r == 0 && stats->guestfs_int_statns_list_len > 0) {
+      ret->val = safe_realloc (g, ret->val,
+                               (ret->len + stats->guestfs_int_statns_list_len) *
+                               sizeof (struct guestfs_statns));
+      for (j = 0; j < stats->guestfs_int_statns_list_len; ++j)
+        copy_statns (&ret->val[ret->len++],
+                     &stats->guestfs_int_statns_list_val[j]);
+    }
+    xdr_free ((xdrproc_t) xdr_guestfs_internal_lstatnslist_ret,
+              (char *) &rets[i]);
+  }
+
+  if (r == -1) {
+    guestfs_free_statns_list (ret);
+    return NULL;
   }
 
   return ret;
@@ -422,44 +453,69 @@ guestfs_impl_lstatnslist (guestfs_h *g, const char *dir, char * const*names)
 struct guestfs_xattr_list *
 guestfs_impl_lxattrlist (guestfs_h *g, const char *dir, char *const *names)
 {
-  size_t len = guestfs_int_count_strings (names);
-  size_t i, old_len;
+  const size_t len = guestfs_int_count_strings (names);
+  const size_t nr_calls = (len + LXATTRLIST_MAX - 1) / LXATTRLIST_MAX;
+  CLEANUP_FREE struct pipelined_call *calls = NULL;
+  CLEANUP_FREE struct guestfs_internal_lxattrlist_args *args = NULL;
+  CLEANUP_FREE struct guestfs_internal_lxattrlist_ret *rets = NULL;
   struct guestfs_xattr_list *ret;
+  size_t i, j;
+  int r;
 
   ret = safe_malloc (g, sizeof *ret);
   ret->len = 0;
   ret->val = NULL;
 
-  while (len > 0) {
-    CLEANUP_FREE_XATTR_LIST struct guestfs_xattr_list *xattrs = NULL;
+  if (nr_calls == 0)
+    return ret;
 
-    /* Note we don't need to free up the strings because take_strings
-     * does not do a deep copy.
-     */
-    CLEANUP_FREE char **first = take_strings (g, names, LXATTRLIST_MAX, &names);
-    len = len <= LXATTRLIST_MAX ? 0 : len - LXATTRLIST_MAX;
+  calls = safe_calloc (g, nr_calls, sizeof *calls);
+  args = safe_calloc (g, nr_calls, sizeof *args);
+  rets = safe_calloc (g, nr_calls, sizeof *rets);
 
-    xattrs = guestfs_internal_lxattrlist (g, dir, first);
+  for (i = 0; i < nr_calls; ++i) {
+    args[i].path = (char *) dir;
+    args[i].names.names_val = (char **) &names[i * LXATTRLIST_MAX];
+    args[i].names.names_len = MIN (LXATTRLIST_MAX, len - i * LXATTRLIST_MAX);
+    calls[i].proc_nr = GUESTFS_PROC_INTERNAL_LXATTRLIST;
+    calls[i].xdr_args = (xdrproc_t) xdr_guestfs_internal_lxattrlist_args;
+    calls[i].args = (char *) &args[i];
+    calls[i].xdr_ret = (xdrproc_t) xdr_guestfs_internal_lxattrlist_ret;
+    calls[i].ret = (char *) &rets[i];
+  }
 
-    if (xattrs == NULL) {
-      guestfs_free_xattr_list (ret);
-      return NULL;
-    }
+  r = guestfs_int_call_pipelined (g, "internal_lxattrlist", calls, nr_calls);
+
+  for (i = 0; i < nr_calls; ++i) {
+    guestfs_int_xattr_list *xattrs = &rets[i].xattrs;
 
-    /* Append xattrs to ret. */
-    old_len = ret->len;
-    ret->len += xattrs->len;
-    ret->val = safe_realloc (g, ret->val,
-                             ret->len * sizeof (struct guestfs_xattr));
-    for (i = 0; i < xattrs->len; ++i, ++old_len) {
-      /* We have to make a deep copy of the attribute name and value.
-       */
-      ret->val[old_len].attrname = safe_strdup (g, xattrs->val[i].attrname);
-      ret->val[old_len].attrval = safe_malloc (g, xattrs->val[i].attrval_len);
-      ret->val[old_len].attrval_len = xattrs->val[i].attrval_len;
-      memcpy (ret->val[old_len].attrval, xattrs->val[i].attrval,
-              xattrs->val[i].attrval_len);
+    /* Append xattrs to ret.  The attribute names and values are
+     * moved to ret rather than copied, so we only need to free the
+     * list itself.
+     */
+    if (r == 0 && xattrs->guestfs_int_xattr_list_len > 0) {
+      ret->val = safe_realloc (g, ret->val,
+                               (ret->len + xattrs->guestfs_int_xattr_list_len) *
+                               sizeof (struct guestfs_xattr));
+      for (j = 0; j < xattrs->guestfs_int_xattr_list_len; ++j) {
+        guestfs_int_xattr *xattr = &xattrs->guestfs_int_xattr_list_val[j];
+        struct guestfs_xattr *dest = &ret->val[ret->len++];
+
+        dest->attrname = xattr->attrname;
+        dest->attrval_len = xattr->attrval.attrval_len;
+        dest->attrval = xattr->attrval.attrval_val;
+      }
+      free (xattrs->guestfs_int_xattr_list_val);
+      xattrs->guestfs_int_xattr_list_val = NULL;
+      xattrs->guestfs_int_xattr_list_len = 0;
     }
+    xdr_free ((xdrproc_t) xdr_guestfs_internal_lxattrlist_ret,
+              (char *) &rets[i]);
+  }
+
+  if (r == -1) {
+    guestfs_free_xattr_list (ret);
+    return NULL;
   }
 
   return ret;
@@ -470,34 +526,126 @@ guestfs_impl_lxattrlist (guestfs_h *g, const char *dir, char *const *names)
 char **
 guestfs_impl_readlinklist (guestfs_h *g, const char *dir, char *const *names)
 {
-  size_t len = guestfs_int_count_strings (names);
-  size_t old_len, ret_len = 0;
+  const size_t len = guestfs_int_count_strings (names);
+  const size_t nr_calls = (len + READLINK_MAX - 1) / READLINK_MAX;
+  CLEANUP_FREE struct pipelined_call *calls = NULL;
+  CLEANUP_FREE struct guestfs_internal_readlinklist_args *args = NULL;
+  CLEANUP_FREE struct guestfs_internal_readlinklist_ret *rets = NULL;
+  size_t i, ret_len = 0;
   char **ret = NULL;
+  int r = 0;
+
+  if (nr_calls > 0) {
+    calls = safe_calloc (g, nr_calls, sizeof *calls);
+    args = safe_calloc (g, nr_calls, sizeof *args);
+    rets = safe_calloc (g, nr_calls, sizeof *rets);
+
+    for (i = 0; i < nr_calls; ++i) {
+      args[i].path = (char *) dir;
+      args[i].names.names_val = (char **) &names[i * READLINK_MAX];
+      args[i].names.names_len = MIN (READLINK_MAX, len - i * READLINK_MAX);
+      calls[i].proc_nr = GUESTFS_PROC_INTERNAL_READLINKLIST;
+      calls[i].xdr_args = (xdrproc_t) xdr_guestfs_internal_readlinklist_args;
+      calls[i].args = (char *) &args[i];
+      calls[i].xdr_ret = (xdrproc_t) xdr_guestfs_internal_readlinklist_ret;
+      calls[i].ret = (char *) &rets[i];
+    }
+
+    r = guestfs_int_call_pipelined (g, "internal_readlinklist",
+                                    calls, nr_calls);
+  }
 
-  while (len > 0) {
-    /* Note we don't need to free up the strings because the 'links'
-     * strings are copied to ret, and 'take_strings' does not do a
-     * deep copy.
+  for (i = 0; i < nr_calls; ++i) {
+    /* Append links to ret.  The strings are moved to ret, so we
+     * only need to free the list itself.
      */
-    CLEANUP_FREE char **links = NULL;
-    CLEANUP_FREE char **first = take_strings (g, names, READLINK_MAX, &names);
-    len = len <= READLINK_MAX ? 0 : len - READLINK_MAX;
+    if (r == 0 && rets[i].links.links_len > 0) {
+      ret = safe_realloc (g, ret,
+                          (ret_len + rets[i].links.links_len) * sizeof (char *));
+      memcpy (&ret[ret_len], rets[i].links.links_val,
+              rets[i].links.links_len * sizeof (char *));
+      ret_len += rets[i].links.links_len;
+      free (rets[i].links.links_val);
+      rets[i].links.links_val = NULL;
+      rets[i].links.links_len = 0;
+    }
+    xdr_free ((xdrproc_t) xdr_guestfs_internal_readlinklist_ret,
+              (char *) &rets[i]);
+  }
+
+  if (r == -1)
+    return NULL;
+
+  /* NULL-terminate the list. */
+  ret = safe_realloc (g, ret, (ret_len+1) * sizeof (char *));
+  ret[ret_len] = NULL;
 
-    links = guestfs_internal_readlinklist (g, dir, first);
+  return ret;
+}
 
-    if (links == NULL) {
-      if (ret)
-        guestfs_int_free_string_list (ret);
-      return NULL;
+/* The files are hashed in parallel by the daemon, so larger batches
+ * keep more vCPUs busy, but each call must still finish in a
+ * reasonable time for progress and cancellation.
+ */
+#define CHECKSUMLIST_MAX 1000
+
+char **
+guestfs_impl_checksumlist (guestfs_h *g, const char *csumtype,
+                           const char *dir, char *const *names)
+{
+  const size_t len = guestfs_int_count_strings (names);
+  const size_t nr_calls = (len + CHECKSUMLIST_MAX - 1) / CHECKSUMLIST_MAX;
+  CLEANUP_FREE struct pipelined_call *calls = NULL;
+  CLEANUP_FREE struct guestfs_internal_checksumlist_args *args = NULL;
+  CLEANUP_FREE struct guestfs_internal_checksumlist_ret *rets = NULL;
+  size_t i, ret_len = 0;
+  char **ret = NULL;
+  int r = 0;
+
+  if (nr_calls > 0) {
+    calls = safe_calloc (g, nr_calls, sizeof *calls);
+    args = safe_calloc (g, nr_calls, sizeof *args);
+    rets = safe_calloc (g, nr_calls, sizeof *rets);
+
+    for (i = 0; i < nr_calls; ++i) {
+      args[i].csumtype = (char *) csumtype;
+      args[i].path = (char *) dir;
+      args[i].names.names_val = (char **) &names[i * CHECKSUMLIST_MAX];
+      args[i].names.names_len =
+        MIN (CHECKSUMLIST_MAX, len - i * CHECKSUMLIST_MAX);
+      calls[i].proc_nr = GUESTFS_PROC_INTERNAL_CHECKSUMLIST;
+      calls[i].xdr_args = (xdrproc_t) xdr_guestfs_internal_checksumlist_args;
+      calls[i].args = (char *) &args[i];
+      calls[i].xdr_ret = (xdrproc_t) xdr_guestfs_internal_checksumlist_ret;
+      calls[i].ret = (char *) &rets[i];
     }
 
-    /* Append links to ret. */
-    old_len = ret_len;
-    ret_len += guestfs_int_count_strings (links);
-    ret = safe_realloc (g, ret, ret_len * sizeof (char *));
-    memcpy (&ret[old_len], links, (ret_len-old_len) * sizeof (char *));
+    r = guestfs_int_call_pipelined (g, "internal_checksumlist",
+                                    calls, nr_calls);
   }
 
+  for (i = 0; i < nr_calls; ++i) {
+    /* Append checksums to ret.  The strings are moved to ret, so we
+     * only need to free the list itself.
+     */
+    if (r == 0 && rets[i].checksums.checksums_len > 0) {
+      ret = safe_realloc (g, ret,
+                          (ret_len + rets[i].checksums.checksums_len) *
+                          sizeof (char *));
+      memcpy (&ret[ret_len], rets[i].checksums.checksums_val,
+              rets[i].checksums.checksums_len * sizeof (char *));
+      ret_len += rets[i].checksums.checksums_len;
+      free (rets[i].checksums.checksums_val);
+      rets[i].checksums.checksums_val = NULL;
+      rets[i].checksums.checksums_len = 0;
+    }
+    xdr_free ((xdrproc_t) xdr_guestfs_internal_checksumlist_ret,
+              (char *) &rets[i]);
+  }
+
+  if (r == -1)
+    return NULL;
+
   /* NULL-terminate the list. */
   ret = safe_realloc (g, ret, (ret_len+1) * sizeof (char *));
   ret[ret_len] = NULL;
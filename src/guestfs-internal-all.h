@@ -32,6 +32,8 @@
 #ifndef GUESTFS_INTERNAL_ALL_H_
 #define GUESTFS_INTERNAL_ALL_H_
 
+#include <string.h>
+
 /* This is also defined in <guestfs.h>, so don't redefine it. */
 #if defined(__GNUC__) && !defined(GUESTFS_GCC_VERSION)
 # define GUESTFS_GCC_VERSION \
@@ -74,6 +76,29 @@
 #define xdr_uint32_t xdr_u_int32_t
 #endif
 
+/* Return true iff the buffer is all zero bytes.
+ *
+ * The first 16 bytes are checked one at a time, which quickly rejects
+ * most buffers that contain data.  If those are zero, then the whole
+ * buffer is zero iff it is equal to itself shifted by 16 bytes, and
+ * that comparison is done by memcmp, which libc implements using
+ * vector instructions.
+ */
+static inline int
+is_zero (const void *buffer, size_t size)
+{
+  const char *p = buffer;
+  const size_t prefix = size < 16 ? size : 16;
+  size_t i;
+
+  for (i = 0; i < prefix; ++i) {
+    if (p[i] != 0)
+      return 0;
+  }
+
+  return size == prefix || memcmp (p, p + 16, size - 16) == 0;
+}
+
 /* Macro which compiles the regexp once when the program/library is
  * loaded, and frees it when the library is unloaded.
  */
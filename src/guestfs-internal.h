@@ -115,6 +115,26 @@
  */
 #define APPLIANCE_TIMEOUT (20*60) /* 20 mins */
 
+/* Limits on pipelined requests (see guestfs_int_call_pipelined).
+ *
+ * The depth limit is an arbitrary sanity check on the value passed
+ * to guestfs_set_pipeline_depth.
+ *
+ * The byte limit caps the size of requests which have been written
+ * to the appliance but not yet replied to.  The daemon does not read
+ * new requests while it is writing a reply, so if we allowed more
+ * than the socket buffers could hold, both sides could block
+ * writing.
+ */
+#define MAX_PIPELINE_DEPTH 64
+#define MAX_PIPELINE_BYTES (64 * 1024)
+
+/* Chunk size for FileIn and FileOut transfers which the library asks
+ * the daemon to use after launch.  The daemon may choose a smaller
+ * size, and old daemons always use GUESTFS_MAX_CHUNK_SIZE (8K).
+ */
+#define REQUESTED_CHUNK_SIZE (1024 * 1024)
+
 /* Some limits on what the inspection code will read, for safety. */
 
 /* Small text configuration files.
@@ -373,6 +393,23 @@ struct connection_ops {
    * Returns: 1 = yes, 0 = no, -1 = error
    */
   int (*can_read_data) (guestfs_h *g, struct connection *);
+
+  /* Some appliances have a second channel which carries only the
+   * chunks of FileIn and FileOut transfers (see
+   * guestfs_internal_enable_bulk_channel).  'has_bulk_channel'
+   * returns true if this connection has one.  'read_bulk' and
+   * 'write_bulk' are the same as 'read_data' and 'write_data', but
+   * for the bulk data channel.
+   */
+  int (*has_bulk_channel) (guestfs_h *g, struct connection *);
+  ssize_t (*read_bulk) (guestfs_h *g, struct connection *, void *buf, size_t len);
+  ssize_t (*write_bulk) (guestfs_h *g, struct connection *, const void *buf, size_t len);
+
+  /* Send a cancel flag (GUESTFS_CANCEL_FLAG) to the daemon.  This is
+   * called from guestfs_user_cancel, so it must be signal safe: it
+   * must not block, allocate memory or set the handle error.
+   */
+  void (*send_cancel_flag) (struct connection *);
 };
 
 /**
@@ -414,6 +451,8 @@ struct guestfs_h {
 
   int smp;                      /* If > 1, -smp flag passed to hv. */
   int memsize;			/* Size of RAM (megabytes). */
+  int pipeline_depth;           /* Max requests in flight (>= 1). */
+  bool transfer_compression;    /* Compress FileIn/FileOut transfers. */
 
   char *path;			/* Path to the appliance. */
   char *hv;			/* Hypervisor (HV) binary. */
@@ -498,6 +537,12 @@ struct guestfs_h {
    */
   int user_cancel;
 
+  /* The library is waiting for the reply to a daemon call which can
+   * be cancelled by sending a cancel flag (see
+   * guestfs_int_cancellable_call_sent in src/proto.c).
+   */
+  int daemon_cancel_armed;
+
   struct timeval launch_t;      /* The time that we called guestfs_launch. */
 
   /* Used by bindtests. */
@@ -512,6 +557,32 @@ struct guestfs_h {
   /*** Protocol. ***/
   struct connection *conn;              /* Connection to appliance. */
   int msg_next_serial;
+  size_t chunk_size;                    /* Negotiated file chunk size. */
+  bool no_internal_batch;               /* Daemon lacks internal_batch. */
+  bool hole_chunks;                     /* Daemon understands hole chunks. */
+  bool compressed_chunks;               /* Chunks may be zlib-compressed. */
+  bool bulk_channel;                    /* File chunks use the bulk channel. */
+
+  /* Length word of a message read from the control channel while
+   * checking for progress messages during a transfer over the bulk
+   * channel.  The rest of the message is read by the next call to
+   * recv_from_daemon.
+   */
+  bool have_pending_len;
+  uint32_t pending_len;
+
+  /* Message buffers, reused from call to call (see src/proto.c). */
+  char *msg_out;                        /* Outgoing requests. */
+  size_t msg_out_size;
+  char *msg_in;                         /* Incoming messages. */
+  size_t msg_in_size;
+  char *chunk_out;                      /* Outgoing file chunks. */
+  size_t chunk_out_size;
+  char *chunk_z;                        /* (De)compressed file chunks. */
+  size_t chunk_z_size;
+
+  /* Per-procedure call statistics (see src/call-stats.c). */
+  struct call_stats *call_stats;
 
 #if HAVE_FUSE
   /**** Used by the mount-local APIs. ****/
@@ -784,17 +855,56 @@ extern void guestfs_int_free_stringsbuf (struct stringsbuf *sb);
 extern void guestfs_int_cleanup_free_stringsbuf (struct stringsbuf *sb);
 
 /* proto.c */
+struct pipelined_call {
+  /* Set by the caller.  'ret' must point to a zeroed reply struct. */
+  int proc_nr;
+  uint64_t optargs_bitmask;
+  xdrproc_t xdr_args;
+  char *args;
+  xdrproc_t xdr_ret;
+  char *ret;
+
+  /* Used internally by guestfs_int_call_pipelined. */
+  int serial;
+  size_t size;                  /* Size of the request on the wire. */
+  bool done;                    /* Reply has been received. */
+};
+
+extern int guestfs_int_encode_message (guestfs_h *g, int proc_nr, int serial, uint64_t progress_hint, uint64_t optargs_bitmask, xdrproc_t xdrp, char *args, size_t *msg_out_size_r);
 extern int guestfs_int_send (guestfs_h *g, int proc_nr, uint64_t progress_hint, uint64_t optargs_bitmask, xdrproc_t xdrp, char *args);
+extern int guestfs_int_send_encoded (guestfs_h *g, const char *msg, size_t msg_size);
 extern int guestfs_int_recv (guestfs_h *g, const char *fn, struct guestfs_message_header *hdr, struct guestfs_message_error *err, xdrproc_t xdrp, char *ret);
 extern int guestfs_int_recv_discard (guestfs_h *g, const char *fn);
 extern int guestfs_int_send_file (guestfs_h *g, const char *filename);
 extern int guestfs_int_recv_file (guestfs_h *g, const char *filename);
 extern int guestfs_int_recv_from_daemon (guestfs_h *g, uint32_t *size_rtn, void **buf_rtn);
+extern int guestfs_int_call_pipelined (guestfs_h *g, const char *fn, struct pipelined_call *calls, size_t nr_calls);
+extern void guestfs_int_cancellable_call_begin (guestfs_h *g);
+extern void guestfs_int_cancellable_call_sent (guestfs_h *g);
+extern void guestfs_int_cancellable_call_end (guestfs_h *g);
 extern void guestfs_int_progress_message_callback (guestfs_h *g, const struct guestfs_progress *message);
 extern void guestfs_int_log_message_callback (guestfs_h *g, const char *buf, size_t len);
 
+/* batch.c */
+struct batch;
+extern struct batch *guestfs_int_new_batch (guestfs_h *g);
+extern int guestfs_int_batch_add (guestfs_h *g, struct batch *b, int proc_nr, uint64_t optargs_bitmask, xdrproc_t xdr_args, char *args, xdrproc_t xdr_ret, size_t ret_size);
+extern int guestfs_int_batch_run (guestfs_h *g, struct batch *b);
+extern int guestfs_int_batch_get (guestfs_h *g, struct batch *b, size_t i, int proc_nr, const char *fn, char *ret);
+extern void guestfs_int_free_batch (struct batch *b);
+
+/* call-stats.c */
+extern void guestfs_int_stats_request_sent (guestfs_h *g, int proc_nr, int serial, size_t size);
+extern void guestfs_int_stats_reply_received (guestfs_h *g, const struct guestfs_message_header *hdr, size_t size);
+extern void guestfs_int_stats_transfer (guestfs_h *g, uint64_t sent, uint64_t received);
+extern void guestfs_int_stats_clear_in_flight (guestfs_h *g);
+extern void guestfs_int_free_call_stats (guestfs_h *g);
+
+/* proc-names.c */
+extern const char *const guestfs_int_proc_names[];
+
 /* conn-socket.c */
-extern struct connection *guestfs_int_new_conn_socket_listening (guestfs_h *g, int daemon_accept_sock, int console_sock);
+extern struct connection *guestfs_int_new_conn_socket_listening (guestfs_h *g, int daemon_accept_sock, int bulk_accept_sock, int console_sock);
 extern struct connection *guestfs_int_new_conn_socket_connected (guestfs_h *g, int daemon_sock, int console_sock);
 
 /* events.c */
@@ -106,6 +106,9 @@ guestfs_create_flags (unsigned flags, ...)
   /* Default is uniprocessor appliance. */
   g->smp = 1;
 
+  /* Default is to wait for each reply before sending the next request. */
+  g->pipeline_depth = 1;
+
   g->path = strdup (GUESTFS_DEFAULT_PATH);
   if (!g->path) goto error;
 
@@ -399,6 +402,11 @@ guestfs_close (guestfs_h *g)
   free (g->backend_data);
   guestfs_int_free_string_list (g->backend_settings);
   free (g->append);
+  free (g->msg_out);
+  free (g->msg_in);
+  free (g->chunk_out);
+  free (g->chunk_z);
+  guestfs_int_free_call_stats (g);
   free (g);
 }
 
@@ -927,3 +935,42 @@ guestfs_impl_get_smp (guestfs_h *g)
 {
   return g->smp;
 }
+
+int
+guestfs_impl_set_pipeline_depth (guestfs_h *g, int v)
+{
+  if (v < 1 || v > MAX_PIPELINE_DEPTH) {
+    error (g, _("invalid pipeline depth: %d (must be between 1 and %d)"),
+           v, MAX_PIPELINE_DEPTH);
+    return -1;
+  }
+  g->pipeline_depth = v;
+  return 0;
+}
+
+int
+guestfs_impl_get_pipeline_depth (guestfs_h *g)
+{
+  return g->pipeline_depth;
+}
+
+int
+guestfs_impl_set_transfer_compression (guestfs_h *g, int v)
+{
+#ifndef HAVE_ZLIB
+  if (v) {
+    guestfs_int_error_errno (g, ENOTSUP,
+                             _("libguestfs was built without zlib, "
+                               "so transfers cannot be compressed"));
+    return -1;
+  }
+#endif
+  g->transfer_compression = !!v;
+  return 0;
+}
+
+int
+guestfs_impl_get_transfer_compression (guestfs_h *g)
+{
+  return g->transfer_compression;
+}
@@ -35,6 +35,7 @@
 
 #include "guestfs.h"
 #include "guestfs-internal.h"
+#include "guestfs-internal-actions.h"
 
 static int check_filesystem (guestfs_h *g, const char *mountable,
                              const struct guestfs_internal_mountable *m,
@@ -42,6 +43,7 @@ static int check_filesystem (guestfs_h *g, const char *mountable,
 static void extend_fses (guestfs_h *g);
 static int get_partition_context (guestfs_h *g, const char *partition, int *partnum_ret, int *nr_partitions_ret);
 static int is_symlink_to (guestfs_h *g, const char *file, const char *wanted_target);
+static void run_fs_probes (guestfs_h *g, int *r);
 
 /* Find out if 'device' contains a filesystem.  If it does, add
  * another entry in g->fses.
@@ -127,6 +129,93 @@ guestfs_int_check_for_filesystem_on (guestfs_h *g, const char *mountable)
   return r;
 }
 
+/* The files and directories tested by check_filesystem.  Testing
+ * them one at a time means a round trip to the daemon for each test,
+ * so they are all tested together in a batch (see src/batch.c) and
+ * check_filesystem looks up the results by their index.
+ */
+enum fs_probe {
+  PROBE_ETC,
+  PROBE_BIN,
+  PROBE_SHARE,
+  PROBE_GRUB_MENU_LST,
+  PROBE_GRUB_GRUB_CONF,
+  PROBE_GRUB2_GRUB_CFG,
+  PROBE_ETC_FREEBSD_UPDATE_CONF,
+  PROBE_ETC_FSTAB,
+  PROBE_NETBSD,
+  PROBE_ETC_RELEASE,
+  PROBE_BSD,
+  PROBE_ETC_MOTD,
+  PROBE_HURD_CONSOLE,
+  PROBE_HURD_HELLO,
+  PROBE_HURD_NULL,
+  PROBE_SERVICE_VM,
+  PROBE_ETC_VERSION,
+  PROBE_ETC_HOSTS,
+  PROBE_ROOT,
+  PROBE_HOME,
+  PROBE_USR,
+  PROBE_ETC_COREOS_UPDATE_CONF,
+  PROBE_LOCAL,
+  PROBE_SHARE_COREOS,
+  PROBE_LOG,
+  PROBE_RUN,
+  PROBE_SPOOL,
+  PROBE_ISOLINUX_ISOLINUX_CFG,
+  PROBE_EFI_BOOT,
+  PROBE_IMAGES_INSTALL_IMG,
+  PROBE_DISK,
+  PROBE_DISCINFO,
+  PROBE_I386_TXTSETUP_SIF,
+  PROBE_AMD64_TXTSETUP_SIF,
+  PROBE_FREEDOS_FREEDOS_ICO,
+  PROBE_BOOT_LOADER_RC,
+  NR_FS_PROBES
+};
+
+static const struct {
+  const char *path;
+  bool is_dir;
+} fs_probes[NR_FS_PROBES] = {
+  [PROBE_ETC] = { "/etc", true },
+  [PROBE_BIN] = { "/bin", true },
+  [PROBE_SHARE] = { "/share", true },
+  [PROBE_GRUB_MENU_LST] = { "/grub/menu.lst", false },
+  [PROBE_GRUB_GRUB_CONF] = { "/grub/grub.conf", false },
+  [PROBE_GRUB2_GRUB_CFG] = { "/grub2/grub.cfg", false },
+  [PROBE_ETC_FREEBSD_UPDATE_CONF] = { "/etc/freebsd-update.conf", false },
+  [PROBE_ETC_FSTAB] = { "/etc/fstab", false },
+  [PROBE_NETBSD] = { "/netbsd", false },
+  [PROBE_ETC_RELEASE] = { "/etc/release", false },
+  [PROBE_BSD] = { "/bsd", false },
+  [PROBE_ETC_MOTD] = { "/etc/motd", false },
+  [PROBE_HURD_CONSOLE] = { "/hurd/console", false },
+  [PROBE_HURD_HELLO] = { "/hurd/hello", false },
+  [PROBE_HURD_NULL] = { "/hurd/null", false },
+  [PROBE_SERVICE_VM] = { "/service/vm", false },
+  [PROBE_ETC_VERSION] = { "/etc/version", false },
+  [PROBE_ETC_HOSTS] = { "/etc/hosts", false },
+  [PROBE_ROOT] = { "/root", true },
+  [PROBE_HOME] = { "/home", true },
+  [PROBE_USR] = { "/usr", true },
+  [PROBE_ETC_COREOS_UPDATE_CONF] = { "/etc/coreos/update.conf", false },
+  [PROBE_LOCAL] = { "/local", true },
+  [PROBE_SHARE_COREOS] = { "/share/coreos", true },
+  [PROBE_LOG] = { "/log", true },
+  [PROBE_RUN] = { "/run", true },
+  [PROBE_SPOOL] = { "/spool", true },
+  [PROBE_ISOLINUX_ISOLINUX_CFG] = { "/isolinux/isolinux.cfg", false },
+  [PROBE_EFI_BOOT] = { "/EFI/BOOT", true },
+  [PROBE_IMAGES_INSTALL_IMG] = { "/images/install.img", false },
+  [PROBE_DISK] = { "/.disk", true },
+  [PROBE_DISCINFO] = { "/.discinfo", false },
+  [PROBE_I386_TXTSETUP_SIF] = { "/i386/txtsetup.sif", false },
+  [PROBE_AMD64_TXTSETUP_SIF] = { "/amd64/txtsetup.sif", false },
+  [PROBE_FREEDOS_FREEDOS_ICO] = { "/freedos/freedos.ico", false },
+  [PROBE_BOOT_LOADER_RC] = { "/boot/loader.rc", false },
+};
+
 static int
 check_filesystem (guestfs_h *g, const char *mountable,
                   const struct guestfs_internal_mountable *m,
@@ -135,6 +224,7 @@ check_filesystem (guestfs_h *g, const char *mountable,
   int partnum = -1, nr_partitions = -1;
   /* Not CLEANUP_FREE, as it will be cleaned up with inspection info */
   char *windows_systemroot = NULL;
+  int probes[NR_FS_PROBES];
 
   extend_fses (g);
 
@@ -149,21 +239,24 @@ check_filesystem (guestfs_h *g, const char *mountable,
 
   fs->mountable = safe_strdup (g, mountable);
 
+  /* Run all the is_file and is_dir tests used below in one batch. */
+  run_fs_probes (g, probes);
+
   /* Optimize some of the tests by avoiding multiple tests of the same thing. */
-  const int is_dir_etc = guestfs_is_dir (g, "/etc") > 0;
-  const int is_dir_bin = guestfs_is_dir (g, "/bin") > 0;
-  const int is_dir_share = guestfs_is_dir (g, "/share") > 0;
+  const int is_dir_etc = probes[PROBE_ETC] > 0;
+  const int is_dir_bin = probes[PROBE_BIN] > 0;
+  const int is_dir_share = probes[PROBE_SHARE] > 0;
 
   /* Grub /boot? */
-  if (guestfs_is_file (g, "/grub/menu.lst") > 0 ||
-      guestfs_is_file (g, "/grub/grub.conf") > 0 ||
-      guestfs_is_file (g, "/grub2/grub.cfg") > 0)
+  if (probes[PROBE_GRUB_MENU_LST] > 0 ||
+      probes[PROBE_GRUB_GRUB_CONF] > 0 ||
+      probes[PROBE_GRUB2_GRUB_CFG] > 0)
     ;
   /* FreeBSD root? */
   else if (is_dir_etc &&
            is_dir_bin &&
-           guestfs_is_file (g, "/etc/freebsd-update.conf") > 0 &&
-           guestfs_is_file (g, "/etc/fstab") > 0) {
+           probes[PROBE_ETC_FREEBSD_UPDATE_CONF] > 0 &&
+           probes[PROBE_ETC_FSTAB] > 0) {
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED;
     if (guestfs_int_check_freebsd_root (g, fs) == -1)
@@ -172,9 +265,9 @@ check_filesystem (guestfs_h *g, const char *mountable,
   /* NetBSD root? */
   else if (is_dir_etc &&
            is_dir_bin &&
-           guestfs_is_file (g, "/netbsd") > 0 &&
-           guestfs_is_file (g, "/etc/fstab") > 0 &&
-           guestfs_is_file (g, "/etc/release") > 0) {
+           probes[PROBE_NETBSD] > 0 &&
+           probes[PROBE_ETC_FSTAB] > 0 &&
+           probes[PROBE_ETC_RELEASE] > 0) {
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED;
     if (guestfs_int_check_netbsd_root (g, fs) == -1)
@@ -183,18 +276,18 @@ check_filesystem (guestfs_h *g, const char *mountable,
   /* OpenBSD root? */
   else if (is_dir_etc &&
            is_dir_bin &&
-           guestfs_is_file (g, "/bsd") > 0 &&
-           guestfs_is_file (g, "/etc/fstab") > 0 &&
-           guestfs_is_file (g, "/etc/motd") > 0) {
+           probes[PROBE_BSD] > 0 &&
+           probes[PROBE_ETC_FSTAB] > 0 &&
+           probes[PROBE_ETC_MOTD] > 0) {
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED;
     if (guestfs_int_check_openbsd_root (g, fs) == -1)
       return -1;
   }
   /* Hurd root? */
-  else if (guestfs_is_file (g, "/hurd/console") > 0 &&
-           guestfs_is_file (g, "/hurd/hello") > 0 &&
-           guestfs_is_file (g, "/hurd/null") > 0) {
+  else if (probes[PROBE_HURD_CONSOLE] > 0 &&
+           probes[PROBE_HURD_HELLO] > 0 &&
+           probes[PROBE_HURD_NULL] > 0) {
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED; /* XXX could be more specific */
     if (guestfs_int_check_hurd_root (g, fs) == -1)
@@ -203,9 +296,9 @@ check_filesystem (guestfs_h *g, const char *mountable,
   /* Minix root? */
   else if (is_dir_etc &&
            is_dir_bin &&
-           guestfs_is_file (g, "/service/vm") > 0 &&
-           guestfs_is_file (g, "/etc/fstab") > 0 &&
-           guestfs_is_file (g, "/etc/version") > 0) {
+           probes[PROBE_SERVICE_VM] > 0 &&
+           probes[PROBE_ETC_FSTAB] > 0 &&
+           probes[PROBE_ETC_VERSION] > 0) {
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED;
     if (guestfs_int_check_minix_root (g, fs) == -1)
@@ -215,8 +308,8 @@ check_filesystem (guestfs_h *g, const char *mountable,
   else if (is_dir_etc &&
            (is_dir_bin ||
             is_symlink_to (g, "/bin", "usr/bin") > 0) &&
-           (guestfs_is_file (g, "/etc/fstab") > 0 ||
-            guestfs_is_file (g, "/etc/hosts") > 0)) {
+           (probes[PROBE_ETC_FSTAB] > 0 ||
+            probes[PROBE_ETC_HOSTS] > 0)) {
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED;
     if (guestfs_int_check_linux_root (g, fs) == -1)
@@ -224,10 +317,10 @@ check_filesystem (guestfs_h *g, const char *mountable,
   }
   /* CoreOS root? */
   else if (is_dir_etc &&
-           guestfs_is_dir (g, "/root") > 0 &&
-           guestfs_is_dir (g, "/home") > 0 &&
-           guestfs_is_dir (g, "/usr") > 0 &&
-           guestfs_is_file (g, "/etc/coreos/update.conf") > 0) {
+           probes[PROBE_ROOT] > 0 &&
+           probes[PROBE_HOME] > 0 &&
+           probes[PROBE_USR] > 0 &&
+           probes[PROBE_ETC_COREOS_UPDATE_CONF] > 0) {
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED;
     if (guestfs_int_check_coreos_root (g, fs) == -1)
@@ -237,28 +330,28 @@ check_filesystem (guestfs_h *g, const char *mountable,
   else if (is_dir_etc &&
            is_dir_bin &&
            is_dir_share &&
-           guestfs_is_dir (g, "/local") == 0 &&
-           guestfs_is_file (g, "/etc/fstab") == 0)
+           probes[PROBE_LOCAL] == 0 &&
+           probes[PROBE_ETC_FSTAB] == 0)
     ;
   /* Linux /usr? */
   else if (is_dir_etc &&
            is_dir_bin &&
            is_dir_share &&
-           guestfs_is_dir (g, "/local") > 0 &&
-           guestfs_is_file (g, "/etc/fstab") == 0)
+           probes[PROBE_LOCAL] > 0 &&
+           probes[PROBE_ETC_FSTAB] == 0)
     ;
   /* CoreOS /usr? */
   else if (is_dir_bin &&
            is_dir_share &&
-           guestfs_is_dir (g, "/local") > 0 &&
-           guestfs_is_dir (g, "/share/coreos") > 0) {
+           probes[PROBE_LOCAL] > 0 &&
+           probes[PROBE_SHARE_COREOS] > 0) {
     if (guestfs_int_check_coreos_usr (g, fs) == -1)
       return -1;
   }
   /* Linux /var? */
-  else if (guestfs_is_dir (g, "/log") > 0 &&
-           guestfs_is_dir (g, "/run") > 0 &&
-           guestfs_is_dir (g, "/spool") > 0)
+  else if (probes[PROBE_LOG] > 0 &&
+           probes[PROBE_RUN] > 0 &&
+           probes[PROBE_SPOOL] > 0)
     ;
   /* Windows root? */
   else if ((windows_systemroot = guestfs_int_get_windows_systemroot (g)) != NULL)
@@ -297,15 +390,15 @@ check_filesystem (guestfs_h *g, const char *mountable,
    * first partition (eg. bootable USB key).
    */
   else if ((whole_device || (partnum == 1 && nr_partitions == 1)) &&
-           (guestfs_is_file (g, "/isolinux/isolinux.cfg") > 0 ||
-            guestfs_is_dir (g, "/EFI/BOOT") > 0 ||
-            guestfs_is_file (g, "/images/install.img") > 0 ||
-            guestfs_is_dir (g, "/.disk") > 0 ||
-            guestfs_is_file (g, "/.discinfo") > 0 ||
-            guestfs_is_file (g, "/i386/txtsetup.sif") > 0 ||
-            guestfs_is_file (g, "/amd64/txtsetup.sif") > 0 ||
-            guestfs_is_file (g, "/freedos/freedos.ico") > 0 ||
-            guestfs_is_file (g, "/boot/loader.rc") > 0)) {
+           (probes[PROBE_ISOLINUX_ISOLINUX_CFG] > 0 ||
+            probes[PROBE_EFI_BOOT] > 0 ||
+            probes[PROBE_IMAGES_INSTALL_IMG] > 0 ||
+            probes[PROBE_DISK] > 0 ||
+            probes[PROBE_DISCINFO] > 0 ||
+            probes[PROBE_I386_TXTSETUP_SIF] > 0 ||
+            probes[PROBE_AMD64_TXTSETUP_SIF] > 0 ||
+            probes[PROBE_FREEDOS_FREEDOS_ICO] > 0 ||
+            probes[PROBE_BOOT_LOADER_RC] > 0)) {
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLER;
     if (guestfs_int_check_installer_root (g, fs) == -1)
@@ -321,6 +414,44 @@ check_filesystem (guestfs_h *g, const char *mountable,
   return 0;
 }
 
+/* Run all the tests in fs_probes.  r[i] is set to the result of
+ * guestfs_is_dir or guestfs_is_file for fs_probes[i].
+ */
+static void
+run_fs_probes (guestfs_h *g, int *r)
+{
+  struct batch *b;
+  int idx[NR_FS_PROBES];
+  size_t i;
+
+  b = guestfs_int_new_batch (g);
+
+  for (i = 0; i < NR_FS_PROBES; ++i) {
+    if (fs_probes[i].is_dir)
+      idx[i] = guestfs_int_batch_add_is_dir (g, b, fs_probes[i].path, NULL);
+    else
+      idx[i] = guestfs_int_batch_add_is_file (g, b, fs_probes[i].path, NULL);
+  }
+
+  if (guestfs_int_batch_run (g, b) == -1) {
+    for (i = 0; i < NR_FS_PROBES; ++i)
+      r[i] = -1;
+    goto out;
+  }
+
+  for (i = 0; i < NR_FS_PROBES; ++i) {
+    if (idx[i] == -1)
+      r[i] = -1;
+    else if (fs_probes[i].is_dir)
+      r[i] = guestfs_int_batch_get_is_dir (g, b, idx[i]);
+    else
+      r[i] = guestfs_int_batch_get_is_file (g, b, idx[i]);
+  }
+
+ out:
+  guestfs_int_free_batch (b);
+}
+
 static void
 extend_fses (guestfs_h *g)
 {
@@ -57,6 +57,7 @@ struct backend_direct_data {
   struct qemu_data *qemu_data;  /* qemu -help output etc. */
 
   char guestfsd_sock[UNIX_PATH_MAX]; /* Path to daemon socket. */
+  char bulk_sock[UNIX_PATH_MAX];     /* Path to bulk data socket. */
 };
 
 static int is_openable (guestfs_h *g, const char *path, int flags);
@@ -220,7 +221,7 @@ launch_direct (guestfs_h *g, void *datav, const char *arg)
 {
   struct backend_direct_data *data = datav;
   CLEANUP_FREE_STRINGSBUF DECLARE_STRINGSBUF (cmdline);
-  int daemon_accept_sock = -1, console_sock = -1;
+  int daemon_accept_sock = -1, bulk_accept_sock = -1, console_sock = -1;
   int r;
   int flags;
   int sv[2];
@@ -313,6 +314,34 @@ launch_direct (guestfs_h *g, void *datav, const char *arg)
     goto cleanup0;
   }
 
+  /* A second socket for the bulk data channel, which carries only
+   * FileIn and FileOut data.
+   */
+  if (guestfs_int_create_socketname (g, "bulk.sock",
+                                     &data->bulk_sock) == -1)
+    goto cleanup0;
+
+  bulk_accept_sock = socket (AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+  if (bulk_accept_sock == -1) {
+    perrorf (g, "socket");
+    goto cleanup0;
+  }
+
+  addr.sun_family = AF_UNIX;
+  strncpy (addr.sun_path, data->bulk_sock, UNIX_PATH_MAX);
+  addr.sun_path[UNIX_PATH_MAX-1] = '\0';
+
+  if (bind (bulk_accept_sock, (struct sockaddr *) &addr,
+            sizeof addr) == -1) {
+    perrorf (g, "bind");
+    goto cleanup0;
+  }
+
+  if (listen (bulk_accept_sock, 1) == -1) {
+    perrorf (g, "listen");
+    goto cleanup0;
+  }
+
   if (!g->direct_mode) {
     if (socketpair (AF_LOCAL, SOCK_STREAM|SOCK_CLOEXEC, 0, sv) == -1) {
       perrorf (g, "socketpair");
@@ -606,6 +635,10 @@ launch_direct (guestfs_h *g, void *datav, const char *arg)
   ADD_CMDLINE_PRINTF ("socket,path=%s,id=channel0", data->guestfsd_sock);
   ADD_CMDLINE ("-device");
   ADD_CMDLINE ("virtserialport,chardev=channel0,name=org.libguestfs.channel.0");
+  ADD_CMDLINE ("-chardev");
+  ADD_CMDLINE_PRINTF ("socket,path=%s,id=channel1", data->bulk_sock);
+  ADD_CMDLINE ("-device");
+  ADD_CMDLINE ("virtserialport,chardev=channel1,name=org.libguestfs.channel.1");
 
   /* Enable user networking. */
   if (g->enable_network) {
@@ -793,12 +826,13 @@ launch_direct (guestfs_h *g, void *datav, const char *arg)
    * virtio-serial and send the GUESTFS_LAUNCH_FLAG message.
    */
   g->conn =
-    guestfs_int_new_conn_socket_listening (g, daemon_accept_sock, console_sock);
+    guestfs_int_new_conn_socket_listening (g, daemon_accept_sock,
+                                           bulk_accept_sock, console_sock);
   if (!g->conn)
     goto cleanup1;
 
   /* g->conn now owns these sockets. */
-  daemon_accept_sock = console_sock = -1;
+  daemon_accept_sock = bulk_accept_sock = console_sock = -1;
 
   r = g->conn->ops->accept_connection (g, g->conn);
   if (r == -1)
@@ -864,6 +898,8 @@ launch_direct (guestfs_h *g, void *datav, const char *arg)
  cleanup0:
   if (daemon_accept_sock >= 0)
     close (daemon_accept_sock);
+  if (bulk_accept_sock >= 0)
+    close (bulk_accept_sock);
   if (console_sock >= 0)
     close (console_sock);
   if (g->conn) {
@@ -991,6 +1027,10 @@ shutdown_direct (guestfs_h *g, void *datav, int check_for_errors)
     unlink (data->guestfsd_sock);
     data->guestfsd_sock[0] = '\0';
   }
+  if (data->bulk_sock[0] != '\0') {
+    unlink (data->bulk_sock);
+    data->bulk_sock[0] = '\0';
+  }
 
   guestfs_int_free_qemu_data (data->qemu_data);
   data->qemu_data = NULL;
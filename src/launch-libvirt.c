@@ -125,6 +125,7 @@ struct backend_libvirt_data {
   char *uefi_code;		/* UEFI (firmware) code and variables. */
   char *uefi_vars;
   char guestfsd_path[UNIX_PATH_MAX]; /* paths to sockets */
+  char bulk_path[UNIX_PATH_MAX];
   char console_path[UNIX_PATH_MAX];
 };
 
@@ -294,7 +295,7 @@ static int
 launch_libvirt (guestfs_h *g, void *datav, const char *libvirt_uri)
 {
   struct backend_libvirt_data *data = datav;
-  int daemon_accept_sock = -1, console_sock = -1;
+  int daemon_accept_sock = -1, bulk_accept_sock = -1, console_sock = -1;
   virConnectPtr conn = NULL;
   virDomainPtr dom = NULL;
   CLEANUP_FREE char *capabilities_xml = NULL;
@@ -497,6 +498,31 @@ launch_libvirt (guestfs_h *g, void *datav, const char *libvirt_uri)
     goto cleanup;
   }
 
+  /* For the bulk data channel. */
+  if (guestfs_int_create_socketname (g, "bulk.sock",
+                                     &data->bulk_path) == -1)
+    goto cleanup;
+
+  bulk_accept_sock = socket (AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+  if (bulk_accept_sock == -1) {
+    perrorf (g, "socket");
+    goto cleanup;
+  }
+
+  addr.sun_family = AF_UNIX;
+  memcpy (addr.sun_path, data->bulk_path, UNIX_PATH_MAX);
+
+  if (bind (bulk_accept_sock, (struct sockaddr *) &addr,
+            sizeof addr) == -1) {
+    perrorf (g, "bind");
+    goto cleanup;
+  }
+
+  if (listen (bulk_accept_sock, 1) == -1) {
+    perrorf (g, "listen");
+    goto cleanup;
+  }
+
   /* For the serial console. */
   if (guestfs_int_create_socketname (g, "console.sock",
                                      &data->console_path) == -1)
@@ -551,6 +577,11 @@ launch_libvirt (guestfs_h *g, void *datav, const char *libvirt_uri)
       goto cleanup;
     }
 
+    if (chmod (data->bulk_path, 0660) == -1) {
+      perrorf (g, "chmod: %s", data->bulk_path);
+      goto cleanup;
+    }
+
     if (chmod (data->console_path, 0660) == -1) {
       perrorf (g, "chmod: %s", data->console_path);
       goto cleanup;
@@ -562,6 +593,10 @@ launch_libvirt (guestfs_h *g, void *datav, const char *libvirt_uri)
         perrorf (g, "chown: %s", data->guestfsd_path);
         goto cleanup;
       }
+      if (chown (data->bulk_path, 0, grp->gr_gid) == -1) {
+        perrorf (g, "chown: %s", data->bulk_path);
+        goto cleanup;
+      }
       if (chown (data->console_path, 0, grp->gr_gid) == -1) {
         perrorf (g, "chown: %s", data->console_path);
         goto cleanup;
@@ -631,12 +666,13 @@ launch_libvirt (guestfs_h *g, void *datav, const char *libvirt_uri)
    * virtio-serial and send the GUESTFS_LAUNCH_FLAG message.
    */
   g->conn =
-    guestfs_int_new_conn_socket_listening (g, daemon_accept_sock, console_sock);
+    guestfs_int_new_conn_socket_listening (g, daemon_accept_sock,
+                                           bulk_accept_sock, console_sock);
   if (!g->conn)
     goto cleanup;
 
   /* g->conn now owns these sockets. */
-  daemon_accept_sock = console_sock = -1;
+  daemon_accept_sock = bulk_accept_sock = console_sock = -1;
 
   r = g->conn->ops->accept_connection (g, g->conn);
   if (r == -1)
@@ -700,6 +736,8 @@ launch_libvirt (guestfs_h *g, void *datav, const char *libvirt_uri)
     close (console_sock);
   if (daemon_accept_sock >= 0)
     close (daemon_accept_sock);
+  if (bulk_accept_sock >= 0)
+    close (bulk_accept_sock);
   if (g->conn) {
     g->conn->ops->free_connection (g, g->conn);
     g->conn = NULL;
@@ -1384,6 +1422,19 @@ construct_libvirt_xml_devices (guestfs_h *g,
       } end_element ();
     } end_element ();
 
+    /* Second virtio-serial port for bulk file data. */
+    start_element ("channel") {
+      attribute ("type", "unix");
+      start_element ("source") {
+        attribute ("mode", "connect");
+        attribute ("path", params->data->bulk_path);
+      } end_element ();
+      start_element ("target") {
+        attribute ("type", "virtio");
+        attribute ("name", "org.libguestfs.channel.1");
+      } end_element ();
+    } end_element ();
+
     /* Connect to libvirt bridge (see: RHBZ#1148012). */
     if (g->enable_network) {
       start_element ("interface") {
@@ -2083,6 +2134,11 @@ shutdown_libvirt (guestfs_h *g, void *datav, int check_for_errors)
     data->guestfsd_path[0] = '\0';
   }
 
+  if (data->bulk_path[0] != '\0') {
+    unlink (data->bulk_path);
+    data->bulk_path[0] = '\0';
+  }
+
   if (data->console_path[0] != '\0') {
     unlink (data->console_path);
     data->console_path[0] = '\0';
@@ -50,6 +50,11 @@ static struct backend {
   const struct backend_ops *ops;
 } *backends = NULL;
 
+static void negotiate_chunk_size (guestfs_h *g);
+static void negotiate_hole_chunks (guestfs_h *g);
+static void negotiate_compressed_chunks (guestfs_h *g);
+static void negotiate_bulk_channel (guestfs_h *g);
+
 int
 guestfs_impl_launch (guestfs_h *g)
 {
@@ -92,13 +97,137 @@ guestfs_impl_launch (guestfs_h *g)
     debug (g, "launch: euid=%ju", (uintmax_t) geteuid ());
   }
 
+  /* Until we have talked to the daemon, use the smallest chunk size. */
+  g->chunk_size = GUESTFS_MAX_CHUNK_SIZE;
+
+  /* The new appliance may support internal_batch (see src/batch.c). */
+  g->no_internal_batch = false;
+  g->hole_chunks = false;
+  g->compressed_chunks = false;
+  g->bulk_channel = false;
+  g->have_pending_len = false;
+  guestfs_int_stats_clear_in_flight (g);
+
   /* Launch the appliance. */
   if (g->backend_ops->launch (g, g->backend_data, g->backend_arg) == -1)
     return -1;
 
+  negotiate_chunk_size (g);
+  negotiate_hole_chunks (g);
+  negotiate_compressed_chunks (g);
+  negotiate_bulk_channel (g);
+
   return 0;
 }
 
+/**
+ * Ask the daemon to use larger chunks for C<FileIn> and C<FileOut>
+ * transfers, which greatly reduces the per-chunk overhead of large
+ * uploads and downloads.
+ *
+ * Old appliances don't have the C<internal_set_chunk_size> call.  In
+ * that case (or if anything else goes wrong) we carry on using
+ * C<GUESTFS_MAX_CHUNK_SIZE>, so this function never fails.
+ */
+static void
+negotiate_chunk_size (guestfs_h *g)
+{
+  int r;
+
+  guestfs_push_error_handler (g, NULL, NULL);
+  r = guestfs_internal_set_chunk_size (g, REQUESTED_CHUNK_SIZE);
+  guestfs_pop_error_handler (g);
+
+  if (r < GUESTFS_MAX_CHUNK_SIZE || r > GUESTFS_MAX_NEGOTIATED_CHUNK_SIZE) {
+    debug (g, "launch: using default chunk size (%d bytes)",
+           GUESTFS_MAX_CHUNK_SIZE);
+    return;
+  }
+
+  g->chunk_size = r;
+  debug (g, "launch: negotiated chunk size: %d bytes", r);
+}
+
+/**
+ * Tell the daemon that we understand hole chunks, so that runs of
+ * zeroes in C<FileIn> and C<FileOut> transfers (eg. downloading a
+ * mostly empty disk) don't have to be sent over the socket.
+ *
+ * Old appliances don't have the C<internal_enable_hole_chunks> call,
+ * in which case neither side sends hole chunks.
+ */
+static void
+negotiate_hole_chunks (guestfs_h *g)
+{
+  int r;
+
+  guestfs_push_error_handler (g, NULL, NULL);
+  r = guestfs_internal_enable_hole_chunks (g);
+  guestfs_pop_error_handler (g);
+
+  g->hole_chunks = r == 0;
+  debug (g, "launch: hole chunks %s",
+         g->hole_chunks ? "enabled" : "not supported by the daemon");
+}
+
+/**
+ * If the user asked for compressed transfers
+ * (C<guestfs_set_transfer_compression>), tell the daemon that we
+ * will accept and may send zlib-compressed chunks.
+ *
+ * If either side was built without zlib, or the appliance is too old
+ * to have the C<internal_enable_compressed_chunks> call, transfers
+ * are done uncompressed.
+ */
+static void
+negotiate_compressed_chunks (guestfs_h *g)
+{
+#ifdef HAVE_ZLIB
+  int r;
+
+  if (!g->transfer_compression)
+    return;
+
+  guestfs_push_error_handler (g, NULL, NULL);
+  r = guestfs_internal_enable_compressed_chunks (g);
+  guestfs_pop_error_handler (g);
+
+  g->compressed_chunks = r == 0;
+  debug (g, "launch: compressed chunks %s",
+         g->compressed_chunks ? "enabled" : "not supported by the daemon");
+#endif
+}
+
+/**
+ * If the backend gave the appliance a second virtio-serial port,
+ * ask the daemon to send C<FileIn> and C<FileOut> chunks over it.
+ * This keeps large transfers off the control channel, so progress
+ * messages are not queued up behind file data.
+ *
+ * If the connection has no bulk data channel, or the daemon is too
+ * old or could not open the port, everything stays on the control
+ * channel.
+ */
+static void
+negotiate_bulk_channel (guestfs_h *g)
+{
+  int r;
+
+  if (g->conn == NULL || g->conn->ops->has_bulk_channel == NULL ||
+      !g->conn->ops->has_bulk_channel (g, g->conn)) {
+    debug (g, "launch: no bulk data channel");
+    return;
+  }
+
+  guestfs_push_error_handler (g, NULL, NULL);
+  r = guestfs_internal_enable_bulk_channel (g);
+  guestfs_pop_error_handler (g);
+
+  g->bulk_channel = r == 0;
+  debug (g, "launch: bulk data channel %s",
+         g->bulk_channel ? "enabled" : "not supported by the daemon");
+}
+
 /**
  * This function sends a launch progress message.
  *
@@ -28,19 +28,20 @@
 
 /* List filesystems.
  *
- * The current implementation just uses guestfs_vfs_type and doesn't
- * try mounting anything, but we reserve the right in future to try
- * mounting filesystems.
+ * The current implementation just uses guestfs_vfs_probe_list (or
+ * guestfs_vfs_type) and doesn't try mounting anything, but we reserve
+ * the right in future to try mounting filesystems.
  */
 
 static void remove_from_list (char **list, const char *item);
-static int check_with_vfs_type (guestfs_h *g, const char *dev, struct stringsbuf *sb);
+static void add_to_list (char **list, size_t *n, char **items);
+static int check_with_vfs_type (guestfs_h *g, const char *dev, const char *vfs_type, struct stringsbuf *sb);
 static int is_mbr_partition_type_42 (guestfs_h *g, const char *partition);
 
 char **
 guestfs_impl_list_filesystems (guestfs_h *g)
 {
-  size_t i;
+  size_t i, n;
   DECLARE_STRINGSBUF (ret);
 
   const char *lvm2[] = { "lvm2", NULL };
@@ -54,6 +55,8 @@ guestfs_impl_list_filesystems (guestfs_h *g)
   CLEANUP_FREE_STRING_LIST char **lvs = NULL;
   CLEANUP_FREE_STRING_LIST char **ldmvols = NULL;
   CLEANUP_FREE_STRING_LIST char **ldmparts = NULL;
+  CLEANUP_FREE char **candidates = NULL;
+  CLEANUP_FREE_VFS_PROBE_LIST struct guestfs_vfs_probe_list *probes = NULL;
 
   /* Look to see if any devices directly contain filesystems
    * (RHBZ#590167).  However vfs-type will fail to tell us anything
@@ -74,49 +77,67 @@ guestfs_impl_list_filesystems (guestfs_h *g)
       remove_from_list (devices, dev);
   }
 
-  /* Use vfs-type to check for filesystems on devices. */
-  for (i = 0; devices[i] != NULL; ++i)
-    if (check_with_vfs_type (g, devices[i], &ret) == -1)
-      goto error;
-
-  /* Use vfs-type to check for filesystems on partitions. */
-  for (i = 0; partitions[i] != NULL; ++i) {
-    if (has_ldm == 0 || ! is_mbr_partition_type_42 (g, partitions[i])) {
-      if (check_with_vfs_type (g, partitions[i], &ret) == -1)
-        goto error;
+  /* Ignore partitions which are part of a Windows dynamic disk. */
+  if (has_ldm > 0) {
+    for (i = 0, n = 0; partitions[i] != NULL; ++i) {
+      if (is_mbr_partition_type_42 (g, partitions[i]))
+        free (partitions[i]);
+      else
+        partitions[n++] = partitions[i];
     }
+    partitions[n] = NULL;
   }
 
-  /* Use vfs-type to check for filesystems on md devices. */
-  for (i = 0; mds[i] != NULL; ++i)
-    if (check_with_vfs_type (g, mds[i], &ret) == -1)
-      goto error;
-
   if (has_lvm2 > 0) {
-    /* Use vfs-type to check for filesystems on LVs. */
     lvs = guestfs_lvs (g);
     if (lvs == NULL) goto error;
-
-    for (i = 0; lvs[i] != NULL; ++i)
-      if (check_with_vfs_type (g, lvs[i], &ret) == -1)
-        goto error;
   }
 
   if (has_ldm > 0) {
-    /* Use vfs-type to check for filesystems on Windows dynamic disks. */
     ldmvols = guestfs_list_ldm_volumes (g);
     if (ldmvols == NULL) goto error;
-
-    for (i = 0; ldmvols[i] != NULL; ++i)
-      if (check_with_vfs_type (g, ldmvols[i], &ret) == -1)
-        goto error;
-
     ldmparts = guestfs_list_ldm_partitions (g);
     if (ldmparts == NULL) goto error;
+  }
+
+  /* Make a list of all the devices, partitions, md devices, LVs and
+   * Windows dynamic disk volumes which could contain filesystems.
+   */
+  n = guestfs_int_count_strings (devices) +
+    guestfs_int_count_strings (partitions) +
+    guestfs_int_count_strings (mds);
+  if (lvs)
+    n += guestfs_int_count_strings (lvs);
+  if (ldmvols)
+    n += guestfs_int_count_strings (ldmvols);
+  if (ldmparts)
+    n += guestfs_int_count_strings (ldmparts);
+  candidates = safe_malloc (g, (n+1) * sizeof (char *));
+  n = 0;
+  add_to_list (candidates, &n, devices);
+  add_to_list (candidates, &n, partitions);
+  add_to_list (candidates, &n, mds);
+  add_to_list (candidates, &n, lvs);
+  add_to_list (candidates, &n, ldmvols);
+  add_to_list (candidates, &n, ldmparts);
+  candidates[n] = NULL;
+
+  /* Probe all of them in a single call.  If this fails (eg. with an
+   * older appliance), fall back to calling vfs-type on each one.
+   */
+  guestfs_push_error_handler (g, NULL, NULL);
+  probes = guestfs_vfs_probe_list (g, candidates);
+  guestfs_pop_error_handler (g);
+  if (probes && probes->len != n) {
+    guestfs_free_vfs_probe_list (probes);
+    probes = NULL;
+  }
 
-    for (i = 0; ldmparts[i] != NULL; ++i)
-      if (check_with_vfs_type (g, ldmparts[i], &ret) == -1)
-        goto error;
+  for (i = 0; i < n; ++i) {
+    if (check_with_vfs_type (g, candidates[i],
+                             probes ? probes->val[i].vp_type : NULL,
+                             &ret) == -1)
+      goto error;
   }
 
   /* Finish off the list and return it. */
@@ -144,19 +165,40 @@ remove_from_list (char **list, const char *item)
     }
 }
 
-/* Use vfs-type to look for a filesystem of some sort on 'dev'.
+/* Append the (borrowed) strings in 'items' to 'list'.  'items' may
+ * be NULL.
+ */
+static void
+add_to_list (char **list, size_t *n, char **items)
+{
+  size_t i;
+
+  if (items == NULL)
+    return;
+
+  for (i = 0; items[i] != NULL; ++i)
+    list[(*n)++] = items[i];
+}
+
+/* Look for a filesystem of some sort on 'dev'.  'probed_type' is the
+ * type found by vfs-probe-list, or NULL to call vfs-type instead.
  * Apart from some types which we ignore, add the result to the
  * 'ret' string list.
  */
 static int
-check_with_vfs_type (guestfs_h *g, const char *device, struct stringsbuf *sb)
+check_with_vfs_type (guestfs_h *g, const char *device,
+                     const char *probed_type, struct stringsbuf *sb)
 {
   const char *v;
   CLEANUP_FREE char *vfs_type = NULL;
 
-  guestfs_push_error_handler (g, NULL, NULL);
-  vfs_type = guestfs_vfs_type (g, device);
-  guestfs_pop_error_handler (g);
+  if (probed_type)
+    vfs_type = safe_strdup (g, probed_type);
+  else {
+    guestfs_push_error_handler (g, NULL, NULL);
+    vfs_type = guestfs_vfs_type (g, device);
+    guestfs_pop_error_handler (g);
+  }
 
   if (!vfs_type)
     v = "unknown";
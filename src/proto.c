@@ -66,6 +66,11 @@
  *
  * =back
  *
+ * Library code which needs to make many independent simple RPCs
+ * (case 2) can instead call C<guestfs_int_call_pipelined>, which
+ * writes several requests before reading the replies, matching
+ * replies to requests by serial number.
+ *
  * All read/write/etc operations are performed using the current
  * connection module (C<g-E<gt>conn>).  During operations the
  * connection module transparently handles log messages that appear on
@@ -88,16 +93,42 @@
 #include <rpc/types.h>
 #include <rpc/xdr.h>
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #include "c-ctype.h"
 #include "ignore-value.h"
 
 #include "guestfs.h"
 #include "guestfs-internal.h"
 #include "guestfs_protocol.h"
+#include "errnostring.h"
 
 /* Size of guestfs_progress message on the wire. */
 #define PROGRESS_MESSAGE_SIZE 24
 
+/* Initial size of the outgoing message buffer.  Most requests are
+ * much smaller than this.
+ */
+#define MSG_OUT_INITIAL_SIZE (64 * 1024)
+
+/* After a large message, the incoming message buffer is shrunk back
+ * to this size when the next message fits in it, so that one large
+ * reply doesn't pin up to GUESTFS_MESSAGE_MAX bytes for the life of
+ * the handle.
+ */
+#define MSG_IN_KEEP_SIZE (64 * 1024)
+
+/* Size of the header of a file chunk on the wire: the length word,
+ * then the 'cancel' field and the length of the 'data' field of
+ * guestfs_chunk.
+ */
+#define CHUNK_HEADER_SIZE 12
+
+/* Zeroes used when a hole has to be written out as data. */
+static const char zero_buf[64 * 1024];
+
 /**
  * This is called if we detect EOF, ie. qemu died.
  */
@@ -166,6 +197,81 @@ guestfs_int_log_message_callback (guestfs_h *g, const char *buf, size_t len)
   }
 }
 
+/**
+ * Read or write data on one of the channels to the daemon.  C<bulk>
+ * selects the bulk data channel instead of the control channel.
+ * Callers pass C<g-E<gt>bulk_channel> for file chunks, and C<false>
+ * for everything else (including the cancellation flags).
+ */
+static ssize_t
+read_channel (guestfs_h *g, bool bulk, void *buf, size_t len)
+{
+  if (bulk)
+    return g->conn->ops->read_bulk (g, g->conn, buf, len);
+  return g->conn->ops->read_data (g, g->conn, buf, len);
+}
+
+static ssize_t
+write_channel (guestfs_h *g, bool bulk, const void *buf, size_t len)
+{
+  if (bulk)
+    return g->conn->ops->write_bulk (g, g->conn, buf, len);
+  return g->conn->ops->write_data (g, g->conn, buf, len);
+}
+
+/**
+ * When file chunks are sent over the bulk data channel, progress
+ * messages still arrive on the control channel.  Handle any which
+ * are waiting, without blocking.
+ *
+ * If some other message (eg. the reply) has started to arrive on the
+ * control channel, its length word is saved in C<g-E<gt>pending_len>
+ * and the rest of it is left for C<recv_from_daemon>.
+ *
+ * Returns C<1> if OK, C<0> if the appliance went away, or C<-1> on
+ * error.
+ */
+static ssize_t
+recv_progress_messages (guestfs_h *g)
+{
+  char buf[4];
+  ssize_t n;
+  uint32_t flag;
+  XDR xdr;
+
+  while (!g->have_pending_len &&
+         g->conn->ops->can_read_data (g, g->conn) == 1) {
+    n = g->conn->ops->read_data (g, g->conn, buf, 4);
+    if (n <= 0) /* 0 or -1 */
+      return n;
+
+    xdrmem_create (&xdr, buf, 4, XDR_DECODE);
+    xdr_uint32_t (&xdr, &flag);
+    xdr_destroy (&xdr);
+
+    if (flag == GUESTFS_PROGRESS_FLAG) {
+      char mbuf[PROGRESS_MESSAGE_SIZE];
+      guestfs_progress message;
+
+      n = g->conn->ops->read_data (g, g->conn, mbuf, PROGRESS_MESSAGE_SIZE);
+      if (n <= 0) /* 0 or -1 */
+        return n;
+
+      xdrmem_create (&xdr, mbuf, PROGRESS_MESSAGE_SIZE, XDR_DECODE);
+      xdr_guestfs_progress (&xdr, &message);
+      xdr_destroy (&xdr);
+
+      guestfs_int_progress_message_callback (g, &message);
+    }
+    else {
+      g->pending_len = flag;
+      g->have_pending_len = true;
+    }
+  }
+
+  return 1;
+}
+
 /**
  * Before writing to the daemon socket, check the read side of the
  * daemon socket for any of these conditions:
@@ -204,6 +310,12 @@ check_daemon_socket (guestfs_h *g)
 
   assert (g->conn); /* callers must check this */
 
+  /* A reply which started to arrive during a transfer over the bulk
+   * data channel (see recv_progress_messages).
+   */
+  if (g->have_pending_len)
+    return 1;
+
  again:
   if (! g->conn->ops->can_read_data (g, g->conn))
     return 1;
@@ -243,32 +355,36 @@ check_daemon_socket (guestfs_h *g)
   return -2;
 }
 
+/**
+ * Encode a request (header and arguments) into the handle's outgoing
+ * message buffer (C<g-E<gt>msg_out>), including the length word at
+ * the beginning.  The buffer is reused by the next call.
+ *
+ * The buffer starts small and is only enlarged to
+ * C<GUESTFS_MESSAGE_MAX> when a request does not fit.  It is shrunk
+ * again as soon as a request fits in the small size, so a run of
+ * large requests reuses the large buffer but it isn't kept after
+ * that.
+ *
+ * Returns C<0> on success, or C<-1> on error.
+ */
 int
-guestfs_int_send (guestfs_h *g, int proc_nr,
-		  uint64_t progress_hint, uint64_t optargs_bitmask,
-		  xdrproc_t xdrp, char *args)
+guestfs_int_encode_message (guestfs_h *g, int proc_nr, int serial,
+                            uint64_t progress_hint, uint64_t optargs_bitmask,
+                            xdrproc_t xdrp, char *args,
+                            size_t *msg_out_size_r)
 {
   struct guestfs_message_header hdr;
   XDR xdr;
   uint32_t len;
-  const int serial = g->msg_next_serial++;
-  ssize_t r;
-  CLEANUP_FREE char *msg_out = NULL;
-  size_t msg_out_size;
 
-  if (!g->conn) {
-    guestfs_int_unexpected_close_error (g);
-    return -1;
+  if (g->msg_out == NULL) {
+    g->msg_out = safe_malloc (g, MSG_OUT_INITIAL_SIZE);
+    g->msg_out_size = MSG_OUT_INITIAL_SIZE;
   }
 
-  /* We have to allocate this message buffer on the heap because
-   * it is quite large (although will be mostly unused).  We
-   * can't allocate it on the stack because in some environments
-   * we have quite limited stack space available, notably when
-   * running in the JVM.
-   */
-  msg_out = safe_malloc (g, GUESTFS_MESSAGE_MAX + 4);
-  xdrmem_create (&xdr, msg_out + 4, GUESTFS_MESSAGE_MAX, XDR_ENCODE);
+ again:
+  xdrmem_create (&xdr, g->msg_out + 4, g->msg_out_size - 4, XDR_ENCODE);
 
   /* Serialize the header. */
   hdr.prog = GUESTFS_PROGRAM;
@@ -282,6 +398,7 @@ guestfs_int_send (guestfs_h *g, int proc_nr,
 
   if (!xdr_guestfs_message_header (&xdr, &hdr)) {
     error (g, _("xdr_guestfs_message_header failed"));
+    xdr_destroy (&xdr);
     return -1;
   }
 
@@ -290,22 +407,109 @@ guestfs_int_send (guestfs_h *g, int proc_nr,
    */
   if (xdrp) {
     if (!(*xdrp) (&xdr, args, 0)) {
+      xdr_destroy (&xdr);
+
+      /* The arguments may just be too large for the buffer, so try
+       * again with the largest possible buffer.  We have to allocate
+       * this on the heap because we can't rely on having much stack
+       * space, notably when running in the JVM.
+       */
+      if (g->msg_out_size < GUESTFS_MESSAGE_MAX + 4) {
+        free (g->msg_out);
+        g->msg_out = safe_malloc (g, GUESTFS_MESSAGE_MAX + 4);
+        g->msg_out_size = GUESTFS_MESSAGE_MAX + 4;
+        goto again;
+      }
+
       error (g, _("dispatch failed to marshal args"));
       return -1;
     }
   }
 
-  /* Get the actual length of the message, resize the buffer to match
-   * the actual length, and write the length word at the beginning.
+  /* Get the actual length of the message and write the length word
+   * at the beginning.
    */
   len = xdr_getpos (&xdr);
   xdr_destroy (&xdr);
 
-  msg_out = safe_realloc (g, msg_out, len + 4);
-  msg_out_size = len + 4;
-
-  xdrmem_create (&xdr, msg_out, 4, XDR_ENCODE);
+  xdrmem_create (&xdr, g->msg_out, 4, XDR_ENCODE);
   xdr_uint32_t (&xdr, &len);
+  xdr_destroy (&xdr);
+
+  if (g->msg_out_size > MSG_OUT_INITIAL_SIZE &&
+      len + 4 <= MSG_OUT_INITIAL_SIZE) {
+    char *msg_out = safe_malloc (g, MSG_OUT_INITIAL_SIZE);
+
+    memcpy (msg_out, g->msg_out, len + 4);
+    free (g->msg_out);
+    g->msg_out = msg_out;
+    g->msg_out_size = MSG_OUT_INITIAL_SIZE;
+  }
+
+  *msg_out_size_r = len + 4;
+  return 0;
+}
+
+static int write_message_to_channel (guestfs_h *g, bool bulk, const char *msg_out, size_t msg_out_size);
+
+/**
+ * Write an encoded request to the daemon.
+ *
+ * Returns C<0> on success, or C<-1> on error.  If the appliance has
+ * gone away, the connection is cleaned up.
+ */
+static int
+write_message (guestfs_h *g, const char *msg_out, size_t msg_out_size)
+{
+  return write_message_to_channel (g, false, msg_out, msg_out_size);
+}
+
+/**
+ * Write a file chunk, which goes over the bulk data channel if it is
+ * in use.  Returns the same as C<write_message>.
+ */
+static int
+write_chunk (guestfs_h *g, const char *buf, size_t len)
+{
+  return write_message_to_channel (g, g->bulk_channel, buf, len);
+}
+
+static int
+write_message_to_channel (guestfs_h *g, bool bulk,
+                          const char *msg_out, size_t msg_out_size)
+{
+  ssize_t r;
+
+  r = write_channel (g, bulk, msg_out, msg_out_size);
+  if (r == -1)
+    return -1;
+  if (r == 0) {
+    guestfs_int_unexpected_close_error (g);
+    child_cleanup (g);
+    return -1;
+  }
+
+  return 0;
+}
+
+int
+guestfs_int_send (guestfs_h *g, int proc_nr,
+		  uint64_t progress_hint, uint64_t optargs_bitmask,
+		  xdrproc_t xdrp, char *args)
+{
+  const int serial = g->msg_next_serial++;
+  ssize_t r;
+  size_t msg_out_size;
+
+  if (!g->conn) {
+    guestfs_int_unexpected_close_error (g);
+    return -1;
+  }
+
+  if (guestfs_int_encode_message (g, proc_nr, serial,
+                                  progress_hint, optargs_bitmask,
+                                  xdrp, args, &msg_out_size) == -1)
+    return -1;
 
   /* Look for stray daemon cancellation messages from earlier calls
    * and ignore them.
@@ -321,7 +525,33 @@ guestfs_int_send (guestfs_h *g, int proc_nr,
   }
 
   /* Send the message. */
-  r = g->conn->ops->write_data (g, g->conn, msg_out, msg_out_size);
+  if (write_message (g, g->msg_out, msg_out_size) == -1)
+    return -1;
+  guestfs_int_stats_request_sent (g, proc_nr, serial, msg_out_size);
+
+  return serial;
+}
+
+/**
+ * Send a request which has already been encoded by
+ * C<guestfs_int_encode_message> (and copied out of the handle's
+ * buffer).  This is used by the batch code in F<src/batch.c> when
+ * it has to fall back to sending requests one at a time.
+ *
+ * Returns C<0> on success, or C<-1> on error.
+ */
+int
+guestfs_int_send_encoded (guestfs_h *g, const char *msg, size_t msg_size)
+{
+  ssize_t r;
+
+  if (!g->conn) {
+    guestfs_int_unexpected_close_error (g);
+    return -1;
+  }
+
+  r = check_daemon_socket (g);
+  /* r == -2 (cancellation) is ignored */
   if (r == -1)
     return -1;
   if (r == 0) {
@@ -330,13 +560,17 @@ guestfs_int_send (guestfs_h *g, int proc_nr,
     return -1;
   }
 
-  return serial;
+  return write_message (g, msg, msg_size);
 }
 
-static int send_file_chunk (guestfs_h *g, int cancel, const char *buf, size_t len);
-static int send_file_data (guestfs_h *g, const char *buf, size_t len);
+static char *get_chunk_buffer (guestfs_h *g);
+static int send_file_chunk (guestfs_h *g, int cancel, size_t len);
+static int send_file_chunk_buffer (guestfs_h *g, char *buf, int cancel, size_t len);
+static int send_file_data (guestfs_h *g, size_t len);
+static int send_file_hole (guestfs_h *g, uint64_t len);
 static int send_file_cancellation (guestfs_h *g);
 static int send_file_complete (guestfs_h *g);
+static int check_daemon_cancellation (guestfs_h *g);
 
 /**
  * Send a file.
@@ -347,8 +581,12 @@ static int send_file_complete (guestfs_h *g);
 int
 guestfs_int_send_file (guestfs_h *g, const char *filename)
 {
-  CLEANUP_FREE char *buf = safe_malloc (g, GUESTFS_MAX_CHUNK_SIZE);
+  char *buf;
   int fd, r = 0, err;
+  struct stat statbuf;
+  bool seek_data = false;
+  uint64_t pos = 0;
+  uint64_t hole = 0;            /* Length of hole not sent yet. */
 
   g->user_cancel = 0;
 
@@ -361,13 +599,58 @@ guestfs_int_send_file (guestfs_h *g, const char *filename)
 
   guestfs_int_fadvise_sequential (fd);
 
+  /* If the daemon understands hole chunks, holes in sparse files can
+   * be found without reading them.
+   */
+  if (g->hole_chunks && fstat (fd, &statbuf) == 0 &&
+      S_ISREG (statbuf.st_mode))
+    seek_data = true;
+
+  /* The file data is read straight into the chunk buffer after the
+   * chunk header, so it doesn't need to be copied when encoding.
+   */
+  buf = get_chunk_buffer (g) + CHUNK_HEADER_SIZE;
+
   /* Send file in chunked encoding. */
   while (!g->user_cancel) {
-    r = read (fd, buf, GUESTFS_MAX_CHUNK_SIZE);
+#ifdef SEEK_DATA
+    if (seek_data) {
+      const off_t data = lseek (fd, pos, SEEK_DATA);
+
+      if (data == -1 && errno == ENXIO) { /* hole up to the end of file */
+        if ((uint64_t) statbuf.st_size > pos)
+          hole += statbuf.st_size - pos;
+        r = 0;
+        break;
+      }
+      if (data == -1)           /* not supported by this filesystem */
+        seek_data = false;
+      else if ((uint64_t) data > pos) {
+        hole += data - pos;
+        pos = data;
+      }
+    }
+#endif
+
+    r = read (fd, buf, g->chunk_size);
     if (r == -1 && (errno == EINTR || errno == EAGAIN))
       continue;
     if (r <= 0) break;
-    err = send_file_data (g, buf, r);
+    pos += r;
+
+    /* Don't send zeroes over the socket. */
+    if (g->hole_chunks && is_zero (buf, r)) {
+      hole += r;
+      continue;
+    }
+
+    err = 0;
+    if (hole > 0) {
+      err = send_file_hole (g, hole);
+      hole = 0;
+    }
+    if (err == 0)
+      err = send_file_data (g, r);
     if (err < 0) {
       if (err == -2)		/* daemon sent cancellation */
         send_file_cancellation (g);
@@ -399,7 +682,11 @@ guestfs_int_send_file (guestfs_h *g, const char *filename)
     return -1;
   }
 
-  err = send_file_complete (g);
+  err = 0;
+  if (hole > 0)
+    err = send_file_hole (g, hole);
+  if (err == 0)
+    err = send_file_complete (g);
   if (err < 0) {
     if (err == -2)              /* daemon sent cancellation */
       send_file_cancellation (g);
@@ -410,12 +697,107 @@ guestfs_int_send_file (guestfs_h *g, const char *filename)
 }
 
 /**
- * Send a chunk of file data.
+ * Return the handle's chunk buffer (C<g-E<gt>chunk_out>), allocating
+ * or enlarging it if necessary.  It has room for the chunk header,
+ * C<g-E<gt>chunk_size> bytes of data and the XDR padding.
+ */
+static char *
+get_chunk_buffer (guestfs_h *g)
+{
+  const size_t size = CHUNK_HEADER_SIZE + g->chunk_size + 4;
+
+  if (g->chunk_out_size < size) {
+    free (g->chunk_out);
+    g->chunk_out = safe_malloc (g, size);
+    g->chunk_out_size = size;
+  }
+
+  return g->chunk_out;
+}
+
+#ifdef HAVE_ZLIB
+/**
+ * Return the handle's compression buffer (C<g-E<gt>chunk_z>), which
+ * is the same size as the chunk buffer.  It is used to hold the
+ * compressed chunk when sending, and the decompressed data when
+ * receiving.
+ */
+static char *
+get_chunk_z_buffer (guestfs_h *g)
+{
+  const size_t size = CHUNK_HEADER_SIZE + g->chunk_size + 4;
+
+  if (g->chunk_z_size < size) {
+    free (g->chunk_z);
+    g->chunk_z = safe_malloc (g, size);
+    g->chunk_z_size = size;
+  }
+
+  return g->chunk_z;
+}
+#endif
+
+/**
+ * Send a chunk of file data.  The data (C<len> bytes) must already be
+ * in the chunk buffer, after the chunk header.
+ *
+ * If compressed chunks were negotiated, the data is compressed and
+ * sent as a compressed chunk, unless it does not get any smaller.
+ */
+static int
+send_file_data (guestfs_h *g, size_t len)
+{
+#ifdef HAVE_ZLIB
+  if (g->compressed_chunks && len > 0) {
+    char *zbuf = get_chunk_z_buffer (g);
+    uLongf zlen = len - 1;
+
+    /* If the output would not fit in len-1 bytes, compress2 fails
+     * with Z_BUF_ERROR and we send the data as it is.
+     */
+    if (compress2 ((Bytef *) zbuf + CHUNK_HEADER_SIZE, &zlen,
+                   (const Bytef *) g->chunk_out + CHUNK_HEADER_SIZE, len,
+                   Z_BEST_SPEED) == Z_OK)
+      return send_file_chunk_buffer (g, zbuf, GUESTFS_CHUNK_COMPRESSED, zlen);
+  }
+#endif
+
+  return send_file_chunk (g, 0, len);
+}
+
+/**
+ * Send a hole chunk, standing for C<len> zero bytes.  Only call this
+ * if the daemon understands hole chunks (C<g-E<gt>hole_chunks>).
  */
 static int
-send_file_data (guestfs_h *g, const char *buf, size_t len)
+send_file_hole (guestfs_h *g, uint64_t hole_len)
 {
-  return send_file_chunk (g, 0, buf, len);
+  char buf[CHUNK_HEADER_SIZE + 8];
+  int cancel = GUESTFS_CHUNK_HOLE;
+  uint32_t len = sizeof buf - 4, data_len = 8;
+  int r;
+  XDR xdr;
+
+  /* This is the same as a guestfs_chunk struct with the length of the
+   * hole (XDR unsigned hyper) as data.
+   */
+  xdrmem_create (&xdr, buf, sizeof buf, XDR_ENCODE);
+  if (!xdr_uint32_t (&xdr, &len) ||
+      !xdr_int (&xdr, &cancel) ||
+      !xdr_uint32_t (&xdr, &data_len) ||
+      !xdr_uint64_t (&xdr, &hole_len)) {
+    error (g, _("xdr_guestfs_chunk failed (hole)"));
+    xdr_destroy (&xdr);
+    return -1;
+  }
+  xdr_destroy (&xdr);
+
+  r = check_daemon_cancellation (g);
+  if (r < 0)
+    return r;
+
+  guestfs_int_stats_transfer (g, sizeof buf, 0);
+  return write_chunk (g, buf, sizeof buf);
 }
 
 /**
@@ -424,7 +806,7 @@ send_file_data (guestfs_h *g, const char *buf, size_t len)
 static int
 send_file_cancellation (guestfs_h *g)
 {
-  return send_file_chunk (g, 1, NULL, 0);
+  return send_file_chunk (g, 1, 0);
 }
 
 /**
@@ -433,49 +815,63 @@ send_file_cancellation (guestfs_h *g)
 static int
 send_file_complete (guestfs_h *g)
 {
-  char buf[1];
-  return send_file_chunk (g, 0, buf, 0);
+  return send_file_chunk (g, 0, 0);
 }
 
 static int
-send_file_chunk (guestfs_h *g, int cancel, const char *buf, size_t buflen)
+send_file_chunk (guestfs_h *g, int cancel, size_t buflen)
 {
-  uint32_t len;
+  return send_file_chunk_buffer (g, get_chunk_buffer (g), cancel, buflen);
+}
+
+/**
+ * Send a chunk whose data (C<buflen> bytes) is already in C<buf>
+ * after the chunk header.  C<buf> must have room for the XDR padding
+ * after the data.
+ */
+static int
+send_file_chunk_buffer (guestfs_h *g, char *buf, int cancel, size_t buflen)
+{
+  const size_t padding = (4 - (buflen & 3)) & 3;
+  uint32_t len, data_len = buflen;
   ssize_t r;
-  guestfs_chunk chunk;
   XDR xdr;
-  CLEANUP_FREE char *msg_out = NULL;
-  size_t msg_out_size;
 
-  /* Allocate the chunk buffer.  Don't use the stack to avoid
-   * excessive stack usage and unnecessary copies.
+  /* Encode the chunk in place.  This is the same as encoding a
+   * guestfs_chunk struct with xdr_guestfs_chunk, but avoids copying
+   * the data.
    */
-  msg_out = safe_malloc (g, GUESTFS_MAX_CHUNK_SIZE + 4 + 48);
-  xdrmem_create (&xdr, msg_out + 4, GUESTFS_MAX_CHUNK_SIZE + 48, XDR_ENCODE);
-
-  /* Serialize the chunk. */
-  chunk.cancel = cancel;
-  chunk.data.data_len = buflen;
-  chunk.data.data_val = (char *) buf;
-
-  if (!xdr_guestfs_chunk (&xdr, &chunk)) {
-    error (g, _("xdr_guestfs_chunk failed (buf = %p, buflen = %zu)"),
-           buf, buflen);
+  len = CHUNK_HEADER_SIZE - 4 + buflen + padding;
+  xdrmem_create (&xdr, buf, CHUNK_HEADER_SIZE, XDR_ENCODE);
+  if (!xdr_uint32_t (&xdr, &len) ||
+      !xdr_int (&xdr, &cancel) ||
+      !xdr_uint32_t (&xdr, &data_len)) {
+    error (g, _("xdr_guestfs_chunk failed (buflen = %zu)"), buflen);
     xdr_destroy (&xdr);
     return -1;
   }
-
-  len = xdr_getpos (&xdr);
   xdr_destroy (&xdr);
+  memset (buf + CHUNK_HEADER_SIZE + buflen, 0, padding);
 
-  /* Reduce the size of the outgoing message buffer to the real length. */
-  msg_out = safe_realloc (g, msg_out, len + 4);
-  msg_out_size = len + 4;
+  r = check_daemon_cancellation (g);
+  if (r < 0)
+    return r;
 
-  xdrmem_create (&xdr, msg_out, 4, XDR_ENCODE);
-  xdr_uint32_t (&xdr, &len);
+  /* Send the chunk. */
+  guestfs_int_stats_transfer (g, len + 4, 0);
+  return write_chunk (g, buf, len + 4);
+}
+
+/**
+ * Check if the daemon sent a cancellation message before we send the
+ * next chunk.  Returns C<0> if not, C<-2> if it did, or C<-1> on
+ * error.
+ */
+static int
+check_daemon_cancellation (guestfs_h *g)
+{
+  ssize_t r;
 
-  /* Did the daemon send a cancellation message? */
   r = check_daemon_socket (g);
   if (r == -2) {
     debug (g, "got daemon cancellation");
@@ -489,19 +885,11 @@ send_file_chunk (guestfs_h *g, int cancel, const char *buf, size_t buflen)
     return -1;
   }
 
-  /* Send the chunk. */
-  r = g->conn->ops->write_data (g, g->conn, msg_out, msg_out_size);
-  if (r == -1)
-    return -1;
-  if (r == 0) {
-    guestfs_int_unexpected_close_error (g);
-    child_cleanup (g);
-    return -1;
-  }
-
   return 0;
 }
 
+static int recv_from_channel (guestfs_h *g, bool bulk, uint32_t *size_rtn, char **buf_rtn);
+
 /**
  * This function reads a single message, file chunk, launch flag or
  * cancellation flag from the daemon.  If something was read, it
@@ -514,7 +902,9 @@ send_file_chunk (guestfs_h *g, int cancel, const char *buf, size_t buflen)
  * C<GUESTFS_LAUNCH_FLAG> or C<GUESTFS_CANCEL_FLAG>.
  *
  * C<*buf_rtn> is returned containing the message (if any) or will be
- * set to C<NULL>.  C<*buf_rtn> must be freed by the caller.
+ * set to C<NULL>.  The message is stored in the handle's incoming
+ * message buffer (C<g-E<gt>msg_in>), which is reused by the next call,
+ * so the caller must not free it.
  *
  * This checks for EOF (appliance died) and passes that up through the
  * child_cleanup function above.
@@ -522,7 +912,18 @@ send_file_chunk (guestfs_h *g, int cancel, const char *buf, size_t buflen)
  * Log message, progress messages are handled transparently here.
  */
 static int
-recv_from_daemon (guestfs_h *g, uint32_t *size_rtn, void **buf_rtn)
+recv_from_daemon (guestfs_h *g, uint32_t *size_rtn, char **buf_rtn)
+{
+  return recv_from_channel (g, false, size_rtn, buf_rtn);
+}
+
+/**
+ * The same as C<recv_from_daemon>, but C<bulk> selects the bulk data
+ * channel instead of the control channel.
+ */
+static int
+recv_from_channel (guestfs_h *g, bool bulk,
+                   uint32_t *size_rtn, char **buf_rtn)
 {
   char lenbuf[4];
   ssize_t n;
@@ -541,19 +942,27 @@ recv_from_daemon (guestfs_h *g, uint32_t *size_rtn, void **buf_rtn)
     return -1;
   }
 
-  /* Read the 4 byte size / flag. */
-  n = g->conn->ops->read_data (g, g->conn, lenbuf, 4);
-  if (n == -1)
-    return -1;
-  if (n == 0) {
-    guestfs_int_unexpected_close_error (g);
-    child_cleanup (g);
-    return -1;
+  /* Read the 4 byte size / flag, unless recv_progress_messages
+   * already read it.
+   */
+  if (!bulk && g->have_pending_len) {
+    *size_rtn = g->pending_len;
+    g->have_pending_len = false;
   }
+  else {
+    n = read_channel (g, bulk, lenbuf, 4);
+    if (n == -1)
+      return -1;
+    if (n == 0) {
+      guestfs_int_unexpected_close_error (g);
+      child_cleanup (g);
+      return -1;
+    }
 
-  xdrmem_create (&xdr, lenbuf, 4, XDR_DECODE);
-  xdr_uint32_t (&xdr, size_rtn);
-  xdr_destroy (&xdr);
+    xdrmem_create (&xdr, lenbuf, 4, XDR_DECODE);
+    xdr_uint32_t (&xdr, size_rtn);
+    xdr_destroy (&xdr);
+  }
 
   if (*size_rtn == GUESTFS_LAUNCH_FLAG) {
     if (g->state != LAUNCHING)
@@ -585,24 +994,35 @@ recv_from_daemon (guestfs_h *g, uint32_t *size_rtn, void **buf_rtn)
   message_size =
     *size_rtn != GUESTFS_PROGRESS_FLAG ? *size_rtn : PROGRESS_MESSAGE_SIZE;
 
-  /* Allocate the complete buffer, size now known. */
-  *buf_rtn = safe_malloc (g, message_size);
+  /* Make sure the buffer is large enough, size now known.  It grows
+   * up to GUESTFS_MESSAGE_MAX, and is shrunk back to MSG_IN_KEEP_SIZE
+   * once messages are small again.  Don't use realloc since we don't
+   * need to preserve the old contents.
+   */
+  if (g->msg_in_size < message_size) {
+    free (g->msg_in);
+    g->msg_in = safe_malloc (g, message_size);
+    g->msg_in_size = message_size;
+  }
+  else if (g->msg_in_size > MSG_IN_KEEP_SIZE &&
+           message_size <= MSG_IN_KEEP_SIZE) {
+    free (g->msg_in);
+    g->msg_in = safe_malloc (g, MSG_IN_KEEP_SIZE);
+    g->msg_in_size = MSG_IN_KEEP_SIZE;
+  }
 
   /* Read the message. */
-  n = g->conn->ops->read_data (g, g->conn, *buf_rtn, message_size);
-  if (n == -1) {
-    free (*buf_rtn);
-    *buf_rtn = NULL;
+  n = read_channel (g, bulk, g->msg_in, message_size);
+  if (n == -1)
     return -1;
-  }
   if (n == 0) {
     guestfs_int_unexpected_close_error (g);
     child_cleanup (g);
-    free (*buf_rtn);
-    *buf_rtn = NULL;
     return -1;
   }
 
+  *buf_rtn = g->msg_in;
+
   /* ... it's a normal message (not progress/launch/cancel) so display
    * it if we're debugging.
    */
@@ -613,13 +1033,13 @@ recv_from_daemon (guestfs_h *g, uint32_t *size_rtn, void **buf_rtn)
     for (i = 0; i < n; i += 16) {
       printf ("%04zx: ", i);
       for (j = i; j < MIN (i+16, n); ++j)
-        printf ("%02x ", (*(unsigned char **)buf_rtn)[j]);
+        printf ("%02x ", (unsigned char) (*buf_rtn)[j]);
       for (; j < i+16; ++j)
         printf ("   ");
       printf ("|");
       for (j = i; j < MIN (i+16, n); ++j)
-        if (c_isprint ((*(char **)buf_rtn)[j]))
-          printf ("%c", (*(char **)buf_rtn)[j]);
+        if (c_isprint ((*buf_rtn)[j]))
+          printf ("%c", (*buf_rtn)[j]);
         else
           printf (".");
       for (; j < i+16; ++j)
@@ -632,8 +1052,13 @@ recv_from_daemon (guestfs_h *g, uint32_t *size_rtn, void **buf_rtn)
   return 0;
 }
 
-int
-guestfs_int_recv_from_daemon (guestfs_h *g, uint32_t *size_rtn, void **buf_rtn)
+/**
+ * Like C<recv_from_daemon>, but progress messages are handled here
+ * and not returned to the caller.  As with C<recv_from_daemon>, the
+ * returned message is only valid until the next call.
+ */
+static int
+recv_message (guestfs_h *g, uint32_t *size_rtn, char **buf_rtn)
 {
   int r;
 
@@ -652,9 +1077,6 @@ guestfs_int_recv_from_daemon (guestfs_h *g, uint32_t *size_rtn, void **buf_rtn)
 
     guestfs_int_progress_message_callback (g, &message);
 
-    free (*buf_rtn);
-    *buf_rtn = NULL;
-
     /* Process next message. */
     goto again;
   }
@@ -668,6 +1090,53 @@ guestfs_int_recv_from_daemon (guestfs_h *g, uint32_t *size_rtn, void **buf_rtn)
   return 0;
 }
 
+/**
+ * Receive a file chunk.  This is the same as
+ * C<recv_message>, except that if the bulk data channel is in use the
+ * chunk is read from there, after handling any progress messages
+ * waiting on the control channel.
+ */
+static int
+recv_chunk (guestfs_h *g, uint32_t *size_rtn, char **buf_rtn)
+{
+  ssize_t r;
+
+  if (!g->bulk_channel || !g->conn)
+    return recv_message (g, size_rtn, buf_rtn);
+
+  r = recv_progress_messages (g);
+  if (r == -1)
+    return -1;
+  if (r == 0) {
+    error (g, _("unexpected end of file when reading from daemon"));
+    child_cleanup (g);
+    return -1;
+  }
+
+  return recv_from_channel (g, true, size_rtn, buf_rtn);
+}
+
+/**
+ * Used by the backends while launching.  This is the same as
+ * C<recv_message>, except that C<*buf_rtn> is a copy of the message
+ * which must be freed by the caller.
+ */
+int
+guestfs_int_recv_from_daemon (guestfs_h *g, uint32_t *size_rtn, void **buf_rtn)
+{
+  char *buf;
+
+  *buf_rtn = NULL;
+
+  if (recv_message (g, size_rtn, &buf) == -1)
+    return -1;
+
+  if (buf != NULL)
+    *buf_rtn = safe_memdup (g, buf, *size_rtn);
+
+  return 0;
+}
+
 /**
  * Receive a reply.
  */
@@ -678,12 +1147,12 @@ guestfs_int_recv (guestfs_h *g, const char *fn,
 		  xdrproc_t xdrp, char *ret)
 {
   XDR xdr;
-  CLEANUP_FREE void *buf = NULL;
+  char *buf;
   uint32_t size;
   int r;
 
  again:
-  r = guestfs_int_recv_from_daemon (g, &size, &buf);
+  r = recv_message (g, &size, &buf);
   if (r == -1)
     return -1;
 
@@ -706,6 +1175,7 @@ guestfs_int_recv (guestfs_h *g, const char *fn,
     xdr_destroy (&xdr);
     return -1;
   }
+  guestfs_int_stats_reply_received (g, hdr, size);
   if (hdr->status == GUESTFS_STATUS_ERROR) {
     if (!xdr_guestfs_message_error (&xdr, err)) {
       error (g, "%s: failed to parse reply error", fn);
@@ -744,12 +1214,12 @@ guestfs_int_recv (guestfs_h *g, const char *fn,
 int
 guestfs_int_recv_discard (guestfs_h *g, const char *fn)
 {
-  CLEANUP_FREE void *buf = NULL;
+  char *buf;
   uint32_t size;
   int r;
 
  again:
-  r = guestfs_int_recv_from_daemon (g, &size, &buf);
+  r = recv_message (g, &size, &buf);
   if (r == -1)
     return -1;
 
@@ -768,6 +1238,237 @@ guestfs_int_recv_discard (guestfs_h *g, const char *fn)
   return 0;
 }
 
+/**
+ * Receive one reply to a pipelined request and store it in the
+ * matching element of C<calls>.
+ *
+ * Returns C<0> if the reply was received (even if the call itself
+ * failed, in which case C<*call_failed> is set and the error is set
+ * on the handle if this is the first failure), or C<-1> if there was
+ * a protocol or connection error, in which case the connection is
+ * unusable for further pipelined requests.
+ */
+static int
+recv_pipelined_reply (guestfs_h *g, const char *fn,
+                      struct pipelined_call *calls, size_t nr_sent,
+                      bool *call_failed)
+{
+  char *buf;
+  uint32_t size;
+  XDR xdr;
+  guestfs_message_header hdr;
+  guestfs_message_error err;
+  struct pipelined_call *c = NULL;
+  size_t i;
+
+ again:
+  if (recv_message (g, &size, &buf) == -1)
+    return -1;
+
+  /* See comment in guestfs_int_recv. */
+  if (size == GUESTFS_CANCEL_FLAG)
+    goto again;
+
+  if (size == GUESTFS_LAUNCH_FLAG) {
+    error (g, "%s: received unexpected launch flag from daemon when expecting reply", fn);
+    return -1;
+  }
+
+  xdrmem_create (&xdr, buf, size, XDR_DECODE);
+
+  memset (&hdr, 0, sizeof hdr);
+  if (!xdr_guestfs_message_header (&xdr, &hdr)) {
+    error (g, "%s: failed to parse reply header", fn);
+    xdr_destroy (&xdr);
+    return -1;
+  }
+
+  /* Match the reply to the request using the serial number. */
+  for (i = 0; i < nr_sent; ++i) {
+    if (!calls[i].done && (unsigned) calls[i].serial == hdr.serial) {
+      c = &calls[i];
+      break;
+    }
+  }
+  if (c == NULL) {
+    error (g, "%s: reply with unexpected serial (%u)", fn, hdr.serial);
+    xdr_destroy (&xdr);
+    return -1;
+  }
+  if (guestfs_int_check_reply_header (g, &hdr, c->proc_nr, c->serial) == -1) {
+    xdr_destroy (&xdr);
+    return -1;
+  }
+  c->done = true;
+  guestfs_int_stats_reply_received (g, &hdr, size);
+
+  if (hdr.status == GUESTFS_STATUS_ERROR) {
+    int errnum = 0;
+
+    memset (&err, 0, sizeof err);
+    if (!xdr_guestfs_message_error (&xdr, &err)) {
+      error (g, "%s: failed to parse reply error", fn);
+      xdr_destroy (&xdr);
+      return -1;
+    }
+    xdr_destroy (&xdr);
+
+    if (g->trace)
+      guestfs_int_trace (g, "%s = -1 (error)", fn);
+
+    /* Only report the first error, as a sequence of calls would. */
+    if (!*call_failed) {
+      if (err.errno_string[0] != '\0')
+        errnum = guestfs_int_string_to_errno (err.errno_string);
+      if (errnum <= 0)
+        error (g, "%s: %s", fn, err.error_message);
+      else
+        guestfs_int_error_errno (g, errnum, "%s: %s", fn, err.error_message);
+    }
+    *call_failed = true;
+    free (err.error_message);
+    free (err.errno_string);
+    return 0;
+  }
+
+  if (c->xdr_ret && c->ret && !c->xdr_ret (&xdr, c->ret, 0)) {
+    error (g, "%s: failed to parse reply", fn);
+    xdr_destroy (&xdr);
+    return -1;
+  }
+  xdr_destroy (&xdr);
+
+  if (g->trace)
+    guestfs_int_trace (g, "%s = <reply, %u bytes>", fn, (unsigned) size);
+
+  return 0;
+}
+
+/**
+ * Issue a sequence of simple RPCs (no C<FileIn> or C<FileOut>
+ * parameters), keeping up to C<g-E<gt>pipeline_depth> requests in
+ * flight at once.  Replies are matched to requests using the serial
+ * number in the message header.
+ *
+ * This is used by library code which splits a single API call into
+ * many independent daemon calls (eg. L<guestfs(3)/guestfs_lstatnslist>).
+ * When the pipeline depth is C<1> (the default) this behaves exactly
+ * like calling C<guestfs_int_send> and C<guestfs_int_recv> for each
+ * element of C<calls> in turn.
+ *
+ * Like the generated wrappers, each daemon call sends a
+ * C<GUESTFS_EVENT_ENTER> event and (if tracing is enabled) a trace
+ * line when it is sent, and another trace line when its reply is
+ * received.
+ *
+ * Returns C<0> if all calls succeeded.  If any call fails, no further
+ * requests are sent, the replies to requests already in flight are
+ * read, the error from the first failed call is set on the handle and
+ * this returns C<-1>.  In every case the caller must free the reply
+ * structs using C<xdr_free>.
+ */
+int
+guestfs_int_call_pipelined (guestfs_h *g, const char *fn,
+                            struct pipelined_call *calls, size_t nr_calls)
+{
+  const size_t depth = g->pipeline_depth >= 1 ? g->pipeline_depth : 1;
+  size_t i, nr_sent = 0, nr_received = 0, bytes_in_flight = 0;
+  bool call_failed = false;
+  bool encoded = false;         /* Next request is in g->msg_out. */
+  size_t msg_out_size = 0;
+  ssize_t r;
+
+  if (guestfs_int_check_appliance_up (g, fn) == -1)
+    return -1;
+
+  if (!g->conn) {
+    guestfs_int_unexpected_close_error (g);
+    return -1;
+  }
+
+  for (i = 0; i < nr_calls; ++i) {
+    calls[i].serial = -1;
+    calls[i].size = 0;
+    calls[i].done = false;
+  }
+
+  while (nr_received < nr_calls) {
+    /* Fill the pipeline. */
+    while (!call_failed && nr_sent < nr_calls &&
+           nr_sent - nr_received < depth) {
+      struct pipelined_call *c = &calls[nr_sent];
+
+      if (!encoded) {
+        /* The arguments aren't traced. */
+        guestfs_int_call_callbacks_message (g, GUESTFS_EVENT_ENTER,
+                                            fn, strlen (fn));
+        if (g->trace)
+          guestfs_int_trace (g, "%s", fn);
+
+        c->serial = g->msg_next_serial++;
+        if (guestfs_int_encode_message (g, c->proc_nr, c->serial,
+                                        0, c->optargs_bitmask,
+                                        c->xdr_args, c->args,
+                                        &msg_out_size) == -1) {
+          if (nr_sent == nr_received)
+            return -1;
+          call_failed = true;
+          break;
+        }
+        c->size = msg_out_size;
+        encoded = true;
+      }
+
+      /* Don't overfill the socket buffers (see MAX_PIPELINE_BYTES).
+       * We can always send one request.
+       */
+      if (nr_sent > nr_received &&
+          bytes_in_flight + c->size > MAX_PIPELINE_BYTES)
+        break;
+
+      /* Nothing is outstanding, so anything we can read now is a
+       * stray cancellation message from an earlier call.
+       */
+      if (nr_sent == nr_received) {
+        r = check_daemon_socket (g);
+        if (r == -1)
+          return -1;
+        if (r == 0) {
+          guestfs_int_unexpected_close_error (g);
+          child_cleanup (g);
+          return -1;
+        }
+      }
+
+      if (write_message (g, g->msg_out, msg_out_size) == -1)
+        return -1;
+      guestfs_int_stats_request_sent (g, c->proc_nr, c->serial, msg_out_size);
+      encoded = false;
+
+      bytes_in_flight += c->size;
+      nr_sent++;
+    }
+
+    if (nr_received == nr_sent)
+      break;                    /* Stopped early because of an error. */
+
+    /* Wait for the next reply. */
+    if (recv_pipelined_reply (g, fn, calls, nr_sent, &call_failed) == -1)
+      return -1;
+    nr_received++;
+
+    /* Replies may arrive out of order, so recalculate the number of
+     * bytes outstanding from the calls which have not been answered.
+     */
+    bytes_in_flight = 0;
+    for (i = 0; i < nr_sent; ++i)
+      if (!calls[i].done)
+        bytes_in_flight += calls[i].size;
+  }
+
+  return call_failed ? -1 : 0;
+}
+
 /* Receive a file. */
 
 static int
@@ -788,7 +1489,29 @@ xwrite (int fd, const void *v_buf, size_t len)
   return 0;
 }
 
-static ssize_t receive_file_data (guestfs_h *g, void **buf);
+static int receive_file_data (guestfs_h *g, const char **buf_r, uint64_t *len_r);
+
+/**
+ * Write a hole of C<len> bytes to C<fd>.  If C<seekable>, the hole
+ * is skipped using L<lseek(2)> so that the output file is sparse,
+ * otherwise zeroes are written.
+ */
+static int
+write_hole (int fd, uint64_t len, bool seekable)
+{
+  if (seekable)
+    return lseek (fd, len, SEEK_CUR) == -1 ? -1 : 0;
+
+  while (len > 0) {
+    const size_t n = MIN (len, sizeof zero_buf);
+
+    if (xwrite (fd, zero_buf, n) == -1)
+      return -1;
+    len -= n;
+  }
+
+  return 0;
+}
 
 /**
  * Returns C<-1> = error, C<0> = EOF, C<E<gt>0> = more data
@@ -796,8 +1519,11 @@ static ssize_t receive_file_data (guestfs_h *g, void **buf);
 int
 guestfs_int_recv_file (guestfs_h *g, const char *filename)
 {
-  void *buf;
+  const char *buf;
+  uint64_t len;
   int fd, r;
+  struct stat statbuf;
+  bool opened = false, seekable, ends_with_hole = false;
 
   g->user_cancel = 0;
 
@@ -809,8 +1535,10 @@ guestfs_int_recv_file (guestfs_h *g, const char *filename)
     fd = dup (1);
   else if (STREQ (filename, "/dev/stderr"))
     fd = dup (2);
-  else
+  else {
     fd = open (filename, O_WRONLY|O_CREAT|O_TRUNC|O_NOCTTY|O_CLOEXEC, 0666);
+    opened = true;
+  }
   if (fd == -1) {
     perrorf (g, "%s", filename);
     goto cancel;
@@ -818,15 +1546,31 @@ guestfs_int_recv_file (guestfs_h *g, const char *filename)
 
   guestfs_int_fadvise_sequential (fd);
 
+  /* Holes can be skipped, and the size set at the end, only when we
+   * opened and truncated a regular file ourselves.  A dup'd stdout or
+   * stderr may be appending to or overwriting part of a file (eg.
+   * "download ... >> file" in guestfish), so holes are written out as
+   * zeroes there.
+   */
+  seekable = opened && fstat (fd, &statbuf) == 0 && S_ISREG (statbuf.st_mode);
+
   /* Receive the file in chunked encoding. */
-  while ((r = receive_file_data (g, &buf)) > 0) {
-    if (xwrite (fd, buf, r) == -1) {
-      perrorf (g, "%s: write", filename);
-      free (buf);
-      close (fd);
-      goto cancel;
+  while ((r = receive_file_data (g, &buf, &len)) > 0) {
+    if (buf == NULL) {          /* hole */
+      if (write_hole (fd, len, seekable) == -1) {
+        perrorf (g, "%s: write", filename);
+        close (fd);
+        goto cancel;
+      }
+      ends_with_hole = true;
+    } else {
+      if (xwrite (fd, buf, len) == -1) {
+        perrorf (g, "%s: write", filename);
+        close (fd);
+        goto cancel;
+      }
+      ends_with_hole = false;
     }
-    free (buf);
 
     if (g->user_cancel) {
       close (fd);
@@ -839,6 +1583,17 @@ guestfs_int_recv_file (guestfs_h *g, const char *filename)
     return -1;
   }
 
+  /* If the file ends with a hole, set the file size. */
+  if (ends_with_hole && seekable) {
+    const off_t pos = lseek (fd, 0, SEEK_CUR);
+
+    if (pos == -1 || ftruncate (fd, pos) == -1) {
+      perrorf (g, "%s: ftruncate", filename);
+      close (fd);
+      return -1;
+    }
+  }
+
   if (close (fd) == -1) {
     perrorf (g, "close: %s", filename);
     return -1;
@@ -866,7 +1621,7 @@ guestfs_int_recv_file (guestfs_h *g, const char *filename)
     return -1;
   }
 
-  while (receive_file_data (g, NULL) > 0)
+  while (receive_file_data (g, NULL, NULL) > 0)
     ;                           /* just discard it */
 
   return -1;
@@ -875,18 +1630,26 @@ guestfs_int_recv_file (guestfs_h *g, const char *filename)
 /**
  * Receive a chunk of file data.
  *
- * Returns C<-1> = error, C<0> = EOF, C<E<gt>0> = more data
+ * If C<buf_r> is not C<NULL>, C<*buf_r> is set to point to the data,
+ * which is in the handle's incoming message buffer (or, for a
+ * compressed chunk, the decompression buffer) and is only valid
+ * until the next message is received.  If the chunk is a hole,
+ * C<*buf_r> is set to C<NULL>.  C<*len_r> is set to the length of
+ * the data or hole.
+ *
+ * Returns C<-1> = error, C<0> = EOF, C<1> = more data
  */
-static ssize_t
-receive_file_data (guestfs_h *g, void **buf_r)
+static int
+receive_file_data (guestfs_h *g, const char **buf_r, uint64_t *len_r)
 {
   int r;
-  CLEANUP_FREE void *buf = NULL;
-  uint32_t len;
+  char *buf;
+  uint32_t len, data_len;
   XDR xdr;
-  guestfs_chunk chunk;
+  int cancel;
+  size_t pos;
 
-  r = guestfs_int_recv_from_daemon (g, &len, &buf);
+  r = recv_chunk (g, &len, &buf);
   if (r == -1)
     return -1;
 
@@ -894,39 +1657,131 @@ receive_file_data (guestfs_h *g, void **buf_r)
     error (g, _("receive_file_data: unexpected flag received when reading file chunks"));
     return -1;
   }
+  guestfs_int_stats_transfer (g, 0, (uint64_t) len + 4);
 
-  memset (&chunk, 0, sizeof chunk);
-
+  /* Decode the guestfs_chunk header ourselves, so that the data can be
+   * used directly from the message buffer instead of being copied
+   * into a separate allocation by xdr_guestfs_chunk.
+   */
   xdrmem_create (&xdr, buf, len, XDR_DECODE);
-  if (!xdr_guestfs_chunk (&xdr, &chunk)) {
+  if (!xdr_int (&xdr, &cancel) || !xdr_uint32_t (&xdr, &data_len)) {
     error (g, _("failed to parse file chunk"));
+    xdr_destroy (&xdr);
     return -1;
   }
+  pos = xdr_getpos (&xdr);
   xdr_destroy (&xdr);
 
-  if (chunk.cancel) {
+  if (data_len > len - pos) {
+    error (g, _("failed to parse file chunk"));
+    return -1;
+  }
+
+  if (cancel == GUESTFS_CHUNK_HOLE && g->hole_chunks) {
+    uint64_t hole_len;
+
+    xdrmem_create (&xdr, buf + pos, data_len, XDR_DECODE);
+    if (!xdr_uint64_t (&xdr, &hole_len)) {
+      error (g, _("failed to parse file chunk"));
+      xdr_destroy (&xdr);
+      return -1;
+    }
+    xdr_destroy (&xdr);
+
+    if (buf_r) *buf_r = NULL;
+    if (len_r) *len_r = hole_len;
+    return 1;
+  }
+
+#ifdef HAVE_ZLIB
+  if (cancel == GUESTFS_CHUNK_COMPRESSED && g->compressed_chunks) {
+    char *zbuf = get_chunk_z_buffer (g);
+    uLongf zlen = g->chunk_size;
+
+    if (data_len == 0 ||
+        uncompress ((Bytef *) zbuf, &zlen,
+                    (const Bytef *) buf + pos, data_len) != Z_OK ||
+        zlen == 0) {
+      error (g, _("failed to decompress file chunk"));
+      return -1;
+    }
+
+    if (buf_r) *buf_r = zbuf;
+    if (len_r) *len_r = zlen;
+    return 1;
+  }
+#endif
+
+  if (cancel) {
     if (g->user_cancel)
       guestfs_int_error_errno (g, EINTR, _("operation cancelled by user"));
     else
       error (g, _("file receive cancelled by daemon"));
-    free (chunk.data.data_val);
     return -1;
   }
 
-  if (chunk.data.data_len == 0) { /* end of transfer */
-    free (chunk.data.data_val);
+  if (data_len == 0) /* end of transfer */
     return 0;
-  }
 
-  if (buf_r) *buf_r = chunk.data.data_val;
-  else free (chunk.data.data_val); /* else caller frees */
+  if (buf_r) *buf_r = buf + pos;
+  if (len_r) *len_r = data_len;
+
+  return 1;
+}
 
-  return chunk.data.data_len;
+/**
+ * Daemon calls which don't have C<FileIn> or C<FileOut> parameters
+ * are cancelled by sending a cancel flag (C<GUESTFS_CANCEL_FLAG>) on
+ * the control channel while the library waits for the reply.
+ * Long-running daemon functions poll for the flag (see
+ * C<cancel_requested> in F<daemon/proto.c>) and stop with an C<EINTR>
+ * error.  Functions which don't poll leave the flag to be discarded
+ * by the daemon's main loop.
+ *
+ * The generated stubs call C<guestfs_int_cancellable_call_begin>
+ * before sending the request, C<guestfs_int_cancellable_call_sent>
+ * after sending it, and C<guestfs_int_cancellable_call_end> after
+ * receiving the reply.
+ */
+void
+guestfs_int_cancellable_call_begin (guestfs_h *g)
+{
+  g->daemon_cancel_armed = 0;
+  g->user_cancel = 0;
+}
+
+void
+guestfs_int_cancellable_call_sent (guestfs_h *g)
+{
+  g->daemon_cancel_armed = 1;
+
+  /* guestfs_user_cancel was called while we were sending the request. */
+  if (g->user_cancel && g->daemon_cancel_armed) {
+    g->daemon_cancel_armed = 0;
+    if (g->conn)
+      g->conn->ops->send_cancel_flag (g->conn);
+  }
+}
+
+void
+guestfs_int_cancellable_call_end (guestfs_h *g)
+{
+  g->daemon_cancel_armed = 0;
 }
 
 int
 guestfs_user_cancel (guestfs_h *g)
 {
   g->user_cancel = 1;
+
+  /* This may race with guestfs_int_cancellable_call_sent so that the
+   * flag is sent twice, but the daemon ignores extra cancel flags.
+   */
+  if (g->daemon_cancel_armed) {
+    g->daemon_cancel_armed = 0;
+    if (g->conn)
+      g->conn->ops->send_cancel_flag (g->conn);
+  }
+
   return 0;
 }
@@ -433,6 +433,38 @@ test_stringsbuf (void)
   guestfs_close (g);
 }
 
+/**
+ * Test C<is_zero>.
+ */
+static void
+test_is_zero (void)
+{
+  char buf[4097];
+  size_t size, i;
+
+  memset (buf, 0, sizeof buf);
+  assert (is_zero (buf, 0));
+
+  /* A single non-zero byte anywhere must be found, including in the
+   * first 16 bytes which are checked separately, and at the end of
+   * buffers which aren't a multiple of 16 bytes.
+   */
+  for (size = 1; size <= sizeof buf; size = size < 40 ? size + 1 : size * 2 + 1) {
+    assert (is_zero (buf, size));
+    for (i = 0; i < size; ++i) {
+      buf[i] = 1;
+      assert (!is_zero (buf, size));
+      buf[i] = 0;
+    }
+  }
+
+  /* Bytes after the end of the buffer are not looked at. */
+  buf[100] = 1;
+  assert (is_zero (buf, 100));
+  assert (!is_zero (buf, 101));
+  assert (is_zero (buf + 101, 100));
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -448,6 +480,7 @@ main (int argc, char *argv[])
   test_timeval_diff ();
   test_match ();
   test_stringsbuf ();
+  test_is_zero ();
 
   exit (EXIT_SUCCESS);
 }
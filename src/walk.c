@@ -0,0 +1,112 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * Implementation of L<guestfs(3)/guestfs_walk>.  The daemon streams
+ * the XDR-encoded entries to a temporary file (see
+ * F<daemon/walk.c>), which is then decoded here.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <rpc/xdr.h>
+#include <rpc/types.h>
+
+#include "guestfs.h"
+#include "guestfs_protocol.h"
+#include "guestfs-internal.h"
+#include "guestfs-internal-all.h"
+#include "guestfs-internal-actions.h"
+
+static int
+deserialise_walk_entries (guestfs_h *g, FILE *fp,
+                          struct guestfs_walk_entry_list *entries)
+{
+  XDR xdr;
+  int ret = 1;
+  uint32_t index;
+  struct stat statbuf;
+
+  if (fstat (fileno (fp), &statbuf) == -1) {
+    perrorf (g, "fstat");
+    return -1;
+  }
+
+  xdrstdio_create (&xdr, fp, XDR_DECODE);
+
+  for (index = 0; xdr_getpos (&xdr) < statbuf.st_size; index++) {
+    if (index == entries->len) {
+      entries->len = 2 * entries->len;
+      entries->val = safe_realloc (g, entries->val,
+                                   entries->len * sizeof (*entries->val));
+    }
+
+    /* Clear the entry so xdr logic will allocate necessary memory. */
+    memset (&entries->val[index], 0, sizeof (*entries->val));
+    ret = xdr_guestfs_int_walk_entry (&xdr, (guestfs_int_walk_entry *)
+                                      &entries->val[index]);
+    if (ret == 0)
+      break;
+  }
+
+  xdr_destroy (&xdr);
+  entries->len = index;
+
+  if (ret == 0) {
+    error (g, _("walk: could not decode the list of entries"));
+    return -1;
+  }
+  return 0;
+}
+
+struct guestfs_walk_entry_list *
+guestfs_impl_walk (guestfs_h *g, const char *directory)
+{
+  CLEANUP_UNLINK_FREE char *tmpfile = NULL;
+  CLEANUP_FCLOSE FILE *fp = NULL;
+  struct guestfs_walk_entry_list *entries;
+
+  if (guestfs_int_lazy_make_tmpdir (g) == -1)
+    return NULL;
+
+  tmpfile = safe_asprintf (g, "%s/walk%d", g->tmpdir, ++g->unique);
+
+  if (guestfs_internal_walk (g, directory, tmpfile) == -1)
+    return NULL;
+
+  fp = fopen (tmpfile, "r");
+  if (fp == NULL) {
+    perrorf (g, "fopen: %s", tmpfile);
+    return NULL;
+  }
+
+  entries = safe_malloc (g, sizeof (*entries));
+  entries->len = 64;
+  entries->val = safe_malloc (g, entries->len * sizeof (*entries->val));
+
+  if (deserialise_walk_entries (g, fp, entries) == -1) {
+    guestfs_free_walk_entry_list (entries);
+    return NULL;
+  }
+
+  return entries;               /* caller frees */
+}
@@ -55,6 +55,19 @@ main (int argc, char *argv[])
       printf ("Result10-1\nResult10-2\n");
     } else if (STREQ (argv[1], "11")) {
       printf ("Result11-1\nResult11-2");
+    } else if (STREQ (argv[1], "12")) {
+      int i;
+
+      /* Much more output than the daemon's initial buffer. */
+      for (i = 0; i < 100000; ++i)
+        printf ("Result12-%d\n", i);
+    } else if (STREQ (argv[1], "13")) {
+      int i;
+
+      /* Lots of stderr, which must be read at the same time as stdout. */
+      for (i = 0; i < 100000; ++i)
+        fprintf (stderr, "Error13-%d\n", i);
+      printf ("Result13");
     } else
       error (EXIT_FAILURE, 0, "unknown parameter: %s", argv[1]);
   } else
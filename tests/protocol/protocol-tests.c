@@ -0,0 +1,209 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <error.h>
+
+#include "guestfs.h"
+#include "guestfs-internal-frontend.h"
+
+#include "protocol-tests.h"
+
+char tmpdir[] = "/tmp/test-protocolXXXXXX";
+
+/* Create the local temporary directory.  The test must remove its
+ * files and the directory itself when it finishes.
+ */
+void
+make_tmpdir (void)
+{
+  if (mkdtemp (tmpdir) == NULL)
+    error (EXIT_FAILURE, errno, "mkdtemp: %s", tmpdir);
+}
+
+/* Return the name of 'name' in the temporary directory. */
+char *
+local_file (const char *name)
+{
+  char *ret;
+
+  if (asprintf (&ret, "%s/%s", tmpdir, name) == -1)
+    error (EXIT_FAILURE, errno, "asprintf");
+  return ret;
+}
+
+/* Create a local file of 'size' bytes, see enum content. */
+char *
+make_file (const char *name, int64_t size, enum content content)
+{
+  char *filename = local_file (name);
+  FILE *fp;
+  int64_t pos;
+  uint32_t x = 1;
+  int text;
+
+  fp = fopen (filename, "w");
+  if (fp == NULL)
+    error (EXIT_FAILURE, errno, "fopen: %s", filename);
+
+  for (pos = 0; pos < size; ++pos) {
+    if (content == MIXED)
+      text = (pos / (512 * 1024)) % 2 == 0;
+    else
+      text = content == TEXT;
+
+    if (text)
+      fputc ("line of text to compress\n"[pos % 25], fp);
+    else {
+      x ^= x << 13;             /* xorshift32 */
+      x ^= x >> 17;
+      x ^= x << 5;
+      fputc (x & 0xff, fp);
+    }
+  }
+
+  if (fclose (fp) == EOF)
+    error (EXIT_FAILURE, errno, "fclose: %s", filename);
+
+  return filename;
+}
+
+/* Create a sparse local file of 'size' bytes.  Data (a single 'x')
+ * is written at each offset in 'data'; the rest of the file is
+ * holes.
+ */
+char *
+make_sparse_file (const char *name, int64_t size,
+                  const int64_t *data, size_t n)
+{
+  char *filename = local_file (name);
+  size_t i;
+  int fd;
+
+  fd = open (filename, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+  if (fd == -1)
+    error (EXIT_FAILURE, errno, "open: %s", filename);
+  if (ftruncate (fd, size) == -1)
+    error (EXIT_FAILURE, errno, "ftruncate: %s", filename);
+  for (i = 0; i < n; ++i) {
+    if (pwrite (fd, "x", 1, data[i]) != 1)
+      error (EXIT_FAILURE, errno, "pwrite: %s", filename);
+  }
+  if (close (fd) == -1)
+    error (EXIT_FAILURE, errno, "close: %s", filename);
+
+  return filename;
+}
+
+/* Fail unless the two local files have the same contents. */
+void
+compare_files (const char *file1, const char *file2)
+{
+  FILE *fp1, *fp2;
+  char buf1[65536], buf2[65536];
+  size_t n1, n2;
+  int64_t pos = 0;
+
+  fp1 = fopen (file1, "r");
+  if (fp1 == NULL)
+    error (EXIT_FAILURE, errno, "fopen: %s", file1);
+  fp2 = fopen (file2, "r");
+  if (fp2 == NULL)
+    error (EXIT_FAILURE, errno, "fopen: %s", file2);
+
+  for (;;) {
+    n1 = fread (buf1, 1, sizeof buf1, fp1);
+    n2 = fread (buf2, 1, sizeof buf2, fp2);
+    if (n1 != n2 || memcmp (buf1, buf2, n1) != 0)
+      error (EXIT_FAILURE, 0, "%s and %s differ near offset %" PRIi64,
+             file1, file2, pos);
+    if (n1 == 0)
+      break;
+    pos += n1;
+  }
+
+  fclose (fp1);
+  fclose (fp2);
+}
+
+/* Partition the first (scratch) disk, make an ext2 filesystem on it
+ * and mount it on /.
+ */
+void
+mount_scratch_fs (guestfs_h *g)
+{
+  if (guestfs_part_disk (g, "/dev/sda", "mbr") == -1 ||
+      guestfs_mkfs (g, "ext2", "/dev/sda1") == -1 ||
+      guestfs_mount (g, "/dev/sda1", "/") == -1)
+    exit (EXIT_FAILURE);
+}
+
+/* Upload the local file to the same name in the root directory,
+ * download it again and compare them.
+ */
+void
+upload_and_download (guestfs_h *g, const char *filename, int64_t size)
+{
+  const char *name = strrchr (filename, '/') + 1;
+  CLEANUP_FREE char *remote = NULL, *copy = NULL;
+
+  if (asprintf (&remote, "/%s", name) == -1 ||
+      asprintf (&copy, "%s.copy", filename) == -1)
+    error (EXIT_FAILURE, errno, "asprintf");
+
+  if (guestfs_upload (g, filename, remote) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_filesize (g, remote) != size)
+    error (EXIT_FAILURE, 0, "%s: wrong size after upload", remote);
+  if (guestfs_download (g, remote, copy) == -1)
+    exit (EXIT_FAILURE);
+
+  compare_files (filename, copy);
+  unlink (copy);
+}
+
+/* Return the bytes sent and received for procedure 'name' since the
+ * last call to guestfs_reset_call_stats.
+ */
+void
+get_bytes (guestfs_h *g, const char *name, uint64_t *sent, uint64_t *received)
+{
+  struct guestfs_call_stat_list *stats;
+  size_t i;
+
+  *sent = *received = 0;
+  stats = guestfs_get_call_stats (g);
+  if (stats == NULL)
+    exit (EXIT_FAILURE);
+  for (i = 0; i < stats->len; ++i) {
+    if (STREQ (stats->val[i].cs_name, name)) {
+      *sent = stats->val[i].cs_bytes_sent;
+      *received = stats->val[i].cs_bytes_received;
+    }
+  }
+  guestfs_free_call_stat_list (stats);
+}
@@ -0,0 +1,47 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Helpers shared by the protocol tests.  They all exit the program
+ * on failure.
+ */
+
+#ifndef PROTOCOL_TESTS_H_
+#define PROTOCOL_TESTS_H_
+
+#include <stdint.h>
+
+#define MB (INT64_C(1024) * 1024)
+
+/* Contents of the local files created by make_file. */
+enum content {
+  TEXT,                         /* compresses well */
+  RANDOM,                       /* pseudo-random, doesn't compress */
+  MIXED,                        /* alternating 512K of each */
+};
+
+extern char tmpdir[];
+extern void make_tmpdir (void);
+extern char *local_file (const char *name);
+extern char *make_file (const char *name, int64_t size, enum content content);
+extern char *make_sparse_file (const char *name, int64_t size, const int64_t *data, size_t n);
+extern void compare_files (const char *file1, const char *file2);
+extern void mount_scratch_fs (guestfs_h *g);
+extern void upload_and_download (guestfs_h *g, const char *filename, int64_t size);
+extern void get_bytes (guestfs_h *g, const char *name, uint64_t *sent, uint64_t *received);
+
+#endif /* PROTOCOL_TESTS_H_ */
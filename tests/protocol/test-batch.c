@@ -0,0 +1,342 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Test the internal_batch call directly.  The requests are encoded
+ * here by hand, and each reply is decoded and checked against the
+ * request it answers.
+ *
+ * The last test sends enough readlink requests that the replies
+ * don't fit in one message.  The daemon must return a prefix of the
+ * replies, and the remaining requests are sent again until all of
+ * them have been answered, which is what src/batch.c does.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <error.h>
+#include <rpc/types.h>
+#include <rpc/xdr.h>
+
+#include "guestfs.h"
+#include "guestfs_protocol.h"
+#include "guestfs-internal-frontend.h"
+
+#include "protocol-tests.h"
+
+/* Length of the symlink target in the overflow test, and the number
+ * of readlink requests sent.  The replies add up to about twice
+ * GUESTFS_MESSAGE_MAX.
+ */
+#define TARGET_LEN 4000
+#define NR_READLINKS 2000
+
+/* Largest encoded request sent by this test. */
+#define REQUEST_MAX 1024
+
+static guestfs_h *g;
+
+/* Serial number of the last reply checked. */
+static size_t next_reply;
+
+/* A buffer of encoded requests, in the format expected by
+ * internal_batch: each message preceded by its length.
+ */
+struct requests {
+  char *buf;
+  size_t len;
+  size_t size;
+};
+
+static void
+add_request (struct requests *r, int proc, unsigned serial,
+             xdrproc_t xdr_args, void *args)
+{
+  XDR xdr;
+  struct guestfs_message_header hdr;
+  uint32_t len;
+
+  /* All the requests sent by this test are small. */
+  if (r->len + REQUEST_MAX + 4 > r->size) {
+    r->size = MAX (r->size * 2, r->len + REQUEST_MAX + 4);
+    r->buf = realloc (r->buf, r->size);
+    if (r->buf == NULL)
+      error (EXIT_FAILURE, errno, "realloc");
+  }
+
+  memset (&hdr, 0, sizeof hdr);
+  hdr.prog = GUESTFS_PROGRAM;
+  hdr.vers = GUESTFS_PROTOCOL_VERSION;
+  hdr.proc = proc;
+  hdr.direction = GUESTFS_DIRECTION_CALL;
+  hdr.serial = serial;
+  hdr.status = GUESTFS_STATUS_OK;
+
+  /* Encode the message after the length word, then go back and
+   * fill in the length.
+   */
+  xdrmem_create (&xdr, r->buf + r->len + 4, REQUEST_MAX, XDR_ENCODE);
+  if (!xdr_guestfs_message_header (&xdr, &hdr) || !xdr_args (&xdr, args, 0))
+    error (EXIT_FAILURE, 0, "could not encode request %u", serial);
+  len = xdr_getpos (&xdr);
+  xdr_destroy (&xdr);
+
+  xdrmem_create (&xdr, r->buf + r->len, 4, XDR_ENCODE);
+  xdr_uint32_t (&xdr, &len);
+  xdr_destroy (&xdr);
+
+  r->len += 4 + len;
+}
+
+/* Split the replies returned by internal_batch.  For each reply,
+ * 'check' is called with the decoding stream positioned after the
+ * header, and it must decode the rest of the message.  Returns the
+ * number of replies.
+ */
+static size_t
+for_each_reply (const char *replies, size_t size,
+                void (*check) (XDR *xdr,
+                               const struct guestfs_message_header *hdr,
+                               void *opaque),
+                void *opaque)
+{
+  size_t pos = 0, n = 0;
+
+  while (pos < size) {
+    XDR xdr;
+    uint32_t len;
+    struct guestfs_message_header hdr;
+
+    if (size - pos < 4)
+      error (EXIT_FAILURE, 0, "truncated length word in reply %zu", n);
+    xdrmem_create (&xdr, (char *) replies + pos, 4, XDR_DECODE);
+    xdr_uint32_t (&xdr, &len);
+    xdr_destroy (&xdr);
+    pos += 4;
+    if (len > size - pos)
+      error (EXIT_FAILURE, 0, "truncated reply %zu", n);
+
+    xdrmem_create (&xdr, (char *) replies + pos, len, XDR_DECODE);
+    memset (&hdr, 0, sizeof hdr);
+    if (!xdr_guestfs_message_header (&xdr, &hdr))
+      error (EXIT_FAILURE, 0, "could not decode header of reply %zu", n);
+    if (hdr.prog != GUESTFS_PROGRAM ||
+        hdr.vers != GUESTFS_PROTOCOL_VERSION ||
+        hdr.direction != GUESTFS_DIRECTION_REPLY)
+      error (EXIT_FAILURE, 0, "invalid header in reply %zu", n);
+    check (&xdr, &hdr, opaque);
+    if (xdr_getpos (&xdr) != len)
+      error (EXIT_FAILURE, 0, "trailing data in reply %zu", n);
+    xdr_destroy (&xdr);
+
+    pos += len;
+    n++;
+  }
+
+  return n;
+}
+
+/* Decode an error reply and return the error message. */
+static char *
+get_error (XDR *xdr, const struct guestfs_message_header *hdr)
+{
+  struct guestfs_message_error err;
+  char *msg;
+
+  if (hdr->status != GUESTFS_STATUS_ERROR)
+    error (EXIT_FAILURE, 0, "reply %u: expected an error", hdr->serial);
+  memset (&err, 0, sizeof err);
+  if (!xdr_guestfs_message_error (xdr, &err))
+    error (EXIT_FAILURE, 0, "reply %u: could not decode error", hdr->serial);
+  msg = strdup (err.error_message);
+  if (msg == NULL)
+    error (EXIT_FAILURE, errno, "strdup");
+  xdr_free ((xdrproc_t) xdr_guestfs_message_error, (char *) &err);
+  return msg;
+}
+
+/* Small batches of is_file calls, including one call which is not
+ * allowed in a batch.
+ *
+ * Serial 1 and 4: is_file ("/file") == true
+ * Serial 2: is_file ("/dir") == false
+ * Serial 3: touch ("/touched"), which must be refused
+ */
+static void
+check_small (XDR *xdr, const struct guestfs_message_header *hdr, void *opaque)
+{
+  const unsigned expected_serial = ++next_reply;
+  struct guestfs_is_file_ret ret;
+
+  if (hdr->serial != expected_serial)
+    error (EXIT_FAILURE, 0, "expected reply %u, got %u",
+           expected_serial, hdr->serial);
+
+  if (hdr->serial == 3) {
+    CLEANUP_FREE char *msg = get_error (xdr, hdr);
+
+    if (hdr->proc != GUESTFS_PROC_TOUCH || strstr (msg, "batch") == NULL)
+      error (EXIT_FAILURE, 0, "unexpected error for touch: %s", msg);
+    return;
+  }
+
+  if (hdr->status != GUESTFS_STATUS_OK || hdr->proc != GUESTFS_PROC_IS_FILE)
+    error (EXIT_FAILURE, 0, "reply %u: is_file failed", hdr->serial);
+  memset (&ret, 0, sizeof ret);
+  if (!xdr_guestfs_is_file_ret (xdr, &ret))
+    error (EXIT_FAILURE, 0, "reply %u: could not decode", hdr->serial);
+  if (ret.fileflag != (hdr->serial != 2))
+    error (EXIT_FAILURE, 0, "reply %u: wrong result from is_file",
+           hdr->serial);
+}
+
+static void
+test_small_batch (void)
+{
+  struct requests r = { .buf = NULL };
+  struct guestfs_is_file_args is_file_args;
+  struct guestfs_touch_args touch_args;
+  CLEANUP_FREE char *replies = NULL;
+  size_t size;
+
+  memset (&is_file_args, 0, sizeof is_file_args);
+  is_file_args.path = (char *) "/file";
+  add_request (&r, GUESTFS_PROC_IS_FILE, 1,
+               (xdrproc_t) xdr_guestfs_is_file_args, &is_file_args);
+  is_file_args.path = (char *) "/dir";
+  add_request (&r, GUESTFS_PROC_IS_FILE, 2,
+               (xdrproc_t) xdr_guestfs_is_file_args, &is_file_args);
+  touch_args.path = (char *) "/touched";
+  add_request (&r, GUESTFS_PROC_TOUCH, 3,
+               (xdrproc_t) xdr_guestfs_touch_args, &touch_args);
+  is_file_args.path = (char *) "/file";
+  add_request (&r, GUESTFS_PROC_IS_FILE, 4,
+               (xdrproc_t) xdr_guestfs_is_file_args, &is_file_args);
+
+  replies = guestfs_internal_batch (g, r.buf, r.len, &size);
+  if (replies == NULL)
+    exit (EXIT_FAILURE);
+
+  next_reply = 0;
+  if (for_each_reply (replies, size, check_small, NULL) != 4)
+    error (EXIT_FAILURE, 0, "expected 4 replies to the small batch");
+
+  if (guestfs_exists (g, "/touched") != 0)
+    error (EXIT_FAILURE, 0, "touch was run in a batch");
+
+  free (r.buf);
+}
+
+/* readlink ("/link") requests with serials 1 .. NR_READLINKS. */
+static void
+check_readlink (XDR *xdr, const struct guestfs_message_header *hdr,
+                void *opaque)
+{
+  const char *target = opaque;
+  const unsigned expected_serial = ++next_reply;
+  struct guestfs_readlink_ret ret;
+
+  if (hdr->serial != expected_serial)
+    error (EXIT_FAILURE, 0, "expected reply %u, got %u",
+           expected_serial, hdr->serial);
+  if (hdr->status != GUESTFS_STATUS_OK || hdr->proc != GUESTFS_PROC_READLINK)
+    error (EXIT_FAILURE, 0, "reply %u: readlink failed", hdr->serial);
+
+  memset (&ret, 0, sizeof ret);
+  if (!xdr_guestfs_readlink_ret (xdr, &ret))
+    error (EXIT_FAILURE, 0, "reply %u: could not decode", hdr->serial);
+  if (STRNEQ (ret.link, target))
+    error (EXIT_FAILURE, 0, "reply %u: wrong symlink target", hdr->serial);
+  xdr_free ((xdrproc_t) xdr_guestfs_readlink_ret, (char *) &ret);
+}
+
+static void
+test_overflow (void)
+{
+  char target[TARGET_LEN + 1];
+  struct guestfs_readlink_args args;
+  size_t rounds = 0;
+
+  memset (target, 'a', TARGET_LEN);
+  target[TARGET_LEN] = '\0';
+  if (guestfs_ln_s (g, target, "/link") == -1)
+    exit (EXIT_FAILURE);
+
+  args.path = (char *) "/link";
+  next_reply = 0;
+
+  while (next_reply < NR_READLINKS) {
+    struct requests r = { .buf = NULL };
+    CLEANUP_FREE char *replies = NULL;
+    size_t i, size, n;
+
+    for (i = next_reply + 1; i <= NR_READLINKS; ++i)
+      add_request (&r, GUESTFS_PROC_READLINK, i,
+                   (xdrproc_t) xdr_guestfs_readlink_args, &args);
+
+    replies = guestfs_internal_batch (g, r.buf, r.len, &size);
+    if (replies == NULL)
+      exit (EXIT_FAILURE);
+    if (size > GUESTFS_MESSAGE_MAX)
+      error (EXIT_FAILURE, 0, "batch replies are larger than a message");
+
+    n = for_each_reply (replies, size, check_readlink, target);
+    if (n == 0)
+      error (EXIT_FAILURE, 0, "no replies to the batch");
+
+    free (r.buf);
+    rounds++;
+  }
+
+  /* The replies can't all fit in one message. */
+  if (rounds < 2)
+    error (EXIT_FAILURE, 0, "expected the batch replies to overflow");
+}
+
+int
+main (int argc, char *argv[])
+{
+  g = guestfs_create ();
+  if (g == NULL)
+    error (EXIT_FAILURE, errno, "guestfs_create");
+
+  if (guestfs_add_drive_scratch (g, 64 * MB, -1) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_launch (g) == -1)
+    exit (EXIT_FAILURE);
+
+  mount_scratch_fs (g);
+
+  if (guestfs_touch (g, "/file") == -1 ||
+      guestfs_mkdir (g, "/dir") == -1)
+    exit (EXIT_FAILURE);
+
+  test_small_batch ();
+  test_overflow ();
+
+  if (guestfs_shutdown (g) == -1)
+    exit (EXIT_FAILURE);
+  guestfs_close (g);
+
+  exit (EXIT_SUCCESS);
+}
@@ -0,0 +1,174 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Test file transfers over the bulk data channel.  Files of sizes
+ * around the chunk boundaries are uploaded, downloaded again and
+ * compared with the original.  After each transfer a small call is
+ * made to check that the control channel is still in step with the
+ * daemon.
+ *
+ * If the backend does not give us a bulk data channel, the test is
+ * skipped.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <error.h>
+
+#include "guestfs.h"
+#include "guestfs-internal-frontend.h"
+
+#include "protocol-tests.h"
+
+static guestfs_h *g;
+static int bulk_channel = 0;
+
+static void
+debug_message (guestfs_h *handle, void *opaque, uint64_t event,
+               int event_handle, int flags,
+               const char *buf, size_t buf_len,
+               const uint64_t *array, size_t array_len)
+{
+  const char *msg = "launch: bulk data channel enabled";
+
+  if (memmem (buf, buf_len, msg, strlen (msg)) != NULL)
+    bulk_channel = 1;
+}
+
+/* Check that the control channel still works after a transfer. */
+static void
+check_control_channel (const char *remote, int64_t size)
+{
+  if (guestfs_ping_daemon (g) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_filesize (g, remote) != size)
+    error (EXIT_FAILURE, 0, "%s: expected size %" PRIi64, remote, size);
+}
+
+/* Upload a file of 'size' bytes, download it again and compare. */
+static void
+round_trip (int64_t size)
+{
+  CLEANUP_FREE char *name = NULL, *filename = NULL;
+  CLEANUP_FREE char *remote = NULL, *copy = NULL;
+
+  if (asprintf (&name, "file-%" PRIi64, size) == -1 ||
+      asprintf (&remote, "/%s", name) == -1)
+    error (EXIT_FAILURE, errno, "asprintf");
+  filename = make_file (name, size, RANDOM);
+  copy = local_file ("copy");
+
+  if (guestfs_upload (g, filename, remote) == -1)
+    exit (EXIT_FAILURE);
+  check_control_channel (remote, size);
+
+  if (guestfs_download (g, remote, copy) == -1)
+    exit (EXIT_FAILURE);
+  check_control_channel (remote, size);
+
+  compare_files (filename, copy);
+
+  unlink (filename);
+  unlink (copy);
+}
+
+/* The same, using upload-offset and download-offset to write and
+ * read back the middle of a remote file.
+ */
+static void
+round_trip_offset (int64_t offset, int64_t size)
+{
+  CLEANUP_FREE char *filename = NULL, *copy = NULL;
+  const char *remote = "/offset";
+
+  filename = make_file ("offset", size, RANDOM);
+  copy = local_file ("copy");
+
+  if (guestfs_upload_offset (g, filename, remote, offset) == -1)
+    exit (EXIT_FAILURE);
+  check_control_channel (remote, offset + size);
+
+  if (guestfs_download_offset (g, remote, copy, offset, size) == -1)
+    exit (EXIT_FAILURE);
+  check_control_channel (remote, offset + size);
+
+  compare_files (filename, copy);
+
+  unlink (filename);
+  unlink (copy);
+}
+
+int
+main (int argc, char *argv[])
+{
+  const int64_t sizes[] = {
+    0, 1, MB - 1, MB, MB + 1, 20 * MB
+  };
+  size_t i;
+
+  g = guestfs_create ();
+  if (g == NULL)
+    error (EXIT_FAILURE, errno, "guestfs_create");
+
+  /* The debug messages are sent to the callback instead of stderr. */
+  if (guestfs_set_event_callback (g, debug_message,
+                                  GUESTFS_EVENT_LIBRARY|GUESTFS_EVENT_APPLIANCE,
+                                  0, NULL) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_set_verbose (g, 1) == -1)
+    exit (EXIT_FAILURE);
+
+  if (guestfs_add_drive_scratch (g, 256 * MB, -1) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_launch (g) == -1)
+    exit (EXIT_FAILURE);
+
+  if (guestfs_set_verbose (g, 0) == -1)
+    exit (EXIT_FAILURE);
+
+  if (!bulk_channel) {
+    fprintf (stderr, "%s: test skipped because there is no bulk data channel\n",
+             argv[0]);
+    guestfs_close (g);
+    exit (77);
+  }
+
+  make_tmpdir ();
+  mount_scratch_fs (g);
+
+  for (i = 0; i < sizeof sizes / sizeof sizes[0]; ++i)
+    round_trip (sizes[i]);
+
+  round_trip_offset (MB + 5, 3 * MB);
+  round_trip_offset (5 * MB, 1);
+
+  if (guestfs_shutdown (g) == -1)
+    exit (EXIT_FAILURE);
+  guestfs_close (g);
+
+  rmdir (tmpdir);
+
+  exit (EXIT_SUCCESS);
+}
@@ -0,0 +1,138 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Test the per-procedure call statistics: the counts of calls and
+ * errors, the byte counts, the times measured by the library and the
+ * daemon, and guestfs_reset_call_stats.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <error.h>
+
+#include "guestfs.h"
+#include "guestfs-internal-frontend.h"
+
+#include "protocol-tests.h"
+
+#define NR_CALLS 10
+
+static guestfs_h *g;
+
+/* Return a copy of the statistics for 'name', or all zeroes if the
+ * procedure has not been called.
+ */
+static struct guestfs_call_stat
+get_stat (const char *name)
+{
+  struct guestfs_call_stat_list *stats;
+  struct guestfs_call_stat ret;
+  size_t i;
+
+  memset (&ret, 0, sizeof ret);
+  stats = guestfs_get_call_stats (g);
+  if (stats == NULL)
+    exit (EXIT_FAILURE);
+  for (i = 0; i < stats->len; ++i) {
+    if (STREQ (stats->val[i].cs_name, name)) {
+      ret = stats->val[i];
+      ret.cs_name = NULL;
+    }
+  }
+  guestfs_free_call_stat_list (stats);
+  return ret;
+}
+
+int
+main (int argc, char *argv[])
+{
+  struct guestfs_call_stat cs, cs2;
+  size_t i;
+  int r;
+
+  g = guestfs_create ();
+  if (g == NULL)
+    error (EXIT_FAILURE, errno, "guestfs_create");
+
+  if (guestfs_add_drive_scratch (g, 256 * MB, -1) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_launch (g) == -1)
+    exit (EXIT_FAILURE);
+
+  mount_scratch_fs (g);
+
+  if (guestfs_reset_call_stats (g) == -1)
+    exit (EXIT_FAILURE);
+
+  for (i = 0; i < NR_CALLS; ++i) {
+    if (guestfs_touch (g, "/file") == -1)
+      exit (EXIT_FAILURE);
+  }
+
+  guestfs_push_error_handler (g, NULL, NULL);
+  r = guestfs_rm (g, "/nonexistent");
+  guestfs_pop_error_handler (g);
+  if (r != -1)
+    error (EXIT_FAILURE, 0, "rm of a missing file did not fail");
+
+  cs = get_stat ("touch");
+  if (cs.cs_calls != NR_CALLS || cs.cs_errors != 0)
+    error (EXIT_FAILURE, 0, "touch: expected %d calls and no errors, "
+           "got %" PRIu64 " calls and %" PRIu64 " errors",
+           NR_CALLS, cs.cs_calls, cs.cs_errors);
+  if (cs.cs_bytes_sent == 0 || cs.cs_bytes_received == 0)
+    error (EXIT_FAILURE, 0, "touch: byte counts were not recorded");
+  if (cs.cs_total_usec == 0 || cs.cs_p50_usec > cs.cs_p99_usec)
+    error (EXIT_FAILURE, 0, "touch: wrong times: total %" PRIu64
+           ", p50 %" PRIu64 ", p99 %" PRIu64,
+           cs.cs_total_usec, cs.cs_p50_usec, cs.cs_p99_usec);
+  if (cs.cs_daemon_calls != NR_CALLS || cs.cs_daemon_usec > cs.cs_total_usec)
+    error (EXIT_FAILURE, 0, "touch: wrong daemon counts: %" PRIu64
+           " calls, %" PRIu64 " usec", cs.cs_daemon_calls, cs.cs_daemon_usec);
+
+  cs = get_stat ("rm");
+  if (cs.cs_calls != 1 || cs.cs_errors != 1)
+    error (EXIT_FAILURE, 0, "rm: expected 1 call and 1 error, "
+           "got %" PRIu64 " calls and %" PRIu64 " errors",
+           cs.cs_calls, cs.cs_errors);
+
+  /* Reading the statistics must not change the daemon's counts. */
+  cs = get_stat ("internal_daemon_call_stats");
+  cs2 = get_stat ("internal_daemon_call_stats");
+  if (cs.cs_daemon_calls != 0 || cs2.cs_daemon_calls != 0)
+    error (EXIT_FAILURE, 0,
+           "the daemon counted its own internal_daemon_call_stats calls");
+
+  if (guestfs_reset_call_stats (g) == -1)
+    exit (EXIT_FAILURE);
+  cs = get_stat ("touch");
+  if (cs.cs_calls != 0 || cs.cs_daemon_calls != 0)
+    error (EXIT_FAILURE, 0, "touch: statistics were not reset");
+
+  if (guestfs_shutdown (g) == -1)
+    exit (EXIT_FAILURE);
+  guestfs_close (g);
+
+  exit (EXIT_SUCCESS);
+}
@@ -0,0 +1,138 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Test that guestfs_user_cancel stops long-running daemon calls which
+ * have no FileIn or FileOut parameter.  Each call is cancelled when
+ * its first progress message arrives.  It must then fail with EINTR,
+ * and the handle must still work afterwards.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <error.h>
+
+#include "guestfs.h"
+#include "guestfs-internal-frontend.h"
+
+#include "protocol-tests.h"
+
+static guestfs_h *g;
+static int cancelled;
+
+static void
+progress_message (guestfs_h *handle, void *opaque, uint64_t event,
+                  int event_handle, int flags,
+                  const char *buf, size_t buf_len,
+                  const uint64_t *array, size_t array_len)
+{
+  /* array[2] and array[3] are the position and total. */
+  if (!cancelled && array_len >= 4 && array[2] < array[3]) {
+    cancelled = 1;
+    guestfs_user_cancel (g);
+  }
+}
+
+/* Check the result of a call which was cancelled, and that the
+ * handle is still in step with the daemon.
+ */
+static void
+check_cancelled (const char *name, int r)
+{
+  if (!cancelled) {
+    /* The call finished before sending any progress messages. */
+    fprintf (stderr, "%s: no progress messages, cancellation not tested\n",
+             name);
+    return;
+  }
+
+  if (r != -1 || guestfs_last_errno (g) != EINTR)
+    error (EXIT_FAILURE, 0, "%s: expected the call to fail with EINTR, "
+           "returned %d, errno %d", name, r, guestfs_last_errno (g));
+
+  if (guestfs_ping_daemon (g) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_touch (g, "/after-cancel") == -1)
+    exit (EXIT_FAILURE);
+}
+
+/* Remove the partly written file, so the next test has room. */
+static void
+remove_file (const char *path)
+{
+  if (guestfs_rm_f (g, path) == -1)
+    exit (EXIT_FAILURE);
+}
+
+int
+main (int argc, char *argv[])
+{
+  int r;
+
+  g = guestfs_create ();
+  if (g == NULL)
+    error (EXIT_FAILURE, errno, "guestfs_create");
+
+  if (guestfs_add_drive_scratch (g, 2048 * MB, -1) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_add_drive_scratch (g, 2048 * MB, -1) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_launch (g) == -1)
+    exit (EXIT_FAILURE);
+
+  mount_scratch_fs (g);
+
+  if (guestfs_set_event_callback (g, progress_message,
+                                  GUESTFS_EVENT_PROGRESS, 0, NULL) == -1)
+    exit (EXIT_FAILURE);
+
+  cancelled = 0;
+  r = guestfs_fill (g, 'A', (int) (1536 * MB), "/fill");
+  check_cancelled ("fill", r);
+  remove_file ("/fill");
+
+  cancelled = 0;
+  r = guestfs_fill_pattern (g, "abcdefg", (int) (1536 * MB), "/fill-pattern");
+  check_cancelled ("fill_pattern", r);
+  remove_file ("/fill-pattern");
+
+  cancelled = 0;
+  r = guestfs_copy_device_to_device (g, "/dev/sda", "/dev/sdb", -1);
+  check_cancelled ("copy_device_to_device", r);
+
+  cancelled = 0;
+  r = guestfs_copy_device_to_device (g, "/dev/sda", "/dev/sdb",
+                                     GUESTFS_COPY_DEVICE_TO_DEVICE_DIRECT, 1,
+                                     -1);
+  check_cancelled ("copy_device_to_device (direct)", r);
+
+  cancelled = 0;
+  r = guestfs_zero_device (g, "/dev/sdb");
+  check_cancelled ("zero_device", r);
+
+  if (guestfs_shutdown (g) == -1)
+    exit (EXIT_FAILURE);
+  guestfs_close (g);
+
+  exit (EXIT_SUCCESS);
+}
@@ -0,0 +1,134 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Test FileIn and FileOut transfers with the chunk size negotiated at
+ * launch.  The chunk size is read from the debug messages, and files
+ * of sizes around both the negotiated size and the old 8K chunk size
+ * are uploaded, downloaded again and compared with the original.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <error.h>
+
+#include "guestfs.h"
+#include "guestfs-internal-frontend.h"
+
+#include "protocol-tests.h"
+
+#define OLD_CHUNK_SIZE 8192
+
+static guestfs_h *g;
+static int chunk_size = 0;
+
+static void
+debug_message (guestfs_h *handle, void *opaque, uint64_t event,
+               int event_handle, int flags,
+               const char *buf, size_t buf_len,
+               const uint64_t *array, size_t array_len)
+{
+  const char *negotiated = "launch: negotiated chunk size: ";
+  const char *dflt = "launch: using default chunk size";
+  const char *p;
+
+  p = memmem (buf, buf_len, negotiated, strlen (negotiated));
+  if (p != NULL) {
+    if (sscanf (p + strlen (negotiated), "%d", &chunk_size) != 1)
+      error (EXIT_FAILURE, 0, "could not parse the negotiated chunk size");
+  }
+  else if (memmem (buf, buf_len, dflt, strlen (dflt)) != NULL)
+    chunk_size = OLD_CHUNK_SIZE;
+}
+
+static void
+round_trip (int64_t size)
+{
+  CLEANUP_FREE char *name = NULL, *filename = NULL;
+
+  if (asprintf (&name, "file-%" PRIi64, size) == -1)
+    error (EXIT_FAILURE, errno, "asprintf");
+  filename = make_file (name, size, RANDOM);
+  upload_and_download (g, filename, size);
+  unlink (filename);
+
+  /* Check that the daemon is still in step with the library. */
+  if (guestfs_ping_daemon (g) == -1)
+    exit (EXIT_FAILURE);
+}
+
+int
+main (int argc, char *argv[])
+{
+  int64_t n;
+  size_t i;
+
+  g = guestfs_create ();
+  if (g == NULL)
+    error (EXIT_FAILURE, errno, "guestfs_create");
+
+  /* The debug messages are sent to the callback instead of stderr. */
+  if (guestfs_set_event_callback (g, debug_message,
+                                  GUESTFS_EVENT_LIBRARY|GUESTFS_EVENT_APPLIANCE,
+                                  0, NULL) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_set_verbose (g, 1) == -1)
+    exit (EXIT_FAILURE);
+
+  if (guestfs_add_drive_scratch (g, 256 * MB, -1) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_launch (g) == -1)
+    exit (EXIT_FAILURE);
+
+  if (guestfs_set_verbose (g, 0) == -1)
+    exit (EXIT_FAILURE);
+
+  if (chunk_size < OLD_CHUNK_SIZE)
+    error (EXIT_FAILURE, 0, "no chunk size in the launch messages");
+  printf ("%s: chunk size %d bytes\n", argv[0], chunk_size);
+
+  make_tmpdir ();
+  mount_scratch_fs (g);
+
+  n = chunk_size;
+  {
+    const int64_t sizes[] = {
+      0, 1,
+      OLD_CHUNK_SIZE - 1, OLD_CHUNK_SIZE, OLD_CHUNK_SIZE + 1,
+      n - 1, n, n + 1,
+      2 * n, 3 * n + 1,
+    };
+
+    for (i = 0; i < sizeof sizes / sizeof sizes[0]; ++i)
+      round_trip (sizes[i]);
+  }
+
+  if (guestfs_shutdown (g) == -1)
+    exit (EXIT_FAILURE);
+  guestfs_close (g);
+
+  rmdir (tmpdir);
+
+  exit (EXIT_SUCCESS);
+}
@@ -0,0 +1,112 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Test file transfers with guestfs_set_transfer_compression.  Files
+ * which compress well, files which don't, and files which mix both
+ * kinds of chunk are uploaded, downloaded again and compared with the
+ * original.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <error.h>
+
+#include "guestfs.h"
+#include "guestfs-internal-frontend.h"
+
+#include "protocol-tests.h"
+
+/* Check that the text file was sent compressed both ways in the
+ * transfers since the last guestfs_reset_call_stats.
+ */
+static void
+check_compressed (guestfs_h *g, const char *name, int64_t size)
+{
+#ifdef HAVE_ZLIB
+  uint64_t sent, received;
+
+  get_bytes (g, "upload", &sent, &received);
+  if (sent > (uint64_t) size / 4)
+    error (EXIT_FAILURE, 0,
+           "%s: upload sent %" PRIu64 " bytes for %" PRIi64 " bytes of text",
+           name, sent, size);
+  get_bytes (g, "download", &sent, &received);
+  if (received > (uint64_t) size / 4)
+    error (EXIT_FAILURE, 0,
+           "%s: download received %" PRIu64 " bytes for %" PRIi64
+           " bytes of text",
+           name, received, size);
+#endif
+}
+
+int
+main (int argc, char *argv[])
+{
+  guestfs_h *g;
+  CLEANUP_FREE char *small = NULL, *text = NULL, *noise = NULL;
+  CLEANUP_FREE char *mixed = NULL;
+
+  make_tmpdir ();
+
+  g = guestfs_create ();
+  if (g == NULL)
+    error (EXIT_FAILURE, errno, "guestfs_create");
+
+  if (guestfs_set_transfer_compression (g, 1) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_add_drive_scratch (g, 256 * MB, -1) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_launch (g) == -1)
+    exit (EXIT_FAILURE);
+
+  mount_scratch_fs (g);
+
+  small = make_file ("small", 100, TEXT);
+  upload_and_download (g, small, 100);
+
+  text = make_file ("text", 8 * MB, TEXT);
+  if (guestfs_reset_call_stats (g) == -1)
+    exit (EXIT_FAILURE);
+  upload_and_download (g, text, 8 * MB);
+  check_compressed (g, "text", 8 * MB);
+
+  noise = make_file ("random", 3 * MB + 17, RANDOM);
+  upload_and_download (g, noise, 3 * MB + 17);
+
+  mixed = make_file ("mixed", 6 * MB + 1, MIXED);
+  upload_and_download (g, mixed, 6 * MB + 1);
+
+  if (guestfs_shutdown (g) == -1)
+    exit (EXIT_FAILURE);
+  guestfs_close (g);
+
+  unlink (small);
+  unlink (text);
+  unlink (noise);
+  unlink (mixed);
+  rmdir (tmpdir);
+
+  exit (EXIT_SUCCESS);
+}
@@ -0,0 +1,142 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Test that concurrent daemon calls are answered correctly.  The
+ * appliance has several vCPUs, so the daemon runs calls marked
+ * concurrent in worker threads, and with a pipeline depth greater
+ * than one the library has several internal_readlinklist (or
+ * internal_lstatnslist) calls in flight at once.  Their replies may
+ * come back in any order, and each must be matched to its request.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <error.h>
+
+#include "guestfs.h"
+#include "guestfs-internal-frontend.h"
+
+#include "protocol-tests.h"
+
+#define NR_LINKS 4000
+
+static guestfs_h *g;
+
+/* The target of link 'i'.  The targets have different lengths, so
+ * that lstatnslist results can be told apart by st_size.
+ */
+static char *
+target (size_t i)
+{
+  char *ret;
+
+  if (asprintf (&ret, "target-%05zu%.*s", i, (int) (i % 7), "xxxxxx") == -1)
+    error (EXIT_FAILURE, errno, "asprintf");
+  return ret;
+}
+
+int
+main (int argc, char *argv[])
+{
+  char **names;
+  const int depths[] = { 2, 4, 16 };
+  size_t i, j;
+
+  g = guestfs_create ();
+  if (g == NULL)
+    error (EXIT_FAILURE, errno, "guestfs_create");
+
+  if (guestfs_set_smp (g, 4) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_add_drive_scratch (g, 256 * MB, -1) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_launch (g) == -1)
+    exit (EXIT_FAILURE);
+
+  mount_scratch_fs (g);
+  if (guestfs_mkdir (g, "/links") == -1)
+    exit (EXIT_FAILURE);
+
+  names = calloc (NR_LINKS + 1, sizeof (char *));
+  if (names == NULL)
+    error (EXIT_FAILURE, errno, "calloc");
+
+  for (i = 0; i < NR_LINKS; ++i) {
+    CLEANUP_FREE char *path = NULL, *t = target (i);
+
+    if (asprintf (&names[i], "link-%05zu", i) == -1 ||
+        asprintf (&path, "/links/%s", names[i]) == -1)
+      error (EXIT_FAILURE, errno, "asprintf");
+    if (guestfs_ln_s (g, t, path) == -1)
+      exit (EXIT_FAILURE);
+  }
+
+  for (j = 0; j < sizeof depths / sizeof depths[0]; ++j) {
+    struct guestfs_statns_list *stats;
+    char **links;
+
+    if (guestfs_set_pipeline_depth (g, depths[j]) == -1)
+      exit (EXIT_FAILURE);
+
+    links = guestfs_readlinklist (g, "/links", names);
+    if (links == NULL)
+      exit (EXIT_FAILURE);
+    if (guestfs_int_count_strings (links) != NR_LINKS)
+      error (EXIT_FAILURE, 0, "depth %d: readlinklist returned %zu results",
+             depths[j], guestfs_int_count_strings (links));
+    for (i = 0; i < NR_LINKS; ++i) {
+      CLEANUP_FREE char *t = target (i);
+
+      if (STRNEQ (links[i], t))
+        error (EXIT_FAILURE, 0, "depth %d: readlinklist: %s: got %s",
+               depths[j], names[i], links[i]);
+    }
+    guestfs_int_free_string_list (links);
+
+    stats = guestfs_lstatnslist (g, "/links", names);
+    if (stats == NULL)
+      exit (EXIT_FAILURE);
+    if (stats->len != NR_LINKS)
+      error (EXIT_FAILURE, 0, "depth %d: lstatnslist returned %" PRIu32
+             " results", depths[j], stats->len);
+    for (i = 0; i < NR_LINKS; ++i) {
+      CLEANUP_FREE char *t = target (i);
+
+      if (!S_ISLNK (stats->val[i].st_mode) ||
+          stats->val[i].st_size != (int64_t) strlen (t))
+        error (EXIT_FAILURE, 0, "depth %d: lstatnslist: %s: wrong result",
+               depths[j], names[i]);
+    }
+    guestfs_free_statns_list (stats);
+  }
+
+  if (guestfs_shutdown (g) == -1)
+    exit (EXIT_FAILURE);
+  guestfs_close (g);
+
+  guestfs_int_free_string_list (names);
+
+  exit (EXIT_SUCCESS);
+}
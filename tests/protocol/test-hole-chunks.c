@@ -0,0 +1,134 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Test that runs of zeroes survive a round trip through the
+ * appliance, and that they are sent as hole chunks rather than as
+ * data.  Each file is uploaded, downloaded again and compared with
+ * the original.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <error.h>
+
+#include "guestfs.h"
+#include "guestfs-internal-frontend.h"
+
+#include "protocol-tests.h"
+
+/* A transfer of this many bytes which is all holes must be sent in
+ * much less than this.
+ */
+#define HOLES_MAX_BYTES (64 * 1024)
+
+/* Check that neither the upload nor the download since the last
+ * guestfs_reset_call_stats sent the data.
+ */
+static void
+check_holes_sent (guestfs_h *g, const char *name)
+{
+  uint64_t sent, received;
+
+  get_bytes (g, "upload", &sent, &received);
+  if (sent > HOLES_MAX_BYTES)
+    error (EXIT_FAILURE, 0,
+           "%s: upload of a file of holes sent %" PRIu64 " bytes",
+           name, sent);
+  get_bytes (g, "download", &sent, &received);
+  if (received > HOLES_MAX_BYTES)
+    error (EXIT_FAILURE, 0,
+           "%s: download of a file of holes received %" PRIu64 " bytes",
+           name, received);
+}
+
+int
+main (int argc, char *argv[])
+{
+  guestfs_h *g;
+  CLEANUP_FREE char *empty = NULL, *holes = NULL, *sparse = NULL;
+  CLEANUP_FREE char *device = NULL, *zeroes = NULL;
+  const int64_t sparse_data[] = {
+    0, MB - 1, MB, 10 * MB + 3, 20 * MB - 1
+  };
+  uint64_t sent, received;
+
+  make_tmpdir ();
+
+  g = guestfs_create ();
+  if (g == NULL)
+    error (EXIT_FAILURE, errno, "guestfs_create");
+
+  if (guestfs_add_drive_scratch (g, 256 * MB, -1) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_launch (g) == -1)
+    exit (EXIT_FAILURE);
+
+  /* The scratch disk is all zeroes, so downloading it should send
+   * nothing but holes.
+   */
+  device = local_file ("device");
+  zeroes = make_sparse_file ("zeroes", 256 * MB, NULL, 0);
+  if (guestfs_reset_call_stats (g) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_download (g, "/dev/sda", device) == -1)
+    exit (EXIT_FAILURE);
+  get_bytes (g, "download", &sent, &received);
+  if (received > HOLES_MAX_BYTES)
+    error (EXIT_FAILURE, 0,
+           "download of an empty device received %" PRIu64 " bytes",
+           received);
+  compare_files (zeroes, device);
+  unlink (device);
+  unlink (zeroes);
+
+  mount_scratch_fs (g);
+
+  empty = make_sparse_file ("empty", 0, NULL, 0);
+  upload_and_download (g, empty, 0);
+
+  holes = make_sparse_file ("holes", 64 * MB, NULL, 0);
+  if (guestfs_reset_call_stats (g) == -1)
+    exit (EXIT_FAILURE);
+  upload_and_download (g, holes, 64 * MB);
+  check_holes_sent (g, "holes");
+  if (guestfs_is_zero (g, "/holes") != 1)
+    error (EXIT_FAILURE, 0, "/holes: uploaded file is not all zeroes");
+
+  sparse = make_sparse_file ("sparse", 20 * MB,
+                             sparse_data,
+                             sizeof sparse_data / sizeof sparse_data[0]);
+  upload_and_download (g, sparse, 20 * MB);
+
+  if (guestfs_shutdown (g) == -1)
+    exit (EXIT_FAILURE);
+  guestfs_close (g);
+
+  unlink (empty);
+  unlink (holes);
+  unlink (sparse);
+  rmdir (tmpdir);
+
+  exit (EXIT_SUCCESS);
+}
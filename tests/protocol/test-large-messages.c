@@ -0,0 +1,127 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Test that the message buffers kept in the handle are reused
+ * correctly.  Large requests and replies (which make the buffers grow)
+ * are alternated with small ones (after which they shrink again), and
+ * every result is checked.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <error.h>
+
+#include "guestfs.h"
+#include "guestfs-internal-frontend.h"
+
+#include "protocol-tests.h"
+
+/* Less than the maximum message size (GUESTFS_MESSAGE_MAX). */
+#define LARGE_SIZE (3 * MB)
+
+#define NR_ROUNDS 5
+
+static guestfs_h *g;
+
+static void
+fill_buffer (char *buf, size_t size, size_t round)
+{
+  size_t i;
+
+  for (i = 0; i < size; ++i)
+    buf[i] = 'a' + (i + round) % 26;
+}
+
+int
+main (int argc, char *argv[])
+{
+  char *large, *ret;
+  size_t i, size, small;
+  CLEANUP_FREE char *contents = NULL;
+
+  g = guestfs_create ();
+  if (g == NULL)
+    error (EXIT_FAILURE, errno, "guestfs_create");
+
+  if (guestfs_add_drive_scratch (g, 256 * MB, -1) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_launch (g) == -1)
+    exit (EXIT_FAILURE);
+
+  mount_scratch_fs (g);
+
+  large = malloc (LARGE_SIZE);
+  if (large == NULL)
+    error (EXIT_FAILURE, errno, "malloc");
+
+  for (i = 0; i < NR_ROUNDS; ++i) {
+    /* Each round uses a different size, so that stale data left at
+     * the end of a reused buffer would be noticed.
+     */
+    size = LARGE_SIZE - i * 1000;
+    small = i + 1;
+    fill_buffer (large, size, i);
+
+    /* Large request, small reply. */
+    if (guestfs_write (g, "/large", large, size) == -1)
+      exit (EXIT_FAILURE);
+
+    /* Small request and reply. */
+    if (guestfs_write (g, "/small", large, small) == -1)
+      exit (EXIT_FAILURE);
+    if (guestfs_filesize (g, "/large") != (int64_t) size)
+      error (EXIT_FAILURE, 0, "round %zu: wrong size after write", i);
+
+    /* Small request, large reply. */
+    ret = guestfs_read_file (g, "/large", &size);
+    if (ret == NULL)
+      exit (EXIT_FAILURE);
+    if (size != LARGE_SIZE - i * 1000 || memcmp (ret, large, size) != 0)
+      error (EXIT_FAILURE, 0, "round %zu: large file read back wrongly", i);
+    free (ret);
+
+    /* Small reply straight after a large one. */
+    ret = guestfs_read_file (g, "/small", &size);
+    if (ret == NULL)
+      exit (EXIT_FAILURE);
+    if (size != small || memcmp (ret, large, small) != 0)
+      error (EXIT_FAILURE, 0, "round %zu: small file read back wrongly", i);
+    free (ret);
+
+    free (contents);
+    contents = guestfs_cat (g, "/small");
+    if (contents == NULL)
+      exit (EXIT_FAILURE);
+    if (strlen (contents) != small || memcmp (contents, large, small) != 0)
+      error (EXIT_FAILURE, 0, "round %zu: cat returned the wrong data", i);
+  }
+
+  free (large);
+
+  if (guestfs_shutdown (g) == -1)
+    exit (EXIT_FAILURE);
+  guestfs_close (g);
+
+  exit (EXIT_SUCCESS);
+}
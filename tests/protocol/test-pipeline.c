@@ -0,0 +1,210 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Test the calls which split a long list of names into several
+ * daemon calls and pipeline them (lstatnslist, readlinklist and
+ * checksumlist).  The results must be the same, and in the same
+ * order, whatever the pipeline depth.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <error.h>
+
+#include "guestfs.h"
+#include "guestfs-internal-frontend.h"
+
+#include "protocol-tests.h"
+
+/* Number of files.  This is several times the number of names sent
+ * in each daemon call.
+ */
+#define NR_FILES 5000
+
+/* Every STRIDE'th file has some content, and for readlinklist and
+ * lstatnslist the name is replaced by a symlink.
+ */
+#define STRIDE 97
+
+#define EMPTY_MD5 "d41d8cd98f00b204e9800998ecf8427e"
+
+static guestfs_h *g;
+
+/* Results of the first run, which the other runs are compared with. */
+static struct guestfs_statns_list *first_stats;
+static char **first_links;
+static char **first_checksums;
+
+static void
+check_results (int depth,
+               struct guestfs_statns_list *stats, char **links,
+               char **checksums, char **md5s)
+{
+  size_t i;
+
+  if (stats->len != NR_FILES ||
+      guestfs_int_count_strings (links) != NR_FILES ||
+      guestfs_int_count_strings (checksums) != NR_FILES)
+    error (EXIT_FAILURE, 0, "depth %d: wrong number of results", depth);
+
+  for (i = 0; i < NR_FILES; ++i) {
+    if (i % STRIDE == 0) {
+      char target[32];
+
+      snprintf (target, sizeof target, "target-%08zu", i);
+      if (!S_ISLNK (stats->val[i].st_mode))
+        error (EXIT_FAILURE, 0, "depth %d: lstatnslist: %zu is not a symlink",
+               depth, i);
+      if (STRNEQ (links[i], target))
+        error (EXIT_FAILURE, 0, "depth %d: readlinklist: %zu: got %s",
+               depth, i, links[i]);
+      if (STRNEQ (checksums[i], md5s[i / STRIDE]))
+        error (EXIT_FAILURE, 0, "depth %d: checksumlist: %zu: got %s",
+               depth, i, checksums[i]);
+    }
+    else {
+      if (!S_ISREG (stats->val[i].st_mode))
+        error (EXIT_FAILURE, 0, "depth %d: lstatnslist: %zu is not a file",
+               depth, i);
+      if (STRNEQ (links[i], ""))
+        error (EXIT_FAILURE, 0, "depth %d: readlinklist: %zu: got %s",
+               depth, i, links[i]);
+      if (STRNEQ (checksums[i], EMPTY_MD5))
+        error (EXIT_FAILURE, 0, "depth %d: checksumlist: %zu: got %s",
+               depth, i, checksums[i]);
+    }
+
+    if (first_stats) {
+      if (stats->val[i].st_ino != first_stats->val[i].st_ino ||
+          STRNEQ (links[i], first_links[i]) ||
+          STRNEQ (checksums[i], first_checksums[i]))
+        error (EXIT_FAILURE, 0,
+               "depth %d: result %zu differs from the first run", depth, i);
+    }
+  }
+}
+
+int
+main (int argc, char *argv[])
+{
+  char **files, **names;
+  char *md5s[NR_FILES / STRIDE + 1];
+  const int depths[] = { 1, 8, 2, 64 };
+  size_t i;
+
+  g = guestfs_create ();
+  if (g == NULL)
+    error (EXIT_FAILURE, errno, "guestfs_create");
+
+  if (guestfs_add_drive_scratch (g, 256 * MB, -1) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_launch (g) == -1)
+    exit (EXIT_FAILURE);
+
+  mount_scratch_fs (g);
+
+  if (guestfs_mkdir (g, "/dir") == -1 ||
+      guestfs_fill_dir (g, "/dir", NR_FILES) == -1)
+    exit (EXIT_FAILURE);
+
+  /* Names of the files created by fill-dir, and the same list with
+   * every STRIDE'th name replaced by a symlink.
+   */
+  files = calloc (NR_FILES + 1, sizeof (char *));
+  names = calloc (NR_FILES + 1, sizeof (char *));
+  if (files == NULL || names == NULL)
+    error (EXIT_FAILURE, errno, "calloc");
+
+  for (i = 0; i < NR_FILES; ++i) {
+    if (asprintf (&files[i], "%08zu", i) == -1)
+      error (EXIT_FAILURE, errno, "asprintf");
+
+    if (i % STRIDE == 0) {
+      CLEANUP_FREE char *path = NULL, *link = NULL, *target = NULL;
+
+      if (asprintf (&path, "/dir/%s", files[i]) == -1 ||
+          asprintf (&link, "/dir/link-%08zu", i) == -1 ||
+          asprintf (&target, "target-%08zu", i) == -1 ||
+          asprintf (&names[i], "link-%08zu", i) == -1)
+        error (EXIT_FAILURE, errno, "asprintf");
+      if (guestfs_write (g, path, files[i], strlen (files[i])) == -1 ||
+          guestfs_ln_s (g, target, link) == -1)
+        exit (EXIT_FAILURE);
+      md5s[i / STRIDE] = guestfs_checksum (g, "md5", path);
+      if (md5s[i / STRIDE] == NULL)
+        exit (EXIT_FAILURE);
+    }
+    else {
+      names[i] = strdup (files[i]);
+      if (names[i] == NULL)
+        error (EXIT_FAILURE, errno, "strdup");
+    }
+  }
+
+  for (i = 0; i < sizeof depths / sizeof depths[0]; ++i) {
+    struct guestfs_statns_list *stats;
+    char **links, **checksums;
+
+    if (guestfs_set_pipeline_depth (g, depths[i]) == -1)
+      exit (EXIT_FAILURE);
+
+    stats = guestfs_lstatnslist (g, "/dir", names);
+    if (stats == NULL)
+      exit (EXIT_FAILURE);
+    links = guestfs_readlinklist (g, "/dir", names);
+    if (links == NULL)
+      exit (EXIT_FAILURE);
+    checksums = guestfs_checksumlist (g, "md5", "/dir", files);
+    if (checksums == NULL)
+      exit (EXIT_FAILURE);
+
+    check_results (depths[i], stats, links, checksums, md5s);
+
+    if (first_stats == NULL) {
+      first_stats = stats;
+      first_links = links;
+      first_checksums = checksums;
+    }
+    else {
+      guestfs_free_statns_list (stats);
+      guestfs_int_free_string_list (links);
+      guestfs_int_free_string_list (checksums);
+    }
+  }
+
+  if (guestfs_shutdown (g) == -1)
+    exit (EXIT_FAILURE);
+  guestfs_close (g);
+
+  guestfs_free_statns_list (first_stats);
+  guestfs_int_free_string_list (first_links);
+  guestfs_int_free_string_list (first_checksums);
+  guestfs_int_free_string_list (files);
+  guestfs_int_free_string_list (names);
+  for (i = 0; i < NR_FILES / STRIDE + 1; ++i)
+    free (md5s[i]);
+
+  exit (EXIT_SUCCESS);
+}
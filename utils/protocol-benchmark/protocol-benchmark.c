@@ -0,0 +1,547 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Benchmark the protocol between the library and the daemon.
+ * Currently tested are:
+ *   - round trip time of a call which does nothing in the daemon
+ *   - time taken by calls returning replies of different sizes
+ *   - upload (FileIn) throughput
+ *   - download (FileOut) throughput at different chunk sizes
+ * The results are printed as JSON, so that they can be saved and
+ * compared to find regressions in src/proto.c and daemon/proto.c.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <error.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "guestfs.h"
+#include "guestfs-internal-frontend.h"
+#include "guestfs_protocol.h"
+
+#include "getprogname.h"
+
+static void print_string (const char *str);
+static void test_rtt (void);
+static void test_reply_size (void);
+static void test_transfer (void);
+
+/* Which tests are enabled? -- All by default. */
+static int rtt = 1;
+static int reply_size = 1;
+static int transfer = 1;
+
+static int iterations = 1000;
+static int64_t transfer_size = INT64_C (256) * 1024 * 1024;
+static int64_t disk_size;
+
+static guestfs_h *g;
+static FILE *out;
+static int first_field = 1;
+
+static void
+reset_default_tests (int *flag)
+{
+  if (*flag) {
+    rtt = 0;
+    reply_size = 0;
+    transfer = 0;
+    *flag = 0;
+  }
+}
+
+static void
+usage (int exitcode)
+{
+  fprintf (stderr,
+           "protocol-benchmark: Benchmark the libguestfs protocol.\n"
+           "\n"
+           "To run all tests (recommended), do:\n"
+           "  protocol-benchmark\n"
+           "\n"
+           "To run only specific tests, do:\n"
+           "  protocol-benchmark --option [--option ...]\n"
+           "where the test options are:\n"
+           "  --rtt\n"
+           "  --reply-size\n"
+           "  --transfer\n"
+           "\n"
+           "Other options:\n"
+           "  --help                       Display help output and exit\n"
+           "  -n <N> | --iterations=<N>    Number of calls in the timing tests\n"
+           "  -o <FILE> | --output=<FILE>  Write the results to FILE\n"
+           "  -s <MB> | --size=<MB>        Size of the transfer tests in megabytes\n"
+           );
+  exit (exitcode);
+}
+
+int
+main (int argc, char *argv[])
+{
+  enum { HELP_OPTION = CHAR_MAX + 1 };
+  static const char options[] = "n:o:s:";
+  static const struct option long_options[] = {
+    { "help", 0, 0, HELP_OPTION },
+    { "iterations", 1, 0, 'n' },
+    { "output", 1, 0, 'o' },
+    { "size", 1, 0, 's' },
+
+    /* Tests. */
+    { "rtt", 0, 0, 0 },
+    { "reply-size", 0, 0, 0 },
+    { "transfer", 0, 0, 0 },
+
+    { 0, 0, 0, 0 }
+  };
+  int c, option_index;
+  int reset_flag = 1;
+  const char *output = NULL;
+  int64_t size_mb;
+  CLEANUP_FREE char *backend = NULL;
+  CLEANUP_FREE char *version_str = NULL;
+  struct guestfs_version *version;
+
+  for (;;) {
+    c = getopt_long (argc, argv, options, long_options, &option_index);
+    if (c == -1) break;
+
+    switch (c) {
+    case 0:
+      /* Options which are long only. */
+      if (STREQ (long_options[option_index].name, "rtt")) {
+        reset_default_tests (&reset_flag);
+        rtt = 1;
+      }
+      else if (STREQ (long_options[option_index].name, "reply-size")) {
+        reset_default_tests (&reset_flag);
+        reply_size = 1;
+      }
+      else if (STREQ (long_options[option_index].name, "transfer")) {
+        reset_default_tests (&reset_flag);
+        transfer = 1;
+      }
+      else {
+        fprintf (stderr, "%s: unknown long option: %s (%d)\n",
+                 getprogname (), long_options[option_index].name, option_index);
+        exit (EXIT_FAILURE);
+      }
+      break;
+
+    case 'n':
+      if (sscanf (optarg, "%d", &iterations) != 1 || iterations < 1) {
+        fprintf (stderr, "%s: -n: argument is not a positive integer\n",
+                 getprogname ());
+        exit (EXIT_FAILURE);
+      }
+      break;
+
+    case 'o':
+      output = optarg;
+      break;
+
+    case 's':
+      if (sscanf (optarg, "%" SCNi64, &size_mb) != 1 || size_mb < 1) {
+        fprintf (stderr, "%s: -s: argument is not a positive integer\n",
+                 getprogname ());
+        exit (EXIT_FAILURE);
+      }
+      transfer_size = size_mb * 1024 * 1024;
+      break;
+
+    case HELP_OPTION:
+      usage (EXIT_SUCCESS);
+
+    default:
+      usage (EXIT_FAILURE);
+    }
+  }
+
+  if (optind != argc) {
+    fprintf (stderr, "%s: extra arguments found on the command line\n",
+             getprogname ());
+    exit (EXIT_FAILURE);
+  }
+
+  if (output) {
+    out = fopen (output, "w");
+    if (out == NULL)
+      error (EXIT_FAILURE, errno, "%s", output);
+  }
+  else
+    out = stdout;
+
+  g = guestfs_create ();
+  if (!g)
+    error (EXIT_FAILURE, errno, "guestfs_create");
+
+  /* The scratch disk is the source of the replies in the reply size
+   * test, and the target of the transfer tests, so it must be at
+   * least as large as the largest reply.
+   */
+  disk_size = transfer_size;
+  if (disk_size < GUESTFS_MESSAGE_MAX)
+    disk_size = GUESTFS_MESSAGE_MAX;
+  if (guestfs_add_drive_scratch (g, disk_size, -1) == -1)
+    exit (EXIT_FAILURE);
+
+  if (guestfs_launch (g) == -1)
+    exit (EXIT_FAILURE);
+
+  version = guestfs_version (g);
+  if (version == NULL)
+    exit (EXIT_FAILURE);
+  backend = guestfs_get_backend (g);
+  if (backend == NULL)
+    exit (EXIT_FAILURE);
+
+  if (asprintf (&version_str, "%" PRIi64 ".%" PRIi64 ".%" PRIi64 "%s",
+                version->major, version->minor, version->release,
+                version->extra) == -1)
+    error (EXIT_FAILURE, errno, "asprintf");
+
+  fprintf (out, "{\n");
+  fprintf (out, "  \"version\": ");
+  print_string (version_str);
+  fprintf (out, ",\n");
+  fprintf (out, "  \"backend\": ");
+  print_string (backend);
+  fprintf (out, ",\n");
+  fprintf (out, "  \"pipeline_depth\": %d,\n", guestfs_get_pipeline_depth (g));
+  fprintf (out, "  \"transfer_compression\": %s",
+           guestfs_get_transfer_compression (g) > 0 ? "true" : "false");
+  first_field = 0;
+  guestfs_free_version (version);
+
+  test_rtt ();
+  test_reply_size ();
+  test_transfer ();
+
+  fprintf (out, "\n}\n");
+
+  if (guestfs_shutdown (g) == -1)
+    exit (EXIT_FAILURE);
+
+  guestfs_close (g);
+
+  if (out != stdout && fclose (out) == EOF)
+    error (EXIT_FAILURE, errno, "%s", output);
+
+  exit (EXIT_SUCCESS);
+}
+
+/* Start a new field in the top level JSON object. */
+static void
+begin_field (const char *name)
+{
+  if (!first_field)
+    fprintf (out, ",\n");
+  first_field = 0;
+  fprintf (out, "  ");
+  print_string (name);
+  fprintf (out, ": ");
+}
+
+/* Print a JSON string, with quotes and with special characters
+ * escaped.
+ */
+static void
+print_string (const char *str)
+{
+  const unsigned char *p;
+
+  fputc ('"', out);
+  for (p = (const unsigned char *) str; *p; ++p) {
+    if (*p == '"' || *p == '\\')
+      fprintf (out, "\\%c", *p);
+    else if (*p < 0x20)
+      fprintf (out, "\\u%04x", *p);
+    else
+      fputc (*p, out);
+  }
+  fputc ('"', out);
+}
+
+static int64_t
+now_usec (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static int
+compare_int64 (const void *av, const void *bv)
+{
+  const int64_t a = *(const int64_t *) av;
+  const int64_t b = *(const int64_t *) bv;
+
+  return a < b ? -1 : a > b ? 1 : 0;
+}
+
+/* Sort the samples and print statistics about them. */
+static void
+print_samples (int64_t *samples, size_t n, const char *indent)
+{
+  int64_t total = 0;
+  size_t i;
+
+  qsort (samples, n, sizeof (int64_t), compare_int64);
+  for (i = 0; i < n; ++i)
+    total += samples[i];
+
+  fprintf (out, "%s\"calls\": %zu,\n", indent, n);
+  fprintf (out, "%s\"min_usec\": %" PRIi64 ",\n", indent, samples[0]);
+  fprintf (out, "%s\"mean_usec\": %.1f,\n", indent, (double) total / n);
+  fprintf (out, "%s\"p50_usec\": %" PRIi64 ",\n", indent, samples[n / 2]);
+  fprintf (out, "%s\"p99_usec\": %" PRIi64 ",\n", indent, samples[n * 99 / 100]);
+  fprintf (out, "%s\"max_usec\": %" PRIi64 ",\n", indent, samples[n - 1]);
+}
+
+/* Return the time the daemon spent running procedure 'name' since
+ * the last call to guestfs_reset_call_stats.
+ */
+static uint64_t
+daemon_usec (const char *name)
+{
+  struct guestfs_call_stat_list *stats;
+  uint64_t ret = 0;
+  size_t i;
+
+  stats = guestfs_get_call_stats (g);
+  if (stats == NULL)
+    exit (EXIT_FAILURE);
+  for (i = 0; i < stats->len; ++i) {
+    if (STREQ (stats->val[i].cs_name, name))
+      ret = stats->val[i].cs_daemon_usec;
+  }
+  guestfs_free_call_stat_list (stats);
+
+  return ret;
+}
+
+/* Round trip time of a call which does nothing in the daemon. */
+static void
+test_rtt (void)
+{
+  CLEANUP_FREE int64_t *samples = NULL;
+  int64_t start;
+  int i;
+
+  if (!rtt)
+    return;
+
+  samples = malloc (iterations * sizeof (int64_t));
+  if (samples == NULL)
+    error (EXIT_FAILURE, errno, "malloc");
+
+  if (guestfs_reset_call_stats (g) == -1)
+    exit (EXIT_FAILURE);
+
+  for (i = 0; i < iterations; ++i) {
+    start = now_usec ();
+    if (guestfs_ping_daemon (g) == -1)
+      exit (EXIT_FAILURE);
+    samples[i] = now_usec () - start;
+  }
+
+  begin_field ("rtt");
+  fprintf (out, "{\n");
+  fprintf (out, "    \"call\": ");
+  print_string ("ping_daemon");
+  fprintf (out, ",\n");
+  print_samples (samples, iterations, "    ");
+  fprintf (out, "    \"daemon_usec_per_call\": %.1f\n",
+           (double) daemon_usec ("ping_daemon") / iterations);
+  fprintf (out, "  }");
+}
+
+/* Time taken by calls returning replies of different sizes.  The
+ * largest reply is close to GUESTFS_MESSAGE_MAX, leaving room for the
+ * reply header.
+ */
+static void
+test_reply_size (void)
+{
+  const size_t sizes[] = {
+    0, 64, 1024, 16 * 1024, 256 * 1024, 1024 * 1024,
+    GUESTFS_MESSAGE_MAX - 4096
+  };
+  CLEANUP_FREE int64_t *samples = NULL;
+  int64_t start;
+  size_t i, j, n, size_r;
+  char *r;
+
+  if (!reply_size)
+    return;
+
+  samples = malloc (iterations * sizeof (int64_t));
+  if (samples == NULL)
+    error (EXIT_FAILURE, errno, "malloc");
+
+  begin_field ("reply_size");
+  fprintf (out, "[\n");
+
+  for (i = 0; i < sizeof sizes / sizeof sizes[0]; ++i) {
+    int64_t total = 0;
+
+    /* Limit the total amount of data read by each test to 64 MB. */
+    n = (64 * 1024 * 1024) / (sizes[i] > 0 ? sizes[i] : 1);
+    if (n > (size_t) iterations)
+      n = iterations;
+    if (n < 1)
+      n = 1;
+
+    if (guestfs_reset_call_stats (g) == -1)
+      exit (EXIT_FAILURE);
+
+    for (j = 0; j < n; ++j) {
+      start = now_usec ();
+      r = guestfs_pread_device (g, "/dev/sda", sizes[i], 0, &size_r);
+      if (r == NULL)
+        exit (EXIT_FAILURE);
+      samples[j] = now_usec () - start;
+      total += samples[j];
+      free (r);
+    }
+
+    fprintf (out, "    {\n");
+    fprintf (out, "      \"call\": ");
+    print_string ("pread_device");
+    fprintf (out, ",\n");
+    fprintf (out, "      \"bytes\": %zu,\n", sizes[i]);
+    print_samples (samples, n, "      ");
+    fprintf (out, "      \"daemon_usec_per_call\": %.1f,\n",
+             (double) daemon_usec ("pread_device") / n);
+    fprintf (out, "      \"mbytes_per_sec\": %.1f\n",
+             total > 0 ? (double) sizes[i] * n / total : 0.0);
+    fprintf (out, "    }%s\n",
+             i < sizeof sizes / sizeof sizes[0] - 1 ? "," : "");
+  }
+
+  fprintf (out, "  ]");
+}
+
+static void
+print_transfer (const char *indent, int64_t bytes, int64_t usec)
+{
+  fprintf (out, "%s\"bytes\": %" PRIi64 ",\n", indent, bytes);
+  fprintf (out, "%s\"usec\": %" PRIi64 ",\n", indent, usec);
+  fprintf (out, "%s\"mbytes_per_sec\": %.1f\n",
+           indent, usec > 0 ? (double) bytes / usec : 0.0);
+}
+
+/* Upload and download throughput.  The data is pseudo-random so that
+ * it is not sent as hole chunks or compressed.  Downloads are repeated
+ * at different chunk sizes by calling internal_set_chunk_size, which
+ * only changes the size of the chunks sent by the daemon.  (Uploads use
+ * the chunk size that the library negotiated at launch.)
+ */
+static void
+test_transfer (void)
+{
+  const int chunk_sizes[] = {
+    GUESTFS_MAX_CHUNK_SIZE, 64 * 1024, 256 * 1024, 1024 * 1024,
+    GUESTFS_MAX_NEGOTIATED_CHUNK_SIZE
+  };
+  char tmpfile[] = "/tmp/protocolbenchXXXXXX";
+  CLEANUP_FREE uint64_t *buf = NULL;
+  const size_t buf_size = 1024 * 1024;
+  uint64_t x = UINT64_C (0x9e3779b97f4a7c15);
+  int64_t start, usec, n;
+  size_t i, j;
+  int fd, r;
+
+  if (!transfer)
+    return;
+
+  /* Create a file filled with pseudo-random data (xorshift64). */
+  buf = malloc (buf_size);
+  if (buf == NULL)
+    error (EXIT_FAILURE, errno, "malloc");
+  fd = mkstemp (tmpfile);
+  if (fd == -1)
+    error (EXIT_FAILURE, errno, "mkstemp: %s", tmpfile);
+  for (n = 0; n < transfer_size; n += buf_size) {
+    const size_t len =
+      transfer_size - n < (int64_t) buf_size ? transfer_size - n : buf_size;
+
+    for (j = 0; j < buf_size / sizeof (uint64_t); ++j) {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      buf[j] = x;
+    }
+    if (write (fd, buf, len) != (ssize_t) len)
+      error (EXIT_FAILURE, errno, "write: %s", tmpfile);
+  }
+  if (close (fd) == -1)
+    error (EXIT_FAILURE, errno, "close: %s", tmpfile);
+
+  begin_field ("upload");
+  start = now_usec ();
+  r = guestfs_upload (g, tmpfile, "/dev/sda");
+  usec = now_usec () - start;
+  unlink (tmpfile);
+  if (r == -1)
+    exit (EXIT_FAILURE);
+  fprintf (out, "{\n");
+  print_transfer ("    ", transfer_size, usec);
+  fprintf (out, "  }");
+
+  begin_field ("download");
+  fprintf (out, "[\n");
+  for (i = 0; i < sizeof chunk_sizes / sizeof chunk_sizes[0]; ++i) {
+    int chunk_size;
+
+    /* Old daemons can't change the chunk size, so just test once. */
+    guestfs_push_error_handler (g, NULL, NULL);
+    chunk_size = guestfs_internal_set_chunk_size (g, chunk_sizes[i]);
+    guestfs_pop_error_handler (g);
+    if (chunk_size == -1 && i > 0)
+      break;
+
+    start = now_usec ();
+    if (guestfs_download (g, "/dev/sda", "/dev/null") == -1)
+      exit (EXIT_FAILURE);
+    usec = now_usec () - start;
+
+    if (i > 0)
+      fprintf (out, ",\n");
+    fprintf (out, "    {\n");
+    if (chunk_size == -1)
+      fprintf (out, "      \"chunk_size\": null,\n");
+    else
+      fprintf (out, "      \"chunk_size\": %d,\n", chunk_size);
+    print_transfer ("      ", disk_size, usec);
+    fprintf (out, "    }");
+
+    if (chunk_size == -1)
+      break;
+  }
+  fprintf (out, "\n  ]");
+}